@@ -8,6 +8,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <random>
 
 #pragma warning(disable:4702) // unreachable code. The last part of main() is unreachable, which is okay since this is just a sample.
@@ -24,7 +25,7 @@ void DebugOutput(const char* pszOutput)
 	printf("Console output: %s", pszOutput);
 }
 
-int main()
+int main(int argc, const char** args)
 {
 #ifdef _WIN32
 	WSADATA wsadata;
@@ -46,9 +47,30 @@ int main()
 
 	srand((int)last_time);
 
-	printf("Searching for servers...\n");
-	while (!vb.HasConnection())
-		vb.FindServer();
+	const char* unix_socket_path = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(args[i], "--unix") == 0 && i < argc - 1)
+		{
+			i++;
+			unix_socket_path = args[i];
+		}
+	}
+
+	if (unix_socket_path)
+	{
+		vb.ConnectUnix(unix_socket_path);
+
+		if (!vb.HasConnection())
+			return 1;
+	}
+	else
+	{
+		printf("Searching for servers...\n");
+		while (!vb.HasConnection())
+			vb.FindServer();
+	}
 
 	for (;;)
 	{
@@ -64,21 +86,25 @@ int main()
 				auto& oData = vb.GetData()[i];
 				printf("%s (%d):", oRegistration.m_sName.c_str(), oData.m_aIntData.size() + oData.m_aFloatData.size() + oData.m_aVectorData.size());
 
+				// The last second's worth, and whatever value was holding when it started.
+				double flLatest = vb.GetLatestDataTime();
+				CViewbackDataRange oRange = vb.GetRange(i, flLatest - 1, flLatest);
+
 				switch (oRegistration.m_eDataType)
 				{
 				case VB_DATATYPE_INT:
-					for (size_t j = oData.m_aIntData.size()>=10?oData.m_aIntData.size()-10:0; j < oData.m_aIntData.size(); j++)
-						printf(" %.2f: %s", oData.m_aIntData[j].time, vb.GetLabelForValue(i, oData.m_aIntData[j].data).c_str());
+					for (size_t j = 0; j < oRange.m_aIntData.size(); j++)
+						printf(" %.2f: %s", oRange.m_aIntData[j].time, vb.GetLabelForValue(i, oRange.m_aIntData[j].data).c_str());
 					break;
 
 				case VB_DATATYPE_FLOAT:
-					for (size_t j = oData.m_aFloatData.size() >= 10 ? oData.m_aFloatData.size() - 10 : 0; j < oData.m_aFloatData.size(); j++)
-						printf(" %.2f: %.1f", oData.m_aFloatData[j].time, oData.m_aFloatData[j].data);
+					for (size_t j = 0; j < oRange.m_aFloatData.size(); j++)
+						printf(" %.2f: %.1f", oRange.m_aFloatData[j].time, oRange.m_aFloatData[j].data);
 					break;
 
 				case VB_DATATYPE_VECTOR:
-					for (size_t j = oData.m_aVectorData.size() >= 10 ? oData.m_aVectorData.size() - 10 : 0; j < oData.m_aVectorData.size(); j++)
-						printf(" %.2f: (%.0f, %.0f, %.0f)", oData.m_aVectorData[j].time, oData.m_aVectorData[j].data.x, oData.m_aVectorData[j].data.y, oData.m_aVectorData[j].data.z);
+					for (size_t j = 0; j < oRange.m_aVectorData.size(); j++)
+						printf(" %.2f: (%.0f, %.0f, %.0f)", oRange.m_aVectorData[j].time, oRange.m_aVectorData[j].data.x, oRange.m_aVectorData[j].data.y, oRange.m_aVectorData[j].data.z);
 					break;
 				}
 
@@ -0,0 +1,987 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/*
+	history_test - Checks the history's queries against doing them the
+	obvious way, then times them.
+
+	  GetRange() against a linear scan, on random series with repeated
+	  times and partly erased fronts, with and without the edge samples.
+	  GetExtents() against binning every sample into its column, on random
+	  series with gaps, erased fronts and windows past either end.
+	  GetFloatStats() against going over every sample in the window. The
+	  quantiles are estimates, they're held to within a percent of rank
+	  and a sample.
+	  Triggers against sorting the window on every sample, for the mean and
+	  rank quantiles, and firing again each time they go true. Then a
+	  duration that runs out while only another channel is sending.
+	  Derived channels against working out each expression by hand, and
+	  expressions that shouldn't compile.
+	  DecodeSample() against Packet::ParseFromArray(), on random packets
+	  and on ones with bytes changed or cut off.
+
+	Prints how many didn't match and returns non-zero if any didn't.
+	Needs no server.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "viewback_history.h"
+#include "viewback_decode.h"
+
+using namespace vb;
+
+static std::mt19937 g_oRandom(1);
+
+static int RandomInt(int iMax)
+{
+	return std::uniform_int_distribution<int>(0, iMax - 1)(g_oRandom);
+}
+
+static double RandomDouble()
+{
+	return std::uniform_real_distribution<double>(0, 1)(g_oRandom);
+}
+
+static double Milliseconds(std::chrono::steady_clock::time_point tStart)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+static int CheckRanges()
+{
+	int iMismatches = 0;
+	int iQueries = 0;
+
+	for (int iSeries = 0; iSeries < 200; iSeries++)
+	{
+		CViewbackSeries<float> aSeries;
+
+		size_t iSamples = RandomInt(5000);
+		double flTime = 100;
+
+		for (size_t i = 0; i < iSamples; i++)
+		{
+			flTime += RandomInt(4) * 0.25;
+			aSeries.push_back(CViewbackDataPair<float>(flTime, (float)i));
+		}
+
+		if (RandomInt(2))
+			aSeries.erase_before(100 + RandomInt(1000));
+
+		aSeries.Sync();
+
+		std::vector<double> aflTimes;
+		for (size_t i = 0; i < aSeries.size(); i++)
+			aflTimes.push_back(aSeries[i].time);
+
+		for (int iQuery = 0; iQuery < 50; iQuery++)
+		{
+			double flStart = 95 + RandomInt(16000) * 0.125;
+			double flEnd = flStart + RandomInt(4000) * 0.125 - 50;
+			bool bEdges = !!RandomInt(2);
+
+			size_t iFirst = 0;
+			while (iFirst < aflTimes.size() && aflTimes[iFirst] < flStart)
+				iFirst++;
+
+			size_t iLast = iFirst;
+			while (iLast < aflTimes.size() && aflTimes[iLast] <= flEnd)
+				iLast++;
+
+			if (bEdges)
+			{
+				if (iFirst > 0)
+					iFirst--;
+				if (iLast < aflTimes.size())
+					iLast++;
+			}
+
+			CViewbackRange<float> oRange = aSeries.GetRange(flStart, flEnd, bEdges);
+
+			size_t iSpanned = 0;
+			for (size_t i = 0; i < oRange.GetNumSpans(); i++)
+				iSpanned += oRange.GetSpan(i).m_iCount;
+
+			iQueries++;
+
+			if (oRange.size() != iLast - iFirst || iSpanned != oRange.size() || (oRange.size() && oRange[0].time != aflTimes[iFirst]))
+			{
+				if (iMismatches < 5)
+					printf("GetRange(%g, %g) returned %d samples, expected %d.\n", flStart, flEnd, (int)oRange.size(), (int)(iLast - iFirst));
+
+				iMismatches++;
+			}
+		}
+	}
+
+	printf("GetRange: %d of %d queries didn't match a linear scan.\n", iMismatches, iQueries);
+
+	return iMismatches;
+}
+
+static void TimeRanges()
+{
+	CViewbackSeries<float> aSeries;
+	for (size_t i = 0; i < 10000000; i++)
+		aSeries.push_back(CViewbackDataPair<float>(i * 0.001, (float)i));
+	aSeries.Sync();
+
+	size_t iTotal = 0;
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < 100000; i++)
+	{
+		double flStart = RandomInt(10000000) * 0.001;
+		iTotal += aSeries.GetRange(flStart, flStart + 1).size();
+	}
+
+	printf("GetRange: %.3f us per query on 10M samples (%d returned).\n", Milliseconds(tStart) * 1000 / 100000, (int)iTotal);
+}
+
+static int Column(double flTime, double flStart, double flEnd, size_t iPixels)
+{
+	if (flTime < flStart)
+		return -1;
+
+	if (flTime > flEnd)
+		return (int)iPixels;
+
+	size_t iColumn = (size_t)((flTime - flStart) / (flEnd - flStart) * iPixels);
+	if (iColumn >= iPixels)
+		iColumn = iPixels - 1;
+
+	return (int)iColumn;
+}
+
+// What GetExtents() should come up with, the slow way.
+static void BinSamples(const CViewbackSeries<float>& aSeries, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<float> >& aExtents)
+{
+	aExtents.clear();
+
+	CViewbackRange<float> oRange = aSeries.GetRange(flStart, flEnd);
+
+	int iCurrent = -2;
+	for (size_t i = 0; i < oRange.size(); i++)
+	{
+		CViewbackDataPair<float> oSample = oRange[i];
+		int iColumn = Column(oSample.time, flStart, flEnd, iPixels);
+
+		if (aExtents.size() && iColumn == iCurrent)
+		{
+			CViewbackExtent<float>& oExtent = aExtents.back();
+			oExtent.m_flLastTime = oSample.time;
+			oExtent.m_oLast = oSample.data;
+
+			if (oSample.data < oExtent.m_oLowest)
+				oExtent.m_oLowest = oSample.data;
+			if (oExtent.m_oHighest < oSample.data)
+				oExtent.m_oHighest = oSample.data;
+
+			continue;
+		}
+
+		iCurrent = iColumn;
+
+		CViewbackExtent<float> oExtent;
+		oExtent.m_flFirstTime = oExtent.m_flLastTime = oSample.time;
+		oExtent.m_oFirst = oExtent.m_oLast = oExtent.m_oLowest = oExtent.m_oHighest = oSample.data;
+		aExtents.push_back(oExtent);
+	}
+}
+
+static bool SameExtents(const std::vector<CViewbackExtent<float> >& a, const std::vector<CViewbackExtent<float> >& b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].m_flFirstTime != b[i].m_flFirstTime || a[i].m_flLastTime != b[i].m_flLastTime)
+			return false;
+
+		if (a[i].m_oFirst != b[i].m_oFirst || a[i].m_oLast != b[i].m_oLast || a[i].m_oLowest != b[i].m_oLowest || a[i].m_oHighest != b[i].m_oHighest)
+			return false;
+	}
+
+	return true;
+}
+
+static int CheckExtents()
+{
+	int iMismatches = 0;
+	int iQueries = 0;
+
+	for (int iSeries = 0; iSeries < 60; iSeries++)
+	{
+		CViewbackDataList oList;
+
+		size_t iSamples = RandomInt(200000) + 1;
+		double flTime = RandomInt(100);
+
+		for (size_t i = 0; i < iSamples; i++)
+		{
+			// Now and then a big gap.
+			flTime += RandomInt(4) / 128.0 * (RandomInt(50) == 0 ? 100 : 1);
+
+			float flValue = (float)RandomInt(1000);
+			oList.m_aFloatData.push_back(CViewbackDataPair<float>(flTime, flValue));
+			oList.m_oFloatPyramid.Add(flTime, flValue);
+
+			if (RandomInt(20000) == 0)
+			{
+				double flClear = flTime - RandomInt(100);
+				oList.m_aFloatData.erase_before(flClear);
+				oList.m_oFloatPyramid.erase_before(flClear);
+			}
+		}
+
+		oList.Sync();
+
+		double flFirst = oList.m_aFloatData.front().time;
+		double flLast = oList.m_aFloatData.back().time;
+
+		for (int iQuery = 0; iQuery < 30; iQuery++)
+		{
+			double flStart = flFirst - 5 + (flLast - flFirst + 10) * RandomDouble();
+			double flEnd = flStart + (flLast - flFirst) * RandomDouble();
+			size_t iPixels = RandomInt(2000) + 1;
+
+			std::vector<CViewbackExtent<float> > aExtents, aBinned;
+			oList.GetExtents(flStart, flEnd, iPixels, aExtents);
+			BinSamples(oList.m_aFloatData, flStart, flEnd, iPixels, aBinned);
+
+			iQueries++;
+
+			if (!SameExtents(aExtents, aBinned))
+			{
+				if (iMismatches < 5)
+					printf("GetExtents(%g, %g, %d) returned %d extents, binning found %d.\n", flStart, flEnd, (int)iPixels, (int)aExtents.size(), (int)aBinned.size());
+
+				iMismatches++;
+			}
+		}
+	}
+
+	printf("GetExtents: %d of %d queries didn't match binning every sample.\n", iMismatches, iQueries);
+
+	return iMismatches;
+}
+
+static void TimeExtents()
+{
+	CViewbackDataList oList;
+
+	double flTime = 0;
+	for (size_t i = 0; i < 10000000; i++)
+	{
+		flTime += 1 / 120.0;
+
+		float flValue = (float)sin(i * 0.001) + RandomInt(100) / 1000.0f;
+		oList.m_aFloatData.push_back(CViewbackDataPair<float>(flTime, flValue));
+		oList.m_oFloatPyramid.Add(flTime, flValue);
+	}
+
+	oList.Sync();
+
+	std::vector<CViewbackExtent<float> > aExtents;
+
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < 100; i++)
+		oList.GetExtents(flTime - 3600, flTime, 1000, aExtents);
+	double flPyramid = Milliseconds(tStart) / 100;
+
+	tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < 10; i++)
+		BinSamples(oList.m_aFloatData, flTime - 3600, flTime, 1000, aExtents);
+	double flBinned = Milliseconds(tStart) / 10;
+
+	printf("GetExtents: an hour at 120 Hz in 1000 columns takes %.3f ms, binning every sample takes %.3f ms.\n", flPyramid, flBinned);
+}
+
+static int CheckStats()
+{
+	int iMismatches = 0;
+	int iQueries = 0;
+
+	static const double aflQuantiles[] = { 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99 };
+
+	for (int iSeries = 0; iSeries < 40; iSeries++)
+	{
+		CViewbackDataList oList;
+		std::vector<std::pair<double, float> > aSamples;
+
+		size_t iSamples = RandomInt(100000) + 1;
+		double flTime = RandomInt(100);
+		int iShape = RandomInt(3);
+
+		for (size_t i = 0; i < iSamples; i++)
+		{
+			flTime += RandomInt(4) / 64.0;
+
+			// Even, skewed, or only a few values with lots of ties.
+			float flValue;
+			if (iShape == 0)
+				flValue = (float)(RandomDouble() * 1000);
+			else if (iShape == 1)
+				flValue = (float)(-100 * log(1 - RandomDouble()));
+			else
+				flValue = (float)RandomInt(5);
+
+			oList.m_aFloatData.push_back(CViewbackDataPair<float>(flTime, flValue));
+			oList.m_oFloatPyramid.Add(flTime, flValue);
+			aSamples.push_back(std::make_pair(flTime, flValue));
+		}
+
+		oList.Sync();
+
+		double flFirst = aSamples.front().first;
+		double flLast = aSamples.back().first;
+
+		for (int iQuery = 0; iQuery < 25; iQuery++)
+		{
+			double flStart = flFirst - 5 + (flLast - flFirst + 10) * RandomDouble();
+			double flEnd = flStart + (flLast - flFirst) * RandomDouble();
+
+			std::vector<double> aflWindow;
+			double flSum = 0;
+			size_t iFirst = aSamples.size();
+			size_t iLast = 0;
+
+			for (size_t i = 0; i < aSamples.size(); i++)
+			{
+				if (aSamples[i].first < flStart || aSamples[i].first > flEnd)
+					continue;
+
+				if (iFirst == aSamples.size())
+					iFirst = i;
+				iLast = i;
+
+				aflWindow.push_back(aSamples[i].second);
+				flSum += aSamples[i].second;
+			}
+
+			CViewbackStats oStats;
+			oList.GetFloatStats(flStart, flEnd, oStats);
+
+			iQueries++;
+
+			bool bMatch = oStats.m_iCount == aflWindow.size();
+
+			if (bMatch && aflWindow.size())
+			{
+				std::sort(aflWindow.begin(), aflWindow.end());
+
+				double flMean = flSum / aflWindow.size();
+				double flM2 = 0;
+				for (size_t i = 0; i < aflWindow.size(); i++)
+					flM2 += (aflWindow[i] - flMean) * (aflWindow[i] - flMean);
+
+				double flScale = aflWindow.back() - aflWindow.front() + 1;
+
+				bMatch = oStats.m_flLowest == aflWindow.front() && oStats.m_flHighest == aflWindow.back()
+					&& oStats.m_flFirstTime == aSamples[iFirst].first && oStats.m_flFirst == aSamples[iFirst].second
+					&& fabs(oStats.m_flLastTime - aSamples[iLast].first) < 1e-3 && oStats.m_flLast == aSamples[iLast].second
+					&& fabs(oStats.m_flMean - flMean) < 1e-4 * flScale
+					&& fabs(oStats.GetVariance() - flM2 / aflWindow.size()) < 1e-3 * flScale * flScale;
+
+				// Where the estimate lands among the samples, ties count either way. It
+				// can fall between two samples, so a sample's worth of rank is let go.
+				double flSlack = 0.01 + 1.0 / aflWindow.size();
+
+				for (size_t i = 0; bMatch && i < sizeof(aflQuantiles) / sizeof(aflQuantiles[0]); i++)
+				{
+					double flEstimate = oStats.GetQuantile(aflQuantiles[i]);
+					double flBelow = (double)(std::lower_bound(aflWindow.begin(), aflWindow.end(), flEstimate) - aflWindow.begin()) / aflWindow.size();
+					double flAtOrBelow = (double)(std::upper_bound(aflWindow.begin(), aflWindow.end(), flEstimate) - aflWindow.begin()) / aflWindow.size();
+
+					if (aflQuantiles[i] < flBelow - flSlack || aflQuantiles[i] > flAtOrBelow + flSlack)
+						bMatch = false;
+				}
+			}
+
+			if (!bMatch)
+			{
+				if (iMismatches < 5)
+					printf("GetFloatStats(%g, %g) had %d samples, expected %d.\n", flStart, flEnd, (int)oStats.m_iCount, (int)aflWindow.size());
+
+				iMismatches++;
+			}
+		}
+	}
+
+	printf("GetFloatStats: %d of %d queries didn't match going over every sample.\n", iMismatches, iQueries);
+
+	return iMismatches;
+}
+
+static bool Compare(vb_compare_t eCompare, double flValue, double flThreshold)
+{
+	switch (eCompare)
+	{
+	case VB_COMPARE_LESS:
+	default:
+		return flValue < flThreshold;
+
+	case VB_COMPARE_LESS_EQUAL:
+		return flValue <= flThreshold;
+
+	case VB_COMPARE_GREATER:
+		return flValue > flThreshold;
+
+	case VB_COMPARE_GREATER_EQUAL:
+		return flValue >= flThreshold;
+	}
+}
+
+// Whether the trigger holds as of the latest sample, the slow way.
+static bool Holds(const CViewbackTrigger& oTrigger, const std::vector<std::pair<double, double> >& aSamples)
+{
+	double flTime = aSamples.back().first;
+
+	if (oTrigger.m_eAggregate == VB_AGGREGATE_VALUE)
+		return Compare(oTrigger.m_eCompare, aSamples.back().second, oTrigger.m_flThreshold);
+
+	if (flTime - aSamples.front().first < oTrigger.m_flWindow)
+		return false;
+
+	std::vector<double> aflWindow;
+	double flSum = 0;
+	for (size_t i = 0; i < aSamples.size(); i++)
+	{
+		if (aSamples[i].first < flTime - oTrigger.m_flWindow)
+			continue;
+
+		aflWindow.push_back(aSamples[i].second);
+		flSum += aSamples[i].second;
+	}
+
+	if (oTrigger.m_eAggregate == VB_AGGREGATE_MEAN)
+		return Compare(oTrigger.m_eCompare, flSum / aflWindow.size(), oTrigger.m_flThreshold);
+
+	// The sample of this rank, counting from 1 at the lowest.
+	std::sort(aflWindow.begin(), aflWindow.end());
+
+	size_t iRank = (size_t)ceil(oTrigger.m_flQuantile * aflWindow.size() - 1e-9);
+	if (iRank < 1)
+		iRank = 1;
+	else if (iRank > aflWindow.size())
+		iRank = aflWindow.size();
+
+	return Compare(oTrigger.m_eCompare, aflWindow[iRank - 1], oTrigger.m_flThreshold);
+}
+
+static int CheckRules()
+{
+	int iMismatches = 0;
+	int iChecks = 0;
+
+	static const double aflQuantiles[] = { 0, 0.05, 0.25, 0.5, 0.9, 0.95, 1 };
+
+	for (int iRule = 0; iRule < 400; iRule++)
+	{
+		CViewbackTrigger oTrigger;
+		oTrigger.m_eAggregate = (vb_aggregate_t)RandomInt(3);
+		oTrigger.m_flQuantile = RandomInt(2) ? aflQuantiles[RandomInt(7)] : RandomDouble();
+		oTrigger.m_flWindow = RandomInt(8) * 0.25;
+		oTrigger.m_eCompare = (vb_compare_t)RandomInt(4);
+		oTrigger.m_flThreshold = RandomInt(11) - 5;
+
+		// No duration, so it should go off on every sample that makes it go from false to true.
+		CViewbackRule oRule(oTrigger);
+
+		std::vector<std::pair<double, double> > aSamples;
+		bool bHeld = false;
+		double flTime = RandomInt(10);
+
+		for (int i = 0; i < 300; i++)
+		{
+			// Whole numbers so the sums are exact, and times that land right on the window's edge.
+			flTime += RandomInt(3) * 0.125;
+			double flValue = RandomInt(21) - 10;
+
+			aSamples.push_back(std::make_pair(flTime, flValue));
+
+			bool bHolds = Holds(oTrigger, aSamples);
+			bool bFired = oRule.Add(flTime, flValue);
+
+			iChecks++;
+
+			if (bFired != (bHolds && !bHeld))
+			{
+				if (iMismatches < 5)
+					printf("Trigger %d (aggregate %d, quantile %g, window %g, compare %d, threshold %g) %s at %g.\n", iRule, (int)oTrigger.m_eAggregate, oTrigger.m_flQuantile, oTrigger.m_flWindow, (int)oTrigger.m_eCompare, oTrigger.m_flThreshold, bFired ? "went off" : "didn't go off", flTime);
+
+				iMismatches++;
+			}
+
+			bHeld = bHolds;
+		}
+	}
+
+	printf("Triggers: %d of %d samples didn't match sorting the window.\n", iMismatches, iChecks);
+
+	return iMismatches;
+}
+
+static void AddChannel(Packet& oRegistration, const char* pszName, vb_data_type_t eType)
+{
+	DataChannel* pChannel = oRegistration.add_data_channels();
+	pChannel->set_name(pszName);
+	pChannel->set_type(eType);
+	pChannel->set_handle(oRegistration.data_channels_size() - 1);
+}
+
+static CViewbackSample MakeSample(unsigned int iHandle, double flTime)
+{
+	CViewbackSample oSample;
+	memset(&oSample, 0, sizeof(oSample));
+
+	oSample.m_iHandle = iHandle;
+	oSample.m_flTime = flTime;
+	oSample.m_bHasTime = true;
+
+	return oSample;
+}
+
+static int CheckDeadlines()
+{
+	Packet oRegistration;
+	AddChannel(oRegistration, "a", VB_DATATYPE_FLOAT);
+	AddChannel(oRegistration, "b", VB_DATATYPE_FLOAT);
+
+	std::vector<CViewbackTrigger> aTriggers(1);
+	aTriggers[0].m_sName = "a below zero";
+	aTriggers[0].m_sChannel = "a";
+	aTriggers[0].m_eCompare = VB_COMPARE_LESS;
+	aTriggers[0].m_flThreshold = 0;
+	aTriggers[0].m_flDuration = 2;
+
+	CViewbackHistory oHistory(oRegistration, 0, std::vector<CViewbackDerivedChannel>(), aTriggers);
+
+	// A sample, then how many times it should have gone off and when the last one was.
+	struct
+	{
+		unsigned int iHandle;
+		double       flTime;
+		float        flValue;
+		size_t       iHits;
+		double       flLastHit;
+	} aSteps[] =
+	{
+		{ 0, 1,   -1, 0, 0 },
+		{ 1, 2.5,  5, 0, 0 },
+		{ 1, 3.5,  5, 1, 3 },   // Only b is sending, but the data is past the deadline.
+		{ 1, 4,    5, 1, 3 },   // Once each time it goes true.
+		{ 0, 5,    1, 1, 3 },
+		{ 0, 6,   -1, 1, 3 },
+		{ 0, 7,    1, 1, 3 },   // False again before its deadline,
+		{ 1, 9,    5, 1, 3 },   // so that deadline doesn't count.
+		{ 0, 10,  -1, 1, 3 },
+		{ 1, 12,   5, 2, 12 },  // Right on the deadline.
+		{ 0, 13,   1, 2, 12 },
+		{ 0, 14,  -1, 2, 12 },
+		{ 0, 17,   1, 3, 16 },  // Its own channel, going false after the deadline.
+		{ 1, 18,   5, 3, 16 },
+		{ 0, 19,  -1, 3, 16 },
+		{ 0, 20,   1, 3, 16 },
+		{ 0, 20.5,-1, 3, 16 },
+		{ 1, 21.5, 5, 3, 16 },  // The first deadline was dropped, the second isn't up yet.
+		{ 1, 23,   5, 4, 22.5 },
+	};
+
+	int iMismatches = 0;
+	int iSteps = (int)(sizeof(aSteps) / sizeof(aSteps[0]));
+
+	for (int i = 0; i < iSteps; i++)
+	{
+		CViewbackSample oSample = MakeSample(aSteps[i].iHandle, aSteps[i].flTime);
+		oSample.m_aflValue[0] = aSteps[i].flValue;
+		oHistory.Stash(oSample);
+
+		oHistory.Publish();
+		oHistory.Snapshot();
+
+		const CViewbackSeries<CViewbackTriggerHit>& aHits = oHistory.GetHits();
+
+		bool bMatch = aHits.size() == aSteps[i].iHits;
+		if (bMatch && aHits.size())
+			bMatch = aHits.back().time == aSteps[i].flLastHit && aHits.back().data.m_iTrigger == 0 && aHits.back().data.m_flValue < 0;
+
+		if (!bMatch)
+		{
+			printf("After %s = %g at %g the trigger went off %d times, expected %d.\n", aSteps[i].iHandle ? "b" : "a", aSteps[i].flValue, aSteps[i].flTime, (int)aHits.size(), (int)aSteps[i].iHits);
+			iMismatches++;
+		}
+	}
+
+	printf("Trigger durations: %d of %d steps didn't match.\n", iMismatches, iSteps);
+
+	return iMismatches;
+}
+
+static bool Close(double flValue, double flExpected)
+{
+	return fabs(flValue - flExpected) <= 1e-4 * (1 + fabs(flExpected));
+}
+
+static int CheckDerived()
+{
+	int iMismatches = 0;
+	int iChecks = 0;
+
+	std::vector<std::string> asNames;
+	asNames.push_back("x");
+	asNames.push_back("n");
+	asNames.push_back("v");
+	asNames.push_back("tick");
+
+	std::vector<vb_data_type_t> aeTypes;
+	aeTypes.push_back(VB_DATATYPE_FLOAT);
+	aeTypes.push_back(VB_DATATYPE_INT);
+	aeTypes.push_back(VB_DATATYPE_VECTOR);
+	aeTypes.push_back(VB_DATATYPE_FLOAT);
+
+	// These shouldn't compile.
+	std::vector<std::string> asBad;
+	asBad.push_back("x +");
+	asBad.push_back("(x");
+	asBad.push_back("x)");
+	asBad.push_back("nothing + 1");
+	asBad.push_back("v * 2");
+	asBad.push_back("length(x)");
+	asBad.push_back("min(x)");
+	asBad.push_back("avg(x)");
+	asBad.push_back("");
+	asBad.push_back(std::string(1000, '(') + "x" + std::string(1000, ')'));
+
+	for (size_t i = 0; i < asBad.size(); i++)
+	{
+		CViewbackExpression oExpression;
+		std::string sError;
+
+		iChecks++;
+
+		if (oExpression.Compile(asBad[i], asNames, aeTypes, sError) || !sError.length())
+		{
+			printf("'%.40s' compiled.\n", asBad[i].c_str());
+			iMismatches++;
+		}
+	}
+
+	Packet oRegistration;
+	for (size_t i = 0; i < asNames.size(); i++)
+		AddChannel(oRegistration, asNames[i].c_str(), aeTypes[i]);
+
+	std::vector<CViewbackDerivedChannel> aDerived(7);
+	aDerived[0].m_sName = "twice";
+	aDerived[0].m_sExpression = "\"x\" * 2 + n";
+	aDerived[1].m_sName = "ratio";
+	aDerived[1].m_sExpression = "(x - n) / (n - 3)";
+	aDerived[2].m_sName = "spread";
+	aDerived[2].m_sExpression = "max(x, n) - min(x, -n) + abs(x)";
+	aDerived[3].m_sName = "size";
+	aDerived[3].m_sExpression = "sqrt(length(v)) - z(v)";
+	aDerived[4].m_sName = "slope";
+	aDerived[4].m_sExpression = "deriv(x)";
+	aDerived[5].m_sName = "smooth";
+	aDerived[5].m_sExpression = "avg(x + n, 0.5)";
+	aDerived[6].m_sName = "again";
+	aDerived[6].m_sExpression = "twice - x";
+
+	CViewbackHistory oHistory(oRegistration, 0, aDerived);
+
+	iChecks++;
+
+	if (oHistory.GetDerivedNames().size() != aDerived.size())
+	{
+		printf("Only %d of %d derived channels compiled.\n", (int)oHistory.GetDerivedNames().size(), (int)aDerived.size());
+		return iMismatches + 1;
+	}
+
+	size_t iFirstDerived = oHistory.GetRegisteredChannels();
+
+	bool bX = false, bN = false, bV = false;
+	float flX = 0, flZ = 0, flLength = 0;
+	int iN = 0;
+
+	bool bSlope = false;
+	double flSlopeTime = 0, flSlopeX = 0, flSlope = 0;
+
+	std::vector<std::pair<double, double> > aSmooth;
+
+	double flTime = 0;
+
+	for (int iSample = 0; iSample < 3000; iSample++)
+	{
+		// Powers of two so the edge of avg()'s window is exact.
+		flTime += (1 + RandomInt(64)) / 1024.0;
+
+		int iHandle = RandomInt(4);
+		CViewbackSample oSample = MakeSample(iHandle, flTime);
+
+		if (iHandle == 0)
+		{
+			oSample.m_aflValue[0] = flX = RandomInt(2001) / 100.0f - 10;
+			bX = true;
+
+			if (bSlope)
+				flSlope = (flX - flSlopeX) / (flTime - flSlopeTime);
+
+			bSlope = true;
+			flSlopeTime = flTime;
+			flSlopeX = flX;
+		}
+		else if (iHandle == 1)
+		{
+			oSample.m_iValue = iN = RandomInt(7);
+			bN = true;
+		}
+		else if (iHandle == 2)
+		{
+			for (int i = 0; i < 3; i++)
+				oSample.m_aflValue[i] = (float)(RandomInt(21) - 10);
+
+			flZ = oSample.m_aflValue[2];
+			flLength = (float)sqrt((double)oSample.m_aflValue[0] * oSample.m_aflValue[0] + (double)oSample.m_aflValue[1] * oSample.m_aflValue[1] + (double)flZ * flZ);
+			bV = true;
+		}
+		else
+			oSample.m_aflValue[0] = 1;
+
+		if ((iHandle == 0 || iHandle == 1) && bX && bN)
+		{
+			aSmooth.push_back(std::make_pair(flTime, (double)flX + iN));
+
+			while (aSmooth.front().first < flTime - 0.5)
+				aSmooth.erase(aSmooth.begin());
+		}
+
+		oHistory.Stash(oSample);
+		oHistory.Publish();
+		oHistory.Snapshot();
+
+		double aflExpected[7];
+		bool abReady[7];
+
+		float flTwice = (float)(flX * 2.0 + iN);
+
+		aflExpected[0] = flTwice;
+		abReady[0] = bX && bN;
+		aflExpected[1] = (iN == 3) ? 0 : (flX - iN) / (double)(iN - 3);
+		abReady[1] = bX && bN;
+		aflExpected[2] = std::max((double)flX, (double)iN) - std::min((double)flX, (double)-iN) + fabs(flX);
+		abReady[2] = bX && bN;
+		aflExpected[3] = sqrt((double)flLength) - flZ;
+		abReady[3] = bV;
+		aflExpected[4] = flSlope;
+		abReady[4] = bX;
+
+		double flSmooth = 0;
+		for (size_t i = 0; i < aSmooth.size(); i++)
+			flSmooth += aSmooth[i].second;
+		aflExpected[5] = aSmooth.size() ? flSmooth / aSmooth.size() : 0;
+		abReady[5] = bX && bN;
+
+		aflExpected[6] = (double)flTwice - flX;
+		abReady[6] = bX && bN;
+
+		for (size_t i = 0; i < aDerived.size(); i++)
+		{
+			const CViewbackSeries<float>& aData = oHistory.GetData()[iFirstDerived + i].m_aFloatData;
+
+			iChecks++;
+
+			bool bMatch = aData.size() ? abReady[i] && Close(aData.back().data, aflExpected[i]) : !abReady[i];
+			if (!bMatch)
+			{
+				if (iMismatches < 5)
+					printf("%s = %s was %g at %g, expected %g.\n", aDerived[i].m_sName.c_str(), aDerived[i].m_sExpression.c_str(), aData.size() ? aData.back().data : 0.0, flTime, abReady[i] ? aflExpected[i] : 0.0);
+
+				iMismatches++;
+			}
+		}
+	}
+
+	printf("Derived channels: %d of %d checks didn't match working them out by hand.\n", iMismatches, iChecks);
+
+	return iMismatches;
+}
+
+static void RandomData(Data* pData)
+{
+	if (RandomInt(4))
+		pData->set_handle(RandomInt(4) ? RandomInt(100) : 0xFFFFFFFF);
+
+	if (RandomInt(2))
+		pData->set_data_int(RandomInt(2) ? RandomInt(1000) : 0x80000000 + RandomInt(1000));
+
+	// A channel sends one or the other.
+	if (RandomInt(2))
+		pData->set_data_float((float)(RandomDouble() * 200 - 100));
+	else if (RandomInt(2))
+		pData->set_data_float_x((float)(RandomDouble() * 200 - 100));
+
+	if (RandomInt(2))
+		pData->set_data_float_y((float)(RandomDouble() * 200 - 100));
+	if (RandomInt(2))
+		pData->set_data_float_z((float)(RandomDouble() * 200 - 100));
+
+	if (RandomInt(2))
+		pData->set_time_double(RandomDouble() * 10000);
+	if (RandomInt(2))
+		pData->set_time_uint64((unsigned long long)RandomInt(1000000000) * RandomInt(1000));
+
+	if (RandomInt(3) == 0)
+		pData->set_maintain_time_double(RandomDouble() * 10000);
+	if (RandomInt(3) == 0)
+		pData->set_maintain_time_uint64(RandomInt(1000000000));
+}
+
+// Bit for bit, so a NaN from a mangled packet still matches itself.
+static bool SameSample(const CViewbackSample& a, const CViewbackSample& b, bool bFirstValue)
+{
+	return a.m_iHandle == b.m_iHandle && a.m_iValue == b.m_iValue
+		&& a.m_bHasTime == b.m_bHasTime && !memcmp(&a.m_flTime, &b.m_flTime, sizeof(a.m_flTime))
+		&& a.m_bHasMaintainTime == b.m_bHasMaintainTime && !memcmp(&a.m_flMaintainTime, &b.m_flMaintainTime, sizeof(a.m_flMaintainTime))
+		&& (!bFirstValue || !memcmp(&a.m_aflValue[0], &b.m_aflValue[0], sizeof(float)))
+		&& !memcmp(&a.m_aflValue[1], &b.m_aflValue[1], sizeof(float) * 2);
+}
+
+static int CheckDecode()
+{
+	int iMismatches = 0;
+	int iChecks = 0;
+
+	for (int iPacket = 0; iPacket < 20000; iPacket++)
+	{
+		Packet oPacket;
+		bool bSample = true;
+
+		if (RandomInt(10))
+			RandomData(oPacket.mutable_data());
+		else
+			bSample = false;
+
+		if (RandomInt(2))
+			oPacket.set_is_registration(false);
+
+		// Anything else and it's not just a sample.
+		if (RandomInt(10) == 0)
+		{
+			oPacket.set_is_registration(true);
+			bSample = false;
+		}
+
+		if (RandomInt(10) == 0)
+		{
+			oPacket.set_console_output("Hello");
+			bSample = false;
+		}
+
+		if (RandomInt(20) == 0)
+		{
+			oPacket.add_data_channels()->set_name("Health");
+			bSample = false;
+		}
+
+		std::string sSerialized = oPacket.SerializeAsString();
+
+		for (int iMangle = 0; iMangle < 4; iMangle++)
+		{
+			std::string sPacket = sSerialized;
+
+			if (iMangle && sPacket.length())
+			{
+				if (RandomInt(3) == 0)
+					sPacket.resize(RandomInt((int)sPacket.length()));
+				else
+				{
+					for (int i = RandomInt(3); i >= 0; i--)
+						sPacket[RandomInt((int)sPacket.length())] = (char)RandomInt(256);
+				}
+			}
+
+			CViewbackSample oDecoded;
+			bool bDecoded = DecodeSample(sPacket.data(), sPacket.length(), oDecoded);
+
+			iChecks++;
+
+			bool bMatch;
+			if (!iMangle && bDecoded != bSample)
+				bMatch = false;
+			else if (!bDecoded)
+				bMatch = true;
+			else
+			{
+				// If it decoded, the full parser has to agree that it's a sample, and which one.
+				Packet oParsed;
+				bMatch = oParsed.ParseFromArray(sPacket.data(), (int)sPacket.length()) && oParsed.has_data();
+
+				if (bMatch)
+				{
+					Packet oRest(oParsed);
+					oRest.clear_data();
+					if (!oRest.is_registration())
+						oRest.clear_is_registration();
+
+					CViewbackSample oParsedSample;
+					SampleFromData(oParsed.data(), oParsedSample);
+
+					bMatch = oRest.ByteSize() == 0 && SameSample(oDecoded, oParsedSample, !(oParsed.data().has_data_float() && oParsed.data().has_data_float_x()));
+				}
+			}
+
+			if (!bMatch)
+			{
+				if (iMismatches < 5)
+					printf("Packet %d (%s) decoded to %s, which the full parser doesn't agree with.\n", iPacket, iMangle ? "mangled" : "intact", bDecoded ? "a sample" : "nothing");
+
+				iMismatches++;
+			}
+		}
+	}
+
+	printf("DecodeSample: %d of %d packets didn't match Packet::ParseFromArray().\n", iMismatches, iChecks);
+
+	return iMismatches;
+}
+
+int main()
+{
+	int iMismatches = 0;
+
+	iMismatches += CheckRanges();
+	iMismatches += CheckExtents();
+	iMismatches += CheckStats();
+	iMismatches += CheckRules();
+	iMismatches += CheckDeadlines();
+	iMismatches += CheckDerived();
+	iMismatches += CheckDecode();
+
+	TimeRanges();
+	TimeExtents();
+
+	return iMismatches ? 1 : 0;
+}
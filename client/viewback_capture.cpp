@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+// Captures can be bigger than 2GB.
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "viewback_capture.h"
+
+#include <string.h>
+
+#include "../server/viewback_shared.h"
+
+using namespace vb;
+
+// Put an index point roughly this often so that a seek never has to read
+// more than this much of the file.
+#define CAPTURE_INDEX_SPACING (256*1024)
+
+static bool CaptureSeek(FILE* pFile, unsigned long long iOffset)
+{
+#ifdef _WIN32
+	return _fseeki64(pFile, (__int64)iOffset, SEEK_SET) == 0;
+#else
+	return fseeko(pFile, (off_t)iOffset, SEEK_SET) == 0;
+#endif
+}
+
+static unsigned long long CaptureFileSize(FILE* pFile)
+{
+#ifdef _WIN32
+	if (_fseeki64(pFile, 0, SEEK_END) != 0)
+		return 0;
+
+	unsigned long long iSize = (unsigned long long)_ftelli64(pFile);
+#else
+	if (fseeko(pFile, 0, SEEK_END) != 0)
+		return 0;
+
+	unsigned long long iSize = (unsigned long long)ftello(pFile);
+#endif
+
+	CaptureSeek(pFile, 0);
+
+	return iSize;
+}
+
+CViewbackCaptureReader::CViewbackCaptureReader()
+{
+	m_pFile = NULL;
+	m_iFileSize = 0;
+	m_iOffset = 0;
+	m_bFrameIsRegistration = false;
+	m_iRegistrationOffset = 0;
+	m_flStartTime = 0;
+	m_flEndTime = 0;
+	m_iNumFrames = 0;
+}
+
+CViewbackCaptureReader::~CViewbackCaptureReader()
+{
+	Close();
+}
+
+bool CViewbackCaptureReader::Open(const char* pszFile)
+{
+	Close();
+
+	m_pFile = fopen(pszFile, "rb");
+	if (!m_pFile)
+		return false;
+
+	m_iFileSize = CaptureFileSize(m_pFile);
+
+	Packet oPacket;
+	unsigned long long iNextIndex = 0;
+	bool bNewSession = true;
+
+	// One pass through the whole file. Most frames are only looked at, not
+	// parsed, so this goes about as fast as the disk does.
+	unsigned long long iFrameOffset = m_iOffset;
+	while (ReadFrame())
+	{
+		m_iNumFrames++;
+
+		// Time can start over after one, so the index can't span it.
+		if (IsRegistration())
+			bNewSession = true;
+
+		if (GetPacketLength() && GetPacket()[0] == 0x0A) // Tag for Packet.data, which the server always writes first.
+		{
+			if (bNewSession || iFrameOffset >= iNextIndex)
+			{
+				double flTime;
+				if (oPacket.ParseFromArray(GetPacket(), (int)GetPacketLength()) && oPacket.has_data() && GetDataTime(oPacket.data(), flTime))
+				{
+					if (bNewSession)
+					{
+						CSession oSession;
+						oSession.flStartTime = oSession.flEndTime = flTime;
+						oSession.iFirstEntry = m_aIndex.size();
+						m_aSessions.push_back(oSession);
+
+						bNewSession = false;
+					}
+
+					CIndexEntry oEntry;
+					oEntry.flTime = flTime;
+					oEntry.iOffset = iFrameOffset;
+					oEntry.iRegistrationOffset = m_iRegistrationOffset;
+					m_aIndex.push_back(oEntry);
+
+					iNextIndex = iFrameOffset + CAPTURE_INDEX_SPACING;
+				}
+			}
+
+			if (!bNewSession)
+				m_aSessions.back().iLastData = iFrameOffset;
+		}
+
+		iFrameOffset = m_iOffset;
+	}
+
+	if (m_iOffset != m_iFileSize)
+		fprintf(stderr, "Capture file is truncated, ignoring the last %llu bytes.\n", m_iFileSize - m_iOffset);
+
+	for (size_t i = 0; i < m_aSessions.size(); i++)
+	{
+		CSession& oSession = m_aSessions[i];
+
+		double flTime;
+		if (SeekOffset(oSession.iLastData) && ReadFrame() && oPacket.ParseFromArray(GetPacket(), (int)GetPacketLength()) && oPacket.has_data() && GetDataTime(oPacket.data(), flTime))
+			oSession.flEndTime = flTime;
+
+		if (!i || oSession.flStartTime < m_flStartTime)
+			m_flStartTime = oSession.flStartTime;
+
+		if (!i || oSession.flEndTime > m_flEndTime)
+			m_flEndTime = oSession.flEndTime;
+	}
+
+	return Rewind();
+}
+
+void CViewbackCaptureReader::Close()
+{
+	if (m_pFile)
+		fclose(m_pFile);
+
+	m_pFile = NULL;
+	m_iFileSize = 0;
+	m_iOffset = 0;
+	m_aFrame.clear();
+	m_bFrameIsRegistration = false;
+	m_aRegistration.clear();
+	m_iRegistrationOffset = 0;
+	m_aIndex.clear();
+	m_aSessions.clear();
+	m_flStartTime = 0;
+	m_flEndTime = 0;
+	m_iNumFrames = 0;
+}
+
+bool CViewbackCaptureReader::ReadFrame()
+{
+	if (!m_pFile)
+		return false;
+
+	if (m_iFileSize - m_iOffset < sizeof(size_t))
+		return false;
+
+	size_t iNetworkLength;
+	if (fread(&iNetworkLength, sizeof(iNetworkLength), 1, m_pFile) != 1)
+		return false;
+
+	size_t iLength = ntohl((unsigned int)iNetworkLength);
+
+	if (m_iFileSize - m_iOffset - sizeof(size_t) < iLength)
+	{
+		// Truncated, probably the game crashed. Stay put so the caller can
+		// see how much of the file was good.
+		CaptureSeek(m_pFile, m_iOffset);
+		return false;
+	}
+
+	m_aFrame.resize(sizeof(size_t) + iLength);
+	memcpy(&m_aFrame[0], &iNetworkLength, sizeof(iNetworkLength));
+
+	if (iLength && fread(&m_aFrame[sizeof(size_t)], 1, iLength, m_pFile) != iLength)
+	{
+		CaptureSeek(m_pFile, m_iOffset);
+		return false;
+	}
+
+	unsigned long long iFrameOffset = m_iOffset;
+	m_iOffset += m_aFrame.size();
+
+	m_bFrameIsRegistration = FrameIsRegistration();
+
+	if (m_bFrameIsRegistration)
+	{
+		m_aRegistration = m_aFrame;
+		m_iRegistrationOffset = iFrameOffset;
+	}
+
+	return true;
+}
+
+bool CViewbackCaptureReader::Seek(double flTime)
+{
+	if (!m_aSessions.size())
+		return Rewind();
+
+	// The first session that was running at that time, or else the first
+	// one that gets that far. If none do, the last one is walked to the end.
+	size_t iSession = 0;
+	while (iSession < m_aSessions.size() && (m_aSessions[iSession].flStartTime > flTime || m_aSessions[iSession].flEndTime < flTime))
+		iSession++;
+
+	if (iSession == m_aSessions.size())
+	{
+		iSession = 0;
+		while (iSession < m_aSessions.size() - 1 && m_aSessions[iSession].flEndTime < flTime)
+			iSession++;
+	}
+
+	size_t iFirst = m_aSessions[iSession].iFirstEntry;
+	size_t iEnd = (iSession + 1 < m_aSessions.size()) ? m_aSessions[iSession + 1].iFirstEntry : m_aIndex.size();
+
+	// Game time never goes backwards within a session, so neither does its part of the index.
+	size_t iEntry = iFirst;
+	for (size_t iStep = iEnd - iFirst; iStep > 0; iStep /= 2)
+	{
+		while (iEntry + iStep < iEnd && m_aIndex[iEntry + iStep].flTime <= flTime)
+			iEntry += iStep;
+	}
+
+	if (!ReadRegistrationAt(m_aIndex[iEntry].iRegistrationOffset))
+		return false;
+
+	if (!SeekOffset(m_aIndex[iEntry].iOffset))
+		return false;
+
+	// Now walk forward to the exact spot. This is at most CAPTURE_INDEX_SPACING bytes.
+	Packet oPacket;
+	unsigned long long iFrameOffset = m_iOffset;
+	while (ReadFrame())
+	{
+		double flFrameTime;
+		if (GetPacketLength() && GetPacket()[0] == 0x0A && oPacket.ParseFromArray(GetPacket(), (int)GetPacketLength()) && oPacket.has_data() && GetDataTime(oPacket.data(), flFrameTime) && flFrameTime >= flTime)
+			return SeekOffset(iFrameOffset);
+
+		iFrameOffset = m_iOffset;
+	}
+
+	// Past the end, the next read will return false.
+	return true;
+}
+
+bool CViewbackCaptureReader::Rewind()
+{
+	m_aRegistration.clear();
+	m_iRegistrationOffset = 0;
+
+	return SeekOffset(0);
+}
+
+bool CViewbackCaptureReader::GetDataTime(const Data& oData, double& flTime)
+{
+	if (oData.has_time_double())
+		flTime = oData.time_double();
+	else if (oData.has_time_uint64())
+		flTime = ((double)oData.time_uint64()) / 1000;
+	else
+		return false;
+
+	return true;
+}
+
+bool CViewbackCaptureReader::SeekOffset(unsigned long long iOffset)
+{
+	if (!m_pFile)
+		return false;
+
+	if (!CaptureSeek(m_pFile, iOffset))
+		return false;
+
+	m_iOffset = iOffset;
+	m_aFrame.clear();
+	m_bFrameIsRegistration = false;
+
+	return true;
+}
+
+bool CViewbackCaptureReader::ReadRegistrationAt(unsigned long long iOffset)
+{
+	m_aRegistration.clear();
+
+	if (!SeekOffset(iOffset))
+		return false;
+
+	// If there's no registration here then the capture didn't start with
+	// one, and a client will have to do without.
+	ReadFrame();
+
+	return true;
+}
+
+bool CViewbackCaptureReader::FrameIsRegistration() const
+{
+	// The server always writes is_registration as the last field of every
+	// packet (see vb__Packet_write) so there's no need to parse the packet.
+	size_t iLength = GetPacketLength();
+	if (iLength < 2)
+		return false;
+
+	const char* pPacket = GetPacket();
+	return pPacket[iLength - 2] == 0x40 && pPacket[iLength - 1] == 0x01;
+}
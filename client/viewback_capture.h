@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+#include "../protobuf/data.pb.h"
+
+namespace vb
+{
+
+/*
+	Reads the capture files that the server writes when vb_config_t::capture_file
+	is set. A capture is the server's framed TCP stream, so each frame is a
+	sizeof(size_t) byte network order length followed by a serialized Packet.
+
+	Open() scans the whole file once to build a sparse index of game times, so
+	that Seek() doesn't have to read from the start. Only the packets that land
+	on an index point get parsed during the scan.
+
+	The server appends to an existing capture, so a game that was restarted
+	leaves several sessions in one file, each starting with a registration
+	and each with its own game time. Time only goes forward within a session.
+*/
+class CViewbackCaptureReader
+{
+public:
+	CViewbackCaptureReader();
+	~CViewbackCaptureReader();
+
+private:
+	CViewbackCaptureReader(const CViewbackCaptureReader&);
+	CViewbackCaptureReader& operator=(const CViewbackCaptureReader&);
+
+public:
+	bool Open(const char* pszFile);
+	void Close();
+	bool IsOpen() const { return !!m_pFile; }
+
+	// Reads the next frame. Returns false at the end of the file or if the
+	// file is truncated. The frame stays valid until the next read or seek.
+	bool ReadFrame();
+
+	// The whole frame including the length prefix, ready to send to a client.
+	const char* GetFrame() const { return m_aFrame.data(); }
+	size_t      GetFrameLength() const { return m_aFrame.size(); }
+
+	// Just the serialized Packet.
+	const char* GetPacket() const { return m_aFrame.data() + sizeof(size_t); }
+	size_t      GetPacketLength() const { return m_aFrame.size() - sizeof(size_t); }
+
+	bool IsRegistration() const { return m_bFrameIsRegistration; }
+
+	// The latest registration frame at or before the current position. A
+	// client connecting now needs this before anything else.
+	const std::vector<char>& GetRegistration() const { return m_aRegistration; }
+
+	// Positions the reader so that the next frame read is the first data
+	// packet with a time at or after flTime, in the first session that was
+	// running at that time or else the first one that gets that far.
+	// Anything in between (console output, control updates) is skipped.
+	bool Seek(double flTime);
+	bool Rewind();
+
+	// The earliest and latest game time of any session.
+	double GetStartTime() const { return m_flStartTime; }
+	double GetEndTime() const { return m_flEndTime; }
+
+	size_t GetNumSessions() const { return m_aSessions.size(); }
+	double GetSessionStartTime(size_t iSession) const { return m_aSessions[iSession].flStartTime; }
+	double GetSessionEndTime(size_t iSession) const { return m_aSessions[iSession].flEndTime; }
+	size_t GetNumFrames() const { return m_iNumFrames; }
+	unsigned long long GetFileSize() const { return m_iFileSize; }
+
+	// Converts the game's time to seconds no matter which type it sent.
+	static bool GetDataTime(const Data& oData, double& flTime);
+
+private:
+	struct CIndexEntry
+	{
+		double             flTime;
+		unsigned long long iOffset;
+		unsigned long long iRegistrationOffset;
+	};
+
+	struct CSession
+	{
+		double             flStartTime;
+		double             flEndTime;
+		size_t             iFirstEntry; // Into m_aIndex, its entries end where the next session's start.
+		unsigned long long iLastData;   // Offset of the last data frame.
+	};
+
+	bool SeekOffset(unsigned long long iOffset);
+	bool ReadRegistrationAt(unsigned long long iOffset);
+	bool FrameIsRegistration() const;
+
+private:
+	FILE*              m_pFile;
+	unsigned long long m_iFileSize;
+	unsigned long long m_iOffset;
+
+	std::vector<char>  m_aFrame;
+	bool               m_bFrameIsRegistration;
+
+	std::vector<char>  m_aRegistration;
+	unsigned long long m_iRegistrationOffset;
+
+	std::vector<CIndexEntry> m_aIndex;
+	std::vector<CSession>    m_aSessions;
+
+	double             m_flStartTime;
+	double             m_flEndTime;
+	size_t             m_iNumFrames;
+};
+
+}
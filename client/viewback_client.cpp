@@ -14,8 +14,8 @@ THE SOFTWARE.
 */
 
 #include "viewback_client.h"
+#include "viewback_export.h"
 
-#include <sstream>
 #include <sys/timeb.h>
 #include <stdarg.h>
 
@@ -27,6 +27,9 @@ THE SOFTWARE.
 using namespace std;
 using namespace vb;
 
+// Most packets Update() will handle in one go.
+#define VB_MAX_PACKETS_PER_UPDATE 65536
+
 static CViewbackClient* VB = NULL;
 
 void vb__debug_printf(const char* format, ...)
@@ -47,299 +50,506 @@ bool CViewbackClient::Initialize(RegistrationUpdateCallback pfnRegistration, Con
 {
 	VB = this;
 
-	m_flNextDataClear = 10;
-	m_flDataClearTime = 0;
-
 	m_pfnRegistrationUpdate = pfnRegistration;
 	m_pfnConsoleOutput = pfnConsoleOutput;
 	m_pfnDebugOutput = pfnDebugOutput;
 
-	m_bDisconnected = false;
+	if (!m_apConnections.size())
+		AddConnection();
 
 	return CViewbackServersThread::Run();
 }
 
 void CViewbackClient::Shutdown()
 {
+	for (size_t i = 0; i < m_apConnections.size(); i++)
+		m_apConnections[i]->ReleaseHistory();
+
 	CViewbackServersThread::Shutdown();
+
+	// The data thread lets go of every connection when it shuts down, so they can all be deleted.
 	CViewbackDataThread::Shutdown();
+
+	for (size_t i = 0; i < m_apConnections.size(); i++)
+		delete m_apConnections[i];
+
+	m_apConnections.clear();
 }
 
 void CViewbackClient::Update()
 {
-	if (CViewbackDataThread::IsConnected())
+	for (size_t i = 0; i < m_apConnections.size(); i++)
+		m_apConnections[i]->Update();
+}
+
+size_t CViewbackClient::AddConnection()
+{
+	m_apConnections.push_back(new CViewbackConnection(this, m_apConnections.size()));
+	return m_apConnections.size() - 1;
+}
+
+CViewbackConnection::CViewbackConnection(CViewbackClient* pClient, size_t iIndex)
+{
+	m_pClient = pClient;
+	m_iIndex = iIndex;
+
+	m_pData = NULL;
+
+	m_pHistory = NULL;
+	m_bOwnHistory = false;
+	m_iHitsRead = 0;
+
+	m_flDataClearTime = 0;
+	m_iMemoryBudget = 0;
+
+	m_iDroppedReported = 0;
+	m_iDroppedReportTime = 0;
+
+	m_bDisconnected = false;
+}
+
+CViewbackConnection::~CViewbackConnection()
+{
+	ReleaseHistory();
+
+	// Only once the data thread has let go, see CViewbackClient::Shutdown().
+	delete m_pData;
+
+	for (size_t i = 0; i < m_apReleasing.size(); i++)
+		delete m_apReleasing[i];
+}
+
+void CViewbackConnection::Update()
+{
+	// Old connections the data thread is done with.
+	size_t iKept = 0;
+	for (size_t i = 0; i < m_apReleasing.size(); i++)
 	{
-		size_t iStartPacket = 0;
-		vector<Packet> aPackets = CViewbackDataThread::GetData();
+		if (m_apReleasing[i]->IsReleased())
+			delete m_apReleasing[i];
+		else
+			m_apReleasing[iKept++] = m_apReleasing[i];
+	}
+
+	m_apReleasing.resize(iKept);
 
-		// Look for a data registration packet.
-		for (size_t i = 0; i < aPackets.size(); i++)
+	if (m_pData && m_pData->IsConnected())
+	{
+		// Handle what's waiting, but don't chase a data thread that's adding
+		// packets as fast as we take them off.
+		size_t iMaxPackets = VB_MAX_PACKETS_PER_UPDATE;
+
+		CViewbackMessage* pMessage;
+		while (iMaxPackets-- && (pMessage = m_pData->PeekData()) != NULL)
 		{
-			if (aPackets[i].is_registration())
+			if (!pMessage->m_bSample && pMessage->m_oPacket.is_registration())
+				InstallRegistration(pMessage->m_oPacket, pMessage->m_pHistory);
+			else if (!m_aDataChannels.size() && !m_aDataControls.size() && !m_aDataGroups.size())
+			{
+				// We somehow don't have any data registrations yet, so stash this message for later.
+				// It might be possible if the server sends some messages between when the client connects and when it requests registrations.
+				m_aUnhandledMessages.push_back(CViewbackMessage());
+				m_aUnhandledMessages.back().m_bSample = pMessage->m_bSample;
+				m_aUnhandledMessages.back().m_oSample = pMessage->m_oSample;
+				m_aUnhandledMessages.back().m_oPacket.Swap(&pMessage->m_oPacket);
+			}
+			else
 			{
-				static VBVector3 aclrColors[] = {
-					VBVector3(1, 0, 0),
-					VBVector3(0, 1, 0),
-					VBVector3(0, 0, 1),
-					VBVector3(0, 1, 1),
-					VBVector3(1, 0, 1),
-					VBVector3(1, 1, 0),
-				};
-				int iColorsSize = sizeof(aclrColors) / sizeof(aclrColors[0]);
-
-				// Disregard any data which came in before the registration packet, it may be from another server or old connection.
-				m_aData.clear();
-				m_aDataChannels.clear();
-				m_aDataGroups.clear();
-				m_aDataControls.clear();
-				m_aMeta.clear();
+				// If we've been saving any messages, handle them first.
+				for (size_t i = 0; i < m_aUnhandledMessages.size(); i++)
+					HandleMessage(m_aUnhandledMessages[i]);
+
 				m_aUnhandledMessages.clear();
-				m_flLatestDataTime = 0;
-				m_flTimeReceivedLatestData = 0;
-				iStartPacket = i + 1;
-
-				m_aDataChannels.resize(aPackets[i].data_channels_size());
-				m_aData.resize(aPackets[i].data_channels_size());
-				m_aMeta.resize(aPackets[i].data_channels_size());
-
-				for (size_t j = 0; j < (size_t)aPackets[i].data_channels_size(); j++)
-				{
-					auto& oChannelProtobuf = aPackets[i].data_channels(j);
-
-					VBAssert(oChannelProtobuf.has_handle());
-					VBAssert(oChannelProtobuf.has_name());
-					VBAssert(oChannelProtobuf.has_type());
-					VBAssert(oChannelProtobuf.handle() == j);
 
-					auto& oChannel = m_aDataChannels[oChannelProtobuf.handle()];
-					oChannel.m_iHandle = oChannelProtobuf.handle();
-					oChannel.m_sName = oChannelProtobuf.name();
-					oChannel.m_eDataType = oChannelProtobuf.type();
+				HandleMessage(*pMessage);
+			}
+
+			m_pData->PopData();
+		}
+
+		// Say so when samples are being dropped, but not every frame.
+		size_t iDropped = m_pData->GetDroppedSamples();
+		if (iDropped != m_iDroppedReported)
+		{
+			time_t iNow;
+			time(&iNow);
+
+			if (iNow != m_iDroppedReportTime)
+			{
+				VBPrintf("%s: dropped %d samples, the client isn't keeping up.\n", m_sName.c_str(), (int)(iDropped - m_iDroppedReported));
+				m_iDroppedReported = iDropped;
+				m_iDroppedReportTime = iNow;
+			}
+		}
+
+		if (m_pHistory)
+		{
+			if (m_bOwnHistory)
+				m_pHistory->Publish();
+
+			// Everything the monitor reads until the next Update() comes from this one snapshot.
+			m_pHistory->Snapshot();
+
+			ReadHits();
+		}
+
+		if (!m_aDataChannels.size() && !m_aDataControls.size() && !m_aDataGroups.size())
+			return;
+
+		while (m_sOutgoingCommands.size())
+		{
+			if (m_pData->SendConsoleCommand(m_sOutgoingCommands.front()))
+				// Message was received, we can remove this command from the list.
+				m_sOutgoingCommands.pop_front();
+			else
+				// The data thread's command queue is full, hold on for now.
+				break;
+		}
+
+		// Tell whoever is stashing how much data to keep. It's cleared out every so often as more arrives.
+		if (m_pHistory)
+		{
+			double flNewest = GetLatestDataTime();
 
-					if (oChannelProtobuf.has_range_min())
-						oChannel.m_flMin = oChannelProtobuf.range_min();
+			m_pHistory->SetMemoryBudget(m_iMemoryBudget);
 
-					if (oChannelProtobuf.has_range_max())
-						oChannel.m_flMax = oChannelProtobuf.range_max();
+			for (size_t i = 0; i < m_aDataChannels.size(); i++)
+			{
+				if (m_aDataChannels[i].m_eDataType == VB_DATATYPE_VECTOR)
+					m_pHistory->SetClearTime(i, flNewest - m_aMeta[i].m_flDisplayDuration - 10);
+				else
+					m_pHistory->SetClearTime(i, m_flDataClearTime);
 
-					m_aMeta[oChannelProtobuf.handle()].m_clrColor = aclrColors[j % iColorsSize];
-				}
+				m_pHistory->SetPriority(i, m_aMeta[i].m_iPriority);
+			}
+		}
+	}
+	else if (m_pData)
+	{
+		// We've been disconnected.
+		ReleaseData();
+	}
+}
 
-				VBPrintf("Installed %d channels.\n", aPackets[i].data_channels_size());
+void CViewbackConnection::Clear()
+{
+	if (!m_pHistory && !m_aDataChannels.size() && !m_aDataControls.size() && !m_aDataGroups.size())
+		return;
 
-				for (int j = 0; j < aPackets[i].data_groups_size(); j++)
-				{
-					auto& oGroupProtobuf = aPackets[i].data_groups(j);
+	ReleaseHistory();
 
-					VBAssert(oGroupProtobuf.has_name());
+	m_aDataChannels.clear();
+	m_aDataControls.clear();
+	m_aDataGroups.clear();
+	m_aMeta.clear();
+	m_aUnhandledMessages.clear();
+	m_sOutgoingCommands.clear();
 
-					m_aDataGroups.push_back(CViewbackDataGroup());
-					auto& oGroup = m_aDataGroups.back();
-					oGroup.m_sName = oGroupProtobuf.name();
-					for (int k = 0; k < oGroupProtobuf.channels_size(); k++)
-						oGroup.m_iChannels.push_back(oGroupProtobuf.channels(k));
-				}
+	if (m_pClient->m_pfnRegistrationUpdate)
+		m_pClient->m_pfnRegistrationUpdate();
+}
 
-				VBPrintf("Installed %d groups.\n", aPackets[i].data_groups_size());
+void CViewbackConnection::ReleaseData()
+{
+	// Clear it all out. The history may belong to the data connection.
+	Clear();
 
-				for (int j = 0; j < aPackets[i].data_labels_size(); j++)
-				{
-					auto& oLabelProtobuf = aPackets[i].data_labels(j);
+	if (!m_pData)
+		return;
 
-					VBAssert(oLabelProtobuf.has_label());
-					VBAssert(oLabelProtobuf.has_channel());
-					VBAssert(oLabelProtobuf.has_value());
+	m_pData->Disconnect();
 
-					auto& oChannel = m_aDataChannels[oLabelProtobuf.channel()];
-					oChannel.m_asLabels[oLabelProtobuf.value()] = oLabelProtobuf.label();
-				}
+	// The data thread may still be using it, it's deleted once it lets go.
+	m_apReleasing.push_back(m_pData);
+	m_pData = NULL;
+}
 
-				VBPrintf("Installed %d labels.\n", aPackets[i].data_controls_size());
+void CViewbackConnection::InstallRegistration(const Packet& oPacket, CViewbackHistory* pHistory)
+{
+	static VBVector3 aclrColors[] = {
+		VBVector3(1, 0, 0),
+		VBVector3(0, 1, 0),
+		VBVector3(0, 0, 1),
+		VBVector3(0, 1, 1),
+		VBVector3(1, 0, 1),
+		VBVector3(1, 1, 0),
+	};
+	int iColorsSize = sizeof(aclrColors) / sizeof(aclrColors[0]);
+
+	// Disregard any data which came in before the registration packet, it may be from another server or old connection.
+	ReleaseHistory();
+	m_aDataChannels.clear();
+	m_aDataGroups.clear();
+	m_aDataControls.clear();
+	m_aMeta.clear();
+	m_aUnhandledMessages.clear();
+
+	if (pHistory)
+	{
+		// The data thread is stashing into this one.
+		m_pHistory = pHistory;
+		m_bOwnHistory = false;
 
-				for (int j = 0; j < aPackets[i].data_controls_size(); j++)
-				{
-					auto& oControlProtobuf = aPackets[i].data_controls(j);
+		m_pData->SetHistoryInUse(pHistory->GetSerial());
+	}
+	else
+	{
+		m_pHistory = new CViewbackHistory(oPacket, 0, CViewbackDataThread::GetDerivedChannels(), CViewbackDataThread::GetTriggers());
+		m_bOwnHistory = true;
 
-					VBAssert(oControlProtobuf.has_name());
-					VBAssert(oControlProtobuf.has_type());
+		const string& sSpillDirectory = CViewbackDataThread::GetSpillDirectory();
+		if (sSpillDirectory.length() && !m_pHistory->SpillTo(sSpillDirectory))
+			VBPrintf("Couldn't make a spill file in %s, keeping the data in memory.\n", sSpillDirectory.c_str());
+	}
 
-					if (!oControlProtobuf.has_name())
-						continue;
+	const vector<string>& asDerivedNames = m_pHistory->GetDerivedNames();
 
-					if (!oControlProtobuf.has_type())
-						continue;
+	m_aDataChannels.resize(oPacket.data_channels_size() + asDerivedNames.size());
+	m_aMeta.resize(oPacket.data_channels_size() + asDerivedNames.size());
 
-					if (oControlProtobuf.type() <= 0 || oControlProtobuf.type() >= VB_CONTROL_MAX)
-					{
-						VBPrintf("Unrecognized control type: %d Need to update your monitor?\n", oControlProtobuf.type());
-						continue;
-					}
+	for (size_t j = 0; j < (size_t)oPacket.data_channels_size(); j++)
+	{
+		auto& oChannelProtobuf = oPacket.data_channels(j);
 
-					m_aDataControls.emplace_back();
-					m_aDataControls.back().m_name = oControlProtobuf.name();
-					m_aDataControls.back().m_type = oControlProtobuf.type();
+		VBAssert(oChannelProtobuf.has_handle());
+		VBAssert(oChannelProtobuf.has_name());
+		VBAssert(oChannelProtobuf.has_type());
+		VBAssert(oChannelProtobuf.handle() == j);
 
-					switch (m_aDataControls.back().m_type)
-					{
-					case VB_CONTROL_BUTTON:
-						m_aDataControls.back().m_command = oControlProtobuf.command();
-						break;
+		auto& oChannel = m_aDataChannels[oChannelProtobuf.handle()];
+		oChannel.m_iHandle = oChannelProtobuf.handle();
+		oChannel.m_sName = oChannelProtobuf.name();
+		oChannel.m_eDataType = oChannelProtobuf.type();
 
-					case VB_CONTROL_SLIDER_FLOAT:
-						m_aDataControls.back().slider_float.range_min = oControlProtobuf.range_min_float();
-						m_aDataControls.back().slider_float.range_max = oControlProtobuf.range_max_float();
-						m_aDataControls.back().slider_float.steps = oControlProtobuf.num_steps();
-						m_aDataControls.back().slider_float.initial_value = oControlProtobuf.value_float();
-						break;
+		if (oChannelProtobuf.has_range_min())
+			oChannel.m_flMin = oChannelProtobuf.range_min();
 
-					case VB_CONTROL_SLIDER_INT:
-						m_aDataControls.back().slider_int.range_min = oControlProtobuf.range_min_int();
-						m_aDataControls.back().slider_int.range_max = oControlProtobuf.range_max_int();
-						m_aDataControls.back().slider_int.step_size = oControlProtobuf.step_size();
-						m_aDataControls.back().slider_int.initial_value = oControlProtobuf.value_int();
-						break;
+		if (oChannelProtobuf.has_range_max())
+			oChannel.m_flMax = oChannelProtobuf.range_max();
 
-					default:
-						VBUnimplemented();
-						break;
-					}
-				}
+		m_aMeta[oChannelProtobuf.handle()].m_clrColor = aclrColors[j % iColorsSize];
+	}
 
-				VBPrintf("Installed %d controls.\n", aPackets[i].data_controls_size());
+	// The history has them after the server's channels.
+	for (size_t j = 0; j < asDerivedNames.size(); j++)
+	{
+		size_t iHandle = m_pHistory->GetRegisteredChannels() + j;
 
-				if (m_pfnRegistrationUpdate)
-					m_pfnRegistrationUpdate();
-			}
-		}
+		auto& oChannel = m_aDataChannels[iHandle];
+		oChannel.m_iHandle = iHandle;
+		oChannel.m_sName = asDerivedNames[j];
+		oChannel.m_eDataType = VB_DATATYPE_FLOAT;
+		oChannel.m_bDerived = true;
+		oChannel.m_aiInputs = m_pHistory->GetDerivedInputs(j);
 
-		if (!m_aDataChannels.size() && !m_aDataControls.size() && !m_aDataGroups.size())
-		{
-			// We somehow don't have any data registrations yet, so stash these messages for later.
-			// It might be possible if the server sends some messages between when the client connects and when it requests registrations.
-			for (size_t i = 0; i < aPackets.size(); i++)
-				m_aUnhandledMessages.push_back(aPackets[i]);
+		m_aMeta[iHandle].m_clrColor = aclrColors[iHandle % iColorsSize];
+	}
 
-			return;
-		}
+	VBPrintf("Installed %d channels.\n", oPacket.data_channels_size());
 
-		// If we've been saving any messages, stick them onto the beginning here.
-		if (m_aUnhandledMessages.size())
-			aPackets.insert(aPackets.begin(), m_aUnhandledMessages.begin(), m_aUnhandledMessages.end());
+	if (asDerivedNames.size())
+		VBPrintf("Installed %d derived channels.\n", (int)asDerivedNames.size());
 
-		m_aUnhandledMessages.clear();
+	if (m_pHistory->GetTriggers().size())
+		VBPrintf("Installed %d triggers.\n", (int)m_pHistory->GetTriggers().size());
 
-		for (size_t i = iStartPacket; i < aPackets.size(); i++)
-		{
-			if (aPackets[i].has_data())
-				StashData(&aPackets[i].data());
+	for (int j = 0; j < oPacket.data_groups_size(); j++)
+	{
+		auto& oGroupProtobuf = oPacket.data_groups(j);
 
-			if (aPackets[i].has_console_output() && m_pfnConsoleOutput)
-				m_pfnConsoleOutput(aPackets[i].console_output().c_str());
+		VBAssert(oGroupProtobuf.has_name());
 
-			if (aPackets[i].has_status())
-				m_sStatus = aPackets[i].status();
+		m_aDataGroups.push_back(CViewbackDataGroup());
+		auto& oGroup = m_aDataGroups.back();
+		oGroup.m_sName = oGroupProtobuf.name();
+		for (int k = 0; k < oGroupProtobuf.channels_size(); k++)
+			oGroup.m_iChannels.push_back(oGroupProtobuf.channels(k));
+	}
 
-			if (aPackets[i].data_controls_size())
-			{
-				VBAssert(!aPackets[i].is_registration());
+	VBPrintf("Installed %d groups.\n", oPacket.data_groups_size());
 
-				for (size_t j = 0; j < m_aDataControls.size(); j++)
-				{
-					if (m_aDataControls[j].m_name != aPackets[i].data_controls(0).name())
-						continue;
+	for (int j = 0; j < oPacket.data_labels_size(); j++)
+	{
+		auto& oLabelProtobuf = oPacket.data_labels(j);
 
-					if (m_pfnControlUpdatedCallback)
-						m_pfnControlUpdatedCallback(j, aPackets[i].data_controls(0).value_float(), aPackets[i].data_controls(0).value_int());
+		VBAssert(oLabelProtobuf.has_label());
+		VBAssert(oLabelProtobuf.has_channel());
+		VBAssert(oLabelProtobuf.has_value());
 
-					break;
-				}
-			}
-		}
+		auto& oChannel = m_aDataChannels[oLabelProtobuf.channel()];
+		oChannel.m_asLabels.Set(oLabelProtobuf.value(), oLabelProtobuf.label());
+	}
 
-		while (m_sOutgoingCommands.size())
+	VBPrintf("Installed %d labels.\n", oPacket.data_controls_size());
+
+	for (int j = 0; j < oPacket.data_controls_size(); j++)
+	{
+		auto& oControlProtobuf = oPacket.data_controls(j);
+
+		VBAssert(oControlProtobuf.has_name());
+		VBAssert(oControlProtobuf.has_type());
+
+		if (!oControlProtobuf.has_name())
+			continue;
+
+		if (!oControlProtobuf.has_type())
+			continue;
+
+		if (oControlProtobuf.type() <= 0 || oControlProtobuf.type() >= VB_CONTROL_MAX)
 		{
-			if (CViewbackDataThread::SendConsoleCommand(m_sOutgoingCommands.front()))
-				// Message was received, we can remove this command from the list.
-				m_sOutgoingCommands.pop_front();
-			else
-				// There's already a command waiting to be sent to the data thread, hold on for now.
-				break;
+			VBPrintf("Unrecognized control type: %d Need to update your monitor?\n", oControlProtobuf.type());
+			continue;
 		}
 
-		// Clear out old data. First let's find the newest timestamp of any data.
-		double flNewest = GetLatestDataTime();
-		if (flNewest > m_flNextDataClear)
-		{
-			for (size_t i = 0; i < m_aData.size(); i++)
-			{
-				if (m_aDataChannels[i].m_eDataType == VB_DATATYPE_VECTOR)
-				{
-					while (m_aData[i].m_aVectorData.size() > 2 && m_aData[i].m_aVectorData.front().time < flNewest - m_aMeta[i].m_flDisplayDuration - 10)
-						m_aData[i].m_aVectorData.pop_front();
-				}
-				else if (m_aDataChannels[i].m_eDataType == VB_DATATYPE_FLOAT)
-				{
-					while (m_aData[i].m_aFloatData.size() > 2 && m_aData[i].m_aFloatData.front().time < m_flDataClearTime)
-						m_aData[i].m_aFloatData.pop_front();
-				}
-				else if (m_aDataChannels[i].m_eDataType == VB_DATATYPE_INT)
-				{
-					while (m_aData[i].m_aIntData.size() > 2 && m_aData[i].m_aIntData.front().time < m_flDataClearTime)
-						m_aData[i].m_aIntData.pop_front();
-				}
-				else
-					VBUnimplemented();
-			}
+		m_aDataControls.emplace_back();
+		m_aDataControls.back().m_name = oControlProtobuf.name();
+		m_aDataControls.back().m_type = oControlProtobuf.type();
 
-			m_flNextDataClear = flNewest + 10;
+		switch (m_aDataControls.back().m_type)
+		{
+		case VB_CONTROL_BUTTON:
+			m_aDataControls.back().m_command = oControlProtobuf.command();
+			break;
+
+		case VB_CONTROL_SLIDER_FLOAT:
+			m_aDataControls.back().slider_float.range_min = oControlProtobuf.range_min_float();
+			m_aDataControls.back().slider_float.range_max = oControlProtobuf.range_max_float();
+			m_aDataControls.back().slider_float.steps = oControlProtobuf.num_steps();
+			m_aDataControls.back().slider_float.initial_value = oControlProtobuf.value_float();
+			break;
+
+		case VB_CONTROL_SLIDER_INT:
+			m_aDataControls.back().slider_int.range_min = oControlProtobuf.range_min_int();
+			m_aDataControls.back().slider_int.range_max = oControlProtobuf.range_max_int();
+			m_aDataControls.back().slider_int.step_size = oControlProtobuf.step_size();
+			m_aDataControls.back().slider_int.initial_value = oControlProtobuf.value_int();
+			break;
+
+		default:
+			VBUnimplemented();
+			break;
 		}
 	}
+
+	VBPrintf("Installed %d controls.\n", oPacket.data_controls_size());
+
+	if (m_pClient->m_pfnRegistrationUpdate)
+		m_pClient->m_pfnRegistrationUpdate();
+}
+
+void CViewbackConnection::ReleaseHistory()
+{
+	// If it belongs to the data thread, it's deleted when the data thread sees we've moved on.
+	if (m_bOwnHistory)
+		delete m_pHistory;
+
+	m_pHistory = NULL;
+	m_bOwnHistory = false;
+	m_iHitsRead = 0;
+}
+
+void CViewbackConnection::ReadHits()
+{
+	const CViewbackSeries<CViewbackTriggerHit>& aHits = m_pHistory->GetHits();
+
+	for (; m_iHitsRead < aHits.size(); m_iHitsRead++)
+	{
+		CViewbackDataPair<CViewbackTriggerHit> oHit = aHits[m_iHitsRead];
+
+		m_pClient->m_aBookmarks.push_back(CViewbackBookmark());
+		CViewbackBookmark& oBookmark = m_pClient->m_aBookmarks.back();
+		oBookmark.m_iConnection = m_iIndex;
+		oBookmark.m_flTime = oHit.time;
+		oBookmark.m_sTrigger = m_pHistory->GetTriggers()[oHit.data.m_iTrigger].m_sName;
+		oBookmark.m_sChannel = m_pHistory->GetTriggers()[oHit.data.m_iTrigger].m_sChannel;
+		oBookmark.m_flValue = oHit.data.m_flValue;
+
+		VBPrintf("Trigger %s went off at %f.\n", oBookmark.m_sTrigger.c_str(), oBookmark.m_flTime);
+
+		if (m_pClient->m_pfnTriggerFiredCallback)
+			m_pClient->m_pfnTriggerFiredCallback(oBookmark);
+	}
+}
+
+void CViewbackConnection::HandleMessage(const CViewbackMessage& oMessage)
+{
+	if (oMessage.m_bSample)
+	{
+		if (m_pClient->m_pfnDataReceivedCallback)
+			m_pClient->m_pfnDataReceivedCallback(m_iIndex, oMessage.m_oSample);
+
+		// If the data thread is doing the stashing it keeps samples to itself.
+		if (m_bOwnHistory)
+			m_pHistory->Stash(oMessage.m_oSample);
+	}
 	else
+		HandlePacket(oMessage.m_oPacket);
+}
+
+void CViewbackConnection::HandlePacket(const Packet& oPacket)
+{
+	if (oPacket.has_data() && (m_bOwnHistory || m_pClient->m_pfnDataReceivedCallback))
 	{
-		if (m_aData.size())
-		{
-			// We've been disconnected. Clear it all out.
-			for (size_t i = 0; i < m_aData.size(); i++)
-			{
-				auto& oData = m_aData[i];
+		CViewbackSample oSample;
+		SampleFromData(oPacket.data(), oSample);
 
-				oData.m_aFloatData.clear();
-				oData.m_aIntData.clear();
-				oData.m_aVectorData.clear();
-			}
+		if (m_pClient->m_pfnDataReceivedCallback)
+			m_pClient->m_pfnDataReceivedCallback(m_iIndex, oSample);
+
+		if (m_bOwnHistory)
+			m_pHistory->Stash(oSample);
+	}
+
+	if (oPacket.has_console_output() && m_pClient->m_pfnConsoleOutput)
+		m_pClient->m_pfnConsoleOutput(oPacket.console_output().c_str());
 
-			m_aData.clear();
+	if (oPacket.has_status())
+		m_sStatus = oPacket.status();
 
-			m_aDataChannels.clear();
-			m_aDataControls.clear();
-			m_aDataGroups.clear();
-			m_aMeta.clear();
+	if (oPacket.data_controls_size())
+	{
+		VBAssert(!oPacket.is_registration());
+
+		for (size_t j = 0; j < m_aDataControls.size(); j++)
+		{
+			if (m_aDataControls[j].m_name != oPacket.data_controls(0).name())
+				continue;
 
-			m_pfnRegistrationUpdate();
+			if (m_pClient->m_pfnControlUpdatedCallback)
+				m_pClient->m_pfnControlUpdatedCallback(j, oPacket.data_controls(0).value_float(), oPacket.data_controls(0).value_int());
+
+			break;
 		}
 	}
 }
 
-vector<CServerListing> CViewbackClient::GetServers()
+CServerList CViewbackClient::GetServers()
 {
 	return CViewbackServersThread::GetServers();
 }
 
-bool CViewbackClient::HasConnection()
+bool CViewbackConnection::HasConnection()
+{
+	return m_pData && m_pData->IsConnected();
+}
+
+size_t CViewbackConnection::GetDroppedSamples() const
 {
-	return CViewbackDataThread::IsConnected();
+	return m_pData ? m_pData->GetDroppedSamples() : 0;
 }
 
-void CViewbackClient::Connect(const char* pszIP, unsigned short iPort)
+void CViewbackConnection::Connect(const char* pszIP, unsigned short iPort)
 {
-	CViewbackDataThread::Disconnect();
+	ReleaseData();
 	m_bDisconnected = false;
 
 	VBPrintf("Connecting to server at %s ...\n", pszIP);
 
 	IN_ADDR address;
 	inet_pton(AF_INET, pszIP, &address);
-	bool bResult = CViewbackDataThread::Connect(ntohl(address.s_addr), iPort);
+
+	CViewbackDataConnection* pData = new CViewbackDataConnection();
+	bool bResult = pData->Connect(ntohl(address.s_addr), iPort);
 
 	if (bResult)
 		VBPrintf("Success.\n");
@@ -347,42 +557,87 @@ void CViewbackClient::Connect(const char* pszIP, unsigned short iPort)
 		VBPrintf("Failed.\n");
 
 	if (!bResult)
+	{
+		delete pData;
 		return;
+	}
 
-	struct timeb now;
-	now.time = 0;
-	now.millitm = 0;
+	char szName[64];
+	sprintf(szName, "%s:%d", pszIP, (int)iPort);
 
-	ftime(&now);
+	m_pData = pData;
+	m_iDroppedReported = 0;
+	m_sName = szName;
+
+	ResetConnectionTime();
+}
+
+void CViewbackConnection::ConnectUnix(const char* pszPath)
+{
+	ReleaseData();
+	m_bDisconnected = false;
+
+	VBPrintf("Connecting to server at %s ...\n", pszPath);
+
+	CViewbackDataConnection* pData = new CViewbackDataConnection();
+	bool bResult = pData->ConnectUnix(pszPath);
+
+	if (bResult)
+		VBPrintf("Success.\n");
+	else
+		VBPrintf("Failed.\n");
+
+	if (!bResult)
+	{
+		delete pData;
+		return;
+	}
+
+	m_pData = pData;
+	m_iDroppedReported = 0;
+	m_sName = pszPath;
+
+	ResetConnectionTime();
+}
 
-	m_iServerConnectionTimeS = now.time;
-	m_iServerConnectionTimeMS = now.millitm;
+void CViewbackConnection::ResetConnectionTime()
+{
 	m_flDataClearTime = 0;
 }
 
 void CViewbackClient::FindServer()
 {
-	vector<CServerListing> server_list = GetServers();
-	if (!server_list.size())
+	CServerList server_list = GetServers();
+	if (!server_list->size())
 		return;
 
-	CViewbackDataThread::Disconnect();
-	m_bDisconnected = false;
-
 	in_addr in;
-	in.s_addr = htonl(server_list[0].address);
+	in.s_addr = htonl((*server_list)[0].address);
 
-	Connect(inet_ntoa(in), server_list[0].tcp_port);
+	m_apConnections[0]->Connect(inet_ntoa(in), (*server_list)[0].tcp_port);
 }
 
-void CViewbackClient::Disconnect()
+void CViewbackConnection::Disconnect()
 {
 	m_bDisconnected = true;
-	CViewbackDataThread::Disconnect();
+	ReleaseData();
 }
 
-void CViewbackClient::ActivateChannel(size_t iChannel)
+void CViewbackConnection::ActivateChannel(size_t iChannel)
 {
+	if (m_aDataChannels[iChannel].m_bDerived)
+	{
+		// The server only knows about what it's made from.
+		for (size_t i = 0; i < m_aDataChannels[iChannel].m_aiInputs.size(); i++)
+		{
+			if (!m_aDataChannels[m_aDataChannels[iChannel].m_aiInputs[i]].m_bActive)
+				ActivateChannel(m_aDataChannels[iChannel].m_aiInputs[i]);
+		}
+
+		m_aDataChannels[iChannel].m_bActive = true;
+		return;
+	}
+
 	char aoeu[10];
 	sprintf(aoeu, "%d", iChannel);
 
@@ -392,8 +647,15 @@ void CViewbackClient::ActivateChannel(size_t iChannel)
 	m_aDataChannels[iChannel].m_bActive = true;
 }
 
-void CViewbackClient::DeactivateChannel(size_t iChannel)
+void CViewbackConnection::DeactivateChannel(size_t iChannel)
 {
+	// Other channels may still be using what it's made from, so leave that be.
+	if (m_aDataChannels[iChannel].m_bDerived)
+	{
+		m_aDataChannels[iChannel].m_bActive = false;
+		return;
+	}
+
 	char aoeu[10];
 	sprintf(aoeu, "%d", iChannel);
 
@@ -403,7 +665,7 @@ void CViewbackClient::DeactivateChannel(size_t iChannel)
 	m_aDataChannels[iChannel].m_bActive = false;
 }
 
-void CViewbackClient::ActivateGroup(size_t iGroup)
+void CViewbackConnection::ActivateGroup(size_t iGroup)
 {
 	char aoeu[10];
 	sprintf(aoeu, "%d", iGroup);
@@ -418,7 +680,7 @@ void CViewbackClient::ActivateGroup(size_t iGroup)
 		m_aDataChannels[i].m_bActive = true;
 }
 
-void CViewbackClient::ControlCallback(int iControl)
+void CViewbackConnection::ControlCallback(int iControl)
 {
 	if (m_aDataControls[iControl].m_override_command.length())
 	{
@@ -433,7 +695,7 @@ void CViewbackClient::ControlCallback(int iControl)
 	m_sOutgoingCommands.push_back(std::string("control: ") + aoeu);
 }
 
-void CViewbackClient::ControlCallback(int iControl, float value)
+void CViewbackConnection::ControlCallback(int iControl, float value)
 {
 	char aoeu[100];
 	sprintf(aoeu, "control: %d %f", iControl, value);
@@ -442,7 +704,7 @@ void CViewbackClient::ControlCallback(int iControl, float value)
 	m_sOutgoingCommands.push_back(aoeu);
 }
 
-void CViewbackClient::ControlCallback(int iControl, int value)
+void CViewbackConnection::ControlCallback(int iControl, int value)
 {
 	char aoeu[100];
 	sprintf(aoeu, "control: %d %d", iControl, value);
@@ -451,116 +713,127 @@ void CViewbackClient::ControlCallback(int iControl, int value)
 	m_sOutgoingCommands.push_back(aoeu);
 }
 
-void CViewbackClient::SendConsoleCommand(const string& sCommand)
+void CViewbackConnection::SendConsoleCommand(const string& sCommand)
 {
 	// This list is pumped into the data thread during the Update().
 	m_sOutgoingCommands.push_back("console: " + sCommand);
 }
 
-vb_data_type_t CViewbackClient::TypeForHandle(size_t iHandle)
+vb_data_type_t CViewbackConnection::TypeForHandle(size_t iHandle)
 {
 	return m_aDataChannels[iHandle].m_eDataType;
 }
 
-bool CViewbackClient::HasLabel(size_t iHandle, int iValue)
+bool CViewbackConnection::HasLabel(size_t iHandle, int iValue)
 {
-	auto it = m_aDataChannels[iHandle].m_asLabels.find(iValue);
-	if (it == m_aDataChannels[iHandle].m_asLabels.end())
-		return false;
-	else
-		return true;
+	return m_aDataChannels[iHandle].m_asLabels.Find(iValue) != NULL;
 }
 
-string CViewbackClient::GetLabelForValue(size_t iHandle, int iValue)
+CViewbackLabelText CViewbackConnection::GetLabelForValue(size_t iHandle, int iValue)
 {
-	auto it = m_aDataChannels[iHandle].m_asLabels.find(iValue);
-	if (it == m_aDataChannels[iHandle].m_asLabels.end())
-		return static_cast<ostringstream*>(&(ostringstream() << iValue))->str();
+	const CViewbackLabels::CLabel* pLabel = m_aDataChannels[iHandle].m_asLabels.FindLabel(iValue);
+	if (!pLabel)
+		return CViewbackLabelText(iValue);
 	else
-		return it->second;
+		return CViewbackLabelText(pLabel->second);
 }
 
-void CViewbackClient::StashData(const Data* pData)
+const vector<CViewbackDataList>& CViewbackConnection::GetData() const
 {
-	VBAssert(pData->has_time_double() || pData->time_uint64());
+	static vector<CViewbackDataList> aNoData;
 
-	double flTime = 0;
+	if (!m_pHistory)
+		return aNoData;
 
-	if (pData->has_time_double())
-		flTime = pData->time_double();
-	else if (pData->has_time_uint64())
-		flTime = ((double)pData->time_uint64()) / 1000;
+	return m_pHistory->GetData();
+}
 
-	double flMaintainTime = 0;
+CViewbackDataRange CViewbackConnection::GetRange(size_t iHandle, double flStart, double flEnd, bool bEdges) const
+{
+	if (iHandle >= GetData().size())
+		return CViewbackDataRange();
 
-	if (pData->has_maintain_time_double())
-		flMaintainTime = pData->maintain_time_double();
-	else if (pData->has_maintain_time_uint64())
-		flMaintainTime = ((double)pData->maintain_time_uint64()) / 1000;
+	return GetData()[iHandle].GetRange(flStart, flEnd, bEdges);
+}
 
-	switch (TypeForHandle(pData->handle()))
+void CViewbackConnection::GetExtents(size_t iHandle, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<int> >& aExtents) const
+{
+	if (iHandle >= GetData().size())
 	{
-	case VB_DATATYPE_NONE:
-	default:
-		VBAssert(false);
-		break;
+		aExtents.clear();
+		return;
+	}
 
-	case VB_DATATYPE_INT:
-		if (pData->has_maintain_time_double() || pData->has_maintain_time_uint64())
-		{
-			// We threw out some data to save on network data. Now the client needs to "fake it" by
-			// maintaining the previous data value until flMaintainTime, which was the last time that
-			// we got from the server of the duplicate value.
-			if (m_aData[pData->handle()].m_aIntData.size() && flMaintainTime != m_aData[pData->handle()].m_aIntData.back().time)
-				m_aData[pData->handle()].m_aIntData.push_back(CViewbackDataList::DataPair<int>(flMaintainTime, m_aData[pData->handle()].m_aIntData.back().data));
-		}
+	GetData()[iHandle].GetExtents(flStart, flEnd, iPixels, aExtents);
+}
 
-		m_aData[pData->handle()].m_aIntData.push_back(CViewbackDataList::DataPair<int>(flTime, pData->data_int()));
-		break;
+void CViewbackConnection::GetExtents(size_t iHandle, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<float> >& aExtents) const
+{
+	if (iHandle >= GetData().size())
+	{
+		aExtents.clear();
+		return;
+	}
 
-	case VB_DATATYPE_FLOAT:
-		if (pData->has_maintain_time_double() || pData->has_maintain_time_uint64())
-		{
-			// We threw out some data to save on network data. Now the client needs to "fake it" by
-			// maintaining the previous data value until flMaintainTime, which was the last time that
-			// we got from the server of the duplicate value.
-			if (m_aData[pData->handle()].m_aFloatData.size() && flMaintainTime != m_aData[pData->handle()].m_aFloatData.back().time)
-				m_aData[pData->handle()].m_aFloatData.push_back(CViewbackDataList::DataPair<float>(flMaintainTime, m_aData[pData->handle()].m_aFloatData.back().data));
-		}
+	GetData()[iHandle].GetExtents(flStart, flEnd, iPixels, aExtents);
+}
 
-		m_aData[pData->handle()].m_aFloatData.push_back(CViewbackDataList::DataPair<float>(flTime, pData->data_float()));
-		break;
+bool CViewbackConnection::GetStats(size_t iHandle, double flStart, double flEnd, CViewbackStats& oStats) const
+{
+	oStats = CViewbackStats();
 
-	case VB_DATATYPE_VECTOR:
-		if (pData->has_maintain_time_double() || pData->has_maintain_time_uint64())
-		{
-			// We threw out some data to save on network data. Now the client needs to "fake it" by
-			// maintaining the previous data value until flMaintainTime, which was the last time that
-			// we got from the server of the duplicate value.
-			if (m_aData[pData->handle()].m_aVectorData.size() && flMaintainTime != m_aData[pData->handle()].m_aVectorData.back().time)
-				m_aData[pData->handle()].m_aVectorData.push_back(CViewbackDataList::DataPair<VBVector3>(flMaintainTime, m_aData[pData->handle()].m_aVectorData.back().data));
-		}
+	if (iHandle >= GetData().size() || iHandle >= m_aDataChannels.size())
+		return false;
 
-		m_aData[pData->handle()].m_aVectorData.push_back(CViewbackDataList::DataPair<VBVector3>(flTime, VBVector3(pData->data_float_x(), pData->data_float_y(), pData->data_float_z())));
-		break;
-	}
+	if (m_aDataChannels[iHandle].m_eDataType == VB_DATATYPE_INT)
+		GetData()[iHandle].GetIntStats(flStart, flEnd, oStats);
+	else if (m_aDataChannels[iHandle].m_eDataType == VB_DATATYPE_FLOAT)
+		GetData()[iHandle].GetFloatStats(flStart, flEnd, oStats);
+	else
+		return false;
 
-	if (flTime > m_flLatestDataTime)
-	{
-		m_flLatestDataTime = flTime;
+	return true;
+}
+
+bool CViewbackConnection::Export(CViewbackExporter& oExporter) const
+{
+	return oExporter.ExportData(m_aDataChannels, GetData());
+}
+
+void CViewbackClient::SetStashOnDataThread(bool bStash)
+{
+	CViewbackDataThread::SetStashData(bStash);
+}
 
-		struct timeb now;
-		now.time = 0;
-		now.millitm = 0;
+void CViewbackClient::SetSpillDirectory(const std::string& sDirectory)
+{
+	CViewbackDataThread::SetSpillDirectory(sDirectory);
+}
 
-		ftime(&now);
+void CViewbackClient::AddDerivedChannel(const std::string& sName, const std::string& sExpression)
+{
+	CViewbackDerivedChannel oChannel;
+	oChannel.m_sName = sName;
+	oChannel.m_sExpression = sExpression;
+	CViewbackDataThread::AddDerivedChannel(oChannel);
+}
 
-		m_flTimeReceivedLatestData = (double)(now.time - m_iServerConnectionTimeS);
-		m_flTimeReceivedLatestData += ((double)(now.millitm) - (double)m_iServerConnectionTimeMS)/1000;
-	}
+void CViewbackClient::ClearDerivedChannels()
+{
+	CViewbackDataThread::ClearDerivedChannels();
 }
 
-double CViewbackClient::PredictCurrentTime()
+void CViewbackClient::AddTrigger(const CViewbackTrigger& oTrigger)
+{
+	CViewbackDataThread::AddTrigger(oTrigger);
+}
+
+void CViewbackClient::ClearTriggers()
+{
+	CViewbackDataThread::ClearTriggers();
+}
+
+double CViewbackConnection::PredictCurrentTime()
 {
 	struct timeb now;
 	now.time = 0;
@@ -568,12 +841,14 @@ double CViewbackClient::PredictCurrentTime()
 
 	ftime(&now);
 
-	double flTimeNow = (double)(now.time - m_iServerConnectionTimeS);
-	flTimeNow += ((double)(now.millitm) - (double)m_iServerConnectionTimeMS) / 1000;
+	if (!m_pHistory)
+		return 0;
+
+	double flTimeNow = (double)now.time + (double)now.millitm / 1000;
 
-	double flTimeDifference = flTimeNow - m_flTimeReceivedLatestData;
+	double flTimeDifference = flTimeNow - m_pHistory->GetTimeReceivedLatestData();
 
-	return m_flLatestDataTime + flTimeDifference;
+	return m_pHistory->GetLatestDataTime() + flTimeDifference;
 }
 
 
@@ -16,10 +16,14 @@ THE SOFTWARE.
 #pragma once
 
 #include <deque>
+#include <memory>
 
 #include "../protobuf/data.pb.h"
 
 #include "vector3.h"
+#include "viewback_decode.h"
+#include "viewback_history.h"
+#include "viewback_labels.h"
 
 #define NOMINMAX
 
@@ -60,8 +64,11 @@ class CViewbackDataChannel
 public:
 	CViewbackDataChannel()
 	{
+		m_iHandle = 0;
+		m_eDataType = VB_DATATYPE_NONE;
 		m_flMin = m_flMax = 0;
 		m_bActive = false;
+		m_bDerived = false;
 	}
 
 public:
@@ -78,7 +85,13 @@ public:
 	// inactive, it's the client's job to keep track of that.
 	bool m_bActive;
 
-	std::map<int, std::string> m_asLabels;
+	CViewbackLabels m_asLabels;
+
+	// Derived channels only, the handles of the channels it's made from.
+	// The server doesn't know about derived channels, activating one
+	// activates these instead.
+	bool                m_bDerived;
+	std::vector<size_t> m_aiInputs;
 };
 
 class CViewbackDataGroup
@@ -116,32 +129,6 @@ public:
 	};
 };
 
-// Holds all of the data associated with one handle.
-class CViewbackDataList
-{
-public:
-	template <typename T>
-	class DataPair
-	{
-	public:
-		DataPair(double _time, T _data)
-		{
-			time = _time;
-			data = _data;
-		}
-
-	public:
-		double time;
-		T      data;
-	};
-
-public:
-	// Only one of these will be used at a time.
-	std::deque<DataPair<int>>       m_aIntData;
-	std::deque<DataPair<float>>     m_aFloatData;
-	std::deque<DataPair<VBVector3>> m_aVectorData;
-};
-
 // This data may be initialized by the server, but after that can be edited
 // by the monitor as per user preferences.
 class CDataMetaInfo
@@ -153,6 +140,7 @@ public:
 		m_clrColor = VBVector3(1, 1, 1);
 		m_flDisplayDuration = 1;
 		m_bVisible = true;
+		m_iPriority = 0;
 	}
 
 public:
@@ -160,6 +148,7 @@ public:
 	VBVector3 m_clrColor;
 	float     m_flDisplayDuration; // In the 2D view, how many seconds worth of data should the monitor show?
 	bool      m_bVisible;
+	int       m_iPriority; // When over the memory budget, channels with lower priority lose their old data first.
 };
 
 class CServerListing
@@ -168,7 +157,22 @@ public:
 	std::string    name;
 	unsigned long  address;
 	unsigned short tcp_port;
-	time_t         last_ping;
+};
+
+// Most recently heard from first, as of the last time a server came, went or
+// was renamed. Never changed once it's handed out, so it can be kept and read
+// from any thread.
+typedef std::shared_ptr<const std::vector<CServerListing> > CServerList;
+
+// Left behind by a trigger going off, see CViewbackClient::AddTrigger().
+class CViewbackBookmark
+{
+public:
+	size_t      m_iConnection; // See CViewbackClient::GetConnection().
+	double      m_flTime;      // Data time, when the trigger had been true for its duration.
+	std::string m_sTrigger;    // The trigger's name.
+	std::string m_sChannel;
+	double      m_flValue;     // The channel's latest sample then.
 };
 
 typedef void(*ConsoleOutputCallback)(const char*);
@@ -178,25 +182,38 @@ typedef void(*RegistrationUpdateCallback)();
 // f_value is valid if the control is a float, i_value is valid if the control is an int
 typedef void(*ControlUpdatedCallback)(size_t control_id, float f_value, int i_value);
 
-class CViewbackClient
+typedef void(*TriggerFiredCallback)(const CViewbackBookmark& bookmark);
+
+// Every sample as it comes in, before it's stored. Not called for samples
+// the data thread stashes itself, see CViewbackClient::SetStashOnDataThread().
+typedef void(*DataReceivedCallback)(size_t connection, const CViewbackSample& sample);
+
+class CViewbackClient;
+class CViewbackDataConnection;
+class CViewbackExporter;
+
+// Everything to do with one server: its channels and their data, and the
+// commands going to it. Each connection has its own handles, channel 0 on
+// one server has nothing to do with channel 0 on another.
+class CViewbackConnection
 {
 public:
-	// Note that on Android you need to explicitly enable Multicast over WiFi.
-	// http://anandtechblog.blogspot.com.es/2011/11/multicast-udp-reciever-in-android.html
-	// http://codeisland.org/2012/udp-multicast-on-android/
-	// Viewback will not do this for you.
-	bool Initialize(RegistrationUpdateCallback pfnRegistration, ConsoleOutputCallback pfnConsoleOutput, DebugOutputCallback pfnDebugOutput = NULL);
-	void Shutdown();
-
-	void Update();
+	CViewbackConnection(CViewbackClient* pClient, size_t iIndex);
+	~CViewbackConnection();
 
-	std::vector<CServerListing> GetServers();
+private:
+	CViewbackConnection(const CViewbackConnection&);
+	CViewbackConnection& operator=(const CViewbackConnection&);
 
+public:
 	bool HasConnection();
 	void Connect(const char* pszIP, unsigned short iPort); // Does not resolve hostnames, pass an IP.
-	void FindServer(); // Connect to the first server you can find by multicast.
+	void ConnectUnix(const char* pszPath); // Connect to a server on this machine through its Unix domain socket.
 	void Disconnect();
 
+	// Where it was last connected to.
+	const std::string& GetName() const { return m_sName; }
+
 	// Deactivated channels will not be sent to the client.
 	// All channels are deactivated by default.
 	void ActivateChannel(size_t iChannel);
@@ -207,62 +224,244 @@ public:
 	void ControlCallback(int iControl, float);
 	void ControlCallback(int iControl, int);
 
-	void SetControlUpdatedCallback(ControlUpdatedCallback callback) { m_pfnControlUpdatedCallback = callback; }
-
 	void SendConsoleCommand(const std::string& sCommand);
-	DebugOutputCallback GetDebugOutputCallback() { return m_pfnDebugOutput; }
 
 	inline const std::vector<CViewbackDataChannel>& GetChannels() const { return m_aDataChannels; }
 	inline const std::vector<CViewbackDataGroup>& GetGroups() const { return m_aDataGroups; }
 	inline std::vector<CViewbackDataControl>& GetControls() { return m_aDataControls; }
-	inline const std::vector<CViewbackDataList>& GetData() const { return m_aData; } // DO NOT STORE without copying, this may be wiped at any time.
+	const std::vector<CViewbackDataList>& GetData() const; // DO NOT STORE without copying, this may be wiped at any time.
+
+	// A channel's samples from flStart to flEnd, see CViewbackSeries::GetRange().
+	// Only good until the next Update(), like GetData().
+	CViewbackDataRange GetRange(size_t iHandle, double flStart, double flEnd, bool bEdges = true) const;
+
+	// An int or float channel from flStart to flEnd boiled down to one extent
+	// per pixel column, see CViewbackPyramid::GetExtents(). Comes back empty
+	// if the channel is the other type.
+	void GetExtents(size_t iHandle, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<int> >& aExtents) const;
+	void GetExtents(size_t iHandle, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<float> >& aExtents) const;
+
+	// Mean, variance, quantiles and so on of an int or float channel from
+	// flStart to flEnd, see CViewbackPyramid::GetStats(). False for vectors.
+	bool GetStats(size_t iHandle, double flStart, double flEnd, CViewbackStats& oStats) const;
+
+	// Writes the channels and time range the exporter was set up for, see
+	// viewback_export.h. It has to be open already.
+	bool Export(CViewbackExporter& oExporter) const;
+
 	inline std::vector<CDataMetaInfo>& GetMeta() { return m_aMeta; }
 
 	vb_data_type_t TypeForHandle(size_t iHandle);
 
 	bool HasLabel(size_t iHandle, int iValue);
-	std::string GetLabelForValue(size_t iHandle, int iValue);
+	// The label, or the number if it has none. Doesn't allocate, see CViewbackLabelText for how long it's good.
+	CViewbackLabelText GetLabelForValue(size_t iHandle, int iValue);
 
 	std::string GetStatus() { return m_sStatus; }
 
-	double GetLatestDataTime() { return m_flLatestDataTime; }
+	// Samples thrown away since it connected because Update() wasn't called
+	// often enough to keep up with the server.
+	size_t GetDroppedSamples() const;
+
+	double GetLatestDataTime() { return m_pHistory ? m_pHistory->GetLatestDataTime() : 0; }
 	double PredictCurrentTime();
 
 	// Time view data (type float or int) with time stamps before this time may be cleared from memory.
 	// It's important to update this periodically or else old data will never be deleted.
 	void SetDataClearTime(double flTime) { m_flDataClearTime = flTime; }
 
+	// Once the data takes up more than this many bytes the oldest is thrown
+	// out, from the channels with the lowest m_iPriority in GetMeta() first.
+	// Old data is kept in summarized form for GetExtents() as long as it
+	// fits. 0, the default, means no limit.
+	void SetMemoryBudget(size_t iBytes) { m_iMemoryBudget = iBytes; }
+
 private:
-	void StashData(const Data* pData);
+	friend class CViewbackClient;
+
+	void Update();
+
+	void ResetConnectionTime();
+
+	void InstallRegistration(const Packet& oPacket, CViewbackHistory* pHistory);
+	void Clear();
+	void ReleaseHistory();
+	void ReleaseData();
+	void ReadHits();
+	void HandleMessage(const CViewbackMessage& oMessage);
+	void HandlePacket(const Packet& oPacket);
 
 private:
-	std::vector<Packet> m_aUnhandledMessages;
+	CViewbackClient* m_pClient;
+	size_t           m_iIndex;
+	std::string      m_sName;
+
+	CViewbackDataConnection*              m_pData;       // NULL while not connected.
+	std::vector<CViewbackDataConnection*> m_apReleasing; // Disconnected, waiting for the data thread to let go.
+
+	std::vector<CViewbackMessage> m_aUnhandledMessages;
 
 	std::vector<CViewbackDataChannel> m_aDataChannels;
 	std::vector<CViewbackDataGroup> m_aDataGroups;
 	std::vector<CViewbackDataControl> m_aDataControls;
-	std::vector<CViewbackDataList> m_aData;
 	std::vector<CDataMetaInfo> m_aMeta;
 
-	std::deque<std::string> m_sOutgoingCommands;
+	CViewbackHistory* m_pHistory;
+	bool              m_bOwnHistory; // Otherwise it belongs to the data thread.
+	size_t            m_iHitsRead;   // Of m_pHistory->GetHits(), the ones that are in the client's bookmarks.
 
-	RegistrationUpdateCallback m_pfnRegistrationUpdate;
-	ConsoleOutputCallback      m_pfnConsoleOutput;
-	DebugOutputCallback        m_pfnDebugOutput;
-	ControlUpdatedCallback     m_pfnControlUpdatedCallback;
+	std::deque<std::string> m_sOutgoingCommands;
 
 	std::string m_sStatus;
 
-	time_t         m_iServerConnectionTimeS;
-	unsigned short m_iServerConnectionTimeMS;
-
-	double m_flNextDataClear;
-	double m_flLatestDataTime;
-	double m_flTimeReceivedLatestData;
-
 	double m_flDataClearTime;
+	size_t m_iMemoryBudget;
+
+	size_t m_iDroppedReported; // Of m_pData->GetDroppedSamples().
+	time_t m_iDroppedReportTime;
 
 	bool m_bDisconnected; // Remain disconnected while this is on.
 };
 
+class CViewbackClient
+{
+public:
+	CViewbackClient()
+	{
+		m_pfnRegistrationUpdate = NULL;
+		m_pfnConsoleOutput = NULL;
+		m_pfnDebugOutput = NULL;
+		m_pfnControlUpdatedCallback = NULL;
+		m_pfnTriggerFiredCallback = NULL;
+		m_pfnDataReceivedCallback = NULL;
+	}
+
+public:
+	// Note that on Android you need to explicitly enable Multicast over WiFi.
+	// http://anandtechblog.blogspot.com.es/2011/11/multicast-udp-reciever-in-android.html
+	// http://codeisland.org/2012/udp-multicast-on-android/
+	// Viewback will not do this for you.
+	bool Initialize(RegistrationUpdateCallback pfnRegistration, ConsoleOutputCallback pfnConsoleOutput, DebugOutputCallback pfnDebugOutput = NULL);
+	void Shutdown();
+
+	void Update();
+
+	CServerList GetServers();
+
+	// Any number of servers can be watched at once, one connection each.
+	// One data thread reads from all of them. There's always at least one
+	// connection, and everything below that doesn't take a connection works
+	// on the first one, for a monitor that only watches one game.
+	size_t                     GetNumConnections() const { return m_apConnections.size(); }
+	CViewbackConnection&       GetConnection(size_t i) { return *m_apConnections[i]; }
+	const CViewbackConnection& GetConnection(size_t i) const { return *m_apConnections[i]; }
+
+	// A new connection that isn't connected to anything yet. Returns its index.
+	size_t AddConnection();
+
+	bool HasConnection() { return m_apConnections[0]->HasConnection(); }
+	void Connect(const char* pszIP, unsigned short iPort) { m_apConnections[0]->Connect(pszIP, iPort); }
+	void ConnectUnix(const char* pszPath) { m_apConnections[0]->ConnectUnix(pszPath); }
+	void FindServer(); // Connect to the first server you can find by multicast.
+	void Disconnect() { m_apConnections[0]->Disconnect(); }
+
+	void ActivateChannel(size_t iChannel) { m_apConnections[0]->ActivateChannel(iChannel); }
+	void DeactivateChannel(size_t iChannel) { m_apConnections[0]->DeactivateChannel(iChannel); }
+	void ActivateGroup(size_t iGroup) { m_apConnections[0]->ActivateGroup(iGroup); }
+
+	void ControlCallback(int iControl) { m_apConnections[0]->ControlCallback(iControl); }
+	void ControlCallback(int iControl, float flValue) { m_apConnections[0]->ControlCallback(iControl, flValue); }
+	void ControlCallback(int iControl, int iValue) { m_apConnections[0]->ControlCallback(iControl, iValue); }
+
+	void SetControlUpdatedCallback(ControlUpdatedCallback callback) { m_pfnControlUpdatedCallback = callback; }
+	void SetTriggerFiredCallback(TriggerFiredCallback callback) { m_pfnTriggerFiredCallback = callback; }
+	void SetDataReceivedCallback(DataReceivedCallback callback) { m_pfnDataReceivedCallback = callback; }
+
+	void SendConsoleCommand(const std::string& sCommand) { m_apConnections[0]->SendConsoleCommand(sCommand); }
+	DebugOutputCallback GetDebugOutputCallback() { return m_pfnDebugOutput; }
+
+	inline const std::vector<CViewbackDataChannel>& GetChannels() const { return m_apConnections[0]->GetChannels(); }
+	inline const std::vector<CViewbackDataGroup>& GetGroups() const { return m_apConnections[0]->GetGroups(); }
+	inline std::vector<CViewbackDataControl>& GetControls() { return m_apConnections[0]->GetControls(); }
+	const std::vector<CViewbackDataList>& GetData() const { return m_apConnections[0]->GetData(); }
+
+	CViewbackDataRange GetRange(size_t iHandle, double flStart, double flEnd, bool bEdges = true) const { return m_apConnections[0]->GetRange(iHandle, flStart, flEnd, bEdges); }
+
+	void GetExtents(size_t iHandle, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<int> >& aExtents) const { m_apConnections[0]->GetExtents(iHandle, flStart, flEnd, iPixels, aExtents); }
+	void GetExtents(size_t iHandle, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<float> >& aExtents) const { m_apConnections[0]->GetExtents(iHandle, flStart, flEnd, iPixels, aExtents); }
+
+	bool GetStats(size_t iHandle, double flStart, double flEnd, CViewbackStats& oStats) const { return m_apConnections[0]->GetStats(iHandle, flStart, flEnd, oStats); }
+
+	bool Export(CViewbackExporter& oExporter) const { return m_apConnections[0]->Export(oExporter); }
+
+	inline std::vector<CDataMetaInfo>& GetMeta() { return m_apConnections[0]->GetMeta(); }
+
+	vb_data_type_t TypeForHandle(size_t iHandle) { return m_apConnections[0]->TypeForHandle(iHandle); }
+
+	bool HasLabel(size_t iHandle, int iValue) { return m_apConnections[0]->HasLabel(iHandle, iValue); }
+	CViewbackLabelText GetLabelForValue(size_t iHandle, int iValue) { return m_apConnections[0]->GetLabelForValue(iHandle, iValue); }
+
+	std::string GetStatus() { return m_apConnections[0]->GetStatus(); }
+
+	double GetLatestDataTime() { return m_apConnections[0]->GetLatestDataTime(); }
+	double PredictCurrentTime() { return m_apConnections[0]->PredictCurrentTime(); }
+
+	void SetDataClearTime(double flTime) { m_apConnections[0]->SetDataClearTime(flTime); }
+	void SetMemoryBudget(size_t iBytes) { m_apConnections[0]->SetMemoryBudget(iBytes); }
+
+	// The rest are for every connection.
+
+	// Off by default. When on, incoming data is decoded and stashed into
+	// GetData() on the data thread, and Update() only takes a snapshot of it,
+	// so the time Update() takes doesn't grow with the data rate. Takes
+	// effect at the next registration packet, call it before connecting.
+	void SetStashOnDataThread(bool bStash);
+
+	// Off (empty) by default. When set, each connection's data goes into a
+	// temporary file in this directory as it fills up and is read back from
+	// it as needed, so the whole session stays reachable through GetData()
+	// and friends while memory use stays about the same. Nothing is cleared
+	// out. Takes effect at the next registration packet, call it before
+	// connecting.
+	void SetSpillDirectory(const std::string& sDirectory);
+
+	// Adds a float channel that's computed on the client out of the ones the
+	// server sends, see CViewbackExpression for what sExpression can do. It
+	// shows up in GetChannels() after the server's channels and is kept up
+	// as their samples come in. Expressions that don't compile are left out
+	// with a message to the debug output. Takes effect at the next
+	// registration packet, call it before connecting.
+	void AddDerivedChannel(const std::string& sName, const std::string& sExpression);
+	void ClearDerivedChannels();
+
+	// Watches a channel for a condition as its samples come in, see
+	// CViewbackTrigger. Whenever one goes off a bookmark is added to
+	// GetBookmarks() and the callback from SetTriggerFiredCallback() is
+	// called with it, during Update(). Each sample costs about the same per
+	// trigger on its channel however long the windows are, and nothing for
+	// triggers on other channels. Triggers on channels that aren't there
+	// are left out with a message to the debug output. Takes effect at the
+	// next registration packet, call it before connecting.
+	void AddTrigger(const CViewbackTrigger& oTrigger);
+	void ClearTriggers();
+
+	// From every connection, kept until they're cleared.
+	const std::vector<CViewbackBookmark>& GetBookmarks() const { return m_aBookmarks; }
+	void ClearBookmarks() { m_aBookmarks.clear(); }
+
+private:
+	friend class CViewbackConnection;
+
+	std::vector<CViewbackConnection*> m_apConnections;
+
+	std::vector<CViewbackBookmark> m_aBookmarks;
+
+	RegistrationUpdateCallback m_pfnRegistrationUpdate;
+	ConsoleOutputCallback      m_pfnConsoleOutput;
+	DebugOutputCallback        m_pfnDebugOutput;
+	ControlUpdatedCallback     m_pfnControlUpdatedCallback;
+	TriggerFiredCallback       m_pfnTriggerFiredCallback;
+	DataReceivedCallback       m_pfnDataReceivedCallback;
+};
+
 }
@@ -0,0 +1,825 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+// Sessions can run long enough to make files bigger than 2GB.
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "viewback_columnar.h"
+
+#include <string.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace vb;
+using namespace std;
+
+static_assert(sizeof(CColumnarFileHeader) == 16, "CColumnarFileHeader must be 16 bytes.");
+static_assert(sizeof(CColumnarChunkInfo) == 80, "CColumnarChunkInfo must be 80 bytes.");
+static_assert(sizeof(CColumnarTrailer) == 32, "CColumnarTrailer must be 32 bytes.");
+
+static size_t ColumnarValueSize(vb_data_type_t eType)
+{
+	switch (eType)
+	{
+	case VB_DATATYPE_INT:
+		return sizeof(int);
+
+	case VB_DATATYPE_FLOAT:
+		return sizeof(float);
+
+	case VB_DATATYPE_VECTOR:
+		return sizeof(float) * 3;
+
+	default:
+		return 0;
+	}
+}
+
+CViewbackColumnarWriter::CViewbackColumnarWriter(size_t iChunkSamples)
+{
+	m_pFile = NULL;
+	m_iOffset = 0;
+	m_bError = false;
+	m_iChunkSamples = iChunkSamples ? iChunkSamples : 1;
+}
+
+CViewbackColumnarWriter::~CViewbackColumnarWriter()
+{
+	Close();
+}
+
+bool CViewbackColumnarWriter::Open(const char* pszFile)
+{
+	Close();
+
+	m_pFile = fopen(pszFile, "wb");
+	if (!m_pFile)
+		return false;
+
+	m_iOffset = 0;
+	m_bError = false;
+	m_aChannels.clear();
+	m_aPending.clear();
+	m_aChunks.clear();
+
+	CColumnarFileHeader oHeader;
+	memcpy(oHeader.m_szMagic, VB_COLUMNAR_MAGIC, sizeof(oHeader.m_szMagic));
+	oHeader.m_iVersion = VB_COLUMNAR_VERSION;
+	oHeader.m_iReserved = 0;
+
+	return Write(&oHeader, sizeof(oHeader));
+}
+
+bool CViewbackColumnarWriter::Close()
+{
+	if (!m_pFile)
+		return false;
+
+	for (size_t i = 0; i < m_aPending.size(); i++)
+		FlushChunk(i);
+
+	CColumnarTrailer oTrailer;
+	memset(&oTrailer, 0, sizeof(oTrailer));
+
+	oTrailer.m_iChunksOffset = m_iOffset;
+	oTrailer.m_iNumChunks = (unsigned int)m_aChunks.size();
+
+	if (m_aChunks.size())
+		Write(m_aChunks.data(), m_aChunks.size() * sizeof(CColumnarChunkInfo));
+
+	oTrailer.m_iChannelsOffset = m_iOffset;
+	oTrailer.m_iNumChannels = (unsigned int)m_aChannels.size();
+
+	for (size_t i = 0; i < m_aChannels.size(); i++)
+	{
+		const CViewbackDataChannel& oChannel = m_aChannels[i];
+
+		unsigned int iHandle = (unsigned int)i;
+		unsigned int iType = (unsigned int)oChannel.m_eDataType;
+		unsigned int iNameLength = (unsigned int)oChannel.m_sName.length();
+		unsigned int iNumLabels = (unsigned int)oChannel.m_asLabels.size();
+
+		Write(&iHandle, sizeof(iHandle));
+		Write(&iType, sizeof(iType));
+		Write(&oChannel.m_flMin, sizeof(oChannel.m_flMin));
+		Write(&oChannel.m_flMax, sizeof(oChannel.m_flMax));
+		Write(&iNameLength, sizeof(iNameLength));
+		Write(oChannel.m_sName.data(), iNameLength);
+		Write(&iNumLabels, sizeof(iNumLabels));
+
+		for (auto it = oChannel.m_asLabels.begin(); it != oChannel.m_asLabels.end(); it++)
+		{
+			int iValue = it->first;
+			unsigned int iLabelLength = (unsigned int)it->second->length();
+
+			Write(&iValue, sizeof(iValue));
+			Write(&iLabelLength, sizeof(iLabelLength));
+			Write(it->second->data(), iLabelLength);
+		}
+	}
+
+	WritePadding();
+
+	oTrailer.m_iVersion = VB_COLUMNAR_VERSION;
+	memcpy(oTrailer.m_szMagic, VB_COLUMNAR_MAGIC, sizeof(oTrailer.m_szMagic));
+
+	Write(&oTrailer, sizeof(oTrailer));
+
+	if (fclose(m_pFile) != 0)
+		m_bError = true;
+
+	m_pFile = NULL;
+
+	return !m_bError;
+}
+
+void CViewbackColumnarWriter::SetRegistration(const Packet& oPacket)
+{
+	for (int i = 0; i < oPacket.data_channels_size(); i++)
+	{
+		const DataChannel& oChannelProtobuf = oPacket.data_channels(i);
+
+		CViewbackDataChannel oChannel;
+		oChannel.m_sName = oChannelProtobuf.name();
+		oChannel.m_eDataType = oChannelProtobuf.type();
+		oChannel.m_flMin = oChannelProtobuf.range_min();
+		oChannel.m_flMax = oChannelProtobuf.range_max();
+
+		SetChannel(oChannelProtobuf.handle(), oChannel);
+	}
+
+	for (int i = 0; i < oPacket.data_labels_size(); i++)
+	{
+		const DataLabel& oLabel = oPacket.data_labels(i);
+
+		if (oLabel.channel() >= m_aChannels.size())
+			continue;
+
+		m_aChannels[oLabel.channel()].m_asLabels.Set(oLabel.value(), oLabel.label());
+	}
+}
+
+void CViewbackColumnarWriter::SetChannel(size_t iHandle, const CViewbackDataChannel& oChannel)
+{
+	if (iHandle >= m_aChannels.size())
+	{
+		m_aChannels.resize(iHandle + 1);
+		m_aPending.resize(iHandle + 1);
+	}
+
+	// Data that's already buffered was for the old type.
+	if (m_aChannels[iHandle].m_eDataType != oChannel.m_eDataType)
+		FlushChunk(iHandle);
+
+	m_aChannels[iHandle] = oChannel;
+	m_aChannels[iHandle].m_iHandle = (unsigned int)iHandle;
+}
+
+bool CViewbackColumnarWriter::AddData(const Data& oData)
+{
+	size_t iHandle = oData.handle();
+
+	if (iHandle >= m_aChannels.size())
+		return false;
+
+	double flTime = 0;
+
+	if (oData.has_time_double())
+		flTime = oData.time_double();
+	else if (oData.has_time_uint64())
+		flTime = ((double)oData.time_uint64()) / 1000;
+
+	bool bMaintain = oData.has_maintain_time_double() || oData.has_maintain_time_uint64();
+	double flMaintainTime = 0;
+
+	if (oData.has_maintain_time_double())
+		flMaintainTime = oData.maintain_time_double();
+	else if (oData.has_maintain_time_uint64())
+		flMaintainTime = ((double)oData.maintain_time_uint64()) / 1000;
+
+	// The server threw out some duplicate values. Repeat the previous value
+	// at the maintain time, exactly like CViewbackClient::StashData() does.
+	// Unless time went backwards, then the game was restarted and the
+	// previous value is from before that.
+	CPendingChunk& oPending = m_aPending[iHandle];
+	bool bHasLast = oPending.m_bHasLast && flTime >= oPending.m_flLastTime;
+
+	switch (m_aChannels[iHandle].m_eDataType)
+	{
+	case VB_DATATYPE_INT:
+		if (bMaintain && bHasLast && flMaintainTime != oPending.m_flLastTime)
+			AddInt(iHandle, flMaintainTime, oPending.m_iLast);
+
+		return AddInt(iHandle, flTime, oData.data_int());
+
+	case VB_DATATYPE_FLOAT:
+		if (bMaintain && bHasLast && flMaintainTime != oPending.m_flLastTime)
+			AddFloat(iHandle, flMaintainTime, oPending.m_aflLast[0]);
+
+		return AddFloat(iHandle, flTime, oData.data_float());
+
+	case VB_DATATYPE_VECTOR:
+		if (bMaintain && bHasLast && flMaintainTime != oPending.m_flLastTime)
+			AddVector(iHandle, flMaintainTime, VBVector3(oPending.m_aflLast));
+
+		return AddVector(iHandle, flTime, VBVector3(oData.data_float_x(), oData.data_float_y(), oData.data_float_z()));
+
+	default:
+		return false;
+	}
+}
+
+bool CViewbackColumnarWriter::AddInt(size_t iHandle, double flTime, int iValue)
+{
+	if (!m_pFile || iHandle >= m_aChannels.size() || m_aChannels[iHandle].m_eDataType != VB_DATATYPE_INT)
+		return false;
+
+	if (!StartChunk(iHandle, flTime))
+		return false;
+
+	CPendingChunk& oPending = m_aPending[iHandle];
+	oPending.m_aflTimes.push_back(flTime);
+	oPending.m_aiValues.push_back(iValue);
+
+	oPending.m_bHasLast = true;
+	oPending.m_flLastTime = flTime;
+	oPending.m_iLast = iValue;
+
+	if (oPending.m_aflTimes.size() >= m_iChunkSamples)
+		return FlushChunk(iHandle);
+
+	return true;
+}
+
+bool CViewbackColumnarWriter::AddFloat(size_t iHandle, double flTime, float flValue)
+{
+	if (!m_pFile || iHandle >= m_aChannels.size() || m_aChannels[iHandle].m_eDataType != VB_DATATYPE_FLOAT)
+		return false;
+
+	if (!StartChunk(iHandle, flTime))
+		return false;
+
+	CPendingChunk& oPending = m_aPending[iHandle];
+	oPending.m_aflTimes.push_back(flTime);
+	oPending.m_aflValues[0].push_back(flValue);
+
+	oPending.m_bHasLast = true;
+	oPending.m_flLastTime = flTime;
+	oPending.m_aflLast[0] = flValue;
+
+	if (oPending.m_aflTimes.size() >= m_iChunkSamples)
+		return FlushChunk(iHandle);
+
+	return true;
+}
+
+bool CViewbackColumnarWriter::AddVector(size_t iHandle, double flTime, const VBVector3& vecValue)
+{
+	if (!m_pFile || iHandle >= m_aChannels.size() || m_aChannels[iHandle].m_eDataType != VB_DATATYPE_VECTOR)
+		return false;
+
+	if (!StartChunk(iHandle, flTime))
+		return false;
+
+	CPendingChunk& oPending = m_aPending[iHandle];
+	oPending.m_aflTimes.push_back(flTime);
+	oPending.m_aflValues[0].push_back(vecValue.x);
+	oPending.m_aflValues[1].push_back(vecValue.y);
+	oPending.m_aflValues[2].push_back(vecValue.z);
+
+	oPending.m_bHasLast = true;
+	oPending.m_flLastTime = flTime;
+	oPending.m_aflLast[0] = vecValue.x;
+	oPending.m_aflLast[1] = vecValue.y;
+	oPending.m_aflLast[2] = vecValue.z;
+
+	if (oPending.m_aflTimes.size() >= m_iChunkSamples)
+		return FlushChunk(iHandle);
+
+	return true;
+}
+
+// A chunk's times have to be in order for the reader to search them. They
+// only go backwards if the game was restarted during a capture, then the
+// new session's data goes in new chunks.
+bool CViewbackColumnarWriter::StartChunk(size_t iHandle, double flTime)
+{
+	CPendingChunk& oPending = m_aPending[iHandle];
+
+	if (oPending.m_aflTimes.size() && flTime < oPending.m_aflTimes.back())
+		return FlushChunk(iHandle);
+
+	return true;
+}
+
+bool CViewbackColumnarWriter::Write(const void* pData, size_t iBytes)
+{
+	if (!m_pFile)
+		return false;
+
+	if (iBytes && fwrite(pData, 1, iBytes, m_pFile) != iBytes)
+		m_bError = true;
+
+	m_iOffset += iBytes;
+
+	return !m_bError;
+}
+
+bool CViewbackColumnarWriter::WritePadding()
+{
+	static const char aZeroes[8] = { 0 };
+
+	if (m_iOffset % 8)
+		return Write(aZeroes, (size_t)(8 - m_iOffset % 8));
+
+	return true;
+}
+
+bool CViewbackColumnarWriter::FlushChunk(size_t iHandle)
+{
+	CPendingChunk& oPending = m_aPending[iHandle];
+
+	size_t iCount = oPending.m_aflTimes.size();
+	if (!iCount)
+		return true;
+
+	vb_data_type_t eType = m_aChannels[iHandle].m_eDataType;
+	int iAxes = (eType == VB_DATATYPE_VECTOR) ? 3 : 1;
+
+	CColumnarChunkInfo oInfo;
+	memset(&oInfo, 0, sizeof(oInfo));
+
+	oInfo.m_iOffset = m_iOffset + sizeof(CColumnarChunkInfo);
+	oInfo.m_iHandle = (unsigned int)iHandle;
+	oInfo.m_iCount = (unsigned int)iCount;
+	oInfo.m_flTimeMin = *min_element(oPending.m_aflTimes.begin(), oPending.m_aflTimes.end());
+	oInfo.m_flTimeMax = *max_element(oPending.m_aflTimes.begin(), oPending.m_aflTimes.end());
+
+	if (eType == VB_DATATYPE_INT)
+	{
+		oInfo.m_aflMin[0] = *min_element(oPending.m_aiValues.begin(), oPending.m_aiValues.end());
+		oInfo.m_aflMax[0] = *max_element(oPending.m_aiValues.begin(), oPending.m_aiValues.end());
+	}
+	else
+	{
+		for (int i = 0; i < iAxes; i++)
+		{
+			oInfo.m_aflMin[i] = *min_element(oPending.m_aflValues[i].begin(), oPending.m_aflValues[i].end());
+			oInfo.m_aflMax[i] = *max_element(oPending.m_aflValues[i].begin(), oPending.m_aflValues[i].end());
+		}
+	}
+
+	Write(&oInfo, sizeof(oInfo));
+	Write(oPending.m_aflTimes.data(), iCount * sizeof(double));
+
+	if (eType == VB_DATATYPE_INT)
+		Write(oPending.m_aiValues.data(), iCount * sizeof(int));
+	else
+	{
+		for (int i = 0; i < iAxes; i++)
+			Write(oPending.m_aflValues[i].data(), iCount * sizeof(float));
+	}
+
+	WritePadding();
+
+	m_aChunks.push_back(oInfo);
+
+	oPending.m_aflTimes.clear();
+	oPending.m_aiValues.clear();
+	for (int i = 0; i < 3; i++)
+		oPending.m_aflValues[i].clear();
+
+	return !m_bError;
+}
+
+CViewbackColumnarReader::CViewbackColumnarReader()
+{
+	m_pData = NULL;
+	m_iSize = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+	m_flStartTime = 0;
+	m_flEndTime = 0;
+}
+
+CViewbackColumnarReader::~CViewbackColumnarReader()
+{
+	Close();
+}
+
+bool CViewbackColumnarReader::Open(const char* pszFile)
+{
+	Close();
+
+#ifdef _WIN32
+	m_hFile = CreateFileA(pszFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER iFileSize;
+	if (!GetFileSizeEx(m_hFile, &iFileSize) || iFileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!m_hMapping)
+	{
+		Close();
+		return false;
+	}
+
+	m_pData = (const char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_pData)
+	{
+		Close();
+		return false;
+	}
+
+	m_iSize = (unsigned long long)iFileSize.QuadPart;
+#else
+	int fd = open(pszFile, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat oStat;
+	if (fstat(fd, &oStat) != 0 || oStat.st_size == 0 || (unsigned long long)oStat.st_size != (size_t)oStat.st_size)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* pData = mmap(NULL, (size_t)oStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	// The mapping holds its own reference to the file.
+	close(fd);
+
+	if (pData == MAP_FAILED)
+		return false;
+
+	m_pData = (const char*)pData;
+	m_iSize = (unsigned long long)oStat.st_size;
+#endif
+
+	if (m_iSize < sizeof(CColumnarFileHeader) + sizeof(CColumnarTrailer))
+	{
+		Close();
+		return false;
+	}
+
+	const CColumnarFileHeader* pHeader = (const CColumnarFileHeader*)m_pData;
+	const CColumnarTrailer* pTrailer = (const CColumnarTrailer*)(m_pData + m_iSize - sizeof(CColumnarTrailer));
+
+	if (memcmp(pHeader->m_szMagic, VB_COLUMNAR_MAGIC, 4) != 0 || pHeader->m_iVersion != VB_COLUMNAR_VERSION ||
+		memcmp(pTrailer->m_szMagic, VB_COLUMNAR_MAGIC, 4) != 0 || pTrailer->m_iVersion != VB_COLUMNAR_VERSION)
+	{
+		// Not a columnar capture, or the writer never finished.
+		Close();
+		return false;
+	}
+
+	unsigned long long iFooterEnd = m_iSize - sizeof(CColumnarTrailer);
+
+	if (pTrailer->m_iChunksOffset % 8 || pTrailer->m_iChunksOffset > iFooterEnd ||
+		(iFooterEnd - pTrailer->m_iChunksOffset) / sizeof(CColumnarChunkInfo) < pTrailer->m_iNumChunks ||
+		pTrailer->m_iChannelsOffset > iFooterEnd)
+	{
+		Close();
+		return false;
+	}
+
+	// Channel table. It isn't aligned, so copy each field out.
+	const char* pCursor = m_pData + pTrailer->m_iChannelsOffset;
+	const char* pEnd = m_pData + iFooterEnd;
+
+#define READ_FIELD(x) \
+	do { \
+		if ((size_t)(pEnd - pCursor) < sizeof(x)) { Close(); return false; } \
+		memcpy(&(x), pCursor, sizeof(x)); \
+		pCursor += sizeof(x); \
+	} while (0)
+
+#define READ_STRING(s, length) \
+	do { \
+		if ((size_t)(pEnd - pCursor) < (length)) { Close(); return false; } \
+		(s).assign(pCursor, (length)); \
+		pCursor += (length); \
+	} while (0)
+
+	for (unsigned int i = 0; i < pTrailer->m_iNumChannels; i++)
+	{
+		unsigned int iHandle, iType, iNameLength, iNumLabels;
+		float flMin, flMax;
+
+		READ_FIELD(iHandle);
+		READ_FIELD(iType);
+		READ_FIELD(flMin);
+		READ_FIELD(flMax);
+		READ_FIELD(iNameLength);
+
+		if (iHandle >= m_aChannels.size())
+			m_aChannels.resize(iHandle + 1);
+
+		CViewbackDataChannel& oChannel = m_aChannels[iHandle];
+		oChannel.m_iHandle = iHandle;
+		oChannel.m_eDataType = (vb_data_type_t)iType;
+		oChannel.m_flMin = flMin;
+		oChannel.m_flMax = flMax;
+
+		READ_STRING(oChannel.m_sName, iNameLength);
+		READ_FIELD(iNumLabels);
+
+		for (unsigned int j = 0; j < iNumLabels; j++)
+		{
+			int iValue;
+			unsigned int iLabelLength;
+			string sLabel;
+			READ_FIELD(iValue);
+			READ_FIELD(iLabelLength);
+			READ_STRING(sLabel, iLabelLength);
+			oChannel.m_asLabels.Set(iValue, sLabel);
+		}
+	}
+
+#undef READ_FIELD
+#undef READ_STRING
+
+	m_aChunksByHandle.resize(m_aChannels.size());
+
+	const CColumnarChunkInfo* pChunks = (const CColumnarChunkInfo*)(m_pData + pTrailer->m_iChunksOffset);
+
+	bool bHaveTime = false;
+	for (unsigned int i = 0; i < pTrailer->m_iNumChunks; i++)
+	{
+		const CColumnarChunkInfo& oChunk = pChunks[i];
+
+		if (oChunk.m_iHandle >= m_aChannels.size() || !oChunk.m_iCount || oChunk.m_iOffset % 8)
+			continue;
+
+		size_t iValueSize = ColumnarValueSize(m_aChannels[oChunk.m_iHandle].m_eDataType);
+		if (!iValueSize)
+			continue;
+
+		// Make sure a bad file can't send us reading outside the mapping.
+		if (oChunk.m_iOffset > pTrailer->m_iChunksOffset || (pTrailer->m_iChunksOffset - oChunk.m_iOffset) / (sizeof(double) + iValueSize) < oChunk.m_iCount)
+			continue;
+
+		m_aChunksByHandle[oChunk.m_iHandle].push_back(&oChunk);
+
+		if (!bHaveTime || oChunk.m_flTimeMin < m_flStartTime)
+			m_flStartTime = oChunk.m_flTimeMin;
+
+		if (!bHaveTime || oChunk.m_flTimeMax > m_flEndTime)
+			m_flEndTime = oChunk.m_flTimeMax;
+
+		bHaveTime = true;
+	}
+
+	m_abOverlapping.resize(m_aChunksByHandle.size());
+
+	for (size_t i = 0; i < m_aChunksByHandle.size(); i++)
+	{
+		vector<const CColumnarChunkInfo*>& aChunks = m_aChunksByHandle[i];
+
+		stable_sort(aChunks.begin(), aChunks.end(), [](const CColumnarChunkInfo* l, const CColumnarChunkInfo* r) {
+			return l->m_flTimeMin < r->m_flTimeMin;
+		});
+
+		// Only if the game was restarted during the capture.
+		for (size_t j = 1; j < aChunks.size(); j++)
+		{
+			if (aChunks[j]->m_flTimeMin < aChunks[j - 1]->m_flTimeMax)
+				m_abOverlapping[i] = true;
+		}
+	}
+
+	return true;
+}
+
+void CViewbackColumnarReader::Close()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData)
+		munmap((void*)m_pData, (size_t)m_iSize);
+#endif
+
+	m_pData = NULL;
+	m_iSize = 0;
+	m_aChannels.clear();
+	m_aChunksByHandle.clear();
+	m_abOverlapping.clear();
+	m_flStartTime = 0;
+	m_flEndTime = 0;
+}
+
+size_t CViewbackColumnarReader::GetNumSamples(size_t iHandle) const
+{
+	if (iHandle >= m_aChunksByHandle.size())
+		return 0;
+
+	size_t iSamples = 0;
+	for (size_t i = 0; i < m_aChunksByHandle[iHandle].size(); i++)
+		iSamples += m_aChunksByHandle[iHandle][i]->m_iCount;
+
+	return iSamples;
+}
+
+size_t CViewbackColumnarReader::GetRange(size_t iHandle, double flStart, double flEnd, CViewbackDataList& oList) const
+{
+	if (iHandle >= m_aChunksByHandle.size())
+		return 0;
+
+	const vector<const CColumnarChunkInfo*>& aChunks = m_aChunksByHandle[iHandle];
+	vb_data_type_t eType = m_aChannels[iHandle].m_eDataType;
+
+	size_t iAdded = 0;
+	for (size_t i = FindFirstChunk(iHandle, flStart); i < aChunks.size() && aChunks[i]->m_flTimeMin <= flEnd; i++)
+	{
+		const CColumnarChunkInfo& oChunk = *aChunks[i];
+
+		if (oChunk.m_flTimeMax < flStart)
+			continue;
+
+		size_t iFirst, iLast;
+		GetChunkRange(oChunk, flStart, flEnd, iFirst, iLast);
+
+		const double* pTimes = GetChunkTimes(oChunk);
+
+		switch (eType)
+		{
+		case VB_DATATYPE_INT:
+		{
+			const int* pValues = GetChunkInts(oChunk);
+			for (size_t j = iFirst; j < iLast; j++)
+				oList.m_aIntData.push_back(CViewbackDataList::DataPair<int>(pTimes[j], pValues[j]));
+			break;
+		}
+
+		case VB_DATATYPE_FLOAT:
+		{
+			const float* pValues = GetChunkFloats(oChunk);
+			for (size_t j = iFirst; j < iLast; j++)
+				oList.m_aFloatData.push_back(CViewbackDataList::DataPair<float>(pTimes[j], pValues[j]));
+			break;
+		}
+
+		case VB_DATATYPE_VECTOR:
+		{
+			const float* pX = GetChunkFloats(oChunk, 0);
+			const float* pY = GetChunkFloats(oChunk, 1);
+			const float* pZ = GetChunkFloats(oChunk, 2);
+			for (size_t j = iFirst; j < iLast; j++)
+				oList.m_aVectorData.push_back(CViewbackDataList::DataPair<VBVector3>(pTimes[j], VBVector3(pX[j], pY[j], pZ[j])));
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		iAdded += iLast - iFirst;
+	}
+
+	oList.Sync();
+
+	return iAdded;
+}
+
+bool CViewbackColumnarReader::GetMinMax(size_t iHandle, double flStart, double flEnd, double aflMin[3], double aflMax[3]) const
+{
+	if (iHandle >= m_aChunksByHandle.size())
+		return false;
+
+	const vector<const CColumnarChunkInfo*>& aChunks = m_aChunksByHandle[iHandle];
+	vb_data_type_t eType = m_aChannels[iHandle].m_eDataType;
+	int iAxes = (eType == VB_DATATYPE_VECTOR) ? 3 : 1;
+
+	for (int i = 0; i < 3; i++)
+		aflMin[i] = aflMax[i] = 0;
+
+	bool bFound = false;
+	for (size_t i = FindFirstChunk(iHandle, flStart); i < aChunks.size() && aChunks[i]->m_flTimeMin <= flEnd; i++)
+	{
+		const CColumnarChunkInfo& oChunk = *aChunks[i];
+
+		if (oChunk.m_flTimeMax < flStart)
+			continue;
+
+		if (oChunk.m_flTimeMin >= flStart && oChunk.m_flTimeMax <= flEnd)
+		{
+			// The whole chunk is in range, the header already has the answer.
+			for (int k = 0; k < iAxes; k++)
+			{
+				if (!bFound || oChunk.m_aflMin[k] < aflMin[k])
+					aflMin[k] = oChunk.m_aflMin[k];
+				if (!bFound || oChunk.m_aflMax[k] > aflMax[k])
+					aflMax[k] = oChunk.m_aflMax[k];
+			}
+
+			bFound = true;
+			continue;
+		}
+
+		size_t iFirst, iLast;
+		GetChunkRange(oChunk, flStart, flEnd, iFirst, iLast);
+
+		for (size_t j = iFirst; j < iLast; j++)
+		{
+			for (int k = 0; k < iAxes; k++)
+			{
+				double flValue = (eType == VB_DATATYPE_INT) ? GetChunkInts(oChunk)[j] : GetChunkFloats(oChunk, k)[j];
+
+				if (!bFound || flValue < aflMin[k])
+					aflMin[k] = flValue;
+				if (!bFound || flValue > aflMax[k])
+					aflMax[k] = flValue;
+			}
+
+			bFound = true;
+		}
+	}
+
+	return bFound;
+}
+
+size_t CViewbackColumnarReader::GetNumChunks(size_t iHandle) const
+{
+	if (iHandle >= m_aChunksByHandle.size())
+		return 0;
+
+	return m_aChunksByHandle[iHandle].size();
+}
+
+const double* CViewbackColumnarReader::GetChunkTimes(const CColumnarChunkInfo& oChunk) const
+{
+	return (const double*)(m_pData + oChunk.m_iOffset);
+}
+
+const int* CViewbackColumnarReader::GetChunkInts(const CColumnarChunkInfo& oChunk) const
+{
+	return (const int*)(m_pData + oChunk.m_iOffset + oChunk.m_iCount * sizeof(double));
+}
+
+const float* CViewbackColumnarReader::GetChunkFloats(const CColumnarChunkInfo& oChunk, int iAxis) const
+{
+	return (const float*)(m_pData + oChunk.m_iOffset + oChunk.m_iCount * sizeof(double) + iAxis * oChunk.m_iCount * sizeof(float));
+}
+
+size_t CViewbackColumnarReader::FindFirstChunk(size_t iHandle, double flStart) const
+{
+	// Then any of them could reach flStart. The callers skip the ones that
+	// don't, and stop at the first one that starts too late.
+	if (m_abOverlapping[iHandle])
+		return 0;
+
+	// Otherwise their end times are sorted too.
+	const vector<const CColumnarChunkInfo*>& aChunks = m_aChunksByHandle[iHandle];
+
+	return lower_bound(aChunks.begin(), aChunks.end(), flStart, [](const CColumnarChunkInfo* pChunk, double flTime) {
+		return pChunk->m_flTimeMax < flTime;
+	}) - aChunks.begin();
+}
+
+void CViewbackColumnarReader::GetChunkRange(const CColumnarChunkInfo& oChunk, double flStart, double flEnd, size_t& iFirst, size_t& iLast) const
+{
+	const double* pTimes = GetChunkTimes(oChunk);
+
+	iFirst = lower_bound(pTimes, pTimes + oChunk.m_iCount, flStart) - pTimes;
+	iLast = upper_bound(pTimes, pTimes + oChunk.m_iCount, flEnd) - pTimes;
+
+	if (iLast < iFirst)
+		iLast = iFirst;
+}
@@ -0,0 +1,233 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+#include "viewback_client.h"
+
+namespace vb
+{
+
+/*
+	Columnar captures. Where a capture file (see vb_config_t::capture_file) is
+	the server's packet stream, a columnar capture stores each channel's data
+	in chunks of contiguous columns, so reading one channel over a long
+	session touches only that channel's chunks. The file is meant to be mapped
+	into memory and read in place, no protobuf parsing required.
+
+	Everything is written in the host's byte order (all of Viewback's
+	platforms are little endian) and every column starts 8 byte aligned.
+
+	File layout:
+		CColumnarFileHeader
+		Chunks, in the order they filled up. Each is:
+			CColumnarChunkInfo
+			double times[count]
+			int values[count] or float values[count] or float x[count], y[count], z[count]
+			Padding to 8 bytes
+		Footer:
+			CColumnarChunkInfo[num_chunks], a copy of every chunk header, so
+			that the reader can find chunks without touching them.
+			Channel table, for each channel:
+				unsigned int handle, unsigned int type, float range_min, float range_max,
+				unsigned int name_length, name bytes,
+				unsigned int num_labels, then for each label:
+					int value, unsigned int label_length, label bytes
+			Padding to 8 bytes
+		CColumnarTrailer
+
+	If the writer never got to write the footer (the program crashed) the
+	chunk headers are enough to recover the data, but the reader doesn't
+	attempt that.
+*/
+
+#define VB_COLUMNAR_MAGIC "VBCF"
+#define VB_COLUMNAR_VERSION 1
+
+struct CColumnarFileHeader
+{
+	char               m_szMagic[4];
+	unsigned int       m_iVersion;
+	unsigned long long m_iReserved;
+};
+
+struct CColumnarChunkInfo
+{
+	unsigned long long m_iOffset; // Where the time column starts. The value columns follow right after it.
+	unsigned int       m_iHandle;
+	unsigned int       m_iCount;
+	double             m_flTimeMin;
+	double             m_flTimeMax;
+	double             m_aflMin[3]; // Scalar channels only use the first element.
+	double             m_aflMax[3];
+};
+
+struct CColumnarTrailer
+{
+	unsigned long long m_iChunksOffset;
+	unsigned long long m_iChannelsOffset;
+	unsigned int       m_iNumChunks;
+	unsigned int       m_iNumChannels;
+	unsigned int       m_iVersion;
+	char               m_szMagic[4];
+};
+
+class CViewbackColumnarWriter
+{
+public:
+	CViewbackColumnarWriter(size_t iChunkSamples = 4096);
+	~CViewbackColumnarWriter();
+
+private:
+	CViewbackColumnarWriter(const CViewbackColumnarWriter&);
+	CViewbackColumnarWriter& operator=(const CViewbackColumnarWriter&);
+
+public:
+	bool Open(const char* pszFile);
+
+	// Writes out everything that's buffered and the footer. Returns false if
+	// anything failed to write along the way.
+	bool Close();
+
+	bool IsOpen() const { return !!m_pFile; }
+
+	// Bytes written so far, not counting what's still buffered in chunks.
+	unsigned long long GetSize() const { return m_iOffset; }
+
+	// Channel names, types and labels, from a registration packet. Data for
+	// a handle isn't accepted until its channel is known.
+	void SetRegistration(const Packet& oPacket);
+
+	// The same for one channel, labels included, for data that didn't come from a packet.
+	void SetChannel(size_t iHandle, const CViewbackDataChannel& oChannel);
+
+	// Handles maintain times the same way CViewbackClient does, so the series
+	// in the file match what a client would have in its CViewbackDataList.
+	bool AddData(const Data& oData);
+
+	bool AddInt(size_t iHandle, double flTime, int iValue);
+	bool AddFloat(size_t iHandle, double flTime, float flValue);
+	bool AddVector(size_t iHandle, double flTime, const VBVector3& vecValue);
+
+private:
+	class CPendingChunk
+	{
+	public:
+		CPendingChunk()
+		{
+			m_bHasLast = false;
+			m_flLastTime = 0;
+			m_iLast = 0;
+			m_aflLast[0] = m_aflLast[1] = m_aflLast[2] = 0;
+		}
+
+	public:
+		std::vector<double> m_aflTimes;
+		std::vector<int>    m_aiValues;
+		std::vector<float>  m_aflValues[3];
+
+		// The last sample, which might already be written out. Needed for maintain times.
+		bool   m_bHasLast;
+		double m_flLastTime;
+		int    m_iLast;
+		float  m_aflLast[3];
+	};
+
+	bool Write(const void* pData, size_t iBytes);
+	bool WritePadding();
+	bool StartChunk(size_t iHandle, double flTime);
+	bool FlushChunk(size_t iHandle);
+
+private:
+	FILE*              m_pFile;
+	unsigned long long m_iOffset;
+	bool               m_bError;
+	size_t             m_iChunkSamples;
+
+	std::vector<CViewbackDataChannel> m_aChannels;
+	std::vector<CPendingChunk>        m_aPending;
+	std::vector<CColumnarChunkInfo>   m_aChunks;
+};
+
+class CViewbackColumnarReader
+{
+public:
+	CViewbackColumnarReader();
+	~CViewbackColumnarReader();
+
+private:
+	CViewbackColumnarReader(const CViewbackColumnarReader&);
+	CViewbackColumnarReader& operator=(const CViewbackColumnarReader&);
+
+public:
+	bool Open(const char* pszFile);
+	void Close();
+	bool IsOpen() const { return !!m_pData; }
+
+	const std::vector<CViewbackDataChannel>& GetChannels() const { return m_aChannels; }
+
+	size_t GetNumSamples(size_t iHandle) const;
+	double GetStartTime() const { return m_flStartTime; }
+	double GetEndTime() const { return m_flEndTime; }
+
+	// Appends every sample of the channel with flStart <= time <= flEnd to the
+	// list for the channel's type. Returns how many were added. If the
+	// channel's chunks overlap (see HasOverlappingChunks()) the samples are
+	// added chunk by chunk, and so are only in order within each session.
+	size_t GetRange(size_t iHandle, double flStart, double flEnd, CViewbackDataList& oList) const;
+
+	// Smallest and largest values over a time range. Chunks entirely inside
+	// the range are answered from their headers without reading the data.
+	// Returns false if there's no data in the range.
+	bool GetMinMax(size_t iHandle, double flStart, double flEnd, double aflMin[3], double aflMax[3]) const;
+
+	// A capture of a game that was restarted has sessions that can overlap
+	// in time. Their chunks are kept apart, but then a channel's chunks
+	// overlap and each query has to look at all of them.
+	bool HasOverlappingChunks(size_t iHandle) const { return iHandle < m_abOverlapping.size() && m_abOverlapping[iHandle]; }
+
+	// Direct access to the mapped columns. The chunks for each handle are
+	// sorted by their start time, and each chunk's samples are in time order.
+	size_t GetNumChunks(size_t iHandle) const;
+	const CColumnarChunkInfo& GetChunkInfo(size_t iHandle, size_t iChunk) const { return *m_aChunksByHandle[iHandle][iChunk]; }
+	const double* GetChunkTimes(const CColumnarChunkInfo& oChunk) const;
+	const int*    GetChunkInts(const CColumnarChunkInfo& oChunk) const;
+	const float*  GetChunkFloats(const CColumnarChunkInfo& oChunk, int iAxis = 0) const;
+
+private:
+	size_t FindFirstChunk(size_t iHandle, double flStart) const;
+	void   GetChunkRange(const CColumnarChunkInfo& oChunk, double flStart, double flEnd, size_t& iFirst, size_t& iLast) const;
+
+private:
+	const char*        m_pData;
+	unsigned long long m_iSize;
+
+#ifdef _WIN32
+	void*              m_hFile;
+	void*              m_hMapping;
+#endif
+
+	std::vector<CViewbackDataChannel> m_aChannels;
+	std::vector<std::vector<const CColumnarChunkInfo*> > m_aChunksByHandle;
+	std::vector<bool>  m_abOverlapping; // By handle, see HasOverlappingChunks().
+
+	double m_flStartTime;
+	double m_flEndTime;
+};
+
+}
@@ -0,0 +1,340 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/*
+	viewback_convert - Converts a capture file into a columnar capture (see
+	viewback_columnar.h) and inspects columnar captures.
+
+	viewback_convert capture_file columnar_file
+	viewback_convert --info columnar_file
+	viewback_convert --range columnar_file handle start_time end_time
+
+	It can also time the client's sample decoder against protobuf on the
+	packets in a capture file:
+
+	viewback_convert --benchmark capture_file
+
+	Or export channels from a capture file as CSV (or columnar, if the
+	output ends in .vbc) for analysis tools:
+
+	viewback_convert --export capture_file output_file [--from time] [--to time] [channel ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <float.h>
+
+#include <chrono>
+#include <vector>
+
+#include "viewback_capture.h"
+#include "viewback_columnar.h"
+#include "viewback_decode.h"
+#include "viewback_export.h"
+
+using namespace vb;
+
+void vb__debug_printf(const char* format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+}
+
+static const char* TypeName(vb_data_type_t eType)
+{
+	switch (eType)
+	{
+	case VB_DATATYPE_INT:
+		return "int";
+
+	case VB_DATATYPE_FLOAT:
+		return "float";
+
+	case VB_DATATYPE_VECTOR:
+		return "vector";
+
+	default:
+		return "none";
+	}
+}
+
+static int Convert(const char* pszCapture, const char* pszColumnar)
+{
+	CViewbackCaptureReader oReader;
+	if (!oReader.Open(pszCapture))
+	{
+		printf("Couldn't open capture file %s\n", pszCapture);
+		return 1;
+	}
+
+	CViewbackColumnarWriter oWriter;
+	if (!oWriter.Open(pszColumnar))
+	{
+		printf("Couldn't create %s\n", pszColumnar);
+		return 1;
+	}
+
+	Packet oPacket;
+	size_t iSamples = 0;
+
+	while (oReader.ReadFrame())
+	{
+		if (!oPacket.ParseFromArray(oReader.GetPacket(), (int)oReader.GetPacketLength()))
+			continue;
+
+		if (oReader.IsRegistration())
+			oWriter.SetRegistration(oPacket);
+		else if (oPacket.has_data() && oWriter.AddData(oPacket.data()))
+			iSamples++;
+	}
+
+	if (!oWriter.Close())
+	{
+		printf("Couldn't write %s\n", pszColumnar);
+		return 1;
+	}
+
+	printf("Converted %d samples from %s to %s.\n", (int)iSamples, pszCapture, pszColumnar);
+
+	return 0;
+}
+
+static int Info(const char* pszColumnar)
+{
+	CViewbackColumnarReader oReader;
+	if (!oReader.Open(pszColumnar))
+	{
+		printf("Couldn't open columnar capture %s\n", pszColumnar);
+		return 1;
+	}
+
+	printf("%s: game time %.3f to %.3f\n", pszColumnar, oReader.GetStartTime(), oReader.GetEndTime());
+
+	for (size_t i = 0; i < oReader.GetChannels().size(); i++)
+	{
+		const CViewbackDataChannel& oChannel = oReader.GetChannels()[i];
+
+		printf("%3d %-24s %-6s %8d samples in %d chunks\n", (int)i, oChannel.m_sName.c_str(), TypeName(oChannel.m_eDataType), (int)oReader.GetNumSamples(i), (int)oReader.GetNumChunks(i));
+	}
+
+	return 0;
+}
+
+static int Range(const char* pszColumnar, size_t iHandle, double flStart, double flEnd)
+{
+	CViewbackColumnarReader oReader;
+	if (!oReader.Open(pszColumnar))
+	{
+		printf("Couldn't open columnar capture %s\n", pszColumnar);
+		return 1;
+	}
+
+	if (iHandle >= oReader.GetChannels().size())
+	{
+		printf("No channel with handle %d\n", (int)iHandle);
+		return 1;
+	}
+
+	CViewbackDataList oList;
+	size_t iSamples = oReader.GetRange(iHandle, flStart, flEnd, oList);
+
+	double aflMin[3], aflMax[3];
+	if (!oReader.GetMinMax(iHandle, flStart, flEnd, aflMin, aflMax))
+	{
+		printf("No data for %s between %.3f and %.3f\n", oReader.GetChannels()[iHandle].m_sName.c_str(), flStart, flEnd);
+		return 0;
+	}
+
+	printf("%s: %d samples between %.3f and %.3f\n", oReader.GetChannels()[iHandle].m_sName.c_str(), (int)iSamples, flStart, flEnd);
+
+	if (oReader.GetChannels()[iHandle].m_eDataType == VB_DATATYPE_VECTOR)
+		printf("min (%g, %g, %g) max (%g, %g, %g)\n", aflMin[0], aflMin[1], aflMin[2], aflMax[0], aflMax[1], aflMax[2]);
+	else
+		printf("min %g max %g\n", aflMin[0], aflMax[0]);
+
+	return 0;
+}
+
+static int Export(int argc, const char** args)
+{
+	const char* pszCapture = args[2];
+	const char* pszOutput = args[3];
+
+	CViewbackExporter oExporter;
+
+	double flStart = -DBL_MAX;
+	double flEnd = DBL_MAX;
+
+	for (int i = 4; i < argc; i++)
+	{
+		if (strcmp(args[i], "--from") == 0 && i < argc - 1)
+			flStart = atof(args[++i]);
+		else if (strcmp(args[i], "--to") == 0 && i < argc - 1)
+			flEnd = atof(args[++i]);
+		else
+			oExporter.SelectChannel(args[i]);
+	}
+
+	oExporter.SetTimeRange(flStart, flEnd);
+
+	size_t iLength = strlen(pszOutput);
+	bool bColumnar = iLength > 4 && strcmp(pszOutput + iLength - 4, ".vbc") == 0;
+
+	if (!oExporter.Open(pszOutput, bColumnar ? VB_EXPORT_COLUMNAR : VB_EXPORT_CSV))
+	{
+		printf("Couldn't create %s\n", pszOutput);
+		return 1;
+	}
+
+	if (!oExporter.ExportCapture(pszCapture))
+	{
+		printf("Couldn't export %s\n", pszCapture);
+		return 1;
+	}
+
+	size_t iSamples = oExporter.GetSamplesWritten();
+
+	if (!oExporter.Close())
+	{
+		printf("Couldn't write %s\n", pszOutput);
+		return 1;
+	}
+
+	printf("Exported %d samples from %s to %s.\n", (int)iSamples, pszCapture, pszOutput);
+
+	return 0;
+}
+
+static bool SamplesMatch(const CViewbackSample& a, const CViewbackSample& b)
+{
+	return a.m_iHandle == b.m_iHandle && a.m_flTime == b.m_flTime && a.m_bHasTime == b.m_bHasTime
+		&& a.m_bHasMaintainTime == b.m_bHasMaintainTime && a.m_flMaintainTime == b.m_flMaintainTime
+		&& a.m_iValue == b.m_iValue && a.m_aflValue[0] == b.m_aflValue[0] && a.m_aflValue[1] == b.m_aflValue[1] && a.m_aflValue[2] == b.m_aflValue[2];
+}
+
+static int Benchmark(const char* pszCapture)
+{
+	CViewbackCaptureReader oReader;
+	if (!oReader.Open(pszCapture))
+	{
+		printf("Couldn't open capture file %s\n", pszCapture);
+		return 1;
+	}
+
+	// Pull every data packet into memory first so that only decoding is timed.
+	std::vector<char>   aBytes;
+	std::vector<size_t> aiOffsets;
+	std::vector<size_t> aiLengths;
+
+	while (oReader.ReadFrame())
+	{
+		if (oReader.IsRegistration())
+			continue;
+
+		aiOffsets.push_back(aBytes.size());
+		aiLengths.push_back(oReader.GetPacketLength());
+		aBytes.insert(aBytes.end(), (const char*)oReader.GetPacket(), (const char*)oReader.GetPacket() + oReader.GetPacketLength());
+	}
+
+	if (!aiOffsets.size())
+	{
+		printf("No data packets in %s\n", pszCapture);
+		return 1;
+	}
+
+	// Both decoders must agree before their speed means anything.
+	Packet oPacket;
+	size_t iSamples = 0;
+	for (size_t i = 0; i < aiOffsets.size(); i++)
+	{
+		CViewbackSample oDecoded, oParsed;
+		if (!DecodeSample(&aBytes[aiOffsets[i]], aiLengths[i], oDecoded))
+			continue;
+
+		iSamples++;
+
+		oPacket.ParseFromArray(&aBytes[aiOffsets[i]], (int)aiLengths[i]);
+		SampleFromData(oPacket.data(), oParsed);
+
+		if (!SamplesMatch(oDecoded, oParsed))
+		{
+			printf("Decoders disagree on packet %d\n", (int)i);
+			return 1;
+		}
+	}
+
+	printf("%d packets, %d of them samples, %.1f MB\n", (int)aiOffsets.size(), (int)iSamples, (double)aBytes.size() / (1024 * 1024));
+
+	const int iPasses = 10;
+
+	// This is the best case for protobuf, one Packet reused so it doesn't reallocate.
+	std::chrono::high_resolution_clock::time_point oStart = std::chrono::high_resolution_clock::now();
+	for (int iPass = 0; iPass < iPasses; iPass++)
+	{
+		for (size_t i = 0; i < aiOffsets.size(); i++)
+			oPacket.ParseFromArray(&aBytes[aiOffsets[i]], (int)aiLengths[i]);
+	}
+	double flProtobuf = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - oStart).count();
+
+	size_t iDecoded = 0;
+	oStart = std::chrono::high_resolution_clock::now();
+	for (int iPass = 0; iPass < iPasses; iPass++)
+	{
+		for (size_t i = 0; i < aiOffsets.size(); i++)
+		{
+			CViewbackSample oSample;
+			iDecoded += DecodeSample(&aBytes[aiOffsets[i]], aiLengths[i], oSample);
+		}
+	}
+	double flDecoder = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - oStart).count();
+
+	double flPackets = (double)aiOffsets.size() * iPasses;
+	double flMB = (double)aBytes.size() * iPasses / (1024 * 1024);
+
+	printf("Packet::ParseFromArray: %10.0f packets/s %8.1f MB/s\n", flPackets / flProtobuf, flMB / flProtobuf);
+	printf("DecodeSample:           %10.0f packets/s %8.1f MB/s (%.1fx)\n", flPackets / flDecoder, flMB / flDecoder, flProtobuf / flDecoder);
+
+	return iDecoded ? 0 : 1;
+}
+
+int main(int argc, const char** args)
+{
+	if (argc == 3 && strcmp(args[1], "--info") == 0)
+		return Info(args[2]);
+
+	if (argc == 3 && strcmp(args[1], "--benchmark") == 0)
+		return Benchmark(args[2]);
+
+	if (argc == 6 && strcmp(args[1], "--range") == 0)
+		return Range(args[2], (size_t)atoi(args[3]), atof(args[4]), atof(args[5]));
+
+	if (argc >= 4 && strcmp(args[1], "--export") == 0)
+		return Export(argc, args);
+
+	if (argc == 3)
+		return Convert(args[1], args[2]);
+
+	printf("Usage: %s capture_file columnar_file\n", args[0]);
+	printf("       %s --info columnar_file\n", args[0]);
+	printf("       %s --range columnar_file handle start_time end_time\n", args[0]);
+	printf("       %s --benchmark capture_file\n", args[0]);
+	printf("       %s --export capture_file output_file [--from time] [--to time] [channel ...]\n", args[0]);
+
+	return 1;
+}
@@ -16,59 +16,123 @@ THE SOFTWARE.
 #include "viewback_data.h"
 #include "viewback_client.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
 using namespace std;
 using namespace vb;
 
-atomic<bool> CViewbackDataThread::s_bRunning;
-atomic<bool> CViewbackDataThread::s_bConnected;
-vector<Packet> CViewbackDataThread::s_aDataDrop;
-atomic<bool> CViewbackDataThread::s_bDataDropReady;
-string CViewbackDataThread::s_sCommandDrop;
-atomic<bool> CViewbackDataThread::s_bCommandDropReady;
-atomic<bool> CViewbackDataThread::s_bDisconnect;
+// How many packets can wait for the main thread before the data thread starts holding on to them itself.
+#define VB_DATA_QUEUE_SIZE 32768
 
-CViewbackDataThread::CViewbackDataThread()
+// How many more it holds on to after that. Past this samples are dropped, but
+// registrations and everything else are kept since losing them would break things.
+#define VB_MAX_OVERFLOW 32768
+
+// How many commands the main thread can queue up before the data thread gets around to sending them.
+#define VB_COMMAND_QUEUE_SIZE 256
+
+// Commands are left in the queue while this much is still waiting to be sent.
+#define VB_MAX_UNSENT (64*1024)
+
+// How long Connect() waits on a server that doesn't answer.
+#define VB_CONNECT_TIMEOUT_MS 2000
+
+// Has to cover the VB_ALIGN() on the queue members, see CViewbackQueue.
+#define VB_ALIGNOF_CONNECTION 64
+
+atomic<bool> CViewbackDataThread::s_bRunning;
+atomic<bool> CViewbackDataThread::s_bShutdown;
+vector<CViewbackDataConnection*> CViewbackDataThread::s_apAdded;
+atomic<bool> CViewbackDataThread::s_bAdded;
+pthread_mutex_t CViewbackDataThread::s_added_mutex;
+atomic<bool> CViewbackDataThread::s_bStashData;
+string CViewbackDataThread::s_sSpillDirectory;
+vector<CViewbackDerivedChannel> CViewbackDataThread::s_aDerivedChannels;
+vector<CViewbackTrigger> CViewbackDataThread::s_aTriggers;
+
+CViewbackDataConnection::CViewbackDataConnection()
+	: m_aDataQueue(VB_DATA_QUEUE_SIZE), m_aCommandQueue(VB_COMMAND_QUEUE_SIZE)
 {
-	s_bRunning = false;
+	m_socket = VB_INVALID_SOCKET;
+	m_udp_socket = VB_INVALID_SOCKET;
+	m_iServerAddress = 0;
+	m_iRecvLength = 0;
+	m_iSendOffset = 0;
+	m_bMessageInQueue = false;
+	m_pHistory = NULL;
+	m_iHistorySerial = 0;
+
+	m_bDataOverflow = false;
+	m_iDroppedSamples = 0;
+	m_iHistoryInUse = 0;
+	m_bConnected = false;
+	m_bDisconnect = false;
+	m_bReleased = false;
 }
 
-CViewbackDataThread& CViewbackDataThread::DataThread()
+CViewbackDataConnection::~CViewbackDataConnection()
 {
-	static CViewbackDataThread t;
+	VBAssert(!m_bConnected);
 
-	return t;
+	// The main thread lets go of its history before it gets here.
+	FreeHistories(true);
 }
 
-bool CViewbackDataThread::Connect(unsigned long address, unsigned short port)
+void* CViewbackDataConnection::operator new(size_t iSize)
 {
-	if (s_bRunning)
-	{
-		// Another data thread is still running. That is bad. Hopefully we told it to disconnect and we're just waiting on that.
-		VBAssert(!s_bConnected);
+#ifdef _WIN32
+	void* p = _aligned_malloc(iSize, VB_ALIGNOF_CONNECTION);
+#else
+	void* p;
+	if (posix_memalign(&p, VB_ALIGNOF_CONNECTION, iSize) != 0)
+		p = NULL;
+#endif
+
+	if (!p)
+		throw std::bad_alloc();
+
+	return p;
+}
 
-		// If not, make sure that we do.
-		s_bDisconnect = true;
+void CViewbackDataConnection::operator delete(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
 
-		pthread_join(DataThread().m_iThread, NULL);
-	}
+// Called after a non-blocking connect() fails, to see if it's just not done yet.
+static bool WaitForConnect(vb__socket_t socket)
+{
+	int iError = vb__socket_error();
+	if (iError != EINPROGRESS && !vb__socket_is_blocking_error(iError))
+		return false;
 
-	// We are being ordered to connect to something. Thus, we should not remain disconnected any longer.
-	s_bDisconnect = false;
+	vb__pollfd_t oPoll;
+	oPoll.fd = socket;
+	oPoll.events = POLLOUT;
+	oPoll.revents = 0;
 
-	return DataThread().Initialize(address, port);
-}
+	if (vb__poll(&oPoll, 1, VB_CONNECT_TIMEOUT_MS) <= 0)
+		return false;
 
-void CViewbackDataThread::Shutdown()
-{
-	if (s_bRunning)
-	{
-		s_bDisconnect = true;
+	int iResult = 0;
+	vb__socklen_t iLength = sizeof(iResult);
+	if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&iResult, &iLength) < 0)
+		return false;
 
-		pthread_join(DataThread().m_iThread, NULL);
-	}
+	return iResult == 0;
 }
 
-bool CViewbackDataThread::Initialize(unsigned long address, unsigned short port)
+bool CViewbackDataConnection::Connect(unsigned long address, unsigned short port)
 {
 	if ((m_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0)
 	{
@@ -76,15 +140,6 @@ bool CViewbackDataThread::Initialize(unsigned long address, unsigned short port)
 		return false;
 	}
 
-	// Any data drops are lying around from last time, so clear them out.
-	s_aDataDrop.clear();
-	s_sCommandDrop.clear();
-
-	s_bConnected = false;
-	s_bDataDropReady = false;
-	s_bCommandDropReady = true;
-	s_bDisconnect = false;
-
 	CCleanupSocket c(m_socket);
 
 	struct sockaddr_in addr;
@@ -93,7 +148,12 @@ bool CViewbackDataThread::Initialize(unsigned long address, unsigned short port)
 	addr.sin_addr.s_addr=htonl(address);
 	addr.sin_port=htons(port == 0?VB_DEFAULT_PORT:port);
 
-	if (connect(m_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	// One thread serves every connection, so a server that stops reading mustn't
+	// block it. It's set before connecting so that a host that doesn't answer
+	// can't hold up the caller for the system's connect timeout either.
+	vb__socket_set_blocking(m_socket, 0);
+
+	if (connect(m_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 && !WaitForConnect(m_socket))
 	{
 		VBPrintf("Could not connect to viewback server.\n");
 		return false;
@@ -101,175 +161,721 @@ bool CViewbackDataThread::Initialize(unsigned long address, unsigned short port)
 
 	VBPrintf("Connected to Viewback server at %s:%d.\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 
-	if (pthread_create(&m_iThread, NULL, (void *(*) (void *))&CViewbackDataThread::ThreadMain, (void*)this) != 0)
+	InitializeUdp(address);
+
+	// Set this before the data thread sees it, it lets go as soon as it sees it off.
+	m_bConnected = true;
+
+	if (!CViewbackDataThread::Add(this))
 	{
-		VBPrintf("Could not create data thread.\n");
+		m_bConnected = false;
+
+		if (vb__socket_valid(m_udp_socket))
+			vb__socket_close(m_udp_socket);
+		m_udp_socket = VB_INVALID_SOCKET;
 		return false;
 	}
 
 	c.Success();
 
-	s_bConnected = true;
 	return true;
 }
 
-void CViewbackDataThread::ThreadMain(CViewbackDataThread* pThis)
+bool CViewbackDataConnection::ConnectUnix(const char* pszPath)
+{
+#ifdef _WIN32
+	VBPrintf("Unix domain sockets are not supported on this platform.\n");
+	return false;
+#else
+	struct sockaddr_un addr;
+
+	if (strlen(pszPath) >= sizeof(addr.sun_path))
+	{
+		VBPrintf("Unix socket path is too long.\n");
+		return false;
+	}
+
+	if ((m_socket = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		VBPrintf("Could not create data socket.\n");
+		return false;
+	}
+
+	CCleanupSocket c(m_socket);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, pszPath);
+
+	if (connect(m_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		VBPrintf("Could not connect to viewback server.\n");
+		return false;
+	}
+
+	VBPrintf("Connected to Viewback server at %s.\n", addr.sun_path);
+
+	vb__socket_set_blocking(m_socket, 0);
+
+	// Datagrams need an IP address to go to, Unix socket connections get everything over the socket.
+	m_udp_socket = VB_INVALID_SOCKET;
+
+	m_bConnected = true;
+
+	if (!CViewbackDataThread::Add(this))
+	{
+		m_bConnected = false;
+		return false;
+	}
+
+	c.Success();
+
+	return true;
+#endif
+}
+
+// Failure here isn't fatal, we just get everything over TCP.
+void CViewbackDataConnection::InitializeUdp(unsigned long address)
 {
+	m_iServerAddress = address;
+	m_aUdpSequence.clear();
+
+	if ((m_udp_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	{
+		m_udp_socket = VB_INVALID_SOCKET;
+		return;
+	}
+
+	CCleanupSocket c(m_udp_socket);
+
+	// Let the OS pick a port, we tell the server which one.
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = 0;
+
+	vb__socklen_t addrlen = sizeof(addr);
+
+	if (bind(m_udp_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		getsockname(m_udp_socket, (struct sockaddr *)&addr, &addrlen) < 0 ||
+		vb__socket_set_blocking(m_udp_socket, 0) != 0)
+	{
+		VBPrintf("Could not set up datagram socket, all channels will use TCP.\n");
+		m_udp_socket = VB_INVALID_SOCKET;
+		return;
+	}
+
+	c.Success();
+
+	char szCommand[32];
+	sprintf(szCommand, "udp: %d", ntohs(addr.sin_port));
+
+	// The data thread sends this as soon as it picks up the connection.
+	*m_aCommandQueue.Reserve() = szCommand;
+	m_aCommandQueue.Push();
+}
+
+void CViewbackDataConnection::Close()
+{
+	if (vb__socket_valid(m_socket))
+		vb__socket_close(m_socket);
+	m_socket = VB_INVALID_SOCKET;
+
+	if (vb__socket_valid(m_udp_socket))
+		vb__socket_close(m_udp_socket);
+	m_udp_socket = VB_INVALID_SOCKET;
+
+	// Let the main thread see whatever came in last.
+	if (m_pHistory)
+		m_pHistory->Publish();
+
+	m_bConnected = false;
+	m_bReleased.store(true, memory_order_release);
+}
+
+CViewbackDataThread::CViewbackDataThread()
+{
+	m_wakeup = VB_INVALID_WAKEUP;
+
+	pthread_mutex_init(&s_added_mutex, nullptr);
+}
+
+CViewbackDataThread& CViewbackDataThread::DataThread()
+{
+	static CViewbackDataThread t;
+
+	return t;
+}
+
+bool CViewbackDataThread::Add(CViewbackDataConnection* pConnection)
+{
+	if (!s_bRunning && !DataThread().StartThread())
+		return false;
+
+	pthread_mutex_lock(&s_added_mutex);
+	s_apAdded.push_back(pConnection);
+	s_bAdded = true;
+	pthread_mutex_unlock(&s_added_mutex);
+
+	Wake();
+
+	return true;
+}
+
+void CViewbackDataThread::Shutdown()
+{
+	if (s_bRunning)
+	{
+		s_bShutdown = true;
+		Wake();
+
+		pthread_join(DataThread().m_iThread, NULL);
+
+		s_bRunning = false;
+		s_bShutdown = false;
+	}
+
+	if (DataThread().m_wakeup != VB_INVALID_WAKEUP)
+		vb__wakeup_destroy(DataThread().m_wakeup);
+	DataThread().m_wakeup = VB_INVALID_WAKEUP;
+}
+
+bool CViewbackDataThread::StartThread()
+{
+	// Kept around until shutdown.
+	if (m_wakeup == VB_INVALID_WAKEUP && !vb__wakeup_create(&m_wakeup))
+	{
+		VBPrintf("Could not create data thread wakeup.\n");
+		m_wakeup = VB_INVALID_WAKEUP;
+		return false;
+	}
+
+	s_bShutdown = false;
+
+	if (pthread_create(&m_iThread, NULL, (void *(*) (void *))&CViewbackDataThread::ThreadMain, (void*)this) != 0)
+	{
+		VBPrintf("Could not create data thread.\n");
+		return false;
+	}
+
 	s_bRunning = true;
 
+	return true;
+}
+
+void CViewbackDataThread::ThreadMain(CViewbackDataThread* pThis)
+{
 	GOOGLE_PROTOBUF_VERIFY_VERSION;
 
-	while (s_bConnected && !s_bDisconnect)
+	while (!s_bShutdown)
 		pThis->Pump();
 
-	s_bConnected = false;
-	vb__socket_close(pThis->m_socket);
+	// Anything added since the last pump is let go of too.
+	pThis->TakeAdded();
+
+	for (size_t i = 0; i < pThis->m_apConnections.size(); i++)
+		pThis->m_apConnections[i]->Close();
+
+	pThis->m_apConnections.clear();
 
 	google::protobuf::ShutdownProtobufLibrary();
+}
+
+void CViewbackDataThread::TakeAdded()
+{
+	if (!s_bAdded)
+		return;
 
-	s_bRunning = false;
+	pthread_mutex_lock(&s_added_mutex);
+	m_apConnections.insert(m_apConnections.end(), s_apAdded.begin(), s_apAdded.end());
+	s_apAdded.clear();
+	s_bAdded = false;
+	pthread_mutex_unlock(&s_added_mutex);
 }
 
 #define MSGBUFSIZE 1024
 
+// Initial size of the TCP receive buffer, and the least room we ask recv() to fill.
+#define VB_RECV_BUFFER_SIZE (64*1024)
+#define VB_RECV_MIN_READ (16*1024)
+
 void CViewbackDataThread::Pump()
 {
-	vb__thread_yield();
+	TakeAdded();
 
-	MaintainDrops();
+	// Let go of the connections that were lost or that the main thread is done with.
+	size_t iKept = 0;
+	for (size_t i = 0; i < m_apConnections.size(); i++)
+	{
+		CViewbackDataConnection* pConnection = m_apConnections[i];
 
-	char msgbuf[MSGBUFSIZE];
+		if (!pConnection->m_bConnected || pConnection->m_bDisconnect)
+		{
+			pConnection->Close();
+			continue;
+		}
 
-	int iBytesRead;
+		pConnection->MaintainDrops();
 
-	vb__socket_set_blocking(m_socket, 0);
+		m_apConnections[iKept++] = pConnection;
+	}
 
-	iBytesRead = recv(m_socket, msgbuf, MSGBUFSIZE, 0);
+	m_apConnections.resize(iKept);
 
-	int iError = vb__socket_error();
+	// Sleep until a server sends something or another thread has something
+	// for us, so that idle connections don't cost any CPU. Datagrams come
+	// before the stream, same as always.
+	m_aPoll.clear();
+	m_apPolled.clear();
+
+	vb__pollfd_t oPoll;
+	oPoll.events = POLLIN;
+	oPoll.revents = 0;
+
+	oPoll.fd = m_wakeup;
+	m_aPoll.push_back(oPoll);
+	m_apPolled.push_back(NULL);
+
+	for (size_t i = 0; i < m_apConnections.size(); i++)
+	{
+		CViewbackDataConnection* pConnection = m_apConnections[i];
+
+		if (vb__socket_valid(pConnection->m_udp_socket))
+		{
+			oPoll.fd = pConnection->m_udp_socket;
+			m_aPoll.push_back(oPoll);
+			m_apPolled.push_back(pConnection);
+		}
+
+		// Commands that didn't all go out last time go out once there's room.
+		oPoll.fd = pConnection->m_socket;
+		oPoll.events = (pConnection->m_iSendOffset < pConnection->m_sSendBuffer.length()) ? (POLLIN | POLLOUT) : POLLIN;
+		m_aPoll.push_back(oPoll);
+		m_apPolled.push_back(pConnection);
+
+		oPoll.events = POLLIN;
+	}
+
+	// Most likely interrupted by a signal. The caller checks the flags and comes right back.
+	if (vb__poll(&m_aPoll[0], m_aPoll.size(), -1) < 0)
+		return;
 
-	vb__socket_set_blocking(m_socket, 1);
+	if (m_aPoll[0].revents)
+		vb__wakeup_clear(m_wakeup);
 
-	// 0 always means the connection was lost.
+	bool bPumped = false;
+
+	for (size_t i = 1; i < m_aPoll.size(); i++)
+	{
+		CViewbackDataConnection* pConnection = m_apPolled[i];
+
+		if (m_aPoll[i].revents)
+		{
+			if (m_aPoll[i].fd == pConnection->m_udp_socket)
+				pConnection->PumpDatagrams();
+			else
+				pConnection->PumpSocket();
+
+			bPumped = true;
+		}
+
+		// A connection's datagram socket comes right before its stream. Let the
+		// main thread see everything from both this round in one go.
+		if (bPumped && (i + 1 == m_aPoll.size() || m_apPolled[i + 1] != pConnection))
+		{
+			if (pConnection->m_pHistory)
+				pConnection->m_pHistory->Publish();
+
+			bPumped = false;
+		}
+	}
+}
+
+void CViewbackDataConnection::PumpSocket()
+{
+	// Read straight onto the end of whatever partial packet is left over from
+	// last time. The buffer only grows when a packet doesn't fit, so once it's
+	// big enough reading doesn't allocate.
+	if (m_aRecvBuffer.size() - m_iRecvLength < VB_RECV_MIN_READ)
+		m_aRecvBuffer.resize(m_aRecvBuffer.size() ? m_aRecvBuffer.size() * 2 : VB_RECV_BUFFER_SIZE);
+
+	// The poll said there's something to read, so this won't block.
+	int iBytesRead = recv(m_socket, &m_aRecvBuffer[m_iRecvLength], (int)(m_aRecvBuffer.size() - m_iRecvLength), 0);
+
+	int iError = vb__socket_error();
+
+	// 0 always means the connection was lost. The socket is closed when the data thread lets go.
 	if (iBytesRead == 0)
 	{
-		vb__socket_close(m_socket);
-		s_bConnected = false;
+		m_bConnected = false;
 		return;
 	}
 
 	if (iBytesRead < 0)
 	{
-		// It would have blocked, meaning there's no data available.
+		// Spurious wakeup, there's no data available after all.
 		if (vb__socket_is_blocking_error(iError))
 			return;
 
 		// There was a real error, we're not connected anymore.
-		vb__socket_close(m_socket);
-		s_bConnected = false;
+		m_bConnected = false;
 		return;
 	}
 
-	vector<char> aMsgBuf;
-
-	// There's a partial packet left over from last time, tack it onto the front.
-	if (m_aLeftover.size())
-	{
-		aMsgBuf.insert(aMsgBuf.end(), m_aLeftover.begin(), m_aLeftover.end());
-		m_aLeftover.clear();
-	}
-
-	vector<char> aBytes(msgbuf, msgbuf + iBytesRead);
-	aMsgBuf.insert(aMsgBuf.end(), aBytes.begin(), aBytes.end());
+	m_iRecvLength += iBytesRead;
 
 	size_t iCurrentPacket = 0;
-	char* pMsgBuf = aMsgBuf.data();
+	const char* pMsgBuf = m_aRecvBuffer.data();
 
-	while (iCurrentPacket < aMsgBuf.size())
+	while (iCurrentPacket + sizeof(size_t) <= m_iRecvLength)
 	{
 		// The first item will be the packet size.
-		size_t iPacketSize = ntohl(*(size_t*)(&pMsgBuf[iCurrentPacket]));
+		size_t iPacketSize;
+		memcpy(&iPacketSize, &pMsgBuf[iCurrentPacket], sizeof(iPacketSize));
+		iPacketSize = ntohl((unsigned int)iPacketSize);
 
-		// For some reason we didn't receive all of the bytes for this packet.
-		// Stuff it in the leftover and bail.
-		if (iCurrentPacket + sizeof(size_t)+iPacketSize > aMsgBuf.size())
-		{
-			m_aLeftover.insert(m_aLeftover.end(), aMsgBuf.begin() + iCurrentPacket, aMsgBuf.end());
+		// We haven't received all of the bytes for this packet yet.
+		if (iCurrentPacket + sizeof(size_t)+iPacketSize > m_iRecvLength)
 			break;
-		}
 
 		// Fast forward sizeof(size_t) bytes to skip the packet size, then parse the next item.
-		Packet packet;
-		packet.ParseFromArray(&pMsgBuf[iCurrentPacket] + sizeof(size_t), iPacketSize);
+		const char* pPacket = &pMsgBuf[iCurrentPacket] + sizeof(size_t);
+
+		// Data samples skip protobuf entirely, everything else gets the full parse.
+		CViewbackMessage* pMessage = BeginMessage();
+		pMessage->m_bSample = DecodeSample(pPacket, iPacketSize, pMessage->m_oSample);
 
-		m_aMessages.push_back(packet);
+		if (pMessage->m_bSample)
+		{
+			if (m_pHistory)
+			{
+				// The main thread never has to see it.
+				m_pHistory->Stash(pMessage->m_oSample);
+				EndMessage(false);
+			}
+			else
+				EndMessage(true);
+		}
+		else
+		{
+			pMessage->m_oPacket.ParseFromArray(pPacket, (int)iPacketSize);
+
+			if (pMessage->m_oPacket.is_registration())
+				StartHistory(pMessage);
+			else if (m_pHistory && pMessage->m_oPacket.has_data())
+			{
+				SampleFromData(pMessage->m_oPacket.data(), pMessage->m_oSample);
+				m_pHistory->Stash(pMessage->m_oSample);
+				pMessage->m_oPacket.clear_data();
+			}
+
+			EndMessage(true);
+		}
 
 		// Fast forward past the packet size and the packet itself.
 		iCurrentPacket += sizeof(size_t)+iPacketSize;
 	}
+
+	// Move the partial packet, if any, to the front for next time.
+	if (iCurrentPacket)
+	{
+		memmove(&m_aRecvBuffer[0], &m_aRecvBuffer[iCurrentPacket], m_iRecvLength - iCurrentPacket);
+		m_iRecvLength -= iCurrentPacket;
+	}
 }
 
-void CViewbackDataThread::MaintainDrops()
+void CViewbackDataConnection::PumpDatagrams()
 {
-	if (!s_bDataDropReady && m_aMessages.size())
+	if (!vb__socket_valid(m_udp_socket))
+		return;
+
+	char msgbuf[MSGBUFSIZE];
+
+	// Drain everything that's waiting, the socket is non-blocking.
+	for (;;)
 	{
-		VBAssert(!s_aDataDrop.size());
+		struct sockaddr_in addr;
+		vb__socklen_t addrlen = sizeof(addr);
 
-		for (size_t i = 0; i < m_aMessages.size(); i++)
-			s_aDataDrop.push_back(m_aMessages[i]);
+		int iBytesRead = recvfrom(m_udp_socket, msgbuf, MSGBUFSIZE, 0, (struct sockaddr *)&addr, &addrlen);
+
+		// Either nothing left to read or a real error. We'll try again next pump either way.
+		if (iBytesRead < 0)
+			return;
 
-		s_bDataDropReady = true;
+		// Not from our server, ignore it.
+		if (ntohl(addr.sin_addr.s_addr) != m_iServerAddress)
+			continue;
 
-		m_aMessages.clear();
+		unsigned int iSequence;
+		if (iBytesRead <= (int)sizeof(iSequence))
+			continue;
+
+		memcpy(&iSequence, msgbuf, sizeof(iSequence));
+		iSequence = ntohl(iSequence);
+
+		// Only data samples are sent this way.
+		CViewbackMessage* pMessage = BeginMessage();
+		pMessage->m_bSample = true;
+		if (!DecodeSample(msgbuf + sizeof(iSequence), iBytesRead - sizeof(iSequence), pMessage->m_oSample))
+		{
+			EndMessage(false);
+			continue;
+		}
+
+		size_t iHandle = pMessage->m_oSample.m_iHandle;
+		if (iHandle >= m_aUdpSequence.size())
+			m_aUdpSequence.resize(iHandle + 1);
+
+		// This one arrived after a newer one for the same channel. Only the latest value matters, toss it.
+		// The subtraction is so that it keeps working after the sequence number wraps around.
+		if (m_aUdpSequence[iHandle] && (int)(iSequence - m_aUdpSequence[iHandle]) <= 0)
+		{
+			EndMessage(false);
+			continue;
+		}
+
+		m_aUdpSequence[iHandle] = iSequence;
+
+		if (m_pHistory)
+		{
+			m_pHistory->Stash(pMessage->m_oSample);
+			EndMessage(false);
+		}
+		else
+			EndMessage(true);
 	}
+}
+
+void CViewbackDataConnection::StartHistory(CViewbackMessage* pMessage)
+{
+	// Whatever the last registration's history was, the main thread will move
+	// on from it when it gets this one.
+	m_pHistory = NULL;
+
+	if (!CViewbackDataThread::s_bStashData)
+		return;
+
+	m_pHistory = new CViewbackHistory(pMessage->m_oPacket, ++m_iHistorySerial, CViewbackDataThread::GetDerivedChannels(), CViewbackDataThread::GetTriggers());
+	m_apHistories.push_back(m_pHistory);
+
+	const string& sSpillDirectory = CViewbackDataThread::GetSpillDirectory();
+	if (sSpillDirectory.length() && !m_pHistory->SpillTo(sSpillDirectory))
+		VBPrintf("Couldn't make a spill file in %s, keeping the data in memory.\n", sSpillDirectory.c_str());
 
-	if (!s_bCommandDropReady)
+	pMessage->m_pHistory = m_pHistory;
+}
+
+void CViewbackDataConnection::FreeHistories(bool bAll)
+{
+	unsigned iInUse = m_iHistoryInUse.load(memory_order_acquire);
+
+	// Histories are handed over in the order they're made, so once the main
+	// thread has one it's done with everything before it.
+	size_t iFreed = 0;
+	while (iFreed < m_apHistories.size())
 	{
-		VBAssert(s_sCommandDrop.length());
+		CViewbackHistory* pHistory = m_apHistories[iFreed];
+
+		if (!bAll && (pHistory == m_pHistory || (int)(pHistory->GetSerial() - iInUse) >= 0))
+			break;
 
-		// Stash it away and let the main thread have it back.
-		string sCommand = s_sCommandDrop;
-		s_bCommandDropReady = true;
+		delete pHistory;
+		iFreed++;
+	}
 
-		string sMessage = sCommand + "\0";
+	m_apHistories.erase(m_apHistories.begin(), m_apHistories.begin() + iFreed);
 
-		// Send it to the server
-		send(m_socket, sMessage.c_str(), sMessage.length()+1, 0); // +1 length for the terminal null
+	if (bAll)
+		m_pHistory = NULL;
+}
+
+// Messages are parsed straight into the queue. If the main thread has
+// fallen so far behind that the queue is full they wait in m_aOverflow
+// instead, so the data thread never has to wait for it.
+CViewbackMessage* CViewbackDataConnection::BeginMessage()
+{
+	if (!m_aOverflow.size())
+	{
+		CViewbackMessage* pSlot = m_aDataQueue.Reserve();
+		if (pSlot)
+		{
+			m_bMessageInQueue = true;
+			pSlot->m_pHistory = NULL;
+			return pSlot;
+		}
 	}
+
+	m_bMessageInQueue = false;
+	m_bDataOverflow = true;
+	m_aOverflow.push_back(CViewbackMessage());
+	return &m_aOverflow.back();
 }
 
-// This function runs as part of the main thread.
-void CViewbackDataThread::Disconnect()
+void CViewbackDataConnection::EndMessage(bool bKeep)
 {
-	s_bDisconnect = true;
+	if (m_bMessageInQueue)
+	{
+		if (bKeep)
+			m_aDataQueue.Push();
+
+		return;
+	}
+
+	if (bKeep && m_aOverflow.size() > VB_MAX_OVERFLOW)
+	{
+		const CViewbackMessage& oMessage = m_aOverflow.back();
+		if (oMessage.m_bSample || (oMessage.m_oPacket.has_data() && !oMessage.m_oPacket.is_registration()))
+		{
+			m_iDroppedSamples.fetch_add(1, memory_order_relaxed);
+			bKeep = false;
+		}
+	}
 
-	// Don't bother joining the thread here, let it die slowly.
-	// We'll join it if it's still running when we try to connect again.
+	if (!bKeep)
+	{
+		m_aOverflow.pop_back();
+		m_bDataOverflow = !!m_aOverflow.size();
+	}
 }
 
-// This function runs as part of the main thread.
-vector<Packet> CViewbackDataThread::GetData()
+void CViewbackDataConnection::MaintainDrops()
 {
-	if (s_bDataDropReady)
+	// The main thread has made some room, move the overflow over.
+	if (m_aOverflow.size())
 	{
-		vector<Packet> temp = s_aDataDrop; // Make a copy.
-		s_aDataDrop.clear();
-		s_bDataDropReady = false; // The data thread can have it back now.
-		return temp;
+		CViewbackMessage* pSlot;
+		while (m_aOverflow.size() && (pSlot = m_aDataQueue.Reserve()) != NULL)
+		{
+			CViewbackMessage& oMessage = m_aOverflow.front();
+
+			pSlot->m_bSample = oMessage.m_bSample;
+			pSlot->m_oSample = oMessage.m_oSample;
+			pSlot->m_oPacket.Swap(&oMessage.m_oPacket);
+			pSlot->m_pHistory = oMessage.m_pHistory;
+
+			m_aDataQueue.Push();
+			m_aOverflow.pop_front();
+		}
+
+		m_bDataOverflow = !!m_aOverflow.size();
 	}
 
-	return vector<Packet>();
+	if (m_apHistories.size())
+		FreeHistories(false);
+
+	SendCommands();
 }
 
-// This function runs as part of the main thread.
-bool CViewbackDataThread::SendConsoleCommand(const string& sCommand)
+// "control: 3 0.5" has the prefix "control: 3 ". Anything that isn't a slider value has none.
+static size_t SliderCommandPrefix(const string& sCommand)
+{
+	if (sCommand.compare(0, 9, "control: ") != 0)
+		return 0;
+
+	size_t iSpace = sCommand.find(' ', 9);
+	if (iSpace == string::npos)
+		return 0;
+
+	return iSpace + 1;
+}
+
+void CViewbackDataConnection::SendCommands()
 {
-	if (s_bCommandDropReady)
+	// Everything the main thread has queued goes out in one send, unless the
+	// server isn't reading them. Then they wait in the queue.
+	string* psCommand;
+	while (m_sSendBuffer.length() - m_iSendOffset < VB_MAX_UNSENT && (psCommand = m_aCommandQueue.Front()) != NULL)
 	{
-		s_sCommandDrop = sCommand;
-		s_bCommandDropReady = false; // The data thread can have it back now.
-		return true;
+		// Dragging a slider makes a stream of values and only the latest one
+		// matters, so an older value for the same control that hasn't started
+		// going out yet is replaced where it is.
+		bool bReplaced = false;
+
+		size_t iPrefix = SliderCommandPrefix(*psCommand);
+		if (iPrefix)
+		{
+			for (size_t i = 0; i < m_sSendBuffer.length(); i = m_sSendBuffer.find('\0', i) + 1)
+			{
+				if (i < m_iSendOffset || m_sSendBuffer.compare(i, iPrefix, *psCommand, 0, iPrefix) != 0)
+					continue;
+
+				m_sSendBuffer.replace(i, m_sSendBuffer.find('\0', i) - i, *psCommand);
+				bReplaced = true;
+				break;
+			}
+		}
+
+		// The server expects each command to be null terminated.
+		if (!bReplaced)
+			m_sSendBuffer.append(psCommand->c_str(), psCommand->length() + 1);
+
+		m_aCommandQueue.Pop();
 	}
 
-	return false;
+	// The socket doesn't block. Whatever doesn't fit now waits for the poll
+	// to say there's room.
+	while (m_iSendOffset < m_sSendBuffer.length())
+	{
+		int iBytes = send(m_socket, m_sSendBuffer.data() + m_iSendOffset, (int)(m_sSendBuffer.length() - m_iSendOffset), 0);
+
+		// Either it's full or the connection is gone, in which case the next recv() will notice.
+		if (iBytes <= 0)
+			break;
+
+		m_iSendOffset += iBytes;
+	}
+
+	if (m_iSendOffset == m_sSendBuffer.length())
+	{
+		m_sSendBuffer.clear();
+		m_iSendOffset = 0;
+	}
+}
+
+// This function runs as part of the main thread.
+void CViewbackDataConnection::Disconnect()
+{
+	m_bDisconnect = true;
+
+	// The data thread closes it and lets go the next time around.
+	CViewbackDataThread::Wake();
+}
+
+// This function runs as part of the main thread.
+CViewbackMessage* CViewbackDataConnection::PeekData()
+{
+	return m_aDataQueue.Front();
+}
+
+// This function runs as part of the main thread.
+void CViewbackDataConnection::PopData()
+{
+	m_aDataQueue.Pop();
+
+	// The data thread is holding on to messages until there's room for them.
+	if (m_bDataOverflow)
+		CViewbackDataThread::Wake();
+}
+
+// This function runs as part of the main thread.
+bool CViewbackDataConnection::SendConsoleCommand(const string& sCommand)
+{
+	string* psSlot = m_aCommandQueue.Reserve();
+	if (!psSlot)
+		return false;
+
+	*psSlot = sCommand;
+	m_aCommandQueue.Push();
+
+	CViewbackDataThread::Wake();
+
+	return true;
+}
+
+void CViewbackDataThread::Wake()
+{
+	if (DataThread().m_wakeup != VB_INVALID_WAKEUP)
+		vb__wakeup_signal(DataThread().m_wakeup);
 }
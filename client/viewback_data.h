@@ -16,6 +16,7 @@ THE SOFTWARE.
 #pragma once
 
 #include <vector>
+#include <deque>
 
 // This is probably way wrong.
 #if defined(__linux__) && !defined(__ANDROID__)
@@ -30,54 +31,190 @@ THE SOFTWARE.
 
 #include "../server/viewback_shared.h"
 
+#include "viewback_queue.h"
+#include "viewback_decode.h"
+#include "viewback_derived.h"
+#include "viewback_history.h"
+#include "viewback_trigger.h"
+
 namespace vb
 {
 
+// One connection to a server. The main thread makes it and connects it,
+// then the data thread reads from it until it's disconnected and lets go
+// of it, at which point the main thread deletes it. Each one has its own
+// queues and histories, so nothing one connection does gets in the way of
+// another's data.
+class CViewbackDataConnection
+{
+public:
+	CViewbackDataConnection();
+	~CViewbackDataConnection();
+
+	// The queues are cache line aligned, which plain new doesn't honor before C++17.
+	static void* operator new(size_t iSize);
+	static void operator delete(void* p);
+
+private:
+	CViewbackDataConnection(const CViewbackDataConnection&);
+	CViewbackDataConnection& operator=(const CViewbackDataConnection&);
+
+public:
+	// Main thread. On success the connection goes to the data thread.
+	bool Connect(unsigned long address, unsigned short iPort = 0);
+	bool ConnectUnix(const char* pszPath);
+
+	// Main thread.
+	bool IsConnected() const { return m_bConnected; }
+	void Disconnect();
+
+	// Main thread. True once the data thread is done with it and it can be
+	// deleted. The main thread has to let go of its history first.
+	bool IsReleased() const { return m_bReleased.load(std::memory_order_acquire); }
+
+	// Messages received from the server, oldest first. PeekData() returns NULL
+	// when there's nothing waiting. The message stays valid until PopData().
+	CViewbackMessage* PeekData();
+	void PopData();
+
+	// Samples thrown away because the main thread fell so far behind that
+	// even the overflow was full.
+	size_t GetDroppedSamples() const { return m_iDroppedSamples.load(std::memory_order_relaxed); }
+
+	// Queues a command for the data thread to send. Returns false if the queue is full.
+	bool SendConsoleCommand(const std::string& sCommand);
+
+	// The main thread has moved on to the history with this serial number,
+	// the data thread is free to delete any older ones.
+	void SetHistoryInUse(unsigned iSerial) { m_iHistoryInUse.store(iSerial, std::memory_order_release); }
+
+private:
+	friend class CViewbackDataThread;
+
+	void InitializeUdp(unsigned long address);
+
+	// Data thread.
+	void PumpSocket();
+	void PumpDatagrams();
+
+	void MaintainDrops();
+	void SendCommands();
+
+	void StartHistory(CViewbackMessage* pMessage);
+	void FreeHistories(bool bAll);
+
+	CViewbackMessage* BeginMessage();
+	void    EndMessage(bool bKeep);
+
+	void Close();
+
+private:
+	vb__socket_t        m_socket;
+
+	// Unreliable channels arrive here, if the server supports it.
+	vb__socket_t              m_udp_socket;
+	unsigned long             m_iServerAddress;
+	std::vector<unsigned int> m_aUdpSequence; // Latest sequence number received for each channel handle.
+
+	std::deque<CViewbackMessage> m_aOverflow; // Messages that didn't fit in m_aDataQueue, oldest first. Samples past VB_MAX_OVERFLOW are dropped.
+	bool                m_bMessageInQueue;
+
+	std::string         m_sSendBuffer; // Commands that haven't all gone out yet.
+	size_t              m_iSendOffset; // Bytes of m_sSendBuffer that have.
+
+	std::vector<char>   m_aRecvBuffer;
+	size_t              m_iRecvLength; // Bytes in m_aRecvBuffer that haven't been parsed yet.
+
+	CViewbackHistory*   m_pHistory; // Samples are stashed here instead of being queued, if it's set.
+	std::vector<CViewbackHistory*> m_apHistories; // Every history that hasn't been deleted yet, oldest first.
+	unsigned            m_iHistorySerial;
+
+	CViewbackQueue<CViewbackMessage> m_aDataQueue; // Data thread pushes, main thread pops.
+	std::atomic<bool>                m_bDataOverflow; // Data thread has messages waiting for room in m_aDataQueue.
+	std::atomic<size_t>              m_iDroppedSamples; // Written by the data thread.
+
+	CViewbackQueue<std::string> m_aCommandQueue; // Main thread pushes, data thread pops.
+
+	std::atomic<unsigned> m_iHistoryInUse; // Written by the main thread.
+
+	std::atomic<bool> m_bConnected;  // Read/write for the data thread, read only for others.
+	std::atomic<bool> m_bDisconnect; // Read/write for the main thread, read only for the data thread.
+	std::atomic<bool> m_bReleased;   // Set by the data thread when it lets go.
+};
+
+// The one thread that reads from every connection. It sleeps in a poll on
+// all of their sockets at once and is started with the first connection.
 class CViewbackDataThread
 {
 public:
-	static bool Connect(unsigned long address, unsigned short iPort = 0);
+	// Main thread. The data thread reads from it from now on.
+	static bool Add(CViewbackDataConnection* pConnection);
+
+	// Main thread. Every connection is let go of, they can all be deleted afterwards.
 	static void Shutdown();
-	static bool IsConnected() { return s_bConnected; }
-	static void Disconnect();
-	static std::vector<Packet> GetData();
 
-	static bool SendConsoleCommand(const std::string& sCommand);
+	// If on, the data thread stashes samples into a CViewbackHistory itself
+	// instead of handing them to the main thread. The history goes to the
+	// main thread with the registration packet, so this takes effect at the
+	// next registration.
+	static void SetStashData(bool bStash) { s_bStashData = bStash; }
+
+	// Where histories spill their old data, see CViewbackHistory::SpillTo().
+	// Empty for no spilling. Only set it while nothing is connected, the
+	// data thread reads it when it makes a history.
+	static void SetSpillDirectory(const std::string& sDirectory) { s_sSpillDirectory = sDirectory; }
+	static const std::string& GetSpillDirectory() { return s_sSpillDirectory; }
+
+	// Channels made up out of the ones the server sends, see
+	// CViewbackHistory's constructor. Same rules as the spill directory.
+	static void AddDerivedChannel(const CViewbackDerivedChannel& oChannel) { s_aDerivedChannels.push_back(oChannel); }
+	static void ClearDerivedChannels() { s_aDerivedChannels.clear(); }
+	static const std::vector<CViewbackDerivedChannel>& GetDerivedChannels() { return s_aDerivedChannels; }
+
+	// Conditions the history watches the data for, same rules again.
+	static void AddTrigger(const CViewbackTrigger& oTrigger) { s_aTriggers.push_back(oTrigger); }
+	static void ClearTriggers() { s_aTriggers.clear(); }
+	static const std::vector<CViewbackTrigger>& GetTriggers() { return s_aTriggers; }
+
+	// Gets the data thread out of its poll so it can look at the queues and flags.
+	static void Wake();
 
 private:
+	friend class CViewbackDataConnection;
+
 	CViewbackDataThread();
 	static CViewbackDataThread& DataThread();
 
 private:
-	bool Initialize(unsigned long address, unsigned short port);
+	bool StartThread();
 
 	static void ThreadMain(CViewbackDataThread* pThis);
 
 	void Pump();
-
-	void MaintainDrops();
+	void TakeAdded();
 
 private:
 	pthread_t m_iThread;
 
-	vb__socket_t        m_socket;
-
-	std::vector<Packet> m_aMessages;
+	vb__wakeup_t m_wakeup;
 
-	std::vector<char>   m_aLeftover;
+	// Data thread only.
+	std::vector<CViewbackDataConnection*> m_apConnections;
+	std::vector<vb__pollfd_t>             m_aPoll;
+	std::vector<CViewbackDataConnection*> m_apPolled; // The connection each of m_aPoll is for, NULL for the wakeup.
 
 	// Thread signalling.
 	static std::atomic<bool> s_bRunning;
+	static std::atomic<bool> s_bShutdown; // Read/write for the main thread, read only for the data thread.
 
-	static std::atomic<bool>   s_bConnected; // Read/write for the data thread, read only for others.
-
-	static std::vector<Packet> s_aDataDrop;
-	static std::atomic<bool>   s_bDataDropReady; // Data thread sets up s_aDataDrop and then flips this. Main thread clears s_aDataDrop and then flips it back.
-
-	static std::string       s_sCommandDrop;
-	static std::atomic<bool> s_bCommandDropReady; // Main thread sets up s_sCommandDrop and then flips this. Data thread clears s_sCommandDrop and then flips it back.
+	static std::vector<CViewbackDataConnection*> s_apAdded; // Waiting for the data thread to pick them up.
+	static std::atomic<bool>                     s_bAdded;
+	static pthread_mutex_t                       s_added_mutex;
 
-	static std::atomic<bool> s_bDisconnect; // Read/write for other threads, read only for the data thread. While this flag is on, data thread is to remain disconnected.
+	static std::atomic<bool>                    s_bStashData;
+	static std::string                          s_sSpillDirectory;
+	static std::vector<CViewbackDerivedChannel> s_aDerivedChannels;
+	static std::vector<CViewbackTrigger>        s_aTriggers;
 };
 
 }
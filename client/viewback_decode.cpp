@@ -0,0 +1,322 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "viewback_decode.h"
+
+#include <string.h>
+
+using namespace vb;
+
+// Protobuf wire types.
+#define WIRE_VARINT  0
+#define WIRE_FIXED64 1
+#define WIRE_LENGTH  2
+#define WIRE_FIXED32 5
+
+namespace
+{
+
+// Walks a protobuf message one field at a time. Every read is bounds checked,
+// running off the end just makes the reader invalid.
+class CWireReader
+{
+public:
+	CWireReader(const unsigned char* pData, size_t iLength)
+	{
+		m_pData = pData;
+		m_pEnd = pData + iLength;
+		m_bValid = true;
+	}
+
+public:
+	bool AtEnd() const { return m_pData >= m_pEnd; }
+	bool IsValid() const { return m_bValid; }
+
+	unsigned long long ReadVarint()
+	{
+		unsigned long long iValue = 0;
+
+		for (int iShift = 0; iShift < 64; iShift += 7)
+		{
+			if (m_pData >= m_pEnd)
+				break;
+
+			unsigned char iByte = *m_pData++;
+			iValue |= (unsigned long long)(iByte & 0x7F) << iShift;
+
+			if (!(iByte & 0x80))
+				return iValue;
+		}
+
+		m_bValid = false;
+		return 0;
+	}
+
+	float ReadFloat()
+	{
+		float flValue = 0;
+		if (!Have(sizeof(flValue)))
+			return 0;
+
+		// Protobuf is little endian, and so is everything Viewback runs on.
+		memcpy(&flValue, m_pData, sizeof(flValue));
+		m_pData += sizeof(flValue);
+		return flValue;
+	}
+
+	double ReadDouble()
+	{
+		double flValue = 0;
+		if (!Have(sizeof(flValue)))
+			return 0;
+
+		memcpy(&flValue, m_pData, sizeof(flValue));
+		m_pData += sizeof(flValue);
+		return flValue;
+	}
+
+	// Returns a reader for an embedded message and skips past it.
+	CWireReader ReadMessage()
+	{
+		size_t iLength = (size_t)ReadVarint();
+		if (!m_bValid || !Have(iLength))
+			return CWireReader(m_pEnd, 0);
+
+		CWireReader oMessage(m_pData, iLength);
+		m_pData += iLength;
+		return oMessage;
+	}
+
+	void Skip(int iWireType)
+	{
+		switch (iWireType)
+		{
+		case WIRE_VARINT:
+			ReadVarint();
+			break;
+
+		case WIRE_FIXED64:
+			if (Have(8))
+				m_pData += 8;
+			break;
+
+		case WIRE_LENGTH:
+		{
+			size_t iLength = (size_t)ReadVarint();
+			if (m_bValid && Have(iLength))
+				m_pData += iLength;
+			break;
+		}
+
+		case WIRE_FIXED32:
+			if (Have(4))
+				m_pData += 4;
+			break;
+
+		default:
+			// Groups are deprecated and Viewback never uses them.
+			m_bValid = false;
+			break;
+		}
+	}
+
+private:
+	bool Have(size_t iBytes)
+	{
+		if ((size_t)(m_pEnd - m_pData) < iBytes)
+			m_bValid = false;
+
+		return m_bValid;
+	}
+
+private:
+	const unsigned char* m_pData;
+	const unsigned char* m_pEnd;
+	bool                 m_bValid;
+};
+
+}
+
+bool vb::DecodeSample(const void* pPacket, size_t iLength, CViewbackSample& oSample)
+{
+	memset(&oSample, 0, sizeof(oSample));
+
+	bool bHasData = false;
+
+	// Same rules as the generated code: a double time wins over an integer
+	// one, and if a field shows up twice the last one counts.
+	bool bTimeDouble = false, bTimeInt = false;
+	bool bMaintainDouble = false, bMaintainInt = false;
+	double flTimeDouble = 0, flMaintainDouble = 0;
+	unsigned long long iTimeInt = 0, iMaintainInt = 0;
+
+	CWireReader oPacket((const unsigned char*)pPacket, iLength);
+
+	while (!oPacket.AtEnd())
+	{
+		unsigned long long iTag = oPacket.ReadVarint();
+
+		if (!oPacket.IsValid())
+			return false;
+
+		// The server sets is_registration on every packet, false is fine.
+		if (iTag == ((8 << 3) | WIRE_VARINT))
+		{
+			if (oPacket.ReadVarint() || !oPacket.IsValid())
+				return false;
+			continue;
+		}
+
+		// Anything but Packet.data needs the full parser.
+		if (iTag != ((1 << 3) | WIRE_LENGTH))
+			return false;
+
+		bHasData = true;
+
+		CWireReader oData = oPacket.ReadMessage();
+		if (!oPacket.IsValid())
+			return false;
+
+		while (!oData.AtEnd())
+		{
+			iTag = oData.ReadVarint();
+			if (!oData.IsValid())
+				return false;
+
+			// Field 0 and tags that don't fit in 32 bits are malformed, the generated code turns them down.
+			if (!(iTag >> 3) || iTag > 0xFFFFFFFF)
+				return false;
+
+			int iWireType = (int)(iTag & 7);
+
+			switch (iTag >> 3)
+			{
+			case 1: // handle
+				if (iWireType != WIRE_VARINT)
+					return false;
+				oSample.m_iHandle = (unsigned int)oData.ReadVarint();
+				break;
+
+			case 3: // data_int
+				if (iWireType != WIRE_VARINT)
+					return false;
+				oSample.m_iValue = (int)(unsigned int)oData.ReadVarint();
+				break;
+
+			case 4: // data_float
+			case 5: // data_float_x
+			case 6: // data_float_y
+			case 7: // data_float_z
+			{
+				if (iWireType != WIRE_FIXED32)
+					return false;
+
+				float flValue = oData.ReadFloat();
+
+				// data_float and data_float_x share a slot, a channel only ever sends one of them.
+				if ((iTag >> 3) == 4)
+					oSample.m_aflValue[0] = flValue;
+				else
+					oSample.m_aflValue[(iTag >> 3) - 5] = flValue;
+				break;
+			}
+
+			case 8: // time_double
+				if (iWireType != WIRE_FIXED64)
+					return false;
+				flTimeDouble = oData.ReadDouble();
+				bTimeDouble = true;
+				break;
+
+			case 9: // time_uint64
+				if (iWireType != WIRE_VARINT)
+					return false;
+				iTimeInt = oData.ReadVarint();
+				bTimeInt = true;
+				break;
+
+			case 10: // maintain_time_double
+				if (iWireType != WIRE_FIXED64)
+					return false;
+				flMaintainDouble = oData.ReadDouble();
+				bMaintainDouble = true;
+				break;
+
+			case 11: // maintain_time_uint64
+				if (iWireType != WIRE_VARINT)
+					return false;
+				iMaintainInt = oData.ReadVarint();
+				bMaintainInt = true;
+				break;
+
+			default:
+				oData.Skip(iWireType);
+				break;
+			}
+
+			if (!oData.IsValid())
+				return false;
+		}
+	}
+
+	if (!bHasData)
+		return false;
+
+	if (bTimeDouble)
+		oSample.m_flTime = flTimeDouble;
+	else if (bTimeInt)
+		oSample.m_flTime = ((double)iTimeInt) / 1000;
+
+	oSample.m_bHasTime = bTimeDouble || bTimeInt;
+
+	if (bMaintainDouble)
+		oSample.m_flMaintainTime = flMaintainDouble;
+	else if (bMaintainInt)
+		oSample.m_flMaintainTime = ((double)iMaintainInt) / 1000;
+
+	oSample.m_bHasMaintainTime = bMaintainDouble || bMaintainInt;
+
+	return true;
+}
+
+void vb::SampleFromData(const Data& oData, CViewbackSample& oSample)
+{
+	memset(&oSample, 0, sizeof(oSample));
+
+	oSample.m_iHandle = oData.handle();
+	oSample.m_iValue = oData.data_int();
+
+	if (oData.has_data_float())
+		oSample.m_aflValue[0] = oData.data_float();
+	else
+		oSample.m_aflValue[0] = oData.data_float_x();
+
+	oSample.m_aflValue[1] = oData.data_float_y();
+	oSample.m_aflValue[2] = oData.data_float_z();
+
+	if (oData.has_time_double())
+		oSample.m_flTime = oData.time_double();
+	else if (oData.has_time_uint64())
+		oSample.m_flTime = ((double)oData.time_uint64()) / 1000;
+
+	oSample.m_bHasTime = oData.has_time_double() || oData.has_time_uint64();
+
+	if (oData.has_maintain_time_double())
+		oSample.m_flMaintainTime = oData.maintain_time_double();
+	else if (oData.has_maintain_time_uint64())
+		oSample.m_flMaintainTime = ((double)oData.maintain_time_uint64()) / 1000;
+
+	oSample.m_bHasMaintainTime = oData.has_maintain_time_double() || oData.has_maintain_time_uint64();
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include "../protobuf/data.pb.h"
+
+namespace vb
+{
+
+class CViewbackHistory;
+
+// One data sample, which is what almost every packet from the server holds.
+// Plain old data, so it can be decoded and passed around without touching
+// the heap.
+class CViewbackSample
+{
+public:
+	unsigned int m_iHandle;
+	double       m_flTime;            // In seconds.
+	double       m_flMaintainTime;    // In seconds, only if m_bHasMaintainTime.
+	bool         m_bHasMaintainTime;
+	bool         m_bHasTime;
+	int          m_iValue;            // Int channels.
+	float        m_aflValue[3];       // Float channels use the first one, vector channels all three.
+};
+
+// Something the server sent. Data samples, the bulk of the traffic, are
+// decoded straight into m_oSample without ever building a Packet. Everything
+// else is parsed into m_oPacket.
+class CViewbackMessage
+{
+public:
+	CViewbackMessage()
+	{
+		m_bSample = false;
+		m_pHistory = NULL;
+	}
+
+public:
+	bool              m_bSample;
+	CViewbackSample   m_oSample;  // Only if m_bSample.
+	Packet            m_oPacket;  // Only if !m_bSample.
+	CViewbackHistory* m_pHistory; // Only for registrations, if the data thread is stashing the data.
+};
+
+// Decodes a serialized Packet straight into a sample, if the packet holds
+// nothing but a Data message (and is_registration = false, which the server
+// always sends). Returns false for anything else (registrations,
+// console output, status, controls, or a malformed packet), which should go
+// through Packet::ParseFromArray() instead.
+bool DecodeSample(const void* pPacket, size_t iLength, CViewbackSample& oSample);
+
+// The same, for a Data message that has already been parsed.
+void SampleFromData(const Data& oData, CViewbackSample& oSample);
+
+}
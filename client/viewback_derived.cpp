@@ -0,0 +1,548 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "viewback_derived.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "viewback_history.h"
+
+using namespace std;
+using namespace vb;
+
+// The parser recurses once per level of parentheses or minus signs. Past
+// this an expression is refused instead of running out of stack.
+#define VB_MAX_EXPRESSION_NESTING 256
+
+CViewbackExpression::CViewbackExpression()
+{
+	m_psSource = NULL;
+	m_iPosition = 0;
+	m_pasNames = NULL;
+	m_paeTypes = NULL;
+	m_iDepth = 0;
+	m_iMaxDepth = 0;
+	m_iNesting = 0;
+}
+
+bool CViewbackExpression::Compile(const string& sExpression, const vector<string>& asNames, const vector<vb_data_type_t>& aeTypes, string& sError)
+{
+	m_aInstructions.clear();
+	m_aStates.clear();
+	m_aiInputs.clear();
+
+	m_psSource = &sExpression;
+	m_iPosition = 0;
+	m_pasNames = &asNames;
+	m_paeTypes = &aeTypes;
+	m_sError.clear();
+	m_iDepth = 0;
+	m_iMaxDepth = 0;
+	m_iNesting = 0;
+
+	bool bCompiled = ParseSum();
+
+	SkipSpace();
+	if (bCompiled && m_iPosition < sExpression.length())
+		bCompiled = Fail("Unexpected '" + sExpression.substr(m_iPosition, 1) + "'");
+
+	m_psSource = NULL;
+	m_pasNames = NULL;
+	m_paeTypes = NULL;
+
+	if (!bCompiled)
+	{
+		sError = m_sError;
+		m_aInstructions.clear();
+		return false;
+	}
+
+	m_aflStack.resize(m_iMaxDepth);
+
+	return true;
+}
+
+bool CViewbackExpression::Evaluate(double flTime, const vector<CViewbackDataList>& aData, double& flValue)
+{
+	for (size_t i = 0; i < m_aiInputs.size(); i++)
+	{
+		const CViewbackDataList& oList = aData[m_aiInputs[i]];
+		if (!oList.m_aIntData.written() && !oList.m_aFloatData.written() && !oList.m_aVectorData.written())
+			return false;
+	}
+
+	// pflTop points just past the top of the stack.
+	double* pflTop = &m_aflStack[0];
+
+	for (size_t i = 0; i < m_aInstructions.size(); i++)
+	{
+		const CInstruction& oInstruction = m_aInstructions[i];
+
+		switch (oInstruction.m_eOp)
+		{
+		case OP_CONSTANT:
+			*pflTop++ = oInstruction.m_flValue;
+			break;
+
+		case OP_CHANNEL:
+		{
+			const CViewbackDataList& oList = aData[oInstruction.m_iIndex];
+			if (oList.m_aIntData.written())
+				*pflTop++ = oList.m_aIntData.last_written().data;
+			else
+				*pflTop++ = oList.m_aFloatData.last_written().data;
+			break;
+		}
+
+		case OP_VECTOR_LENGTH:
+		case OP_VECTOR_X:
+		case OP_VECTOR_Y:
+		case OP_VECTOR_Z:
+		{
+			const VBVector3& vecValue = aData[oInstruction.m_iIndex].m_aVectorData.last_written().data;
+			if (oInstruction.m_eOp == OP_VECTOR_LENGTH)
+				*pflTop++ = sqrt((double)vecValue.x * vecValue.x + (double)vecValue.y * vecValue.y + (double)vecValue.z * vecValue.z);
+			else if (oInstruction.m_eOp == OP_VECTOR_X)
+				*pflTop++ = vecValue.x;
+			else if (oInstruction.m_eOp == OP_VECTOR_Y)
+				*pflTop++ = vecValue.y;
+			else
+				*pflTop++ = vecValue.z;
+			break;
+		}
+
+		case OP_ADD:
+			pflTop--;
+			pflTop[-1] += pflTop[0];
+			break;
+
+		case OP_SUBTRACT:
+			pflTop--;
+			pflTop[-1] -= pflTop[0];
+			break;
+
+		case OP_MULTIPLY:
+			pflTop--;
+			pflTop[-1] *= pflTop[0];
+			break;
+
+		case OP_DIVIDE:
+			pflTop--;
+			pflTop[-1] = pflTop[0] ? pflTop[-1] / pflTop[0] : 0;
+			break;
+
+		case OP_NEGATE:
+			pflTop[-1] = -pflTop[-1];
+			break;
+
+		case OP_ABS:
+			pflTop[-1] = fabs(pflTop[-1]);
+			break;
+
+		case OP_SQRT:
+			pflTop[-1] = (pflTop[-1] > 0) ? sqrt(pflTop[-1]) : 0;
+			break;
+
+		case OP_MIN:
+			pflTop--;
+			if (pflTop[0] < pflTop[-1])
+				pflTop[-1] = pflTop[0];
+			break;
+
+		case OP_MAX:
+			pflTop--;
+			if (pflTop[0] > pflTop[-1])
+				pflTop[-1] = pflTop[0];
+			break;
+
+		case OP_DERIVATIVE:
+		{
+			CState& oState = m_aStates[oInstruction.m_iIndex];
+			double flCurrent = pflTop[-1];
+
+			// Two samples at the same time keep the last slope rather than divide by zero.
+			if (oState.m_bHasPrevious && flTime > oState.m_flPreviousTime)
+				oState.m_flDerivative = (flCurrent - oState.m_flPrevious) / (flTime - oState.m_flPreviousTime);
+
+			if (!oState.m_bHasPrevious || flTime > oState.m_flPreviousTime)
+			{
+				oState.m_bHasPrevious = true;
+				oState.m_flPreviousTime = flTime;
+				oState.m_flPrevious = flCurrent;
+			}
+
+			pflTop[-1] = oState.m_flDerivative;
+			break;
+		}
+
+		case OP_AVERAGE:
+		{
+			CState& oState = m_aStates[oInstruction.m_iIndex];
+
+			oState.m_aWindow.push_back(pair<double, double>(flTime, pflTop[-1]));
+			oState.m_flSum += pflTop[-1];
+
+			while (oState.m_aWindow.front().first < flTime - oInstruction.m_flValue)
+			{
+				oState.m_flSum -= oState.m_aWindow.front().second;
+				oState.m_aWindow.pop_front();
+			}
+
+			pflTop[-1] = oState.m_flSum / oState.m_aWindow.size();
+			break;
+		}
+		}
+	}
+
+	flValue = pflTop[-1];
+	return true;
+}
+
+bool CViewbackExpression::ParseSum()
+{
+	if (!ParseProduct())
+		return false;
+
+	while (true)
+	{
+		SkipSpace();
+
+		if (m_iPosition >= m_psSource->length())
+			return true;
+
+		char c = (*m_psSource)[m_iPosition];
+		if (c != '+' && c != '-')
+			return true;
+
+		m_iPosition++;
+
+		if (!ParseProduct())
+			return false;
+
+		Emit(c == '+' ? OP_ADD : OP_SUBTRACT);
+	}
+}
+
+bool CViewbackExpression::ParseProduct()
+{
+	if (!ParseUnary())
+		return false;
+
+	while (true)
+	{
+		SkipSpace();
+
+		if (m_iPosition >= m_psSource->length())
+			return true;
+
+		char c = (*m_psSource)[m_iPosition];
+		if (c != '*' && c != '/')
+			return true;
+
+		m_iPosition++;
+
+		if (!ParseUnary())
+			return false;
+
+		Emit(c == '*' ? OP_MULTIPLY : OP_DIVIDE);
+	}
+}
+
+bool CViewbackExpression::ParseUnary()
+{
+	// Everything that nests comes through here.
+	if (m_iNesting >= VB_MAX_EXPRESSION_NESTING)
+		return Fail("Expression is nested too deeply");
+
+	m_iNesting++;
+
+	bool bParsed;
+
+	SkipSpace();
+
+	if (m_iPosition < m_psSource->length() && (*m_psSource)[m_iPosition] == '-')
+	{
+		m_iPosition++;
+
+		bParsed = ParseUnary();
+		if (bParsed)
+			Emit(OP_NEGATE);
+	}
+	else
+		bParsed = ParsePrimary();
+
+	m_iNesting--;
+
+	return bParsed;
+}
+
+bool CViewbackExpression::ParsePrimary()
+{
+	SkipSpace();
+
+	if (m_iPosition >= m_psSource->length())
+		return Fail("Unexpected end of expression");
+
+	const string& sSource = *m_psSource;
+	char c = sSource[m_iPosition];
+
+	if (c == '(')
+	{
+		m_iPosition++;
+		return ParseSum() && Expect(')');
+	}
+
+	if (isdigit((unsigned char)c) || c == '.')
+	{
+		char* pszEnd;
+		double flValue = strtod(sSource.c_str() + m_iPosition, &pszEnd);
+		if (pszEnd == sSource.c_str() + m_iPosition)
+			return Fail("Bad number");
+
+		m_iPosition = pszEnd - sSource.c_str();
+		Emit(OP_CONSTANT, flValue);
+		return true;
+	}
+
+	size_t iStart = m_iPosition;
+
+	string sName;
+	if (!ParseName(sName))
+		return false;
+
+	SkipSpace();
+
+	bool bCall = c != '"' && m_iPosition < sSource.length() && sSource[m_iPosition] == '(';
+	if (!bCall)
+	{
+		m_iPosition = iStart;
+
+		size_t iHandle;
+		if (!ParseChannel(false, iHandle))
+			return false;
+
+		Emit(OP_CHANNEL, 0, iHandle);
+		return true;
+	}
+
+	m_iPosition++;
+
+	if (sName == "length" || sName == "x" || sName == "y" || sName == "z")
+	{
+		size_t iHandle;
+		if (!ParseChannel(true, iHandle) || !Expect(')'))
+			return false;
+
+		if (sName == "length")
+			Emit(OP_VECTOR_LENGTH, 0, iHandle);
+		else if (sName == "x")
+			Emit(OP_VECTOR_X, 0, iHandle);
+		else if (sName == "y")
+			Emit(OP_VECTOR_Y, 0, iHandle);
+		else
+			Emit(OP_VECTOR_Z, 0, iHandle);
+
+		return true;
+	}
+
+	if (sName == "abs" || sName == "sqrt" || sName == "deriv")
+	{
+		if (!ParseSum() || !Expect(')'))
+			return false;
+
+		if (sName == "abs")
+			Emit(OP_ABS);
+		else if (sName == "sqrt")
+			Emit(OP_SQRT);
+		else
+		{
+			Emit(OP_DERIVATIVE, 0, m_aStates.size());
+			m_aStates.push_back(CState());
+		}
+
+		return true;
+	}
+
+	if (sName == "min" || sName == "max")
+	{
+		if (!ParseSum() || !Expect(',') || !ParseSum() || !Expect(')'))
+			return false;
+
+		Emit(sName == "min" ? OP_MIN : OP_MAX);
+		return true;
+	}
+
+	if (sName == "avg")
+	{
+		if (!ParseSum() || !Expect(','))
+			return false;
+
+		SkipSpace();
+
+		char* pszEnd;
+		double flWindow = strtod(sSource.c_str() + m_iPosition, &pszEnd);
+		if (pszEnd == sSource.c_str() + m_iPosition || !(flWindow > 0))
+			return Fail("avg() needs a number of seconds");
+
+		m_iPosition = pszEnd - sSource.c_str();
+
+		if (!Expect(')'))
+			return false;
+
+		Emit(OP_AVERAGE, flWindow, m_aStates.size());
+		m_aStates.push_back(CState());
+		return true;
+	}
+
+	return Fail("Unknown function " + sName + "()");
+}
+
+bool CViewbackExpression::ParseName(string& sName)
+{
+	const string& sSource = *m_psSource;
+
+	if (sSource[m_iPosition] == '"')
+	{
+		size_t iEnd = sSource.find('"', m_iPosition + 1);
+		if (iEnd == string::npos)
+			return Fail("Missing closing quote");
+
+		sName = sSource.substr(m_iPosition + 1, iEnd - m_iPosition - 1);
+		m_iPosition = iEnd + 1;
+		return true;
+	}
+
+	size_t iStart = m_iPosition;
+	while (m_iPosition < sSource.length() && (isalnum((unsigned char)sSource[m_iPosition]) || sSource[m_iPosition] == '_' || sSource[m_iPosition] == '.'))
+		m_iPosition++;
+
+	if (m_iPosition == iStart)
+		return Fail("Unexpected '" + sSource.substr(m_iPosition, 1) + "'");
+
+	sName = sSource.substr(iStart, m_iPosition - iStart);
+	return true;
+}
+
+bool CViewbackExpression::ParseChannel(bool bVector, size_t& iHandle)
+{
+	SkipSpace();
+
+	if (m_iPosition >= m_psSource->length())
+		return Fail("Unexpected end of expression");
+
+	string sName;
+	if (!ParseName(sName))
+		return false;
+
+	const vector<string>& asNames = *m_pasNames;
+
+	for (iHandle = 0; iHandle < asNames.size(); iHandle++)
+	{
+		if (asNames[iHandle] == sName)
+			break;
+	}
+
+	if (iHandle == asNames.size())
+		return Fail("No channel named " + sName);
+
+	vb_data_type_t eType = (*m_paeTypes)[iHandle];
+
+	if (bVector && eType != VB_DATATYPE_VECTOR)
+		return Fail(sName + " isn't a vector channel");
+
+	if (!bVector && eType == VB_DATATYPE_VECTOR)
+		return Fail(sName + " is a vector channel, use length(), x(), y() or z()");
+
+	if (eType != VB_DATATYPE_INT && eType != VB_DATATYPE_FLOAT && eType != VB_DATATYPE_VECTOR)
+		return Fail(sName + " has no type");
+
+	for (size_t i = 0; i < m_aiInputs.size(); i++)
+	{
+		if (m_aiInputs[i] == iHandle)
+			return true;
+	}
+
+	m_aiInputs.push_back(iHandle);
+	return true;
+}
+
+bool CViewbackExpression::Expect(char c)
+{
+	SkipSpace();
+
+	if (m_iPosition >= m_psSource->length() || (*m_psSource)[m_iPosition] != c)
+		return Fail(string("Expected '") + c + "'");
+
+	m_iPosition++;
+	return true;
+}
+
+void CViewbackExpression::SkipSpace()
+{
+	while (m_iPosition < m_psSource->length() && isspace((unsigned char)(*m_psSource)[m_iPosition]))
+		m_iPosition++;
+}
+
+bool CViewbackExpression::Fail(const string& sError)
+{
+	char szPosition[32];
+	sprintf(szPosition, " at character %d", (int)m_iPosition + 1);
+
+	if (!m_sError.length())
+		m_sError = sError + szPosition;
+
+	return false;
+}
+
+void CViewbackExpression::Emit(op_t eOp, double flValue, size_t iIndex)
+{
+	CInstruction oInstruction;
+	oInstruction.m_eOp = eOp;
+	oInstruction.m_flValue = flValue;
+	oInstruction.m_iIndex = iIndex;
+	m_aInstructions.push_back(oInstruction);
+
+	// Keep track of how deep the stack gets so it can be made big enough up front.
+	switch (eOp)
+	{
+	case OP_CONSTANT:
+	case OP_CHANNEL:
+	case OP_VECTOR_LENGTH:
+	case OP_VECTOR_X:
+	case OP_VECTOR_Y:
+	case OP_VECTOR_Z:
+		m_iDepth++;
+		break;
+
+	case OP_ADD:
+	case OP_SUBTRACT:
+	case OP_MULTIPLY:
+	case OP_DIVIDE:
+	case OP_MIN:
+	case OP_MAX:
+		m_iDepth--;
+		break;
+
+	default:
+		break;
+	}
+
+	if (m_iDepth > m_iMaxDepth)
+		m_iMaxDepth = m_iDepth;
+}
@@ -0,0 +1,149 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "../protobuf/data.pb.h"
+
+namespace vb
+{
+
+class CViewbackDataList;
+
+// A channel the client makes up out of the ones the server sends, see
+// CViewbackClient::AddDerivedChannel().
+class CViewbackDerivedChannel
+{
+public:
+	std::string m_sName;
+	std::string m_sExpression;
+};
+
+// A derived channel's expression, compiled once into a little stack machine
+// and then run every time one of the channels it uses gets a sample.
+//
+//   Channels  By name, or in double quotes if the name has spaces. Int and
+//             float channels are their latest value. Vector channels can
+//             only be used through length(), x(), y() and z().
+//   Operators + - * / and parentheses. Dividing by zero gives zero.
+//   Functions abs(a), sqrt(a), min(a, b), max(a, b)
+//             deriv(a)        Change per second since the last sample.
+//             avg(a, seconds) Average over the last so many seconds of samples.
+//
+// For example: deriv(length("Player velocity")) or avg(fps - 60, 0.5)
+class CViewbackExpression
+{
+public:
+	CViewbackExpression();
+
+public:
+	// asNames and aeTypes are the channels it can use, by handle. Returns
+	// false with a reason in sError if it doesn't make sense.
+	bool Compile(const std::string& sExpression, const std::vector<std::string>& asNames, const std::vector<vb_data_type_t>& aeTypes, std::string& sError);
+
+	// Writer. The value at flTime going by the latest sample of each channel
+	// in aData. False until every channel it uses has a sample.
+	bool Evaluate(double flTime, const std::vector<CViewbackDataList>& aData, double& flValue);
+
+	// The handles of the channels it uses, each one once.
+	const std::vector<size_t>& GetInputs() const { return m_aiInputs; }
+
+private:
+	typedef enum
+	{
+		OP_CONSTANT,
+		OP_CHANNEL,
+		OP_VECTOR_LENGTH,
+		OP_VECTOR_X,
+		OP_VECTOR_Y,
+		OP_VECTOR_Z,
+		OP_ADD,
+		OP_SUBTRACT,
+		OP_MULTIPLY,
+		OP_DIVIDE,
+		OP_NEGATE,
+		OP_ABS,
+		OP_SQRT,
+		OP_MIN,
+		OP_MAX,
+		OP_DERIVATIVE,
+		OP_AVERAGE,
+	} op_t;
+
+	class CInstruction
+	{
+	public:
+		op_t   m_eOp;
+		double m_flValue; // Constants, and avg()'s window.
+		size_t m_iIndex;  // The channel handle, or where deriv() and avg() keep their state.
+	};
+
+	// What deriv() and avg() remember from one sample to the next.
+	class CState
+	{
+	public:
+		CState()
+		{
+			m_bHasPrevious = false;
+			m_flPreviousTime = m_flPrevious = m_flDerivative = 0;
+			m_flSum = 0;
+		}
+
+	public:
+		bool   m_bHasPrevious;
+		double m_flPreviousTime;
+		double m_flPrevious;
+		double m_flDerivative;
+
+		std::deque<std::pair<double, double> > m_aWindow;
+		double                                 m_flSum;
+	};
+
+	// The parser, one function per level of precedence.
+	bool ParseSum();
+	bool ParseProduct();
+	bool ParseUnary();
+	bool ParsePrimary();
+	bool ParseName(std::string& sName);
+	bool ParseChannel(bool bVector, size_t& iHandle);
+	bool Expect(char c);
+	void SkipSpace();
+	bool Fail(const std::string& sError);
+	void Emit(op_t eOp, double flValue = 0, size_t iIndex = 0);
+
+private:
+	std::vector<CInstruction> m_aInstructions;
+	std::vector<CState>       m_aStates;
+	std::vector<size_t>       m_aiInputs;
+	std::vector<double>       m_aflStack;
+
+	// Only while compiling.
+	const std::string*                 m_psSource;
+	size_t                             m_iPosition;
+	const std::vector<std::string>*    m_pasNames;
+	const std::vector<vb_data_type_t>* m_paeTypes;
+	std::string                        m_sError;
+	size_t                             m_iDepth;
+	size_t                             m_iMaxDepth;
+	size_t                             m_iNesting; // Of the parse, see VB_MAX_EXPRESSION_NESTING.
+};
+
+}
@@ -0,0 +1,459 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _WIN32
+// Sessions can run long enough to make files bigger than 2GB.
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "viewback_export.h"
+
+#include <float.h>
+#include <string.h>
+
+#include "viewback_capture.h"
+#include "viewback_decode.h"
+
+using namespace vb;
+using namespace std;
+
+// Big writes, a gigabyte session is millions of rows.
+#define VB_EXPORT_BUFFER_SIZE (1024*1024)
+
+// Long enough for any number, or three of them.
+#define VB_EXPORT_VALUE_SIZE 128
+
+static void ChannelsFromRegistration(const Packet& oPacket, vector<CViewbackDataChannel>& aChannels)
+{
+	aChannels.clear();
+
+	for (int i = 0; i < oPacket.data_channels_size(); i++)
+	{
+		const DataChannel& oChannelProtobuf = oPacket.data_channels(i);
+		size_t iHandle = oChannelProtobuf.handle();
+
+		if (iHandle >= aChannels.size())
+			aChannels.resize(iHandle + 1);
+
+		CViewbackDataChannel& oChannel = aChannels[iHandle];
+		oChannel.m_iHandle = (unsigned int)iHandle;
+		oChannel.m_sName = oChannelProtobuf.name();
+		oChannel.m_eDataType = oChannelProtobuf.type();
+		oChannel.m_flMin = oChannelProtobuf.range_min();
+		oChannel.m_flMax = oChannelProtobuf.range_max();
+	}
+
+	for (int i = 0; i < oPacket.data_labels_size(); i++)
+	{
+		const DataLabel& oLabel = oPacket.data_labels(i);
+
+		if (oLabel.channel() < aChannels.size())
+			aChannels[oLabel.channel()].m_asLabels.Set(oLabel.value(), oLabel.label());
+	}
+}
+
+CViewbackExporter::CViewbackExporter()
+{
+	m_flStart = -DBL_MAX;
+	m_flEnd = DBL_MAX;
+
+	m_eFormat = VB_EXPORT_CSV;
+	m_pFile = NULL;
+	m_bError = false;
+	m_iSamples = 0;
+	m_iSize = 0;
+}
+
+CViewbackExporter::~CViewbackExporter()
+{
+	Close();
+}
+
+void CViewbackExporter::SelectChannel(const string& sName)
+{
+	m_asSelected.push_back(sName);
+}
+
+void CViewbackExporter::ClearChannels()
+{
+	m_asSelected.clear();
+}
+
+void CViewbackExporter::SetTimeRange(double flStart, double flEnd)
+{
+	m_flStart = flStart;
+	m_flEnd = flEnd;
+}
+
+bool CViewbackExporter::Open(const char* pszFile, vb_export_format_t eFormat)
+{
+	Close();
+
+	m_eFormat = eFormat;
+	m_bError = false;
+	m_iSamples = 0;
+	m_iSize = 0;
+
+	if (m_eFormat == VB_EXPORT_COLUMNAR)
+		return m_oColumnar.Open(pszFile);
+
+	m_pFile = fopen(pszFile, "wb");
+	if (!m_pFile)
+		return false;
+
+	m_aBuffer.resize(VB_EXPORT_BUFFER_SIZE);
+	setvbuf(m_pFile, m_aBuffer.data(), _IOFBF, m_aBuffer.size());
+
+	static const char szHeader[] = "time,channel,value,x,y,z,label\n";
+	return WriteRow(szHeader, (int)strlen(szHeader));
+}
+
+bool CViewbackExporter::Close()
+{
+	m_aChannels.clear();
+	m_aLast.clear();
+
+	if (m_oColumnar.IsOpen())
+		return m_oColumnar.Close();
+
+	if (!m_pFile)
+		return false;
+
+	if (fclose(m_pFile) != 0)
+		m_bError = true;
+
+	m_pFile = NULL;
+
+	// Only once the file is closed, it was the file's buffer.
+	m_aBuffer.clear();
+	m_aBuffer.shrink_to_fit();
+
+	return !m_bError;
+}
+
+unsigned long long CViewbackExporter::GetSize() const
+{
+	if (m_oColumnar.IsOpen())
+		return m_oColumnar.GetSize();
+
+	return m_iSize;
+}
+
+bool CViewbackExporter::ExportData(const vector<CViewbackDataChannel>& aChannels, const vector<CViewbackDataList>& aData)
+{
+	if (!IsOpen())
+		return false;
+
+	SetChannels(aChannels);
+
+	for (size_t i = 0; i < m_aChannels.size() && i < aData.size(); i++)
+	{
+		switch (m_aChannels[i].m_eDataType)
+		{
+		case VB_DATATYPE_INT:
+			ExportSeries(i, aData[i].m_aIntData);
+			break;
+
+		case VB_DATATYPE_FLOAT:
+			ExportSeries(i, aData[i].m_aFloatData);
+			break;
+
+		case VB_DATATYPE_VECTOR:
+			ExportSeries(i, aData[i].m_aVectorData);
+			break;
+
+		default:
+			break;
+		}
+
+		if (m_bError)
+			return false;
+	}
+
+	return true;
+}
+
+bool CViewbackExporter::ExportCapture(const char* pszCapture)
+{
+	if (!IsOpen())
+		return false;
+
+	CViewbackCaptureReader oReader;
+	if (!oReader.Open(pszCapture))
+		return false;
+
+	Packet oPacket;
+	vector<CViewbackDataChannel> aChannels;
+
+	// Skip what's before the range. The registration that was in effect there comes along.
+	// Each session restarts the clock, so with more than one the whole file is read.
+	if (oReader.GetNumSessions() == 1 && m_flStart > oReader.GetStartTime() && oReader.Seek(m_flStart))
+	{
+		const vector<char>& aRegistration = oReader.GetRegistration();
+
+		if (aRegistration.size() > sizeof(size_t) && oPacket.ParseFromArray(aRegistration.data() + sizeof(size_t), (int)(aRegistration.size() - sizeof(size_t))))
+		{
+			ChannelsFromRegistration(oPacket, aChannels);
+			SetChannels(aChannels);
+		}
+	}
+
+	CViewbackSample oSample;
+	bool bPastEnd = false;
+
+	while (oReader.ReadFrame())
+	{
+		if (oReader.IsRegistration())
+		{
+			bPastEnd = false;
+
+			if (oPacket.ParseFromArray(oReader.GetPacket(), (int)oReader.GetPacketLength()))
+			{
+				ChannelsFromRegistration(oPacket, aChannels);
+				SetChannels(aChannels);
+			}
+
+			continue;
+		}
+
+		// Nothing more from this session, but the next one may be in range.
+		if (bPastEnd)
+			continue;
+
+		// Most packets are one sample, skip protobuf for those.
+		if (!DecodeSample(oReader.GetPacket(), oReader.GetPacketLength(), oSample))
+		{
+			if (!oPacket.ParseFromArray(oReader.GetPacket(), (int)oReader.GetPacketLength()) || !oPacket.has_data())
+				continue;
+
+			SampleFromData(oPacket.data(), oSample);
+		}
+
+		// A session is in time order, see CViewbackCaptureReader::Seek().
+		if (oSample.m_bHasTime && oSample.m_flTime > m_flEnd)
+		{
+			if (oReader.GetNumSessions() == 1)
+				break;
+
+			bPastEnd = true;
+			continue;
+		}
+
+		if (!AddSample(oSample))
+			return false;
+	}
+
+	return !m_bError;
+}
+
+bool CViewbackExporter::IsSelected(const CViewbackDataChannel& oChannel) const
+{
+	if (!m_asSelected.size())
+		return true;
+
+	for (size_t i = 0; i < m_asSelected.size(); i++)
+	{
+		if (m_asSelected[i] == oChannel.m_sName)
+			return true;
+	}
+
+	return false;
+}
+
+void CViewbackExporter::SetChannels(const vector<CViewbackDataChannel>& aChannels)
+{
+	m_aChannels = aChannels;
+
+	// A new registration starts everything over, same as in the client.
+	m_aLast.clear();
+	m_aLast.resize(m_aChannels.size());
+
+	for (size_t i = 0; i < m_aChannels.size(); i++)
+	{
+		if (!IsSelected(m_aChannels[i]))
+			m_aChannels[i].m_eDataType = VB_DATATYPE_NONE;
+
+		if (m_oColumnar.IsOpen() && m_aChannels[i].m_eDataType != VB_DATATYPE_NONE)
+			m_oColumnar.SetChannel(i, m_aChannels[i]);
+	}
+}
+
+bool CViewbackExporter::AddSample(const CViewbackSample& oSample)
+{
+	size_t iHandle = oSample.m_iHandle;
+
+	if (iHandle >= m_aChannels.size())
+		return true;
+
+	double flTime = oSample.m_bHasTime ? oSample.m_flTime : 0;
+
+	// The server threw out some duplicate values. Repeat the previous value
+	// at the maintain time, exactly like the client does.
+	CLastSample& oLast = m_aLast[iHandle];
+	bool bMaintain = oSample.m_bHasMaintainTime && oLast.m_bHasLast && oSample.m_flMaintainTime != oLast.m_flTime;
+
+	switch (m_aChannels[iHandle].m_eDataType)
+	{
+	case VB_DATATYPE_INT:
+		if (bMaintain)
+			WriteSample(iHandle, oSample.m_flMaintainTime, oLast.m_iValue);
+
+		WriteSample(iHandle, flTime, oSample.m_iValue);
+		oLast.m_iValue = oSample.m_iValue;
+		break;
+
+	case VB_DATATYPE_FLOAT:
+		if (bMaintain)
+			WriteSample(iHandle, oSample.m_flMaintainTime, oLast.m_aflValue[0]);
+
+		WriteSample(iHandle, flTime, oSample.m_aflValue[0]);
+		oLast.m_aflValue[0] = oSample.m_aflValue[0];
+		break;
+
+	case VB_DATATYPE_VECTOR:
+		if (bMaintain)
+			WriteSample(iHandle, oSample.m_flMaintainTime, VBVector3(oLast.m_aflValue));
+
+		WriteSample(iHandle, flTime, VBVector3(oSample.m_aflValue));
+		memcpy(oLast.m_aflValue, oSample.m_aflValue, sizeof(oLast.m_aflValue));
+		break;
+
+	default:
+		return true;
+	}
+
+	oLast.m_bHasLast = true;
+	oLast.m_flTime = flTime;
+
+	return !m_bError;
+}
+
+template <typename T>
+bool CViewbackExporter::ExportSeries(size_t iHandle, const CViewbackSeries<T>& aSeries)
+{
+	// The range is a view of the snapshot, nothing is copied out of it.
+	CViewbackRange<T> aRange = aSeries.GetRange(m_flStart, m_flEnd, false);
+
+	for (size_t i = 0; i < aRange.GetNumSpans(); i++)
+	{
+		CViewbackSpan<T> oSpan = aRange.GetSpan(i);
+
+		for (size_t j = 0; j < oSpan.m_iCount; j++)
+		{
+			if (!WriteSample(iHandle, oSpan.GetTime(j), oSpan.GetValue(j)))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool CViewbackExporter::WriteSample(size_t iHandle, double flTime, int iValue)
+{
+	if (flTime < m_flStart || flTime > m_flEnd)
+		return true;
+
+	m_iSamples++;
+
+	if (m_oColumnar.IsOpen())
+		return m_oColumnar.AddInt(iHandle, flTime, iValue);
+
+	char szValue[VB_EXPORT_VALUE_SIZE];
+	int iLength = snprintf(szValue, sizeof(szValue), ",%d,,,,", iValue);
+
+	if (!WriteStart(iHandle, flTime) || !WriteRow(szValue, iLength))
+		return false;
+
+	const string* psLabel = m_aChannels[iHandle].m_asLabels.Find(iValue);
+	if (psLabel && !WriteQuoted(*psLabel))
+		return false;
+
+	return WriteRow("\n", 1);
+}
+
+bool CViewbackExporter::WriteSample(size_t iHandle, double flTime, float flValue)
+{
+	if (flTime < m_flStart || flTime > m_flEnd)
+		return true;
+
+	m_iSamples++;
+
+	if (m_oColumnar.IsOpen())
+		return m_oColumnar.AddFloat(iHandle, flTime, flValue);
+
+	char szValue[VB_EXPORT_VALUE_SIZE];
+	int iLength = snprintf(szValue, sizeof(szValue), ",%.9g,,,,\n", flValue);
+
+	return WriteStart(iHandle, flTime) && WriteRow(szValue, iLength);
+}
+
+bool CViewbackExporter::WriteSample(size_t iHandle, double flTime, const VBVector3& vecValue)
+{
+	if (flTime < m_flStart || flTime > m_flEnd)
+		return true;
+
+	m_iSamples++;
+
+	if (m_oColumnar.IsOpen())
+		return m_oColumnar.AddVector(iHandle, flTime, vecValue);
+
+	char szValue[VB_EXPORT_VALUE_SIZE];
+	int iLength = snprintf(szValue, sizeof(szValue), ",,%.9g,%.9g,%.9g,\n", vecValue.x, vecValue.y, vecValue.z);
+
+	return WriteStart(iHandle, flTime) && WriteRow(szValue, iLength);
+}
+
+bool CViewbackExporter::WriteStart(size_t iHandle, double flTime)
+{
+	char szTime[VB_EXPORT_VALUE_SIZE];
+	int iLength = snprintf(szTime, sizeof(szTime), "%.6f,", flTime);
+
+	return WriteRow(szTime, iLength) && WriteQuoted(m_aChannels[iHandle].m_sName);
+}
+
+bool CViewbackExporter::WriteQuoted(const string& s)
+{
+	if (!WriteRow("\"", 1))
+		return false;
+
+	// Quotes inside are doubled.
+	size_t iStart = 0;
+	for (size_t i = 0; i < s.length(); i++)
+	{
+		if (s[i] != '"')
+			continue;
+
+		if (!WriteRow(s.data() + iStart, (int)(i + 1 - iStart)))
+			return false;
+
+		iStart = i;
+	}
+
+	return WriteRow(s.data() + iStart, (int)(s.length() - iStart)) && WriteRow("\"", 1);
+}
+
+bool CViewbackExporter::WriteRow(const char* pszRow, int iLength)
+{
+	if (!m_pFile || iLength < 0)
+		return false;
+
+	if (iLength && fwrite(pszRow, 1, iLength, m_pFile) != (size_t)iLength)
+		m_bError = true;
+
+	m_iSize += iLength;
+
+	return !m_bError;
+}
@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "viewback_client.h"
+#include "viewback_columnar.h"
+
+namespace vb
+{
+
+typedef enum
+{
+	VB_EXPORT_CSV,      // One row per sample: time,channel,value,x,y,z,label
+	VB_EXPORT_COLUMNAR, // A columnar capture, see viewback_columnar.h.
+} vb_export_format_t;
+
+/*
+	Writes channels out for analysis tools, from a client's data or from a
+	capture file. Everything streams: samples are written as they're read,
+	so memory stays the same however long the session was.
+
+	Set the channels and time range, Open(), export one or more sources,
+	then Close(). With nothing selected every channel is exported.
+
+	Data from a client comes out one channel after another. Data from a
+	capture comes out in the order the server sent it.
+*/
+class CViewbackExporter
+{
+public:
+	CViewbackExporter();
+	~CViewbackExporter();
+
+private:
+	CViewbackExporter(const CViewbackExporter&);
+	CViewbackExporter& operator=(const CViewbackExporter&);
+
+public:
+	void SelectChannel(const std::string& sName);
+	void ClearChannels();
+
+	// Inclusive. Everything by default.
+	void SetTimeRange(double flStart, double flEnd);
+
+	bool Open(const char* pszFile, vb_export_format_t eFormat);
+
+	// Returns false if anything failed to write along the way.
+	bool Close();
+
+	bool IsOpen() const { return m_pFile || m_oColumnar.IsOpen(); }
+
+	// What a client has right now, see CViewbackConnection::GetChannels() and
+	// GetData(). Call it between updates, the data must stay put while it runs.
+	bool ExportData(const std::vector<CViewbackDataChannel>& aChannels, const std::vector<CViewbackDataList>& aData);
+
+	// A capture file as the server wrote it, see vb_config_t::capture_file.
+	bool ExportCapture(const char* pszCapture);
+
+	// Samples one at a time as a server sends them, to record a session as
+	// it happens. Set the channels first and again whenever the server
+	// registers, see DataReceivedCallback.
+	void SetChannels(const std::vector<CViewbackDataChannel>& aChannels);
+	bool AddSample(const CViewbackSample& oSample);
+
+	size_t GetSamplesWritten() const { return m_iSamples; }
+	unsigned long long GetSize() const; // Bytes in the file so far.
+
+private:
+	class CLastSample
+	{
+	public:
+		CLastSample()
+		{
+			m_bHasLast = false;
+			m_flTime = 0;
+			m_iValue = 0;
+			m_aflValue[0] = m_aflValue[1] = m_aflValue[2] = 0;
+		}
+
+	public:
+		bool   m_bHasLast;
+		double m_flTime;
+		int    m_iValue;
+		float  m_aflValue[3];
+	};
+
+	bool IsSelected(const CViewbackDataChannel& oChannel) const;
+
+	template <typename T>
+	bool ExportSeries(size_t iHandle, const CViewbackSeries<T>& aSeries);
+
+	bool WriteSample(size_t iHandle, double flTime, int iValue);
+	bool WriteSample(size_t iHandle, double flTime, float flValue);
+	bool WriteSample(size_t iHandle, double flTime, const VBVector3& vecValue);
+	bool WriteStart(size_t iHandle, double flTime); // The time and channel columns.
+	bool WriteQuoted(const std::string& s);
+	bool WriteRow(const char* pszRow, int iLength);
+
+private:
+	std::vector<std::string> m_asSelected;
+	double                   m_flStart;
+	double                   m_flEnd;
+
+	vb_export_format_t       m_eFormat;
+	FILE*                    m_pFile; // CSV only.
+	std::vector<char>        m_aBuffer;
+	bool                     m_bError;
+	size_t                   m_iSamples;
+	unsigned long long       m_iSize; // CSV only.
+
+	CViewbackColumnarWriter  m_oColumnar;
+
+	// For the source being exported. Unselected channels have VB_DATATYPE_NONE.
+	std::vector<CViewbackDataChannel> m_aChannels;
+	std::vector<CLastSample>          m_aLast;
+};
+
+}
@@ -0,0 +1,544 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "viewback_history.h"
+
+#include <sys/timeb.h>
+#include <algorithm>
+
+#include "../server/viewback_shared.h"
+
+using namespace std;
+using namespace vb;
+
+// Old data is thrown out once per this many seconds of data time.
+#define VB_DATA_CLEAR_INTERVAL 10
+
+CViewbackHistory::CViewbackHistory(const Packet& oRegistration, unsigned iSerial, const vector<CViewbackDerivedChannel>& aDerived, const vector<CViewbackTrigger>& aTriggers)
+{
+	m_iSerial = iSerial;
+	m_iRegisteredChannels = oRegistration.data_channels_size();
+
+	vector<string> asNames(m_iRegisteredChannels);
+	m_aeTypes.resize(m_iRegisteredChannels, VB_DATATYPE_NONE);
+	for (int i = 0; i < oRegistration.data_channels_size(); i++)
+	{
+		auto& oChannel = oRegistration.data_channels(i);
+		if (oChannel.handle() < m_aeTypes.size())
+		{
+			m_aeTypes[oChannel.handle()] = oChannel.type();
+			asNames[oChannel.handle()] = oChannel.name();
+		}
+	}
+
+	// Each derived channel can use the ones before it too.
+	for (size_t i = 0; i < aDerived.size(); i++)
+	{
+		CViewbackExpression oExpression;
+		string sError;
+		if (!oExpression.Compile(aDerived[i].m_sExpression, asNames, m_aeTypes, sError))
+		{
+			VBPrintf("Couldn't make derived channel %s: %s\n", aDerived[i].m_sName.c_str(), sError.c_str());
+			continue;
+		}
+
+		m_aDerived.push_back(oExpression);
+		m_asDerivedNames.push_back(aDerived[i].m_sName);
+		asNames.push_back(aDerived[i].m_sName);
+		m_aeTypes.push_back(VB_DATATYPE_FLOAT);
+	}
+
+	m_aaiDerivedFrom.resize(m_aeTypes.size());
+	for (size_t i = 0; i < m_aDerived.size(); i++)
+	{
+		const vector<size_t>& aiInputs = m_aDerived[i].GetInputs();
+		for (size_t j = 0; j < aiInputs.size(); j++)
+			m_aaiDerivedFrom[aiInputs[j]].push_back(i);
+	}
+
+	m_aaiRulesOn.resize(m_aeTypes.size());
+	for (size_t i = 0; i < aTriggers.size(); i++)
+	{
+		size_t iHandle = find(asNames.begin(), asNames.end(), aTriggers[i].m_sChannel) - asNames.begin();
+		if (iHandle == asNames.size())
+		{
+			VBPrintf("Couldn't make trigger %s: No channel named '%s'\n", aTriggers[i].m_sName.c_str(), aTriggers[i].m_sChannel.c_str());
+			continue;
+		}
+
+		if (m_aeTypes[iHandle] != VB_DATATYPE_INT && m_aeTypes[iHandle] != VB_DATATYPE_FLOAT)
+		{
+			VBPrintf("Couldn't make trigger %s: '%s' isn't an int or float channel, try a derived channel\n", aTriggers[i].m_sName.c_str(), aTriggers[i].m_sChannel.c_str());
+			continue;
+		}
+
+		m_aaiRulesOn[iHandle].push_back(m_aRules.size());
+		m_aRules.push_back(CViewbackRule(aTriggers[i]));
+		m_aTriggers.push_back(aTriggers[i]);
+	}
+
+	// The lists can't be copied, so they can't be resized into place.
+	vector<CViewbackDataList>(m_aeTypes.size()).swap(m_aData);
+
+	m_aflClearTime.reset(new atomic<double>[m_aeTypes.size()]);
+	for (size_t i = 0; i < m_aeTypes.size(); i++)
+		m_aflClearTime[i] = 0;
+
+	m_aiPriority.reset(new atomic<int>[m_aeTypes.size()]);
+	for (size_t i = 0; i < m_aeTypes.size(); i++)
+		m_aiPriority[i] = 0;
+
+	m_iMemoryBudget = 0;
+	m_iStashedSinceBudget = 0;
+
+	m_flLatestDataTime = 0;
+	m_flTimeReceived = 0;
+	m_flNextDataClear = VB_DATA_CLEAR_INTERVAL;
+
+	m_iSequence = 0;
+	m_iAcknowledged = 0;
+
+	m_flPublishedLatestDataTime = 0;
+	m_flPublishedTimeReceived = 0;
+
+	m_flReadLatestDataTime = 0;
+	m_flReadTimeReceived = 0;
+}
+
+void CViewbackHistory::Stash(const CViewbackSample& oSample)
+{
+	// It could be a stale packet from an old registration, there's nowhere to put it.
+	if (oSample.m_iHandle >= m_iRegisteredChannels || !oSample.m_bHasTime)
+		return;
+
+	double flTime = oSample.m_flTime;
+	double flMaintainTime = oSample.m_flMaintainTime;
+
+	CViewbackDataList& oList = m_aData[oSample.m_iHandle];
+
+	switch (m_aeTypes[oSample.m_iHandle])
+	{
+	case VB_DATATYPE_NONE:
+	default:
+		return;
+
+	case VB_DATATYPE_INT:
+		if (oSample.m_bHasMaintainTime)
+		{
+			// We threw out some data to save on network data. Now the client needs to "fake it" by
+			// maintaining the previous data value until flMaintainTime, which was the last time that
+			// we got from the server of the duplicate value.
+			if (oList.m_aIntData.written() && flMaintainTime != oList.m_aIntData.last_written().time)
+			{
+				int iHeld = oList.m_aIntData.last_written().data;
+				oList.m_aIntData.push_back(CViewbackDataList::DataPair<int>(flMaintainTime, iHeld));
+				oList.m_oIntPyramid.Add(flMaintainTime, iHeld);
+				Check(oSample.m_iHandle, flMaintainTime, iHeld);
+			}
+		}
+
+		oList.m_aIntData.push_back(CViewbackDataList::DataPair<int>(flTime, oSample.m_iValue));
+		oList.m_oIntPyramid.Add(flTime, oSample.m_iValue);
+		Check(oSample.m_iHandle, flTime, oSample.m_iValue);
+		break;
+
+	case VB_DATATYPE_FLOAT:
+		if (oSample.m_bHasMaintainTime)
+		{
+			// We threw out some data to save on network data. Now the client needs to "fake it" by
+			// maintaining the previous data value until flMaintainTime, which was the last time that
+			// we got from the server of the duplicate value.
+			if (oList.m_aFloatData.written() && flMaintainTime != oList.m_aFloatData.last_written().time)
+			{
+				float flHeld = oList.m_aFloatData.last_written().data;
+				oList.m_aFloatData.push_back(CViewbackDataList::DataPair<float>(flMaintainTime, flHeld));
+				oList.m_oFloatPyramid.Add(flMaintainTime, flHeld);
+				Check(oSample.m_iHandle, flMaintainTime, flHeld);
+			}
+		}
+
+		oList.m_aFloatData.push_back(CViewbackDataList::DataPair<float>(flTime, oSample.m_aflValue[0]));
+		oList.m_oFloatPyramid.Add(flTime, oSample.m_aflValue[0]);
+		Check(oSample.m_iHandle, flTime, oSample.m_aflValue[0]);
+		break;
+
+	case VB_DATATYPE_VECTOR:
+		if (oSample.m_bHasMaintainTime)
+		{
+			// We threw out some data to save on network data. Now the client needs to "fake it" by
+			// maintaining the previous data value until flMaintainTime, which was the last time that
+			// we got from the server of the duplicate value.
+			if (oList.m_aVectorData.written() && flMaintainTime != oList.m_aVectorData.last_written().time)
+				oList.m_aVectorData.push_back(CViewbackDataList::DataPair<VBVector3>(flMaintainTime, oList.m_aVectorData.last_written().data));
+		}
+
+		oList.m_aVectorData.push_back(CViewbackDataList::DataPair<VBVector3>(flTime, VBVector3(oSample.m_aflValue[0], oSample.m_aflValue[1], oSample.m_aflValue[2])));
+		break;
+	}
+
+	if (m_aaiDerivedFrom[oSample.m_iHandle].size())
+		Derive(oSample.m_iHandle, flTime);
+
+	// Checking costs a pass over the channels, no need to do it for every sample.
+	if (++m_iStashedSinceBudget >= VB_SERIES_CHUNK_SIZE)
+	{
+		m_iStashedSinceBudget = 0;
+		KeepInBudget();
+	}
+
+	if (flTime <= m_flLatestDataTime)
+		return;
+
+	m_flLatestDataTime = flTime;
+
+	// A trigger waiting out its duration goes off once the data gets past
+	// it, even if its channel hasn't sent anything since. Servers don't
+	// send a value again while it stays the same.
+	while (m_aDeadlines.size() && m_aDeadlines.top().first <= m_flLatestDataTime)
+	{
+		double flDeadline = m_aDeadlines.top().first;
+		size_t iRule = m_aDeadlines.top().second;
+		m_aDeadlines.pop();
+
+		if (!m_aRules[iRule].IsPending() || m_aRules[iRule].GetDeadline() != flDeadline)
+			continue;
+
+		m_aRules[iRule].SetFired();
+		Fire(iRule);
+	}
+
+	struct timeb now;
+	now.time = 0;
+	now.millitm = 0;
+
+	ftime(&now);
+
+	m_flTimeReceived = (double)now.time + (double)now.millitm / 1000;
+
+	if (m_flLatestDataTime > m_flNextDataClear)
+	{
+		if (m_oSpill.IsOpen())
+		{
+			// The whole session is kept when spilling. Only let go of whatever
+			// old data the reader has paged back in.
+			m_oSpill.ReleasePages();
+		}
+		else
+		{
+			// Clear out old data.
+			for (size_t i = 0; i < m_aData.size(); i++)
+			{
+				double flClearTime = m_aflClearTime[i].load(memory_order_relaxed);
+
+				m_aData[i].m_aIntData.erase_before(flClearTime);
+				m_aData[i].m_aFloatData.erase_before(flClearTime);
+				m_aData[i].m_aVectorData.erase_before(flClearTime);
+				m_aData[i].m_oIntPyramid.erase_before(flClearTime);
+				m_aData[i].m_oFloatPyramid.erase_before(flClearTime);
+			}
+		}
+
+		m_flNextDataClear = m_flLatestDataTime + VB_DATA_CLEAR_INTERVAL;
+	}
+}
+
+void CViewbackHistory::Derive(size_t iHandle, double flTime)
+{
+	const vector<size_t>& aiDerived = m_aaiDerivedFrom[iHandle];
+
+	for (size_t i = 0; i < aiDerived.size(); i++)
+	{
+		size_t iDerivedHandle = m_iRegisteredChannels + aiDerived[i];
+		CViewbackDataList& oList = m_aData[iDerivedHandle];
+
+		// Channels don't always arrive in time order with each other, but a
+		// series has to be in order.
+		double flDerivedTime = flTime;
+		if (oList.m_aFloatData.written() && flDerivedTime < oList.m_aFloatData.last_written().time)
+			flDerivedTime = oList.m_aFloatData.last_written().time;
+
+		double flValue;
+		if (!m_aDerived[aiDerived[i]].Evaluate(flDerivedTime, m_aData, flValue))
+			continue;
+
+		oList.m_aFloatData.push_back(CViewbackDataList::DataPair<float>(flDerivedTime, (float)flValue));
+		oList.m_oFloatPyramid.Add(flDerivedTime, (float)flValue);
+		Check(iDerivedHandle, flDerivedTime, (float)flValue);
+
+		// It may be used by a derived channel that comes after it.
+		if (m_aaiDerivedFrom[iDerivedHandle].size())
+			Derive(iDerivedHandle, flDerivedTime);
+	}
+}
+
+void CViewbackHistory::Check(size_t iHandle, double flTime, double flValue)
+{
+	const vector<size_t>& aiRules = m_aaiRulesOn[iHandle];
+
+	for (size_t i = 0; i < aiRules.size(); i++)
+	{
+		CViewbackRule& oRule = m_aRules[aiRules[i]];
+
+		bool bWasPending = oRule.IsPending();
+
+		if (oRule.Add(flTime, flValue))
+			Fire(aiRules[i]);
+		else if (!bWasPending && oRule.IsPending())
+			m_aDeadlines.push(make_pair(oRule.GetDeadline(), aiRules[i]));
+	}
+}
+
+void CViewbackHistory::Fire(size_t iRule)
+{
+	CViewbackTriggerHit oHit;
+	oHit.m_iTrigger = iRule;
+	oHit.m_flValue = (float)m_aRules[iRule].GetLatest();
+
+	// When it had been true for long enough, which can be before the sample that showed it.
+	m_aHits.push_back(CViewbackDataPair<CViewbackTriggerHit>(m_aRules[iRule].GetDeadline(), oHit));
+}
+
+bool CViewbackHistory::SpillTo(const string& sDirectory)
+{
+	if (!m_oSpill.Open(sDirectory))
+		return false;
+
+	for (size_t i = 0; i < m_aData.size(); i++)
+	{
+		m_aData[i].m_aIntData.SetSpill(&m_oSpill);
+		m_aData[i].m_aFloatData.SetSpill(&m_oSpill);
+		m_aData[i].m_aVectorData.SetSpill(&m_oSpill);
+		m_aData[i].m_oIntPyramid.SetSpill(&m_oSpill);
+		m_aData[i].m_oFloatPyramid.SetSpill(&m_oSpill);
+	}
+
+	return true;
+}
+
+void CViewbackHistory::KeepInBudget()
+{
+	size_t iBudget = m_iMemoryBudget.load(memory_order_relaxed);
+	if (!iBudget)
+		return;
+
+	size_t iMemory = GetMemory();
+
+	// Samples go first, the oldest from the lowest priority channels.
+	while (iMemory > iBudget)
+	{
+		size_t iVictim = m_aData.size();
+		int iVictimPriority = 0;
+		double flVictimTime = 0;
+
+		for (size_t i = 0; i < m_aData.size(); i++)
+		{
+			const CViewbackDataList& oList = m_aData[i];
+
+			double flOldest;
+			switch (m_aeTypes[i])
+			{
+			case VB_DATATYPE_INT:
+				if (oList.m_aIntData.written() <= VB_SERIES_CHUNK_SIZE)
+					continue;
+				flOldest = oList.m_aIntData.first_written().time;
+				break;
+
+			case VB_DATATYPE_FLOAT:
+				if (oList.m_aFloatData.written() <= VB_SERIES_CHUNK_SIZE)
+					continue;
+				flOldest = oList.m_aFloatData.first_written().time;
+				break;
+
+			case VB_DATATYPE_VECTOR:
+				if (oList.m_aVectorData.written() <= VB_SERIES_CHUNK_SIZE)
+					continue;
+				flOldest = oList.m_aVectorData.first_written().time;
+				break;
+
+			default:
+				continue;
+			}
+
+			int iPriority = m_aiPriority[i].load(memory_order_relaxed);
+
+			if (iVictim == m_aData.size() || iPriority < iVictimPriority || (iPriority == iVictimPriority && flOldest < flVictimTime))
+			{
+				iVictim = i;
+				iVictimPriority = iPriority;
+				flVictimTime = flOldest;
+			}
+		}
+
+		if (iVictim == m_aData.size())
+			break;
+
+		CViewbackDataList& oList = m_aData[iVictim];
+
+		size_t iBefore = oList.m_aIntData.GetMemory() + oList.m_aFloatData.GetMemory() + oList.m_aVectorData.GetMemory();
+
+		if (!oList.m_aIntData.erase_oldest_chunk() && !oList.m_aFloatData.erase_oldest_chunk() && !oList.m_aVectorData.erase_oldest_chunk())
+			break;
+
+		iMemory -= iBefore - (oList.m_aIntData.GetMemory() + oList.m_aFloatData.GetMemory() + oList.m_aVectorData.GetMemory());
+	}
+
+	// Then the pyramids, lowest priority first.
+	vector<bool> abSpent(m_aData.size(), false);
+
+	while (iMemory > iBudget)
+	{
+		size_t iVictim = m_aData.size();
+		int iVictimPriority = 0;
+
+		for (size_t i = 0; i < m_aData.size(); i++)
+		{
+			if (abSpent[i])
+				continue;
+
+			int iPriority = m_aiPriority[i].load(memory_order_relaxed);
+
+			if (iVictim == m_aData.size() || iPriority < iVictimPriority)
+			{
+				iVictim = i;
+				iVictimPriority = iPriority;
+			}
+		}
+
+		if (iVictim == m_aData.size())
+			break;
+
+		CViewbackDataList& oList = m_aData[iVictim];
+
+		size_t iBefore = oList.m_oIntPyramid.GetMemory() + oList.m_oFloatPyramid.GetMemory();
+
+		if (!oList.m_oIntPyramid.erase_oldest_chunk() && !oList.m_oFloatPyramid.erase_oldest_chunk())
+		{
+			abSpent[iVictim] = true;
+			continue;
+		}
+
+		iMemory -= iBefore - (oList.m_oIntPyramid.GetMemory() + oList.m_oFloatPyramid.GetMemory());
+	}
+}
+
+size_t CViewbackHistory::GetMemory() const
+{
+	size_t iMemory = 0;
+
+	for (size_t i = 0; i < m_aData.size(); i++)
+	{
+		const CViewbackDataList& oList = m_aData[i];
+
+		iMemory += oList.m_aIntData.GetMemory() + oList.m_aFloatData.GetMemory() + oList.m_aVectorData.GetMemory();
+		iMemory += oList.m_oIntPyramid.GetMemory() + oList.m_oFloatPyramid.GetMemory();
+	}
+
+	return iMemory;
+}
+
+void CViewbackHistory::Publish()
+{
+	// Anything retired in a publish the reader has seen or passed is free to go.
+	unsigned iAcknowledged = m_iAcknowledged.load(memory_order_acquire);
+
+	for (size_t i = 0; i < m_aData.size(); i++)
+	{
+		m_aData[i].m_aIntData.Reclaim(iAcknowledged);
+		m_aData[i].m_aFloatData.Reclaim(iAcknowledged);
+		m_aData[i].m_aVectorData.Reclaim(iAcknowledged);
+		m_aData[i].m_oIntPyramid.Reclaim(iAcknowledged);
+		m_aData[i].m_oFloatPyramid.Reclaim(iAcknowledged);
+	}
+
+	m_aHits.Reclaim(iAcknowledged);
+
+	unsigned iSequence = m_iSequence.load(memory_order_relaxed);
+
+	m_iSequence.store(iSequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	unsigned iEpoch = iSequence + 2;
+
+	for (size_t i = 0; i < m_aData.size(); i++)
+	{
+		m_aData[i].m_aIntData.Publish(iEpoch);
+		m_aData[i].m_aFloatData.Publish(iEpoch);
+		m_aData[i].m_aVectorData.Publish(iEpoch);
+		m_aData[i].m_oIntPyramid.Publish(iEpoch);
+		m_aData[i].m_oFloatPyramid.Publish(iEpoch);
+	}
+
+	m_aHits.Publish(iEpoch);
+
+	m_flPublishedLatestDataTime.store(m_flLatestDataTime, memory_order_relaxed);
+	m_flPublishedTimeReceived.store(m_flTimeReceived, memory_order_relaxed);
+
+	m_iSequence.store(iEpoch, memory_order_release);
+}
+
+void CViewbackHistory::Snapshot()
+{
+	for (;;)
+	{
+		unsigned iSequence = m_iSequence.load(memory_order_acquire);
+
+		if (!(iSequence & 1))
+		{
+			for (size_t i = 0; i < m_aData.size(); i++)
+			{
+				m_aData[i].m_aIntData.Snapshot();
+				m_aData[i].m_aFloatData.Snapshot();
+				m_aData[i].m_aVectorData.Snapshot();
+				m_aData[i].m_oIntPyramid.Snapshot();
+				m_aData[i].m_oFloatPyramid.Snapshot();
+			}
+
+			m_aHits.Snapshot();
+
+			m_flReadLatestDataTime = m_flPublishedLatestDataTime.load(memory_order_relaxed);
+			m_flReadTimeReceived = m_flPublishedTimeReceived.load(memory_order_relaxed);
+
+			atomic_thread_fence(memory_order_acquire);
+
+			if (m_iSequence.load(memory_order_relaxed) == iSequence)
+			{
+				// Done with the last snapshot, the writer can free what it dropped before this one.
+				m_iAcknowledged.store(iSequence, memory_order_release);
+				return;
+			}
+		}
+
+		// The writer is in the middle of a publish. It doesn't take long, but
+		// let it run in case it's sharing a core with us.
+		vb__thread_yield();
+	}
+}
+
+void CViewbackHistory::SetClearTime(size_t iHandle, double flTime)
+{
+	if (iHandle < m_aeTypes.size())
+		m_aflClearTime[iHandle].store(flTime, memory_order_relaxed);
+}
+
+void CViewbackHistory::SetMemoryBudget(size_t iBytes)
+{
+	m_iMemoryBudget.store(iBytes, memory_order_relaxed);
+}
+
+void CViewbackHistory::SetPriority(size_t iHandle, int iPriority)
+{
+	if (iHandle < m_aeTypes.size())
+		m_aiPriority[iHandle].store(iPriority, memory_order_relaxed);
+}
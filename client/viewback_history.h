@@ -0,0 +1,1473 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <functional>
+
+// This is probably way wrong.
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <cstdatomic>
+#else
+#include <atomic>
+#endif
+
+#include "../protobuf/data.pb.h"
+
+#include "vector3.h"
+#include "viewback_decode.h"
+#include "viewback_derived.h"
+#include "viewback_spill.h"
+#include "viewback_stats.h"
+#include "viewback_trigger.h"
+
+namespace vb
+{
+
+// Samples are kept in chunks of this many. A chunk never moves once it's
+// allocated, so it can be read while more samples are being added.
+#define VB_SERIES_CHUNK_SIZE 1024
+
+template <typename T>
+class CViewbackDataPair
+{
+public:
+	CViewbackDataPair()
+	{
+		time = 0;
+	}
+
+	CViewbackDataPair(double _time, T _data)
+	{
+		time = _time;
+		data = _data;
+	}
+
+public:
+	double time;
+	T      data;
+};
+
+// A chunk's values, one array per component so that a scan over them walks
+// straight through memory.
+template <typename T>
+class CViewbackColumns
+{
+public:
+	T    Get(size_t i) const { return m_aValues[i]; }
+	void Set(size_t i, const T& oValue) { m_aValues[i] = oValue; }
+
+public:
+	T m_aValues[VB_SERIES_CHUNK_SIZE];
+};
+
+template <>
+class CViewbackColumns<VBVector3>
+{
+public:
+	VBVector3 Get(size_t i) const { return VBVector3(m_aflX[i], m_aflY[i], m_aflZ[i]); }
+
+	void Set(size_t i, const VBVector3& vecValue)
+	{
+		m_aflX[i] = vecValue.x;
+		m_aflY[i] = vecValue.y;
+		m_aflZ[i] = vecValue.z;
+	}
+
+public:
+	float m_aflX[VB_SERIES_CHUNK_SIZE];
+	float m_aflY[VB_SERIES_CHUNK_SIZE];
+	float m_aflZ[VB_SERIES_CHUNK_SIZE];
+};
+
+// Times are stored as single precision offsets from the chunk's first
+// sample. The error grows with how long the chunk covers, so it stays tiny
+// next to the spacing between samples: a chunk from a 1 kHz channel covers
+// about a second and is good to a tenth of a microsecond, one from a channel
+// that changes every few seconds is still good to a fraction of a millisecond.
+template <typename T>
+class CViewbackChunk
+{
+public:
+	double              m_flBaseTime;
+	float               m_aflTime[VB_SERIES_CHUNK_SIZE]; // Seconds after m_flBaseTime.
+	CViewbackColumns<T> m_oValues;
+};
+
+// Consecutive samples in one chunk. This is the cheap way to walk a lot of
+// data: the arrays can be read directly, starting at m_iFirst.
+template <typename T>
+class CViewbackSpan
+{
+public:
+	double GetTime(size_t i) const { return m_pChunk->m_flBaseTime + m_pChunk->m_aflTime[m_iFirst + i]; }
+	T      GetValue(size_t i) const { return m_pChunk->m_oValues.Get(m_iFirst + i); }
+
+public:
+	const CViewbackChunk<T>* m_pChunk;
+	size_t                   m_iFirst; // Index into the chunk's arrays.
+	size_t                   m_iCount;
+};
+
+template <typename T>
+class CViewbackRange;
+
+// The samples for one channel, oldest first. One thread writes and one
+// thread reads, and they may be different threads. The reader sees what the
+// writer had the last time it published, and nothing the writer drops off
+// the front is freed until the reader has acknowledged a newer publish.
+// CViewbackHistory does the publishing for all of a connection's channels
+// at once.
+//
+// The read side looks like a read only std::deque of CViewbackDataPair so
+// that code which indexes the data doesn't need to care. Code that walks a
+// lot of it should use the spans instead.
+template <typename T>
+class CViewbackSeries
+{
+	typedef CViewbackChunk<T> CChunk;
+
+	// A slot can be pointed at a chunk's spilled copy while the reader is
+	// looking at it, so they're atomic.
+	class CTable
+	{
+	public:
+		CTable(size_t iSize)
+			: m_apChunks(new std::atomic<CChunk*>[iSize])
+		{
+			m_iMask = iSize - 1;
+			for (size_t i = 0; i < iSize; i++)
+				m_apChunks[i].store(NULL, std::memory_order_relaxed);
+		}
+
+	public:
+		CChunk* Get(size_t iChunk) const { return m_apChunks[iChunk & m_iMask].load(std::memory_order_acquire); }
+		void    Set(size_t iChunk, CChunk* pChunk) { m_apChunks[iChunk & m_iMask].store(pChunk, std::memory_order_release); }
+
+	public:
+		size_t m_iMask;
+		std::unique_ptr<std::atomic<CChunk*>[]> m_apChunks; // Chunk number & m_iMask.
+	};
+
+public:
+	CViewbackSeries()
+	{
+		m_iBegin = 0;
+		m_iEnd = 0;
+		m_iFirstChunk = 0;
+		m_iRetiredChunks = 0;
+		m_pTable = NULL;
+		m_pSpill = NULL;
+		m_iFirstSpilledChunk = 0;
+		m_iSpilledChunks = 0;
+
+		m_iPublishedBegin = 0;
+		m_iPublishedEnd = 0;
+		m_pPublishedTable = NULL;
+
+		m_iReadBegin = 0;
+		m_iReadEnd = 0;
+		m_pReadTable = NULL;
+	}
+
+	~CViewbackSeries()
+	{
+		if (m_pTable)
+		{
+			for (size_t i = m_iFirstChunk; i < ChunksEnd(); i++)
+			{
+				if (!IsSpilled(i))
+					delete m_pTable->Get(i);
+			}
+		}
+
+		for (size_t i = 0; i < m_aSpilledChunks.size(); i++)
+			delete m_aSpilledChunks[i].second;
+
+		delete m_pTable;
+
+		for (size_t i = 0; i < m_apGrownTables.size(); i++)
+			delete m_apGrownTables[i];
+
+		for (size_t i = 0; i < m_aRetiredTables.size(); i++)
+			delete m_aRetiredTables[i].second;
+	}
+
+private:
+	CViewbackSeries(const CViewbackSeries&);
+	CViewbackSeries& operator=(const CViewbackSeries&);
+
+public:
+	// Reader. Only what was there at the last snapshot.
+	size_t               size() const { return m_iReadEnd - m_iReadBegin; }
+	bool                 empty() const { return m_iReadEnd == m_iReadBegin; }
+	CViewbackDataPair<T> operator[](size_t i) const { return At(m_pReadTable, m_iReadBegin + i); }
+	CViewbackDataPair<T> front() const { return At(m_pReadTable, m_iReadBegin); }
+	CViewbackDataPair<T> back() const { return At(m_pReadTable, m_iReadEnd - 1); }
+
+	// Reader. The snapshot as one span per chunk, oldest first.
+	size_t           GetNumSpans() const { return SpanCount(m_iReadBegin, m_iReadEnd); }
+	CViewbackSpan<T> GetSpan(size_t i) const { return SpanAt(m_iReadBegin, m_iReadEnd, i); }
+
+	// Reader. The samples with flStart <= time <= flEnd, found by binary
+	// search. With bEdges the sample just before flStart and the one just
+	// after flEnd come too, if there are any. Then the value in effect at
+	// flStart is always there even if it was set long before, including
+	// when it's being held by a maintain time, and lines can be drawn all
+	// the way to both ends of the window.
+	CViewbackRange<T> GetRange(double flStart, double flEnd, bool bEdges = true) const;
+
+	// Writer.
+	size_t                      written() const { return m_iEnd - m_iBegin; }
+	const CViewbackDataPair<T>& last_written() const { return m_oLastWritten; }
+
+	void push_back(const CViewbackDataPair<T>& oItem)
+	{
+		size_t iOffset = m_iEnd % VB_SERIES_CHUNK_SIZE;
+
+		if (!iOffset)
+		{
+			size_t iChunk = m_iEnd / VB_SERIES_CHUNK_SIZE;
+
+			// A slot is only reused once the chunk that was in it is freed,
+			// the reader may still be looking at it until then.
+			if (!m_pTable || iChunk - m_iFirstChunk > m_pTable->m_iMask)
+				Grow();
+
+			CChunk* pChunk = new CChunk;
+			pChunk->m_flBaseTime = oItem.time;
+			m_pTable->Set(iChunk, pChunk);
+		}
+
+		CChunk* pChunk = m_pTable->Get(m_iEnd / VB_SERIES_CHUNK_SIZE);
+		pChunk->m_aflTime[iOffset] = (float)(oItem.time - pChunk->m_flBaseTime);
+		pChunk->m_oValues.Set(iOffset, oItem.data);
+
+		// Kept at full precision for the maintain time check.
+		m_oLastWritten = oItem;
+
+		m_iEnd++;
+	}
+
+	// Writer. Drops samples older than flTime, but always keeps the last
+	// iKeep so that there's still a line to draw.
+	void erase_before(double flTime, size_t iKeep = 2)
+	{
+		while (m_iEnd - m_iBegin > iKeep && At(m_pTable, m_iBegin).time < flTime)
+			m_iBegin++;
+	}
+
+	// Writer. Drops every sample in the oldest chunk so the chunk can be
+	// freed, unless it's the one being written to or it's been spilled and
+	// there's nothing to free.
+	bool erase_oldest_chunk()
+	{
+		size_t iNext = (m_iBegin / VB_SERIES_CHUNK_SIZE + 1) * VB_SERIES_CHUNK_SIZE;
+		if (m_iEnd <= iNext || IsSpilled(m_iBegin / VB_SERIES_CHUNK_SIZE))
+			return false;
+
+		m_iBegin = iNext;
+		return true;
+	}
+
+	// Writer. Bytes in the chunks that haven't been dropped or spilled.
+	size_t GetMemory() const
+	{
+		size_t iFirst = m_iBegin / VB_SERIES_CHUNK_SIZE;
+		size_t iEnd = ChunksEnd();
+		if (iEnd <= iFirst)
+			return 0;
+
+		size_t iSpilledFirst = (iFirst > m_iFirstSpilledChunk) ? iFirst : m_iFirstSpilledChunk;
+		size_t iSpilledEnd = (iEnd < m_iSpilledChunks) ? iEnd : m_iSpilledChunks;
+		size_t iSpilled = (iSpilledEnd > iSpilledFirst) ? iSpilledEnd - iSpilledFirst : 0;
+
+		return (iEnd - iFirst - iSpilled) * sizeof(CChunk);
+	}
+
+	// Writer. From now on each chunk is copied into pSpill once it's full,
+	// and the copy in memory is freed. Chunks are the same on disk as in
+	// memory, so reading doesn't change, the OS just pages them back in.
+	// pSpill has to stay open for as long as the series is around.
+	void SetSpill(CViewbackSpillFile* pSpill)
+	{
+		m_pSpill = pSpill;
+		m_iFirstSpilledChunk = m_iSpilledChunks = m_iEnd / VB_SERIES_CHUNK_SIZE;
+	}
+
+	// Writer. The oldest sample that hasn't been dropped.
+	CViewbackDataPair<T> first_written() const { return At(m_pTable, m_iBegin); }
+
+	// Writer. Frees whatever was retired at or before the publish the reader
+	// has acknowledged.
+	void Reclaim(unsigned iAcknowledged)
+	{
+		while (m_aiChunkEpochs.size() && (int)(iAcknowledged - m_aiChunkEpochs.front()) >= 0)
+		{
+			// Spilled chunks are in the file, there's nothing to free.
+			if (!IsSpilled(m_iFirstChunk))
+				delete m_pTable->Get(m_iFirstChunk);
+
+			m_pTable->Set(m_iFirstChunk, NULL);
+			m_iFirstChunk++;
+			m_aiChunkEpochs.pop_front();
+		}
+
+		while (m_aSpilledChunks.size() && (int)(iAcknowledged - m_aSpilledChunks.front().first) >= 0)
+		{
+			delete m_aSpilledChunks.front().second;
+			m_aSpilledChunks.pop_front();
+		}
+
+		while (m_aRetiredTables.size() && (int)(iAcknowledged - m_aRetiredTables.front().first) >= 0)
+		{
+			delete m_aRetiredTables.front().second;
+			m_aRetiredTables.pop_front();
+		}
+	}
+
+	// Writer. Called inside CViewbackHistory's publish, iEpoch is the number
+	// of the publish. Anything dropped since the last one is retired with it.
+	void Publish(unsigned iEpoch)
+	{
+		for (; m_iRetiredChunks < m_iBegin / VB_SERIES_CHUNK_SIZE; m_iRetiredChunks++)
+			m_aiChunkEpochs.push_back(iEpoch);
+
+		// Full chunks go to the spill file. The reader may be in the middle of
+		// the one in memory, so it's retired rather than freed.
+		if (m_pSpill)
+		{
+			for (; m_iSpilledChunks < m_iEnd / VB_SERIES_CHUNK_SIZE; m_iSpilledChunks++)
+			{
+				CChunk* pChunk = m_pTable->Get(m_iSpilledChunks);
+				const void* pCopy = m_pSpill->Write(pChunk, sizeof(CChunk));
+				if (!pCopy)
+				{
+					// Out of disk, keep everything from here on in memory.
+					m_pSpill = NULL;
+					break;
+				}
+
+				m_pTable->Set(m_iSpilledChunks, (CChunk*)pCopy);
+				m_aSpilledChunks.push_back(std::make_pair(iEpoch, pChunk));
+			}
+		}
+
+		for (size_t i = 0; i < m_apGrownTables.size(); i++)
+			m_aRetiredTables.push_back(std::make_pair(iEpoch, m_apGrownTables[i]));
+		m_apGrownTables.clear();
+
+		m_iPublishedBegin.store(m_iBegin, std::memory_order_relaxed);
+		m_iPublishedEnd.store(m_iEnd, std::memory_order_relaxed);
+		m_pPublishedTable.store(m_pTable, std::memory_order_relaxed);
+	}
+
+	// Reader. Called inside CViewbackHistory's snapshot.
+	void Snapshot()
+	{
+		m_iReadBegin = m_iPublishedBegin.load(std::memory_order_relaxed);
+		m_iReadEnd = m_iPublishedEnd.load(std::memory_order_relaxed);
+		m_pReadTable = m_pPublishedTable.load(std::memory_order_relaxed);
+	}
+
+	// For a series only one thread ever touches: makes everything written so
+	// far readable and frees anything that was dropped.
+	void Sync()
+	{
+		Publish(0);
+		Snapshot();
+		Reclaim(0);
+	}
+
+private:
+	friend class CViewbackRange<T>;
+	template <typename U> friend class CViewbackPyramid;
+
+	const CChunk* ReadChunk(size_t iChunk) const { return m_pReadTable->Get(iChunk); }
+
+	size_t SpanCount(size_t iBegin, size_t iEnd) const
+	{
+		if (iEnd == iBegin)
+			return 0;
+
+		return (iEnd - 1) / VB_SERIES_CHUNK_SIZE - iBegin / VB_SERIES_CHUNK_SIZE + 1;
+	}
+
+	CViewbackSpan<T> SpanAt(size_t iBegin, size_t iEnd, size_t i) const
+	{
+		size_t iChunk = iBegin / VB_SERIES_CHUNK_SIZE + i;
+		size_t iStart = iChunk * VB_SERIES_CHUNK_SIZE;
+		size_t iFirst = (iBegin > iStart) ? iBegin : iStart;
+		size_t iLast = (iEnd < iStart + VB_SERIES_CHUNK_SIZE) ? iEnd : iStart + VB_SERIES_CHUNK_SIZE;
+
+		CViewbackSpan<T> oSpan;
+		oSpan.m_pChunk = ReadChunk(iChunk);
+		oSpan.m_iFirst = iFirst - iStart;
+		oSpan.m_iCount = iLast - iFirst;
+		return oSpan;
+	}
+
+	// Indices in the snapshot of the samples GetRange() returns.
+	void FindRange(double flStart, double flEnd, bool bEdges, size_t& iBegin, size_t& iEnd) const
+	{
+		iBegin = Search(flStart, true);
+		iEnd = Search(flEnd, false);
+
+		if (iEnd < iBegin)
+			iEnd = iBegin;
+
+		if (bEdges)
+		{
+			if (iBegin > m_iReadBegin)
+				iBegin--;
+
+			if (iEnd < m_iReadEnd)
+				iEnd++;
+		}
+	}
+
+	// Index of the first sample in the snapshot that comes after flTime, or
+	// at flTime too if bInclusive. Chunks are found by their first sample's
+	// time, then samples within the chunk.
+	size_t Search(double flTime, bool bInclusive) const
+	{
+		if (m_iReadEnd == m_iReadBegin)
+			return m_iReadEnd;
+
+		size_t iFirstChunk = m_iReadBegin / VB_SERIES_CHUNK_SIZE;
+
+		// The first chunk that starts at or past flTime. The answer is either
+		// in the chunk before it or is its first sample.
+		size_t iLow = iFirstChunk;
+		size_t iHigh = (m_iReadEnd - 1) / VB_SERIES_CHUNK_SIZE + 1;
+		while (iLow < iHigh)
+		{
+			size_t iMiddle = iLow + (iHigh - iLow) / 2;
+			double flBase = ReadChunk(iMiddle)->m_flBaseTime;
+			if (bInclusive ? (flBase < flTime) : (flBase <= flTime))
+				iLow = iMiddle + 1;
+			else
+				iHigh = iMiddle;
+		}
+
+		if (iLow == iFirstChunk)
+			return m_iReadBegin;
+
+		size_t iChunk = iLow - 1;
+		const CChunk* pChunk = ReadChunk(iChunk);
+
+		size_t iStart = iChunk * VB_SERIES_CHUNK_SIZE;
+		size_t iFirst = (m_iReadBegin > iStart) ? m_iReadBegin - iStart : 0;
+		size_t iLast = (m_iReadEnd < iStart + VB_SERIES_CHUNK_SIZE) ? m_iReadEnd - iStart : VB_SERIES_CHUNK_SIZE;
+
+		while (iFirst < iLast)
+		{
+			size_t iMiddle = iFirst + (iLast - iFirst) / 2;
+			double flSample = pChunk->m_flBaseTime + pChunk->m_aflTime[iMiddle];
+			if (bInclusive ? (flSample < flTime) : (flSample <= flTime))
+				iFirst = iMiddle + 1;
+			else
+				iLast = iMiddle;
+		}
+
+		return iStart + iFirst;
+	}
+
+	static CViewbackDataPair<T> At(const CTable* pTable, size_t iIndex)
+	{
+		const CChunk* pChunk = pTable->Get(iIndex / VB_SERIES_CHUNK_SIZE);
+		size_t iOffset = iIndex % VB_SERIES_CHUNK_SIZE;
+		return CViewbackDataPair<T>(pChunk->m_flBaseTime + pChunk->m_aflTime[iOffset], pChunk->m_oValues.Get(iOffset));
+	}
+
+	bool IsSpilled(size_t iChunk) const { return iChunk >= m_iFirstSpilledChunk && iChunk < m_iSpilledChunks; }
+
+	// One past the last allocated chunk.
+	size_t ChunksEnd() const { return (m_iEnd + VB_SERIES_CHUNK_SIZE - 1) / VB_SERIES_CHUNK_SIZE; }
+
+	void Grow()
+	{
+		CTable* pTable = new CTable(m_pTable ? (m_pTable->m_iMask + 1) * 2 : 4);
+
+		if (m_pTable)
+		{
+			for (size_t i = m_iFirstChunk; i < ChunksEnd(); i++)
+				pTable->Set(i, m_pTable->Get(i));
+
+			// The reader may have the old table, it's retired at the next publish.
+			m_apGrownTables.push_back(m_pTable);
+		}
+
+		m_pTable = pTable;
+	}
+
+private:
+	// Writer only. Indices count every sample ever added, so they never move.
+	size_t               m_iBegin;
+	size_t               m_iEnd;
+	size_t               m_iFirstChunk;    // Oldest chunk that hasn't been freed.
+	size_t               m_iRetiredChunks; // Chunks before this one have been stamped in m_aiChunkEpochs.
+	CTable*              m_pTable;
+	CViewbackDataPair<T> m_oLastWritten;
+	std::deque<unsigned> m_aiChunkEpochs; // The publish each chunk from m_iFirstChunk was retired in.
+	std::vector<CTable*> m_apGrownTables; // Replaced since the last publish.
+	std::deque<std::pair<unsigned, CTable*> > m_aRetiredTables;
+	CViewbackSpillFile*  m_pSpill;
+	size_t               m_iFirstSpilledChunk; // Chunks from this one up to m_iSpilledChunks are in the spill file.
+	size_t               m_iSpilledChunks;
+	std::deque<std::pair<unsigned, CChunk*> > m_aSpilledChunks; // Copies in memory, freed once the reader is past the publish they were spilled in.
+
+	// Written by the writer when it publishes, read by the reader when it takes a snapshot.
+	std::atomic<size_t>  m_iPublishedBegin;
+	std::atomic<size_t>  m_iPublishedEnd;
+	std::atomic<CTable*> m_pPublishedTable;
+
+	// Reader only.
+	size_t        m_iReadBegin;
+	size_t        m_iReadEnd;
+	const CTable* m_pReadTable;
+};
+
+// Part of a series' snapshot. Like the series it's a view, nothing is
+// copied, and it's only good until the next snapshot.
+template <typename T>
+class CViewbackRange
+{
+public:
+	CViewbackRange()
+	{
+		m_pSeries = NULL;
+		m_iBegin = 0;
+		m_iEnd = 0;
+	}
+
+	CViewbackRange(const CViewbackSeries<T>* pSeries, size_t iBegin, size_t iEnd)
+	{
+		m_pSeries = pSeries;
+		m_iBegin = iBegin;
+		m_iEnd = iEnd;
+	}
+
+public:
+	size_t               size() const { return m_iEnd - m_iBegin; }
+	bool                 empty() const { return m_iEnd == m_iBegin; }
+	CViewbackDataPair<T> operator[](size_t i) const { return CViewbackSeries<T>::At(m_pSeries->m_pReadTable, m_iBegin + i); }
+
+	size_t           GetNumSpans() const { return m_pSeries ? m_pSeries->SpanCount(m_iBegin, m_iEnd) : 0; }
+	CViewbackSpan<T> GetSpan(size_t i) const { return m_pSeries->SpanAt(m_iBegin, m_iEnd, i); }
+
+private:
+	const CViewbackSeries<T>* m_pSeries;
+	size_t                    m_iBegin; // Indices in the series.
+	size_t                    m_iEnd;
+};
+
+template <typename T>
+CViewbackRange<T> CViewbackSeries<T>::GetRange(double flStart, double flEnd, bool bEdges) const
+{
+	size_t iBegin, iEnd;
+	FindRange(flStart, flEnd, bEdges, iBegin, iEnd);
+
+	return CViewbackRange<T>(this, iBegin, iEnd);
+}
+
+// The part of a CViewbackDataList between two times.
+class CViewbackDataRange
+{
+public:
+	// Only one of these will be used at a time.
+	CViewbackRange<int>       m_aIntData;
+	CViewbackRange<float>     m_aFloatData;
+	CViewbackRange<VBVector3> m_aVectorData;
+};
+
+// The pyramid's finest buckets cover this many samples, and each level's
+// buckets cover VB_PYRAMID_FANOUT of the level below's.
+#define VB_PYRAMID_BUCKET_SIZE 16
+#define VB_PYRAMID_FANOUT 4
+#define VB_PYRAMID_LEVELS 11
+
+// A run of consecutive samples boiled down to what it takes to draw them:
+// where the line comes in, where it leaves, and how far it goes either way.
+template <typename T>
+class CViewbackBucket
+{
+public:
+	T     m_oFirst;
+	T     m_oLast;
+	T     m_oLowest;
+	T     m_oHighest;
+	float m_flLength; // Seconds from the first sample to the last.
+	float m_flMean;
+	float m_flM2;     // Sum of squared differences from the mean.
+};
+
+// Every so many samples are also summed up as a t-digest of this many
+// centroids for quantiles, and each level's digests cover
+// VB_DIGEST_FANOUT of the level below's.
+#define VB_DIGEST_BLOCK_SIZE 1024
+#define VB_DIGEST_CENTROIDS 64
+#define VB_DIGEST_FANOUT 16
+#define VB_DIGEST_LEVELS 3
+
+// Centroids kept in CViewbackStats::m_aCentroids.
+#define VB_STATS_CENTROIDS 200
+
+// One centroid of a stored digest. A digest is always VB_DIGEST_CENTROIDS
+// of these in a row, the unused ones have no weight.
+class CViewbackDigestCentroid
+{
+public:
+	float m_flMean;
+	float m_flWeight;
+};
+
+// One column of a chart, see CViewbackPyramid::GetExtents().
+template <typename T>
+class CViewbackExtent
+{
+public:
+	double m_flFirstTime;
+	double m_flLastTime;
+	T      m_oFirst;
+	T      m_oLast;
+	T      m_oLowest;
+	T      m_oHighest;
+};
+
+// Min/max summaries of a series at coarser and coarser resolutions, so that
+// drawing a long stretch of it costs about as much as the chart is wide no
+// matter how many samples it covers. Every sample has to be both pushed
+// into the series and added here, and the levels are published along with
+// the series by the same writer.
+template <typename T>
+class CViewbackPyramid
+{
+	typedef CViewbackBucket<T> CBucket;
+	typedef CViewbackDigestCentroid CDigestCentroid;
+
+public:
+	CViewbackPyramid()
+	{
+		m_iCount = 0;
+	}
+
+private:
+	CViewbackPyramid(const CViewbackPyramid&);
+	CViewbackPyramid& operator=(const CViewbackPyramid&);
+
+public:
+	// Reader. Boils the samples GetRange() would return down to at most one
+	// extent per pixel column of a chart iPixels wide showing flStart to
+	// flEnd, plus one each for the samples just outside the window. Columns
+	// with no samples are skipped. Whole buckets are used wherever they fit
+	// in one column, so the cost is about the number of columns, not samples.
+	// Where samples were dropped to stay under a memory budget the buckets
+	// that are left stand in for them, a little less exactly.
+	void GetExtents(const CViewbackSeries<T>& aSeries, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<T> >& aExtents) const;
+
+	// Reader. Statistics for the samples from flStart to flEnd, put together
+	// from the biggest buckets that fit so the cost grows with the log of the
+	// number of samples. The count, lowest and highest are exact, and the
+	// mean and variance are as good as a float. Quantiles come from the
+	// digests the same way, plus the samples at either end that don't fill
+	// one. Where samples were dropped to stay under a memory budget, buckets
+	// that start and end inside the window stand in for them.
+	void GetStats(const CViewbackSeries<T>& aSeries, double flStart, double flEnd, CViewbackStats& oStats) const;
+
+	// Writer. Call after pushing the sample into the series.
+	void Add(double flTime, const T& oValue)
+	{
+		size_t iIndex = m_iCount++;
+
+		if (iIndex % VB_DIGEST_BLOCK_SIZE == 0)
+		{
+			m_aflDigestTime[0] = flTime;
+			m_aaPendingCentroids[0].clear();
+		}
+
+		m_aaPendingCentroids[0].push_back(CViewbackCentroid((double)oValue, 1));
+
+		if ((iIndex + 1) % VB_DIGEST_BLOCK_SIZE == 0)
+			AddBlock(iIndex / VB_DIGEST_BLOCK_SIZE);
+
+		CBucket& oPending = m_aPending[0];
+		if (iIndex % VB_PYRAMID_BUCKET_SIZE == 0)
+		{
+			m_aflPendingTime[0] = flTime;
+			oPending.m_oFirst = oPending.m_oLast = oPending.m_oLowest = oPending.m_oHighest = oValue;
+			m_aflPendingMean[0] = (double)oValue;
+			m_aflPendingM2[0] = 0;
+		}
+		else
+		{
+			oPending.m_oLast = oValue;
+			if (oValue < oPending.m_oLowest)
+				oPending.m_oLowest = oValue;
+			if (oPending.m_oHighest < oValue)
+				oPending.m_oHighest = oValue;
+
+			// Welford's running mean and variance.
+			double flDelta = (double)oValue - m_aflPendingMean[0];
+			m_aflPendingMean[0] += flDelta / (iIndex % VB_PYRAMID_BUCKET_SIZE + 1);
+			m_aflPendingM2[0] += flDelta * ((double)oValue - m_aflPendingMean[0]);
+		}
+
+		oPending.m_flLength = (float)(flTime - m_aflPendingTime[0]);
+
+		if ((iIndex + 1) % VB_PYRAMID_BUCKET_SIZE)
+			return;
+
+		// A bucket is done, pass it on up for as long as that finishes one too.
+		size_t iBucket = iIndex / VB_PYRAMID_BUCKET_SIZE;
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+		{
+			CBucket& oDone = m_aPending[i];
+			double flDoneTime = m_aflPendingTime[i];
+
+			oDone.m_flMean = (float)m_aflPendingMean[i];
+			oDone.m_flM2 = (float)m_aflPendingM2[i];
+
+			m_aLevels[i].push_back(CViewbackDataPair<CBucket>(flDoneTime, oDone));
+
+			if (i + 1 == VB_PYRAMID_LEVELS)
+				break;
+
+			CBucket& oAbove = m_aPending[i + 1];
+			if (iBucket % VB_PYRAMID_FANOUT == 0)
+			{
+				m_aflPendingTime[i + 1] = flDoneTime;
+				oAbove = oDone;
+				m_aflPendingMean[i + 1] = m_aflPendingMean[i];
+				m_aflPendingM2[i + 1] = m_aflPendingM2[i];
+			}
+			else
+			{
+				// Same as CViewbackStats::Merge(), with the counts known.
+				double flBefore = (double)(iBucket % VB_PYRAMID_FANOUT);
+				double flDelta = m_aflPendingMean[i] - m_aflPendingMean[i + 1];
+				m_aflPendingMean[i + 1] += flDelta / (flBefore + 1);
+				m_aflPendingM2[i + 1] += m_aflPendingM2[i] + flDelta * flDelta * BucketSize(i) * flBefore / (flBefore + 1);
+
+				oAbove.m_oLast = oDone.m_oLast;
+				if (oDone.m_oLowest < oAbove.m_oLowest)
+					oAbove.m_oLowest = oDone.m_oLowest;
+				if (oAbove.m_oHighest < oDone.m_oHighest)
+					oAbove.m_oHighest = oDone.m_oHighest;
+				oAbove.m_flLength = (float)(flDoneTime + oDone.m_flLength - m_aflPendingTime[i + 1]);
+			}
+
+			if ((iBucket + 1) % VB_PYRAMID_FANOUT)
+				break;
+
+			iBucket /= VB_PYRAMID_FANOUT;
+		}
+	}
+
+	// Writer. Drops every bucket that starts before flTime. Anything that's
+	// left then is newer than what the series keeps, unless the series had
+	// chunks dropped to stay under a memory budget.
+	void erase_before(double flTime)
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			m_aLevels[i].erase_before(flTime, 0);
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			m_aDigests[i].erase_before(flTime, 0);
+	}
+
+	// Writer. See CViewbackSeries::SetSpill().
+	void SetSpill(CViewbackSpillFile* pSpill)
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			m_aLevels[i].SetSpill(pSpill);
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			m_aDigests[i].SetSpill(pSpill);
+	}
+
+	// Writer. Drops the oldest chunk of the finest level that has one to
+	// spare, digests only once the buckets are down to one chunk a level.
+	bool erase_oldest_chunk()
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+		{
+			if (m_aLevels[i].erase_oldest_chunk())
+				return true;
+		}
+
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+		{
+			if (m_aDigests[i].erase_oldest_chunk())
+				return true;
+		}
+
+		return false;
+	}
+
+	size_t GetMemory() const
+	{
+		size_t iMemory = 0;
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			iMemory += m_aLevels[i].GetMemory();
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			iMemory += m_aDigests[i].GetMemory();
+		return iMemory;
+	}
+
+	void Reclaim(unsigned iAcknowledged)
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			m_aLevels[i].Reclaim(iAcknowledged);
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			m_aDigests[i].Reclaim(iAcknowledged);
+	}
+
+	void Publish(unsigned iEpoch)
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			m_aLevels[i].Publish(iEpoch);
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			m_aDigests[i].Publish(iEpoch);
+	}
+
+	// Reader.
+	void Snapshot()
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			m_aLevels[i].Snapshot();
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			m_aDigests[i].Snapshot();
+	}
+
+	void Sync()
+	{
+		for (size_t i = 0; i < VB_PYRAMID_LEVELS; i++)
+			m_aLevels[i].Sync();
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+			m_aDigests[i].Sync();
+	}
+
+private:
+	// -1 before the window and iPixels after it.
+	static int Column(double flTime, double flStart, double flEnd, size_t iPixels)
+	{
+		if (flTime < flStart)
+			return -1;
+
+		if (flTime > flEnd)
+			return (int)iPixels;
+
+		size_t iColumn = (size_t)((flTime - flStart) / (flEnd - flStart) * iPixels);
+		if (iColumn >= iPixels)
+			iColumn = iPixels - 1;
+
+		return (int)iColumn;
+	}
+
+	static size_t BucketSize(size_t iLevel)
+	{
+		size_t iSize = VB_PYRAMID_BUCKET_SIZE;
+		for (size_t i = 0; i < iLevel; i++)
+			iSize *= VB_PYRAMID_FANOUT;
+		return iSize;
+	}
+
+	static size_t DigestSize(size_t iLevel)
+	{
+		size_t iSize = VB_DIGEST_BLOCK_SIZE;
+		for (size_t i = 0; i < iLevel; i++)
+			iSize *= VB_DIGEST_FANOUT;
+		return iSize;
+	}
+
+	// Writer. Digests a full block and passes it on up for as long as that
+	// finishes a digest too.
+	void AddBlock(size_t iDigest)
+	{
+		for (size_t i = 0; i < VB_DIGEST_LEVELS; i++)
+		{
+			std::vector<CViewbackCentroid>& aDone = m_aaPendingCentroids[i];
+			CompressCentroids(aDone, VB_DIGEST_CENTROIDS);
+
+			for (size_t j = 0; j < VB_DIGEST_CENTROIDS; j++)
+			{
+				CDigestCentroid oCentroid;
+				oCentroid.m_flMean = (j < aDone.size()) ? (float)aDone[j].m_flMean : 0;
+				oCentroid.m_flWeight = (j < aDone.size()) ? (float)aDone[j].m_flWeight : 0;
+				m_aDigests[i].push_back(CViewbackDataPair<CDigestCentroid>(m_aflDigestTime[i], oCentroid));
+			}
+
+			if (i + 1 == VB_DIGEST_LEVELS)
+				break;
+
+			std::vector<CViewbackCentroid>& aAbove = m_aaPendingCentroids[i + 1];
+			if (iDigest % VB_DIGEST_FANOUT == 0)
+			{
+				m_aflDigestTime[i + 1] = m_aflDigestTime[i];
+				aAbove.clear();
+			}
+
+			aAbove.insert(aAbove.end(), aDone.begin(), aDone.end());
+
+			if ((iDigest + 1) % VB_DIGEST_FANOUT)
+				break;
+
+			iDigest /= VB_DIGEST_FANOUT;
+		}
+	}
+
+	// Reader. Samples dropped to stay under a memory budget can still be here
+	// as buckets after they're gone from the series, so a window that starts
+	// at the first sample may really start further back.
+	size_t FirstIndex(const CViewbackSeries<T>& aSeries, double flStart, double flEnd, bool bEdges, size_t iBegin) const
+	{
+		if (iBegin != aSeries.m_iReadBegin)
+			return iBegin;
+
+		for (size_t j = 0; j < VB_PYRAMID_LEVELS; j++)
+		{
+			if (m_aLevels[j].empty())
+				continue;
+
+			size_t iBucketBegin, iBucketEnd;
+			m_aLevels[j].FindRange(flStart, flEnd, bEdges, iBucketBegin, iBucketEnd);
+
+			if (iBucketBegin < iBucketEnd && iBucketBegin * BucketSize(j) < iBegin)
+				iBegin = iBucketBegin * BucketSize(j);
+		}
+
+		return iBegin;
+	}
+
+	// Reader. Where the next bucket or digest after i starts, for skipping
+	// over the gaps that dropping chunks leaves before iSamplesBegin.
+	size_t NextIndex(size_t i, size_t iSamplesBegin) const
+	{
+		size_t iNext = iSamplesBegin;
+		for (size_t j = 0; j < VB_PYRAMID_LEVELS; j++)
+		{
+			size_t iSize = BucketSize(j);
+			const CViewbackSeries<CBucket>& aLevel = m_aLevels[j];
+
+			size_t iBucket = i / iSize + 1;
+			if (iBucket < aLevel.m_iReadBegin)
+				iBucket = aLevel.m_iReadBegin;
+
+			if (iBucket < aLevel.m_iReadEnd && iBucket * iSize < iNext)
+				iNext = iBucket * iSize;
+		}
+
+		for (size_t j = 0; j < VB_DIGEST_LEVELS; j++)
+		{
+			size_t iSize = DigestSize(j);
+			const CViewbackSeries<CDigestCentroid>& aLevel = m_aDigests[j];
+
+			size_t iDigest = i / iSize + 1;
+			if (iDigest * VB_DIGEST_CENTROIDS < aLevel.m_iReadBegin)
+				iDigest = (aLevel.m_iReadBegin + VB_DIGEST_CENTROIDS - 1) / VB_DIGEST_CENTROIDS;
+
+			if ((iDigest + 1) * VB_DIGEST_CENTROIDS <= aLevel.m_iReadEnd && iDigest * iSize < iNext)
+				iNext = iDigest * iSize;
+		}
+
+		return iNext;
+	}
+
+private:
+	// Bucket n of level i covers samples n * BucketSize(i) up to the next
+	// one, counting every sample ever added the way the series does.
+	CViewbackSeries<CBucket> m_aLevels[VB_PYRAMID_LEVELS];
+
+	// Digest n of level i covers samples n * DigestSize(i) up to the next
+	// one, and is the VB_DIGEST_CENTROIDS centroids from n * VB_DIGEST_CENTROIDS.
+	CViewbackSeries<CDigestCentroid> m_aDigests[VB_DIGEST_LEVELS];
+
+	// Writer only. The buckets still being filled.
+	size_t  m_iCount;
+	CBucket m_aPending[VB_PYRAMID_LEVELS];
+	double  m_aflPendingTime[VB_PYRAMID_LEVELS];
+	double  m_aflPendingMean[VB_PYRAMID_LEVELS];
+	double  m_aflPendingM2[VB_PYRAMID_LEVELS];
+
+	// Writer only. The digests still being filled, the finest one with a
+	// centroid for every sample.
+	std::vector<CViewbackCentroid> m_aaPendingCentroids[VB_DIGEST_LEVELS];
+	double                         m_aflDigestTime[VB_DIGEST_LEVELS];
+};
+
+template <typename T>
+void CViewbackPyramid<T>::GetExtents(const CViewbackSeries<T>& aSeries, double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<T> >& aExtents) const
+{
+	aExtents.clear();
+
+	if (!iPixels || !(flEnd > flStart))
+		return;
+
+	size_t iBegin, iEnd;
+	aSeries.FindRange(flStart, flEnd, true, iBegin, iEnd);
+
+	size_t iSamplesBegin = aSeries.m_iReadBegin;
+	iBegin = FirstIndex(aSeries, flStart, flEnd, true, iBegin);
+
+	// Levels are only used up to the finest one that has no more than a few
+	// buckets per column. A short enough stretch is just read sample by sample.
+	size_t iLevels = 0;
+	while (iLevels < VB_PYRAMID_LEVELS && (iEnd - iBegin) / (iLevels ? BucketSize(iLevels - 1) : 1) > iPixels * 4)
+		iLevels++;
+
+	int iColumn = 0;
+
+	for (size_t i = iBegin; i < iEnd; )
+	{
+		double flFirstTime, flLastTime;
+		CBucket oBucket;
+		size_t iCount = 0;
+		int iFirstColumn = 0;
+
+		// The biggest bucket that starts here, fits, and doesn't cross a column.
+		for (size_t j = iLevels; j-- > 0; )
+		{
+			size_t iSize = BucketSize(j);
+			const CViewbackSeries<CBucket>& aLevel = m_aLevels[j];
+
+			if (i % iSize || i + iSize > iEnd || i / iSize < aLevel.m_iReadBegin || i / iSize >= aLevel.m_iReadEnd)
+				continue;
+
+			CViewbackDataPair<CBucket> oPair = CViewbackSeries<CBucket>::At(aLevel.m_pReadTable, i / iSize);
+			flFirstTime = oPair.time;
+			flLastTime = oPair.time + oPair.data.m_flLength;
+
+			iFirstColumn = Column(flFirstTime, flStart, flEnd, iPixels);
+			if (iFirstColumn != Column(flLastTime, flStart, flEnd, iPixels))
+				continue;
+
+			oBucket = oPair.data;
+			iCount = iSize;
+			break;
+		}
+
+		if (!iCount && i >= iSamplesBegin)
+		{
+			CViewbackDataPair<T> oPair = CViewbackSeries<T>::At(aSeries.m_pReadTable, i);
+			flFirstTime = flLastTime = oPair.time;
+			oBucket.m_oFirst = oBucket.m_oLast = oBucket.m_oLowest = oBucket.m_oHighest = oPair.data;
+			iFirstColumn = Column(flFirstTime, flStart, flEnd, iPixels);
+			iCount = 1;
+		}
+		else if (!iCount)
+		{
+			// The samples are gone, so the finest bucket there is will have to
+			// do even if it crosses a column. It goes in the one it starts in.
+			for (size_t j = 0; j < VB_PYRAMID_LEVELS; j++)
+			{
+				size_t iSize = BucketSize(j);
+				const CViewbackSeries<CBucket>& aLevel = m_aLevels[j];
+
+				if (i % iSize || i + iSize > iSamplesBegin || i / iSize < aLevel.m_iReadBegin || i / iSize >= aLevel.m_iReadEnd)
+					continue;
+
+				CViewbackDataPair<CBucket> oPair = CViewbackSeries<CBucket>::At(aLevel.m_pReadTable, i / iSize);
+				flFirstTime = oPair.time;
+				flLastTime = oPair.time + oPair.data.m_flLength;
+				oBucket = oPair.data;
+				iFirstColumn = Column(flFirstTime, flStart, flEnd, iPixels);
+				iCount = iSize;
+				break;
+			}
+
+			if (!iCount)
+			{
+				// Nothing starts here. Skip to wherever something does.
+				i = NextIndex(i, iSamplesBegin);
+				continue;
+			}
+		}
+
+		i += iCount;
+
+		// Single precision times can round a hair backwards across a column edge.
+		if (aExtents.size() && iFirstColumn < iColumn)
+			iFirstColumn = iColumn;
+
+		if (aExtents.size() && iFirstColumn == iColumn)
+		{
+			CViewbackExtent<T>& oExtent = aExtents.back();
+			oExtent.m_flLastTime = flLastTime;
+			oExtent.m_oLast = oBucket.m_oLast;
+			if (oBucket.m_oLowest < oExtent.m_oLowest)
+				oExtent.m_oLowest = oBucket.m_oLowest;
+			if (oExtent.m_oHighest < oBucket.m_oHighest)
+				oExtent.m_oHighest = oBucket.m_oHighest;
+		}
+		else
+		{
+			iColumn = iFirstColumn;
+
+			CViewbackExtent<T> oExtent;
+			oExtent.m_flFirstTime = flFirstTime;
+			oExtent.m_flLastTime = flLastTime;
+			oExtent.m_oFirst = oBucket.m_oFirst;
+			oExtent.m_oLast = oBucket.m_oLast;
+			oExtent.m_oLowest = oBucket.m_oLowest;
+			oExtent.m_oHighest = oBucket.m_oHighest;
+			aExtents.push_back(oExtent);
+		}
+
+		// That was the one after the window.
+		if (iColumn == (int)iPixels)
+			break;
+	}
+}
+
+template <typename T>
+void CViewbackPyramid<T>::GetStats(const CViewbackSeries<T>& aSeries, double flStart, double flEnd, CViewbackStats& oStats) const
+{
+	oStats = CViewbackStats();
+
+	if (!(flEnd >= flStart))
+		return;
+
+	size_t iBegin, iEnd;
+	aSeries.FindRange(flStart, flEnd, false, iBegin, iEnd);
+
+	size_t iSamplesBegin = aSeries.m_iReadBegin;
+	iBegin = FirstIndex(aSeries, flStart, flEnd, false, iBegin);
+
+	// The moments, from the biggest buckets that fit.
+	size_t i = iBegin;
+	while (i < iEnd)
+	{
+		double flFirstTime, flLastTime, flMean, flM2;
+		CBucket oBucket;
+		size_t iCount = 0;
+
+		for (size_t j = VB_PYRAMID_LEVELS; j-- > 0; )
+		{
+			size_t iSize = BucketSize(j);
+			const CViewbackSeries<CBucket>& aLevel = m_aLevels[j];
+
+			if (i % iSize || i + iSize > iEnd || i / iSize < aLevel.m_iReadBegin || i / iSize >= aLevel.m_iReadEnd)
+				continue;
+
+			CViewbackDataPair<CBucket> oPair = CViewbackSeries<CBucket>::At(aLevel.m_pReadTable, i / iSize);
+
+			// Where the samples are gone only the times say where the window ends.
+			if (i + iSize <= iSamplesBegin && oPair.time + oPair.data.m_flLength > flEnd)
+				continue;
+
+			flFirstTime = oPair.time;
+			flLastTime = oPair.time + oPair.data.m_flLength;
+			oBucket = oPair.data;
+			flMean = oBucket.m_flMean;
+			flM2 = oBucket.m_flM2;
+			iCount = iSize;
+			break;
+		}
+
+		if (!iCount && i >= iSamplesBegin)
+		{
+			CViewbackDataPair<T> oPair = CViewbackSeries<T>::At(aSeries.m_pReadTable, i);
+			flFirstTime = flLastTime = oPair.time;
+			oBucket.m_oFirst = oBucket.m_oLast = oBucket.m_oLowest = oBucket.m_oHighest = oPair.data;
+			flMean = (double)oPair.data;
+			flM2 = 0;
+			iCount = 1;
+		}
+		else if (!iCount)
+		{
+			// A bucket that starts here but doesn't fit goes past the end of
+			// the window, and so does everything after it.
+			bool bPastEnd = false;
+			for (size_t j = 0; j < VB_PYRAMID_LEVELS; j++)
+			{
+				size_t iSize = BucketSize(j);
+				const CViewbackSeries<CBucket>& aLevel = m_aLevels[j];
+
+				if (!(i % iSize) && i + iSize <= iSamplesBegin && i / iSize >= aLevel.m_iReadBegin && i / iSize < aLevel.m_iReadEnd)
+					bPastEnd = true;
+			}
+
+			if (bPastEnd)
+				break;
+
+			i = NextIndex(i, iSamplesBegin);
+			continue;
+		}
+
+		if (!oStats.m_iCount)
+		{
+			oStats.m_flFirstTime = flFirstTime;
+			oStats.m_flFirst = (double)oBucket.m_oFirst;
+		}
+
+		oStats.m_flLastTime = flLastTime;
+		oStats.m_flLast = (double)oBucket.m_oLast;
+
+		oStats.Merge(iCount, flMean, flM2, (double)oBucket.m_oLowest, (double)oBucket.m_oHighest);
+
+		i += iCount;
+	}
+
+	// The quantiles cover the same samples.
+	iEnd = i;
+
+	std::vector<CViewbackCentroid>& aCentroids = oStats.m_aCentroids;
+
+	for (i = iBegin; i < iEnd; )
+	{
+		size_t iCount = 0;
+
+		for (size_t j = VB_DIGEST_LEVELS; j-- > 0; )
+		{
+			size_t iSize = DigestSize(j);
+			const CViewbackSeries<CDigestCentroid>& aLevel = m_aDigests[j];
+			size_t iFirst = i / iSize * VB_DIGEST_CENTROIDS;
+
+			if (i % iSize || i + iSize > iEnd || iFirst < aLevel.m_iReadBegin || iFirst + VB_DIGEST_CENTROIDS > aLevel.m_iReadEnd)
+				continue;
+
+			for (size_t k = 0; k < VB_DIGEST_CENTROIDS; k++)
+			{
+				CDigestCentroid oCentroid = CViewbackSeries<CDigestCentroid>::At(aLevel.m_pReadTable, iFirst + k).data;
+				if (oCentroid.m_flWeight > 0)
+					aCentroids.push_back(CViewbackCentroid(oCentroid.m_flMean, oCentroid.m_flWeight));
+			}
+
+			iCount = iSize;
+			break;
+		}
+
+		if (!iCount && i >= iSamplesBegin)
+		{
+			aCentroids.push_back(CViewbackCentroid((double)CViewbackSeries<T>::At(aSeries.m_pReadTable, i).data, 1));
+			iCount = 1;
+		}
+		else if (!iCount)
+		{
+			// The samples are gone, so the finest bucket there is stands in for them.
+			for (size_t j = 0; j < VB_PYRAMID_LEVELS; j++)
+			{
+				size_t iSize = BucketSize(j);
+				const CViewbackSeries<CBucket>& aLevel = m_aLevels[j];
+
+				if (i % iSize || i + iSize > iEnd || i / iSize < aLevel.m_iReadBegin || i / iSize >= aLevel.m_iReadEnd)
+					continue;
+
+				aCentroids.push_back(CViewbackCentroid(CViewbackSeries<CBucket>::At(aLevel.m_pReadTable, i / iSize).data.m_flMean, (double)iSize));
+				iCount = iSize;
+				break;
+			}
+
+			if (!iCount)
+			{
+				i = NextIndex(i, iSamplesBegin);
+				continue;
+			}
+		}
+
+		i += iCount;
+
+		// Keeps a long window from piling up too many.
+		if (aCentroids.size() > VB_STATS_CENTROIDS * 8)
+			CompressCentroids(aCentroids, VB_STATS_CENTROIDS);
+	}
+
+	CompressCentroids(aCentroids, VB_STATS_CENTROIDS);
+}
+
+// Holds all of the data associated with one handle.
+class CViewbackDataList
+{
+public:
+	template <typename T>
+	using DataPair = CViewbackDataPair<T>;
+
+public:
+	CViewbackDataRange GetRange(double flStart, double flEnd, bool bEdges = true) const
+	{
+		CViewbackDataRange oRange;
+		oRange.m_aIntData = m_aIntData.GetRange(flStart, flEnd, bEdges);
+		oRange.m_aFloatData = m_aFloatData.GetRange(flStart, flEnd, bEdges);
+		oRange.m_aVectorData = m_aVectorData.GetRange(flStart, flEnd, bEdges);
+		return oRange;
+	}
+
+	// A chart's worth of an int or float channel, see CViewbackPyramid::GetExtents().
+	void GetExtents(double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<int> >& aExtents) const
+	{
+		m_oIntPyramid.GetExtents(m_aIntData, flStart, flEnd, iPixels, aExtents);
+	}
+
+	void GetExtents(double flStart, double flEnd, size_t iPixels, std::vector<CViewbackExtent<float> >& aExtents) const
+	{
+		m_oFloatPyramid.GetExtents(m_aFloatData, flStart, flEnd, iPixels, aExtents);
+	}
+
+	// Statistics for an int or float channel, see CViewbackPyramid::GetStats().
+	void GetIntStats(double flStart, double flEnd, CViewbackStats& oStats) const
+	{
+		m_oIntPyramid.GetStats(m_aIntData, flStart, flEnd, oStats);
+	}
+
+	void GetFloatStats(double flStart, double flEnd, CViewbackStats& oStats) const
+	{
+		m_oFloatPyramid.GetStats(m_aFloatData, flStart, flEnd, oStats);
+	}
+
+	// For a list only one thread uses.
+	void Sync()
+	{
+		m_aIntData.Sync();
+		m_aFloatData.Sync();
+		m_aVectorData.Sync();
+		m_oIntPyramid.Sync();
+		m_oFloatPyramid.Sync();
+	}
+
+public:
+	// Only one of these will be used at a time.
+	CViewbackSeries<int>       m_aIntData;
+	CViewbackSeries<float>     m_aFloatData;
+	CViewbackSeries<VBVector3> m_aVectorData;
+
+	// Only kept up by CViewbackHistory. Vectors aren't charted so they don't get one.
+	CViewbackPyramid<int>   m_oIntPyramid;
+	CViewbackPyramid<float> m_oFloatPyramid;
+};
+
+// All of the data for one connection, from one registration packet until
+// the next. It's stashed into by one thread, either the main thread or the
+// data thread (see CViewbackClient::SetStashOnDataThread()), and read by
+// the main thread.
+//
+// The writer publishes what it has every so often. The reader takes a
+// snapshot at the start of each frame and everything it reads until the
+// next snapshot is consistent with that one publish, no matter how much
+// data arrives in the meantime. Publishes are guarded by a sequence number
+// the way a seqlock is, so neither side ever waits on a lock, and the
+// reader hands back the sequence number it saw so the writer knows when
+// dropped chunks are safe to free.
+class CViewbackHistory
+{
+public:
+	// The derived channels get handles after the registration's own, in
+	// order, leaving out any that don't compile. Triggers can watch any of
+	// them except vectors, ones on channels that aren't there are left out.
+	CViewbackHistory(const Packet& oRegistration, unsigned iSerial = 0, const std::vector<CViewbackDerivedChannel>& aDerived = std::vector<CViewbackDerivedChannel>(), const std::vector<CViewbackTrigger>& aTriggers = std::vector<CViewbackTrigger>());
+
+private:
+	CViewbackHistory(const CViewbackHistory&);
+	CViewbackHistory& operator=(const CViewbackHistory&);
+
+public:
+	// Writer.
+	void Stash(const CViewbackSample& oSample);
+	void Publish();
+
+	// Writer, before the first Stash(). Full chunks of samples go into a
+	// file in sDirectory from then on, so memory use stays at about a chunk
+	// per channel and nothing is thrown out, clear times are ignored. Old
+	// data is paged back in from the file when it's read. Returns false and
+	// keeps everything in memory if the file can't be made.
+	bool SpillTo(const std::string& sDirectory);
+
+	// Reader.
+	void Snapshot();
+
+	const std::vector<CViewbackDataList>& GetData() const { return m_aData; }
+	double GetLatestDataTime() const { return m_flReadLatestDataTime; }
+	double GetTimeReceivedLatestData() const { return m_flReadTimeReceived; } // Wall clock seconds.
+
+	// Either side. Data older than this may be thrown out.
+	void SetClearTime(size_t iHandle, double flTime);
+
+	// Either side. When the channels' samples take more than this many bytes
+	// the oldest are thrown out, from the lowest priority channels first.
+	// What's in the pyramids is kept as long as it still fits, so the
+	// channels can still be drawn zoomed out. 0 means no limit.
+	void SetMemoryBudget(size_t iBytes);
+	void SetPriority(size_t iHandle, int iPriority);
+
+	unsigned GetSerial() const { return m_iSerial; }
+
+	// Either side, they don't change after the history is made.
+	size_t                          GetRegisteredChannels() const { return m_iRegisteredChannels; }
+	const std::vector<std::string>& GetDerivedNames() const { return m_asDerivedNames; }
+	const std::vector<size_t>&      GetDerivedInputs(size_t iDerived) const { return m_aDerived[iDerived].GetInputs(); }
+	const std::vector<CViewbackTrigger>& GetTriggers() const { return m_aTriggers; }
+
+	// Reader. Every time a trigger has gone off, in the order they did.
+	// Nothing is ever dropped from it.
+	const CViewbackSeries<CViewbackTriggerHit>& GetHits() const { return m_aHits; }
+
+private:
+	// Writer.
+	void   Derive(size_t iHandle, double flTime);
+	void   Check(size_t iHandle, double flTime, double flValue);
+	void   Fire(size_t iRule);
+	void   KeepInBudget();
+	size_t GetMemory() const;
+
+private:
+	unsigned m_iSerial;
+
+	// Before m_aData, it has to outlive the chunks in it.
+	CViewbackSpillFile m_oSpill;
+
+	std::vector<vb_data_type_t>    m_aeTypes;
+	std::vector<CViewbackDataList> m_aData;
+
+	// Derived channel i has the handle m_iRegisteredChannels + i.
+	size_t                            m_iRegisteredChannels;
+	std::vector<std::string>          m_asDerivedNames;
+	std::vector<CViewbackExpression>  m_aDerived;           // Evaluated by the writer.
+	std::vector<std::vector<size_t> > m_aaiDerivedFrom;     // By handle, the derived channels that use it.
+
+	std::vector<CViewbackTrigger>     m_aTriggers;
+	std::vector<CViewbackRule>        m_aRules;           // Checked by the writer, one per trigger.
+	std::vector<std::vector<size_t> > m_aaiRulesOn;       // By handle, the rules that watch it.
+
+	// Rules waiting out a duration, soonest first. A rule that's gone false
+	// and true again since it was queued has a new deadline, and the old
+	// one is skipped.
+	std::priority_queue<std::pair<double, size_t>, std::vector<std::pair<double, size_t> >, std::greater<std::pair<double, size_t> > > m_aDeadlines;
+
+	CViewbackSeries<CViewbackTriggerHit> m_aHits;
+
+	std::unique_ptr<std::atomic<double>[]> m_aflClearTime;
+	std::unique_ptr<std::atomic<int>[]>    m_aiPriority;
+	std::atomic<size_t>                    m_iMemoryBudget;
+
+	// Writer only.
+	double m_flLatestDataTime;
+	double m_flTimeReceived;
+	double m_flNextDataClear;
+	size_t m_iStashedSinceBudget;
+
+	std::atomic<unsigned> m_iSequence;     // Odd while the writer is publishing.
+	std::atomic<unsigned> m_iAcknowledged; // The last sequence number the reader took a snapshot at.
+
+	std::atomic<double> m_flPublishedLatestDataTime;
+	std::atomic<double> m_flPublishedTimeReceived;
+
+	// Reader only.
+	double m_flReadLatestDataTime;
+	double m_flReadTimeReceived;
+};
+
+}
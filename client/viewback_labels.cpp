@@ -0,0 +1,127 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "viewback_labels.h"
+
+#include <algorithm>
+
+using namespace vb;
+using namespace std;
+
+static bool LabelLess(const CViewbackLabels::CLabel& l, int r)
+{
+	return l.first < r;
+}
+
+void CViewbackLabels::Set(int iValue, const string& sLabel)
+{
+	vector<CLabel>::iterator it = lower_bound(m_aLabels.begin(), m_aLabels.end(), iValue, &LabelLess);
+
+	// A new string rather than changing the old one, which might still be held.
+	if (it != m_aLabels.end() && it->first == iValue)
+	{
+		it->second = make_shared<const string>(sLabel);
+		return;
+	}
+
+	m_aLabels.insert(it, CLabel(iValue, make_shared<const string>(sLabel)));
+
+	Index();
+}
+
+void CViewbackLabels::clear()
+{
+	m_aLabels.clear();
+	m_aiDense.clear();
+	m_iDenseMin = 0;
+}
+
+const string* CViewbackLabels::Find(int iValue) const
+{
+	const CLabel* pLabel = FindLabel(iValue);
+	if (!pLabel)
+		return NULL;
+
+	return pLabel->second.get();
+}
+
+const CViewbackLabels::CLabel* CViewbackLabels::FindLabel(int iValue) const
+{
+	if (m_aiDense.size())
+	{
+		// Unsigned so that values below the range wrap around and miss too.
+		size_t iIndex = (size_t)((unsigned int)iValue - (unsigned int)m_iDenseMin);
+		if (iIndex >= m_aiDense.size() || m_aiDense[iIndex] < 0)
+			return NULL;
+
+		return &m_aLabels[m_aiDense[iIndex]];
+	}
+
+	vector<CLabel>::const_iterator it = lower_bound(m_aLabels.begin(), m_aLabels.end(), iValue, &LabelLess);
+	if (it == m_aLabels.end() || it->first != iValue)
+		return NULL;
+
+	return &*it;
+}
+
+void CViewbackLabels::Index()
+{
+	m_aiDense.clear();
+	m_iDenseMin = 0;
+
+	if (!m_aLabels.size())
+		return;
+
+	// Index directly if it wouldn't be mostly holes.
+	long long iRange = (long long)m_aLabels.back().first - m_aLabels.front().first + 1;
+	if (iRange > (long long)m_aLabels.size() * 4 + 16)
+		return;
+
+	m_iDenseMin = m_aLabels.front().first;
+	m_aiDense.assign((size_t)iRange, -1);
+
+	for (size_t i = 0; i < m_aLabels.size(); i++)
+		m_aiDense[m_aLabels[i].first - m_iDenseMin] = (int)i;
+}
+
+CViewbackLabelText::CViewbackLabelText(const shared_ptr<const string>& pLabel)
+	: m_pLabel(pLabel)
+{
+	m_szNumber[0] = '\0';
+}
+
+CViewbackLabelText::CViewbackLabelText(int iValue)
+{
+	// By hand, it's a lot quicker than sprintf() and timelines do this a lot.
+	char szDigits[12];
+	size_t iDigits = 0;
+
+	unsigned int iMagnitude = iValue < 0 ? 0u - (unsigned int)iValue : (unsigned int)iValue;
+	do
+	{
+		szDigits[iDigits++] = (char)('0' + iMagnitude % 10);
+		iMagnitude /= 10;
+	} while (iMagnitude);
+
+	char* pszNumber = m_szNumber;
+	if (iValue < 0)
+		*pszNumber++ = '-';
+
+	while (iDigits)
+		*pszNumber++ = szDigits[--iDigits];
+
+	*pszNumber = '\0';
+}
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vb
+{
+
+// A channel's labels, sorted by value. Lookups are a binary search, or
+// straight indexing if the values are close together the way enums are.
+class CViewbackLabels
+{
+public:
+	typedef std::pair<int, std::shared_ptr<const std::string> > CLabel; // Shared so that CViewbackLabelText can hold on to it.
+	typedef std::vector<CLabel>::const_iterator const_iterator;
+
+public:
+	CViewbackLabels()
+	{
+		m_iDenseMin = 0;
+	}
+
+public:
+	void Set(int iValue, const std::string& sLabel);
+	void clear();
+
+	// NULL if the value has no label.
+	const std::string* Find(int iValue) const;
+	const CLabel*      FindLabel(int iValue) const;
+
+	size_t         size() const { return m_aLabels.size(); }
+	const_iterator begin() const { return m_aLabels.begin(); }
+	const_iterator end() const { return m_aLabels.end(); }
+
+private:
+	void Index();
+
+private:
+	std::vector<CLabel> m_aLabels;
+
+	// Position in m_aLabels for each value from m_iDenseMin on, -1 for no label. Empty if too spread out.
+	int              m_iDenseMin;
+	std::vector<int> m_aiDense;
+};
+
+// A value's label, or the number if it has none, as GetLabelForValue()
+// hands it back. Small enough to return by value and doesn't allocate. It
+// holds on to the label and keeps the number inside, so it stays good for
+// as long as it's kept, even past the next registration.
+class CViewbackLabelText
+{
+public:
+	explicit CViewbackLabelText(const std::shared_ptr<const std::string>& pLabel);
+	explicit CViewbackLabelText(int iValue);
+
+public:
+	bool        IsLabel() const { return !!m_pLabel; }
+	const char* c_str() const { return m_pLabel ? m_pLabel->c_str() : m_szNumber; }
+
+	operator std::string() const { return m_pLabel ? *m_pLabel : std::string(m_szNumber); }
+
+private:
+	std::shared_ptr<const std::string> m_pLabel; // NULL for a number.
+	char                               m_szNumber[12];
+};
+
+}
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+// This is probably way wrong.
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <cstdatomic>
+#else
+#include <atomic>
+#endif
+
+#include "../server/viewback_shared.h"
+
+namespace vb
+{
+
+// A bounded queue for exactly one producer thread and one consumer thread.
+// Neither side takes a lock or waits for the other. All of the slots are
+// constructed up front and reused, so items that own memory (a Packet, a
+// string) keep their allocations from one trip around the ring to the next.
+// Items are filled and read in place, never copied in or out.
+template <typename T>
+class CViewbackQueue
+{
+public:
+	// Capacity is rounded up to a power of two.
+	CViewbackQueue(size_t iCapacity)
+	{
+		size_t iSize = 1;
+		while (iSize < iCapacity)
+			iSize *= 2;
+
+		m_aSlots.resize(iSize);
+		m_iMask = iSize - 1;
+
+		m_iHead = 0;
+		m_iTail = 0;
+		m_iCachedHead = 0;
+		m_iCachedTail = 0;
+	}
+
+private:
+	CViewbackQueue(const CViewbackQueue&);
+	CViewbackQueue& operator=(const CViewbackQueue&);
+
+public:
+	// Producer. Returns the slot to fill in, or NULL if the queue is full.
+	// The consumer doesn't see it until Push().
+	T* Reserve()
+	{
+		size_t iTail = m_iTail.load(std::memory_order_relaxed);
+
+		if (iTail - m_iCachedHead > m_iMask)
+		{
+			m_iCachedHead = m_iHead.load(std::memory_order_acquire);
+			if (iTail - m_iCachedHead > m_iMask)
+				return NULL;
+		}
+
+		return &m_aSlots[iTail & m_iMask];
+	}
+
+	// Producer. Hands the slot from Reserve() to the consumer.
+	void Push()
+	{
+		m_iTail.store(m_iTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer. Returns the oldest item, or NULL if the queue is empty. The
+	// item stays valid until Pop().
+	T* Front()
+	{
+		size_t iHead = m_iHead.load(std::memory_order_relaxed);
+
+		if (iHead == m_iCachedTail)
+		{
+			m_iCachedTail = m_iTail.load(std::memory_order_acquire);
+			if (iHead == m_iCachedTail)
+				return NULL;
+		}
+
+		return &m_aSlots[iHead & m_iMask];
+	}
+
+	// Consumer. Gives the slot from Front() back to the producer.
+	void Pop()
+	{
+		m_iHead.store(m_iHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	size_t GetCapacity() const { return m_aSlots.size(); }
+
+	// Only safe when neither thread is using the queue.
+	void Clear()
+	{
+		m_iHead = 0;
+		m_iTail = 0;
+		m_iCachedHead = 0;
+		m_iCachedTail = 0;
+	}
+
+private:
+	std::vector<T> m_aSlots;
+	size_t         m_iMask;
+
+	// The two sides are kept on separate cache lines so that they don't
+	// bounce one line back and forth between the producer and consumer.
+	// Each side keeps a stale copy of the other's index and only reloads
+	// it when the queue looks full or empty.
+	VB_ALIGN(64) std::atomic<size_t> m_iHead; // Written by the consumer.
+	size_t                           m_iCachedTail;
+
+	VB_ALIGN(64) std::atomic<size_t> m_iTail; // Written by the producer.
+	size_t                           m_iCachedHead;
+};
+
+}
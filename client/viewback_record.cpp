@@ -0,0 +1,564 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/*
+	viewback_record - Records games to disk with no monitor attached, for
+	soak tests and the like. It connects to every server that discovery
+	finds (or the ones it's told about), turns on the channels it's asked
+	for and writes each server's data to its own file, starting a new one
+	when the current one gets too big or too old.
+
+	viewback_record [options]
+	  --server H:P    Record this server instead of discovering them. Repeatable.
+	  --unix PATH     Record the server on this Unix domain socket. Repeatable.
+	  --max N         Record at most N discovered servers at once. Default 16.
+	  --channel NAME  Record this channel. Repeatable. Default is every channel.
+	  --group NAME    Activate this group of channels instead. Repeatable.
+	  --out DIR       Where the files go. Default is the current directory.
+	  --csv           Write CSV (see viewback_export.h) instead of columnar captures.
+	  --rotate-mb N   Start a new file after N megabytes. Default 1024, 0 for never.
+	  --rotate-min N  Start a new file after N minutes. Default 60, 0 for never.
+	  --duration S    Stop after S seconds. Default is to run until interrupted.
+
+	Files are named after the server and the time they were started. A
+	server that goes away has its file finished, and a new one is started
+	if it comes back. Discovered servers are dropped once they stop
+	announcing themselves, servers given on the command line are retried
+	less and less often until they're back. Memory use doesn't grow with how long it runs: the
+	client only keeps a few seconds of data around.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "viewback_client.h"
+#include "viewback_export.h"
+
+using namespace vb;
+
+// Data this old is let go, it's on disk by then.
+#define RECORD_KEEP_SECONDS 5
+
+// Per server, for anything that's still in memory anyway.
+#define RECORD_MEMORY_BUDGET (16*1024*1024)
+
+// Servers that were asked for by name are retried at most this far apart.
+#define RECORD_MAX_RETRY_SECONDS 60
+
+class CRecording
+{
+public:
+	CRecording()
+	{
+		m_iConnection = 0;
+		m_bUnix = false;
+		m_bDiscovered = false;
+		m_iNextRetry = 0;
+		m_iRetryDelay = 1;
+		m_bActivated = false;
+		m_iOpened = 0;
+		m_iFiles = 0;
+	}
+
+public:
+	size_t      m_iConnection;
+	std::string m_sAddress; // "ip:port", or the socket path for Unix sockets.
+	bool        m_bUnix;
+	bool        m_bDiscovered;
+
+	time_t      m_iNextRetry;  // Don't try to connect again before this.
+	int         m_iRetryDelay; // Seconds, doubles with each failure.
+
+	std::vector<CViewbackDataChannel> m_aChannels; // From the latest registration.
+	bool        m_bActivated;
+
+	CViewbackExporter m_oExporter;
+	time_t            m_iOpened;
+	size_t            m_iFiles;
+};
+
+static CViewbackClient g_oClient;
+static std::vector<CRecording*> g_apRecordings;
+static std::vector<size_t> g_aiFreeConnections; // The client can't remove connections, so they're reused.
+
+static std::vector<std::string> g_asChannels;
+static std::vector<std::string> g_asGroups;
+static std::string g_sDirectory = ".";
+static bool g_bCSV = false;
+static unsigned long long g_iRotateBytes = 1024ULL * 1024 * 1024;
+static int g_iRotateSeconds = 60 * 60;
+
+static volatile sig_atomic_t g_bStop = 0;
+
+static void DebugOutput(const char* pszOutput)
+{
+	fputs(pszOutput, stdout);
+}
+
+static void Stop(int)
+{
+	g_bStop = 1;
+}
+
+static CRecording* FindRecording(size_t iConnection)
+{
+	for (size_t i = 0; i < g_apRecordings.size(); i++)
+	{
+		if (g_apRecordings[i]->m_iConnection == iConnection)
+			return g_apRecordings[i];
+	}
+
+	return NULL;
+}
+
+static bool SameChannels(const std::vector<CViewbackDataChannel>& a, const std::vector<CViewbackDataChannel>& b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].m_sName != b[i].m_sName || a[i].m_eDataType != b[i].m_eDataType || a[i].m_asLabels.size() != b[i].m_asLabels.size())
+			return false;
+	}
+
+	return true;
+}
+
+static void CloseFile(CRecording& oRecording)
+{
+	if (!oRecording.m_oExporter.IsOpen())
+		return;
+
+	size_t iSamples = oRecording.m_oExporter.GetSamplesWritten();
+
+	if (oRecording.m_oExporter.Close())
+		printf("Finished a file for %s, %d samples.\n", oRecording.m_sAddress.c_str(), (int)iSamples);
+	else
+		printf("Couldn't finish writing a file for %s.\n", oRecording.m_sAddress.c_str());
+}
+
+static void OpenFile(CRecording& oRecording)
+{
+	time_t now;
+	time(&now);
+
+	char szTime[32];
+	strftime(szTime, sizeof(szTime), "%Y%m%d-%H%M%S", localtime(&now));
+
+	// Something that works as a file name.
+	std::string sName = oRecording.m_sAddress;
+	for (size_t i = 0; i < sName.length(); i++)
+	{
+		if (sName[i] == ':' || sName[i] == '/' || sName[i] == '\\')
+			sName[i] = '_';
+	}
+
+	char szFile[64];
+	sprintf(szFile, "-%s-%d.%s", szTime, (int)oRecording.m_iFiles, g_bCSV ? "csv" : "vbc");
+
+	std::string sFile = g_sDirectory + "/" + sName + szFile;
+
+	oRecording.m_iFiles++;
+	oRecording.m_iOpened = now;
+
+	if (!oRecording.m_oExporter.Open(sFile.c_str(), g_bCSV ? VB_EXPORT_CSV : VB_EXPORT_COLUMNAR))
+	{
+		printf("Couldn't create %s\n", sFile.c_str());
+		return;
+	}
+
+	oRecording.m_oExporter.SetChannels(oRecording.m_aChannels);
+
+	printf("Recording %s to %s\n", oRecording.m_sAddress.c_str(), sFile.c_str());
+}
+
+static void Activate(CRecording& oRecording)
+{
+	CViewbackConnection& oConnection = g_oClient.GetConnection(oRecording.m_iConnection);
+
+	// ActivateGroup() would have the server drop everything else that's active,
+	// so only the last group would get recorded. Activate each channel instead.
+	std::vector<bool> abSelected(oConnection.GetChannels().size(), !g_asChannels.size() && !g_asGroups.size());
+
+	for (size_t i = 0; i < oConnection.GetGroups().size(); i++)
+	{
+		for (size_t j = 0; j < g_asGroups.size(); j++)
+		{
+			if (oConnection.GetGroups()[i].m_sName != g_asGroups[j])
+				continue;
+
+			for (size_t k : oConnection.GetGroups()[i].m_iChannels)
+			{
+				if (k < abSelected.size())
+					abSelected[k] = true;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < oConnection.GetChannels().size(); i++)
+	{
+		for (size_t j = 0; j < g_asChannels.size(); j++)
+		{
+			if (oConnection.GetChannels()[i].m_sName == g_asChannels[j])
+				abSelected[i] = true;
+		}
+
+		if (abSelected[i] && !oConnection.GetChannels()[i].m_bActive)
+			oConnection.ActivateChannel(i);
+	}
+
+	oRecording.m_bActivated = true;
+}
+
+// Called from CViewbackClient::Update(), which is how a new registration
+// gets handled before any of the data that comes after it.
+static void RegistrationUpdate()
+{
+	for (size_t i = 0; i < g_apRecordings.size(); i++)
+	{
+		CRecording& oRecording = *g_apRecordings[i];
+		CViewbackConnection& oConnection = g_oClient.GetConnection(oRecording.m_iConnection);
+
+		if (SameChannels(oConnection.GetChannels(), oRecording.m_aChannels))
+			continue;
+
+		oRecording.m_aChannels = oConnection.GetChannels();
+		oRecording.m_bActivated = false;
+
+		if (!oRecording.m_aChannels.size())
+			continue;
+
+		if (oRecording.m_oExporter.IsOpen())
+			oRecording.m_oExporter.SetChannels(oRecording.m_aChannels);
+		else
+			OpenFile(oRecording);
+
+		// Channels are only ever activated here, if the server sent the same
+		// registration again it remembers which ones were on.
+		Activate(oRecording);
+	}
+}
+
+static void DataReceived(size_t iConnection, const CViewbackSample& oSample)
+{
+	CRecording* pRecording = FindRecording(iConnection);
+
+	if (pRecording && pRecording->m_oExporter.IsOpen())
+		pRecording->m_oExporter.AddSample(oSample);
+}
+
+static CRecording* AddRecording(const std::string& sAddress, bool bUnix, bool bDiscovered)
+{
+	CRecording* pRecording = new CRecording();
+	pRecording->m_sAddress = sAddress;
+	pRecording->m_bUnix = bUnix;
+	pRecording->m_bDiscovered = bDiscovered;
+
+	// The client starts out with one connection.
+	if (g_aiFreeConnections.size())
+	{
+		pRecording->m_iConnection = g_aiFreeConnections.back();
+		g_aiFreeConnections.pop_back();
+	}
+	else if (g_apRecordings.size())
+		pRecording->m_iConnection = g_oClient.AddConnection();
+	else
+		VBAssert(g_oClient.GetNumConnections() == 1);
+
+	g_apRecordings.push_back(pRecording);
+
+	return pRecording;
+}
+
+static void RemoveRecording(size_t iRecording)
+{
+	CRecording* pRecording = g_apRecordings[iRecording];
+
+	CloseFile(*pRecording);
+	g_oClient.GetConnection(pRecording->m_iConnection).Disconnect();
+	g_aiFreeConnections.push_back(pRecording->m_iConnection);
+
+	g_apRecordings.erase(g_apRecordings.begin() + iRecording);
+	delete pRecording;
+}
+
+static void Connect(CRecording& oRecording)
+{
+	CViewbackConnection& oConnection = g_oClient.GetConnection(oRecording.m_iConnection);
+
+	if (oRecording.m_bUnix)
+		oConnection.ConnectUnix(oRecording.m_sAddress.c_str());
+	else
+	{
+		std::string sIP = oRecording.m_sAddress.substr(0, oRecording.m_sAddress.find(':'));
+		unsigned short iPort = (unsigned short)atoi(oRecording.m_sAddress.c_str() + sIP.length() + 1);
+
+		oConnection.Connect(sIP.c_str(), iPort);
+	}
+
+	oRecording.m_aChannels.clear();
+	oRecording.m_bActivated = false;
+
+	// Reset once the connection is seen working.
+	oRecording.m_iNextRetry = time(NULL) + oRecording.m_iRetryDelay;
+	oRecording.m_iRetryDelay = std::min(oRecording.m_iRetryDelay * 2, RECORD_MAX_RETRY_SECONDS);
+}
+
+static std::string ServerAddress(const CServerListing& oServer)
+{
+	in_addr in;
+	in.s_addr = htonl(oServer.address);
+
+	char szAddress[64];
+	sprintf(szAddress, "%s:%d", inet_ntoa(in), (int)oServer.tcp_port);
+
+	return szAddress;
+}
+
+static bool IsAnnouncing(const CServerList& pServers, const std::string& sAddress)
+{
+	for (size_t i = 0; i < pServers->size(); i++)
+	{
+		if (ServerAddress((*pServers)[i]) == sAddress)
+			return true;
+	}
+
+	return false;
+}
+
+static void Discover(const CServerList& pServers, size_t iMaxServers)
+{
+	for (size_t i = 0; i < pServers->size(); i++)
+	{
+		const CServerListing& oServer = (*pServers)[i];
+		std::string sAddress = ServerAddress(oServer);
+
+		bool bFound = false;
+		for (size_t j = 0; j < g_apRecordings.size(); j++)
+		{
+			if (g_apRecordings[j]->m_sAddress == sAddress)
+				bFound = true;
+		}
+
+		if (bFound || g_apRecordings.size() >= iMaxServers)
+			continue;
+
+		printf("Found %s at %s\n", oServer.name.c_str(), sAddress.c_str());
+
+		Connect(*AddRecording(sAddress, false, true));
+	}
+}
+
+int main(int argc, const char** args)
+{
+#ifdef _WIN32
+	WSADATA wsadata;
+	if (WSAStartup(MAKEWORD(2,2), &wsadata) != 0)
+		return 1;
+
+#ifdef PTW32_STATIC_LIB
+	pthread_win32_process_attach_np();
+#endif
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	size_t iMaxServers = 16;
+	double flDuration = 0;
+
+	std::vector<std::string> asServers;
+	std::vector<std::string> asUnix;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(args[i], "--server") == 0 && i < argc - 1 && strchr(args[i + 1], ':'))
+		{
+			i++;
+			asServers.push_back(args[i]);
+		}
+		else if (strcmp(args[i], "--unix") == 0 && i < argc - 1)
+		{
+			i++;
+			asUnix.push_back(args[i]);
+		}
+		else if (strcmp(args[i], "--max") == 0 && i < argc - 1)
+		{
+			i++;
+			iMaxServers = (size_t)atoi(args[i]);
+		}
+		else if (strcmp(args[i], "--channel") == 0 && i < argc - 1)
+		{
+			i++;
+			g_asChannels.push_back(args[i]);
+		}
+		else if (strcmp(args[i], "--group") == 0 && i < argc - 1)
+		{
+			i++;
+			g_asGroups.push_back(args[i]);
+		}
+		else if (strcmp(args[i], "--out") == 0 && i < argc - 1)
+		{
+			i++;
+			g_sDirectory = args[i];
+		}
+		else if (strcmp(args[i], "--csv") == 0)
+			g_bCSV = true;
+		else if (strcmp(args[i], "--rotate-mb") == 0 && i < argc - 1)
+		{
+			i++;
+			g_iRotateBytes = (unsigned long long)atoi(args[i]) * 1024 * 1024;
+		}
+		else if (strcmp(args[i], "--rotate-min") == 0 && i < argc - 1)
+		{
+			i++;
+			g_iRotateSeconds = atoi(args[i]) * 60;
+		}
+		else if (strcmp(args[i], "--duration") == 0 && i < argc - 1)
+		{
+			i++;
+			flDuration = atof(args[i]);
+		}
+		else
+		{
+			printf("Usage: %s [--server host:port] [--unix path] [--max N] [--channel name] [--group name]\n", args[0]);
+			printf("       [--out directory] [--csv] [--rotate-mb N] [--rotate-min N] [--duration seconds]\n");
+			return 1;
+		}
+	}
+
+	signal(SIGINT, Stop);
+	signal(SIGTERM, Stop);
+
+	if (!g_oClient.Initialize(&RegistrationUpdate, NULL, &DebugOutput))
+		return 1;
+
+	g_oClient.SetDataReceivedCallback(&DataReceived);
+
+	for (size_t i = 0; i < asServers.size(); i++)
+		Connect(*AddRecording(asServers[i], false, false));
+
+	for (size_t i = 0; i < asUnix.size(); i++)
+		Connect(*AddRecording(asUnix[i], true, false));
+
+	bool bDiscover = !g_apRecordings.size();
+
+	if (bDiscover)
+		printf("Searching for servers...\n");
+
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+	time_t iLastCheck = 0;
+
+	while (!g_bStop)
+	{
+		g_oClient.Update();
+
+		time_t now;
+		time(&now);
+
+		if (now != iLastCheck)
+		{
+			iLastCheck = now;
+
+			CServerList pServers;
+			if (bDiscover)
+				pServers = g_oClient.GetServers();
+
+			for (size_t i = 0; i < g_apRecordings.size(); i++)
+			{
+				CRecording& oRecording = *g_apRecordings[i];
+				CViewbackConnection& oConnection = g_oClient.GetConnection(oRecording.m_iConnection);
+
+				if (!oConnection.HasConnection())
+				{
+					// Finish the file now, the server might never come back.
+					if (oRecording.m_oExporter.IsOpen())
+					{
+						printf("Lost %s\n", oRecording.m_sAddress.c_str());
+						CloseFile(oRecording);
+					}
+
+					// Its announcements have expired, so it's gone. Make room for others.
+					if (oRecording.m_bDiscovered && !IsAnnouncing(pServers, oRecording.m_sAddress))
+					{
+						printf("Dropping %s\n", oRecording.m_sAddress.c_str());
+						RemoveRecording(i);
+						i--;
+						continue;
+					}
+
+					if (now >= oRecording.m_iNextRetry)
+						Connect(oRecording);
+
+					continue;
+				}
+
+				oRecording.m_iRetryDelay = 1;
+
+				// Everything's on disk already, there's no need to keep it.
+				oConnection.SetDataClearTime(oConnection.GetLatestDataTime() - RECORD_KEEP_SECONDS);
+				oConnection.SetMemoryBudget(RECORD_MEMORY_BUDGET);
+
+				if (!oRecording.m_oExporter.IsOpen())
+					continue;
+
+				bool bTooBig = g_iRotateBytes && oRecording.m_oExporter.GetSize() >= g_iRotateBytes;
+				bool bTooOld = g_iRotateSeconds && now - oRecording.m_iOpened >= g_iRotateSeconds;
+
+				if (bTooBig || bTooOld)
+				{
+					CloseFile(oRecording);
+					OpenFile(oRecording);
+				}
+			}
+
+			// After the expired ones are gone, so that new ones can take their place.
+			if (bDiscover)
+				Discover(pServers, iMaxServers);
+		}
+
+		if (flDuration > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() >= flDuration)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	printf("Stopping.\n");
+
+	for (size_t i = 0; i < g_apRecordings.size(); i++)
+	{
+		CloseFile(*g_apRecordings[i]);
+		delete g_apRecordings[i];
+	}
+
+	g_apRecordings.clear();
+
+	g_oClient.Shutdown();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return 0;
+}
@@ -0,0 +1,620 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/*
+	viewback_replay - Plays back a capture file made by the server (see
+	vb_config_t::capture_file) as if the game were running. It announces
+	itself over multicast like vb_server_update() does, so monitors find it
+	the usual way.
+
+	viewback_replay [options] capture_file
+	  --speed N   Play at N times the recorded speed. Default 1.
+	  --fast      Play as fast as the monitors can take it.
+	  --start T   Start from game time T, in seconds.
+	  --port P    TCP port to listen on. Default is the usual Viewback port.
+	  --name S    Server name to announce.
+	  --loop      Start over at the end instead of quitting.
+
+	Playback doesn't advance while no monitor is connected.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <signal.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../server/viewback_shared.h"
+
+#include "viewback_capture.h"
+
+using namespace vb;
+
+void vb__debug_printf(const char* format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+}
+
+class CReplayConnection
+{
+public:
+	vb__socket_t      m_socket;
+	std::vector<bool> m_abActive; // Indexed by channel handle. Channels start inactive, like the server.
+	std::string       m_sCommands; // Received but not yet handled, the last one may be partial.
+};
+
+class CReplayServer
+{
+public:
+	CReplayServer();
+	~CReplayServer();
+
+public:
+	bool Initialize(const char* pszName, unsigned short iPort);
+	void Shutdown();
+
+	// Accepts connections and handles commands, waiting up to flTimeout seconds for something to happen.
+	void Update(double flTimeout);
+
+	size_t GetNumConnections() const { return m_aConnections.size(); }
+
+	void SendRegistration(const std::vector<char>& aFrame);
+	void SendFrame(const char* pFrame, size_t iLength, const Packet& oPacket);
+
+private:
+	void Announce();
+	void Accept();
+	bool HandleCommand(size_t iConnection, const char* pszCommand); // Returns false if the monitor got disconnected.
+	bool Send(size_t iConnection, const char* pFrame, size_t iLength);
+	void Disconnect(size_t iConnection);
+
+private:
+	std::string        m_sName;
+	unsigned short     m_iPort;
+
+	vb__socket_t       m_multicast_socket;
+	struct sockaddr_in m_multicast_addr;
+	time_t             m_iLastMulticast;
+
+	vb__socket_t       m_tcp_socket;
+
+	std::vector<CReplayConnection> m_aConnections;
+
+	std::vector<char>  m_aRegistration;
+	Packet             m_oRegistration; // Parsed, for the group memberships.
+
+	std::vector<std::vector<char> > m_aLastData; // Latest data frame for each channel, for the "group:" command.
+};
+
+CReplayServer::CReplayServer()
+{
+	m_iPort = 0;
+	m_multicast_socket = VB_INVALID_SOCKET;
+	m_tcp_socket = VB_INVALID_SOCKET;
+	m_iLastMulticast = 0;
+}
+
+CReplayServer::~CReplayServer()
+{
+	Shutdown();
+}
+
+bool CReplayServer::Initialize(const char* pszName, unsigned short iPort)
+{
+	m_sName = pszName;
+	m_iPort = iPort;
+
+	m_multicast_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (!vb__socket_valid(m_multicast_socket))
+		return false;
+
+	int ttl = 10;
+	if (setsockopt(m_multicast_socket, IPPROTO_IP, IP_TTL, (const char*)&ttl, sizeof(ttl)) != 0)
+		return false;
+
+	memset(&m_multicast_addr, 0, sizeof(m_multicast_addr));
+	m_multicast_addr.sin_family = AF_INET;
+	inet_pton(AF_INET, VB_DEFAULT_MULTICAST_ADDRESS, &m_multicast_addr.sin_addr);
+	m_multicast_addr.sin_port = htons(VB_DEFAULT_PORT);
+
+	m_tcp_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (!vb__socket_valid(m_tcp_socket))
+		return false;
+
+	struct sockaddr_in tcp_addr;
+	memset(&tcp_addr, 0, sizeof(tcp_addr));
+	tcp_addr.sin_family = AF_INET;
+	tcp_addr.sin_addr.s_addr = INADDR_ANY;
+
+	// Same as the server, try a few ports in case a game is running too.
+	int i;
+	for (i = 0; i < 5; i++)
+	{
+		tcp_addr.sin_port = htons(m_iPort);
+
+		if (bind(m_tcp_socket, (struct sockaddr*)&tcp_addr, sizeof(tcp_addr)) == 0)
+			break;
+
+		m_iPort++;
+	}
+
+	if (i == 5)
+		return false;
+
+	if (listen(m_tcp_socket, SOMAXCONN) != 0)
+		return false;
+
+	printf("Replaying on port %d as \"%s\".\n", m_iPort, m_sName.c_str());
+
+	return true;
+}
+
+void CReplayServer::Shutdown()
+{
+	while (m_aConnections.size())
+		Disconnect(m_aConnections.size() - 1);
+
+	if (vb__socket_valid(m_tcp_socket))
+		vb__socket_close(m_tcp_socket);
+	m_tcp_socket = VB_INVALID_SOCKET;
+
+	if (vb__socket_valid(m_multicast_socket))
+		vb__socket_close(m_multicast_socket);
+	m_multicast_socket = VB_INVALID_SOCKET;
+}
+
+void CReplayServer::Update(double flTimeout)
+{
+	Announce();
+
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+
+	FD_SET(m_tcp_socket, &read_fds);
+	vb__socket_t max_socket = m_tcp_socket;
+
+	for (size_t i = 0; i < m_aConnections.size(); i++)
+	{
+		FD_SET(m_aConnections[i].m_socket, &read_fds);
+
+		if (m_aConnections[i].m_socket > max_socket)
+			max_socket = m_aConnections[i].m_socket;
+	}
+
+	struct timeval timeout;
+	timeout.tv_sec = (long)flTimeout;
+	timeout.tv_usec = (long)((flTimeout - timeout.tv_sec) * 1000000);
+
+	if (select((int)(max_socket + 1), &read_fds, NULL, NULL, &timeout) <= 0)
+		return;
+
+	if (FD_ISSET(m_tcp_socket, &read_fds))
+		Accept();
+
+	for (size_t i = 0; i < m_aConnections.size(); i++)
+	{
+		if (!FD_ISSET(m_aConnections[i].m_socket, &read_fds))
+			continue;
+
+		char mesg[1024];
+		int n = recv(m_aConnections[i].m_socket, mesg, sizeof(mesg), 0);
+
+		if (n <= 0)
+		{
+			printf("Monitor on %d disconnected.\n", (int)m_aConnections[i].m_socket);
+			Disconnect(i);
+			i--;
+			continue;
+		}
+
+		// Commands are null terminated. More than one may have arrived at
+		// once, and the last one may not have arrived all the way.
+		std::string sCommands = m_aConnections[i].m_sCommands;
+		sCommands.append(mesg, n);
+
+		size_t iStart = 0;
+		bool bConnected = true;
+		for (size_t iEnd = sCommands.find('\0'); iEnd != std::string::npos; iEnd = sCommands.find('\0', iStart))
+		{
+			const char* pszCommand = sCommands.c_str() + iStart;
+			iStart = iEnd + 1;
+
+			if (*pszCommand && !HandleCommand(i, pszCommand))
+			{
+				bConnected = false;
+				break;
+			}
+		}
+
+		if (!bConnected)
+		{
+			i--;
+			continue;
+		}
+
+		m_aConnections[i].m_sCommands = sCommands.substr(iStart);
+
+		// Commands are short, this monitor isn't sending any.
+		if (m_aConnections[i].m_sCommands.length() > sizeof(mesg))
+		{
+			printf("Monitor on %d sent a command that's too long, disconnected.\n", (int)m_aConnections[i].m_socket);
+			Disconnect(i);
+			i--;
+		}
+	}
+}
+
+void CReplayServer::SendRegistration(const std::vector<char>& aFrame)
+{
+	m_aRegistration = aFrame;
+
+	if (!m_aRegistration.size() || !m_oRegistration.ParseFromArray(&m_aRegistration[sizeof(size_t)], (int)(m_aRegistration.size() - sizeof(size_t))))
+		m_oRegistration.Clear();
+
+	for (size_t i = 0; i < m_aConnections.size(); i++)
+	{
+		if (!m_aRegistration.size())
+			break;
+
+		if (!Send(i, &m_aRegistration[0], m_aRegistration.size()))
+			i--;
+	}
+}
+
+void CReplayServer::SendFrame(const char* pFrame, size_t iLength, const Packet& oPacket)
+{
+	size_t iHandle = 0;
+
+	if (oPacket.has_data())
+	{
+		iHandle = oPacket.data().handle();
+
+		if (iHandle >= m_aLastData.size())
+			m_aLastData.resize(iHandle + 1);
+
+		m_aLastData[iHandle].assign(pFrame, pFrame + iLength);
+	}
+
+	for (size_t i = 0; i < m_aConnections.size(); i++)
+	{
+		// Data only goes to monitors that asked for that channel, everything else goes to everybody.
+		if (oPacket.has_data() && (iHandle >= m_aConnections[i].m_abActive.size() || !m_aConnections[i].m_abActive[iHandle]))
+			continue;
+
+		if (!Send(i, pFrame, iLength))
+			i--;
+	}
+}
+
+void CReplayServer::Announce()
+{
+	time_t current_time;
+	time(&current_time);
+
+	/* Once per second, just like the server. */
+	if (current_time <= m_iLastMulticast)
+		return;
+
+	// 2 for "VB" + 1 for version byte + 2 for port number = 5
+	std::vector<char> aMessage(5 + m_sName.length() + 1);
+	aMessage[0] = 'V';
+	aMessage[1] = 'B';
+	aMessage[2] = 1;
+
+	unsigned short tcp_port = htons(m_iPort);
+	memcpy(&aMessage[3], &tcp_port, sizeof(tcp_port));
+
+	memcpy(&aMessage[5], m_sName.c_str(), m_sName.length() + 1);
+
+	if (sendto(m_multicast_socket, &aMessage[0], aMessage.size(), 0, (struct sockaddr *)&m_multicast_addr, sizeof(m_multicast_addr)) < 0)
+		printf("Multicast sendto failed, error %d\n", vb__socket_error());
+
+	m_iLastMulticast = current_time;
+}
+
+void CReplayServer::Accept()
+{
+	char VB_ALIGN(8) client_addr[64];
+	vb__socklen_t client_addr_len = sizeof(client_addr);
+	vb__socket_t incoming_socket = accept(m_tcp_socket, (struct sockaddr*)&client_addr[0], &client_addr_len);
+
+	if (!vb__socket_valid(incoming_socket))
+		return;
+
+	printf("Monitor connected on %d.\n", (int)incoming_socket);
+
+	CReplayConnection oConnection;
+	oConnection.m_socket = incoming_socket;
+	m_aConnections.push_back(oConnection);
+
+	if (m_aRegistration.size())
+		Send(m_aConnections.size() - 1, &m_aRegistration[0], m_aRegistration.size());
+}
+
+bool CReplayServer::HandleCommand(size_t iConnection, const char* pszCommand)
+{
+	CReplayConnection& oConnection = m_aConnections[iConnection];
+
+	if (strncmp(pszCommand, "registrations", 13) == 0)
+	{
+		if (m_aRegistration.size())
+			return Send(iConnection, &m_aRegistration[0], m_aRegistration.size());
+	}
+	else if (strncmp(pszCommand, "activate: ", 10) == 0)
+	{
+		int iChannel = atoi(pszCommand + 10);
+		if (iChannel < 0)
+			return true;
+
+		if ((size_t)iChannel >= oConnection.m_abActive.size())
+			oConnection.m_abActive.resize(iChannel + 1);
+
+		oConnection.m_abActive[iChannel] = true;
+	}
+	else if (strncmp(pszCommand, "deactivate: ", 12) == 0)
+	{
+		int iChannel = atoi(pszCommand + 12);
+		if (iChannel >= 0 && (size_t)iChannel < oConnection.m_abActive.size())
+			oConnection.m_abActive[iChannel] = false;
+	}
+	else if (strncmp(pszCommand, "group: ", 7) == 0)
+	{
+		int iGroup = atoi(pszCommand + 7);
+
+		oConnection.m_abActive.assign(oConnection.m_abActive.size(), false);
+
+		if (iGroup < 0 || iGroup >= m_oRegistration.data_groups_size())
+			return true;
+
+		const DataGroup& oGroup = m_oRegistration.data_groups(iGroup);
+		for (int i = 0; i < oGroup.channels_size(); i++)
+		{
+			size_t iChannel = oGroup.channels(i);
+
+			if (iChannel >= oConnection.m_abActive.size())
+				oConnection.m_abActive.resize(iChannel + 1);
+
+			oConnection.m_abActive[iChannel] = true;
+
+			// The server sends the last value of each channel in the group, so do the same.
+			if (iChannel < m_aLastData.size() && m_aLastData[iChannel].size())
+			{
+				if (!Send(iConnection, &m_aLastData[iChannel][0], m_aLastData[iChannel].size()))
+					return false;
+			}
+		}
+	}
+	else
+		// Console commands and controls have no game to go to.
+		printf("Ignoring command from monitor: %s\n", pszCommand);
+
+	return true;
+}
+
+bool CReplayServer::Send(size_t iConnection, const char* pFrame, size_t iLength)
+{
+	while (iLength)
+	{
+		int iSent = send(m_aConnections[iConnection].m_socket, pFrame, (int)iLength, 0);
+
+		if (iSent <= 0)
+		{
+			printf("Error (code: %d) sending to %d, disconnected.\n", vb__socket_error(), (int)m_aConnections[iConnection].m_socket);
+			Disconnect(iConnection);
+			return false;
+		}
+
+		pFrame += iSent;
+		iLength -= iSent;
+	}
+
+	return true;
+}
+
+void CReplayServer::Disconnect(size_t iConnection)
+{
+	vb__socket_close(m_aConnections[iConnection].m_socket);
+	m_aConnections.erase(m_aConnections.begin() + iConnection);
+}
+
+static double GetWallTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, const char** args)
+{
+#ifdef _WIN32
+	WSADATA wsadata;
+	if (WSAStartup(MAKEWORD(2,2), &wsadata) != 0)
+		return 1;
+#else
+	/* Don't die when writing to a monitor that went away, we check all writes. */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	const char* pszFile = NULL;
+	const char* pszName = "Viewback Replay";
+	unsigned short iPort = VB_DEFAULT_PORT;
+	double flSpeed = 1;
+	bool bFast = false;
+	bool bLoop = false;
+	bool bStart = false;
+	double flStart = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(args[i], "--speed") == 0 && i < argc - 1)
+		{
+			i++;
+			flSpeed = atof(args[i]);
+		}
+		else if (strcmp(args[i], "--fast") == 0)
+			bFast = true;
+		else if (strcmp(args[i], "--loop") == 0)
+			bLoop = true;
+		else if (strcmp(args[i], "--start") == 0 && i < argc - 1)
+		{
+			i++;
+			bStart = true;
+			flStart = atof(args[i]);
+		}
+		else if (strcmp(args[i], "--port") == 0 && i < argc - 1)
+		{
+			i++;
+			iPort = (unsigned short)atoi(args[i]);
+		}
+		else if (strcmp(args[i], "--name") == 0 && i < argc - 1)
+		{
+			i++;
+			pszName = args[i];
+		}
+		else
+			pszFile = args[i];
+	}
+
+	if (!pszFile || flSpeed <= 0)
+	{
+		printf("Usage: %s [--speed N] [--fast] [--start seconds] [--port P] [--name S] [--loop] capture_file\n", args[0]);
+		return 1;
+	}
+
+	CViewbackCaptureReader oReader;
+	if (!oReader.Open(pszFile))
+	{
+		printf("Couldn't open capture file %s\n", pszFile);
+		return 1;
+	}
+
+	printf("%s: %llu bytes, %d packets, game time %.3f to %.3f.\n", pszFile, oReader.GetFileSize(), (int)oReader.GetNumFrames(), oReader.GetStartTime(), oReader.GetEndTime());
+
+	if (oReader.GetNumSessions() > 1)
+		printf("The game was started %d times during the capture.\n", (int)oReader.GetNumSessions());
+
+	if (bStart && !oReader.Seek(flStart))
+	{
+		printf("Couldn't seek to %.3f\n", flStart);
+		return 1;
+	}
+
+	CReplayServer oServer;
+	if (!oServer.Initialize(pszName, iPort))
+	{
+		printf("Couldn't create replay server. Did you call WSAStartup() first?\n");
+		return 1;
+	}
+
+	oServer.SendRegistration(oReader.GetRegistration());
+
+	Packet oPacket;
+	bool bPending = false;   // A frame has been read and is waiting for its time to come.
+	bool bRebase = true;     // Line the game clock up with the wall clock at the next data packet.
+	double flGameBase = 0;
+	double flWallBase = 0;
+	double flLastTime = 0;
+	size_t iFramesSent = 0;
+
+	for (;;)
+	{
+		if (!oServer.GetNumConnections())
+		{
+			// Hold the replay until somebody is watching.
+			oServer.Update(0.1);
+			bRebase = true;
+			continue;
+		}
+
+		if (!bPending)
+		{
+			if (!oReader.ReadFrame())
+			{
+				if (!bLoop)
+					break;
+
+				printf("Starting over.\n");
+				oReader.Rewind();
+				bRebase = true;
+				continue;
+			}
+
+			if (!oPacket.ParseFromArray(oReader.GetPacket(), (int)oReader.GetPacketLength()))
+			{
+				printf("Skipping a packet that couldn't be parsed.\n");
+				continue;
+			}
+
+			bPending = true;
+		}
+
+		double flWait = 0;
+		double flTime;
+		if (!bFast && oPacket.has_data() && CViewbackCaptureReader::GetDataTime(oPacket.data(), flTime))
+		{
+			// Going backwards means the game was restarted without the
+			// registration being captured.
+			if (bRebase || flTime < flLastTime)
+			{
+				flGameBase = flTime;
+				flWallBase = GetWallTime();
+				bRebase = false;
+			}
+
+			flLastTime = flTime;
+
+			flWait = flWallBase + (flTime - flGameBase) / flSpeed - GetWallTime();
+		}
+
+		if (flWait > 0)
+		{
+			// Not time yet, listen to the monitors in the meantime.
+			oServer.Update(flWait < 0.1 ? flWait : 0.1);
+			continue;
+		}
+
+		if (oReader.IsRegistration())
+		{
+			oServer.SendRegistration(oReader.GetRegistration());
+
+			// The game may have been restarted, its clock could be anywhere.
+			bRebase = true;
+		}
+		else
+			oServer.SendFrame(oReader.GetFrame(), oReader.GetFrameLength(), oPacket);
+
+		bPending = false;
+		iFramesSent++;
+
+		// Keep up with the monitors even when falling behind.
+		if (iFramesSent % 256 == 0)
+			oServer.Update(0);
+	}
+
+	printf("Replay finished, %d packets sent.\n", (int)iFramesSent);
+
+	oServer.Shutdown();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return 0;
+}
@@ -19,16 +19,13 @@ THE SOFTWARE.
 #include <string.h>
 #endif
 
-#include <algorithm>
-
 #include "../server/viewback_shared.h"
 
 using namespace std;
 using namespace vb;
 
 atomic<bool> CViewbackServersThread::s_bShutdown;
-std::vector<CServerListing> CViewbackServersThread::s_servers_drop;
-pthread_mutex_t CViewbackServersThread::s_servers_drop_mutex;
+CServerList CViewbackServersThread::s_pServers;
 
 CViewbackServersThread& CViewbackServersThread::ServersThread()
 {
@@ -39,7 +36,7 @@ CViewbackServersThread& CViewbackServersThread::ServersThread()
 
 bool CViewbackServersThread::Run()
 {
-	pthread_mutex_init(&s_servers_drop_mutex, nullptr);
+	std::atomic_store(&s_pServers, CServerList(new std::vector<CServerListing>()));
 
 	return ServersThread().Initialize();
 }
@@ -47,18 +44,21 @@ bool CViewbackServersThread::Run()
 void CViewbackServersThread::Shutdown()
 {
 	s_bShutdown = true;
+	vb__wakeup_signal(ServersThread().m_wakeup);
 
 	pthread_join(ServersThread().m_iThread, NULL);
 
 	ServersThread().m_aServers.clear();
+	ServersThread().m_aServerIndex.clear();
 	vb__socket_close(ServersThread().m_socket);
-
-	pthread_mutex_destroy(&s_servers_drop_mutex);
+	vb__wakeup_destroy(ServersThread().m_wakeup);
 }
 
 bool CViewbackServersThread::Initialize()
 {
 	m_aServers.clear();
+	m_aServerIndex.clear();
+	m_bServersChanged = false;
 	m_iNextServerListUpdate = 0;
 
 	struct ip_mreq mreq;
@@ -102,6 +102,15 @@ bool CViewbackServersThread::Initialize()
 		return false;
 	}
 
+	// The thread sleeps in poll, reads never block.
+	vb__socket_set_blocking(m_socket, 0);
+
+	if (!vb__wakeup_create(&m_wakeup))
+	{
+		VBPrintf("Could not create multicast listener wakeup.\n");
+		return false;
+	}
+
 	if (pthread_create(&m_iThread, NULL, (void *(*) (void *))&CViewbackServersThread::ThreadMain, (void*)this) != 0)
 	{
 		VBPrintf("Could not create multicast listener thread.\n");
@@ -119,65 +128,96 @@ void CViewbackServersThread::ThreadMain(CViewbackServersThread* pThis)
 		pThis->Pump();
 }
 
-bool last_ping_sort(const CServerListing& l, const CServerListing& r)
-{
-	return l.last_ping > r.last_ping;
-}
-
 #define MSGBUFSIZE 1024
 
 void CViewbackServersThread::Pump()
 {
-	vb__thread_yield();
-
 	time_t now;
 	time(&now);
 
 	if (now >= m_iNextServerListUpdate)
+		UpdateServerList();
+
+	// Sleep until a server announces itself or the list is due to be
+	// refreshed, which is about once a second.
+	int iTimeout = (int)(m_iNextServerListUpdate - now) * 1000;
+	if (iTimeout < 0)
+		iTimeout = 0;
+	if (iTimeout > 1000)
+		iTimeout = 1000;
+
+	vb__pollfd_t aPoll[2];
+	aPoll[0].fd = m_wakeup;
+	aPoll[0].events = POLLIN;
+	aPoll[0].revents = 0;
+	aPoll[1].fd = m_socket;
+	aPoll[1].events = POLLIN;
+	aPoll[1].revents = 0;
+
+	// Most likely interrupted by a signal. The caller checks for shutdown and comes right back.
+	if (vb__poll(aPoll, 2, iTimeout) <= 0)
+		return;
+
+	if (!aPoll[1].revents)
+		return;
+
+	// Take everything that's come in so far.
+	while (true)
 	{
-		std::vector<CServerListing> server_list;
-		for (map<unsigned long, CServerListing>::iterator it = m_aServers.begin(); it != m_aServers.end(); it++)
+		char msgbuf[MSGBUFSIZE];
+
+		struct sockaddr_in addr;
+		vb__socklen_t addrlen = sizeof(addr);
+
+		int iBytesRead = recvfrom(m_socket, msgbuf, MSGBUFSIZE - 1, 0, (struct sockaddr *)&addr, &addrlen);
+		if (iBytesRead < 0)
 		{
-			if (now - it->second.last_ping > 10)
-				continue;
+			int error = vb__socket_error();
+			if (!vb__socket_is_blocking_error(error))
+				VBPrintf("Error reading multicast socket: %d.\n", error);
 
-			server_list.push_back(it->second);
+			return;
 		}
 
-		std::sort(server_list.begin(), server_list.end(), &last_ping_sort);
-
-		pthread_mutex_lock(&s_servers_drop_mutex);
+		msgbuf[iBytesRead] = '\0';
 
-		s_servers_drop = server_list;
+		ReadPacket(msgbuf, iBytesRead, addr);
+	}
+}
 
-		pthread_mutex_unlock(&s_servers_drop_mutex);
+void CViewbackServersThread::UpdateServerList()
+{
+	time_t now;
+	time(&now);
 
-		m_iNextServerListUpdate = now + 1;
+	while (m_aServers.size() && now - m_aServers.back().last_ping > 10)
+	{
+		const CServerListing& server = m_aServers.back().listing;
+		m_aServerIndex.erase(((unsigned long long)server.address << 16) | server.tcp_port);
+		m_aServers.pop_back();
+		m_bServersChanged = true;
 	}
 
-	char msgbuf[MSGBUFSIZE];
+	m_iNextServerListUpdate = now + 1;
 
-	struct sockaddr_in addr;
-	vb__socklen_t addrlen = sizeof(addr);
+	if (!m_bServersChanged)
+		return;
 
-	vb__socket_set_blocking(m_socket, 0);
+	m_bServersChanged = false;
 
-	int iBytesRead;
-	if ((iBytesRead = recvfrom(m_socket, msgbuf, MSGBUFSIZE, 0, (struct sockaddr *)&addr, &addrlen)) < 0)
-	{
-		int error = vb__socket_error();
-		if (!vb__socket_is_blocking_error(error))
-		{
-			VBPrintf("Error reading multicast socket: %d.\n", error);
-			return;
-		}
-	}
+	// Readers may still have the old one, so it's a new list every time.
+	std::vector<CServerListing>* pServers = new std::vector<CServerListing>();
+	pServers->reserve(m_aServers.size());
 
-	vb__socket_set_blocking(m_socket, 1);
+	for (list<CServerEntry>::const_iterator it = m_aServers.begin(); it != m_aServers.end(); it++)
+		pServers->push_back(it->listing);
 
-	VBAssert(iBytesRead < MSGBUFSIZE);
+	std::atomic_store(&s_pServers, CServerList(pServers));
+}
 
-	if (strncmp(msgbuf, "VB", 2) != 0)
+void CViewbackServersThread::ReadPacket(const char* msgbuf, int iBytesRead, const struct sockaddr_in& addr)
+{
+	if (iBytesRead < 3 || strncmp(msgbuf, "VB", 2) != 0)
 		// This must be some other packet.
 		return;
 
@@ -185,6 +225,7 @@ void CViewbackServersThread::Pump()
 		// Version is too new.
 		return;
 
+	time_t now;
 	time(&now);
 
 	unsigned long server_address = ntohl(addr.sin_addr.s_addr);
@@ -193,6 +234,9 @@ void CViewbackServersThread::Pump()
 
 	if (msgbuf[2] == 1)
 	{
+		if (iBytesRead < 5)
+			return;
+
 		server_port = ntohs(*((unsigned short*)(&msgbuf[3])));
 		server_name = std::string(msgbuf + 5);
 	}
@@ -202,30 +246,47 @@ void CViewbackServersThread::Pump()
 		return;
 	}
 
-	unsigned long index = server_port ^ server_address;
+	unsigned long long index = ((unsigned long long)server_address << 16) | server_port;
 
-	CServerListing& server = m_aServers[index];
+	map<unsigned long long, list<CServerEntry>::iterator>::iterator it = m_aServerIndex.find(index);
+	if (it == m_aServerIndex.end())
+	{
+		m_aServers.push_front(CServerEntry());
+		m_aServerIndex[index] = m_aServers.begin();
 
-	server.address = server_address;
-	server.last_ping = now;
-	server.name = server_name;
-	server.tcp_port = server_port;
+		CServerListing& server = m_aServers.front().listing;
+		server.address = server_address;
+		server.tcp_port = server_port;
+		server.name = server_name;
 
-	// Force update now.
-	m_iNextServerListUpdate = 0;
-}
+		// Show new servers right away.
+		m_iNextServerListUpdate = 0;
+		m_bServersChanged = true;
+	}
+	else
+	{
+		CServerListing& server = it->second->listing;
+		if (server.name != server_name)
+		{
+			server.name = server_name;
+			m_iNextServerListUpdate = 0;
+			m_bServersChanged = true;
+		}
 
-vector<CServerListing> CViewbackServersThread::GetServers()
-{
-	vector<CServerListing> server_list;
+		m_aServers.splice(m_aServers.begin(), m_aServers, it->second);
+	}
 
-	pthread_mutex_lock(&s_servers_drop_mutex);
+	// Only keeps it from expiring, the published list stays as it is.
+	m_aServers.front().last_ping = now;
+}
 
-	server_list = s_servers_drop;
+CServerList CViewbackServersThread::GetServers()
+{
+	CServerList pServers = std::atomic_load(&s_pServers);
 
-	pthread_mutex_unlock(&s_servers_drop_mutex);
+	// Not running yet.
+	if (!pServers)
+		return CServerList(new std::vector<CServerListing>());
 
-	// A bit inefficient since we make a copy once during the mutex lock and a copy again when we return the value.
-	// Don't think it's ever going to be a perf problem though.
-	return server_list;
+	return pServers;
 }
@@ -15,7 +15,9 @@ THE SOFTWARE.
 
 #pragma once
 
+#include <list>
 #include <map>
+#include <memory>
 #include <vector>
 
 // This is probably way wrong.
@@ -40,7 +42,7 @@ public:
 	static bool Run();
 	static void Shutdown();
 
-	static std::vector<CServerListing> GetServers();
+	static CServerList GetServers();
 
 private:
 	CViewbackServersThread() {};
@@ -52,18 +54,32 @@ private:
 	static void ThreadMain(CViewbackServersThread* pThis);
 
 	void Pump();
+	void UpdateServerList();
+	void ReadPacket(const char* msgbuf, int iBytesRead, const struct sockaddr_in& addr);
 
 private:
 	pthread_t m_iThread;
 
 	vb__socket_t          m_socket;
+	vb__wakeup_t          m_wakeup; // Signaled to get the thread out of poll at shutdown.
 
-	std::map<unsigned long, CServerListing> m_aServers;
+	class CServerEntry
+	{
+	public:
+		CServerListing listing;
+		time_t         last_ping; // Not published, it changes with every announcement.
+	};
+
+	// Most recently heard from at the front, so the ones that went quiet
+	// expire off the back. Keyed by address and port together.
+	std::list<CServerEntry> m_aServers;
+	std::map<unsigned long long, std::list<CServerEntry>::iterator> m_aServerIndex;
+	bool m_bServersChanged; // A server came, went or was renamed since the list was last published.
 
 	time_t m_iNextServerListUpdate;
 
-	static std::vector<CServerListing> s_servers_drop;
-	static pthread_mutex_t      s_servers_drop_mutex;
+	// Replaced whole, read with std::atomic_load().
+	static CServerList s_pServers;
 
 	static std::atomic<bool> s_bShutdown;
 };
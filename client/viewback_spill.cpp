@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _WIN32
+// Sessions can run long enough to make files bigger than 2GB.
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "viewback_spill.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace vb;
+using namespace std;
+
+// Blocks start on this boundary so that anything in them is aligned.
+#define VB_SPILL_ALIGNMENT 16
+
+CViewbackSpillFile::CViewbackSpillFile()
+{
+	m_bOpen = false;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	m_iFile = -1;
+#endif
+	m_iSegmentUsed = 0;
+	m_iSize = 0;
+}
+
+CViewbackSpillFile::~CViewbackSpillFile()
+{
+	Close();
+}
+
+bool CViewbackSpillFile::Open(const string& sDirectory)
+{
+	Close();
+
+#ifdef _WIN32
+	char szFile[MAX_PATH];
+	if (!GetTempFileNameA(sDirectory.c_str(), "vb", 0, szFile))
+		return false;
+
+	m_hFile = CreateFileA(szFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+
+	if (m_hFile == INVALID_HANDLE_VALUE)
+	{
+		DeleteFileA(szFile);
+		return false;
+	}
+#else
+	string sFile = sDirectory + "/viewback-spill-XXXXXX";
+	vector<char> aszFile(sFile.begin(), sFile.end());
+	aszFile.push_back('\0');
+
+	m_iFile = mkstemp(&aszFile[0]);
+	if (m_iFile < 0)
+		return false;
+
+	// It stays around until it's closed, and nobody has to clean up after a crash.
+	unlink(&aszFile[0]);
+#endif
+
+	m_bOpen = true;
+	return true;
+}
+
+void CViewbackSpillFile::Close()
+{
+#ifdef _WIN32
+	for (size_t i = 0; i < m_apSegments.size(); i++)
+		UnmapViewOfFile(m_apSegments[i]);
+
+	for (size_t i = 0; i < m_ahMappings.size(); i++)
+		CloseHandle(m_ahMappings[i]);
+
+	m_ahMappings.clear();
+
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	for (size_t i = 0; i < m_apSegments.size(); i++)
+		munmap((void*)m_apSegments[i], VB_SPILL_SEGMENT_SIZE);
+
+	if (m_iFile >= 0)
+		close(m_iFile);
+
+	m_iFile = -1;
+#endif
+
+	m_apSegments.clear();
+	m_iSegmentUsed = 0;
+	m_iSize = 0;
+	m_bOpen = false;
+}
+
+const void* CViewbackSpillFile::Write(const void* pData, size_t iSize)
+{
+	if (!m_bOpen || iSize > VB_SPILL_SEGMENT_SIZE)
+		return NULL;
+
+	size_t iOffset = (m_iSegmentUsed + VB_SPILL_ALIGNMENT - 1) & ~(size_t)(VB_SPILL_ALIGNMENT - 1);
+
+	if (!m_apSegments.size() || iOffset + iSize > VB_SPILL_SEGMENT_SIZE)
+	{
+		if (!AddSegment())
+			return NULL;
+
+		iOffset = 0;
+	}
+
+	unsigned long long iFileOffset = (unsigned long long)(m_apSegments.size() - 1) * VB_SPILL_SEGMENT_SIZE + iOffset;
+
+#ifdef _WIN32
+	OVERLAPPED oOverlapped = {};
+	oOverlapped.Offset = (DWORD)iFileOffset;
+	oOverlapped.OffsetHigh = (DWORD)(iFileOffset >> 32);
+
+	DWORD iWritten = 0;
+	if (!WriteFile(m_hFile, pData, (DWORD)iSize, &iWritten, &oOverlapped) || iWritten != iSize)
+		return NULL;
+#else
+	const char* pBytes = (const char*)pData;
+	size_t iWritten = 0;
+	while (iWritten < iSize)
+	{
+		ssize_t iResult = pwrite(m_iFile, pBytes + iWritten, iSize - iWritten, (off_t)(iFileOffset + iWritten));
+		if (iResult <= 0)
+			return NULL;
+
+		iWritten += (size_t)iResult;
+	}
+#endif
+
+	m_iSegmentUsed = iOffset + iSize;
+	m_iSize += iSize;
+
+	// The mapping sees what was written, they share the OS's cache of the file.
+	return m_apSegments.back() + iOffset;
+}
+
+void CViewbackSpillFile::ReleasePages()
+{
+#ifndef _WIN32
+	for (size_t i = 0; i < m_apSegments.size(); i++)
+		madvise((void*)m_apSegments[i], VB_SPILL_SEGMENT_SIZE, MADV_DONTNEED);
+#endif
+	// Windows trims the working set by itself, and the pages are clean.
+}
+
+bool CViewbackSpillFile::AddSegment()
+{
+	unsigned long long iEnd = (unsigned long long)(m_apSegments.size() + 1) * VB_SPILL_SEGMENT_SIZE;
+	unsigned long long iStart = iEnd - VB_SPILL_SEGMENT_SIZE;
+
+#ifdef _WIN32
+	// The file has to be as big as the mapping before a read only one can be made.
+	LARGE_INTEGER iSize;
+	iSize.QuadPart = (LONGLONG)iEnd;
+	if (!SetFilePointerEx(m_hFile, iSize, NULL, FILE_BEGIN) || !SetEndOfFile(m_hFile))
+		return false;
+
+	HANDLE hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, (DWORD)(iEnd >> 32), (DWORD)iEnd, NULL);
+	if (!hMapping)
+		return false;
+
+	void* pSegment = MapViewOfFile(hMapping, FILE_MAP_READ, (DWORD)(iStart >> 32), (DWORD)iStart, VB_SPILL_SEGMENT_SIZE);
+	if (!pSegment)
+	{
+		CloseHandle(hMapping);
+		return false;
+	}
+
+	m_ahMappings.push_back(hMapping);
+#else
+	// Sparse, disk space is only used as it's written.
+	if (ftruncate(m_iFile, (off_t)iEnd) != 0)
+		return false;
+
+	void* pSegment = mmap(NULL, VB_SPILL_SEGMENT_SIZE, PROT_READ, MAP_SHARED, m_iFile, (off_t)iStart);
+	if (pSegment == MAP_FAILED)
+		return false;
+
+	// Chunks from every channel are mixed together in the file, so reading
+	// ahead would mostly bring in other channels' data.
+	madvise(pSegment, VB_SPILL_SEGMENT_SIZE, MADV_RANDOM);
+#endif
+
+	m_apSegments.push_back((const char*)pSegment);
+	m_iSegmentUsed = 0;
+
+	return true;
+}
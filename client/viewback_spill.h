@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace vb
+{
+
+// Blocks are written into the file in segments of this size, each one
+// mapped separately so that nothing already handed out ever moves.
+#define VB_SPILL_SEGMENT_SIZE (64*1024*1024)
+
+// An append-only scratch file that hands back read-only mapped pointers to
+// what's written into it. The OS pages the blocks in when they're read and
+// is free to drop them again, so a lot of data can stay reachable without
+// staying in memory. The file is deleted when it's closed, it's only good
+// for the life of the process.
+//
+// Only the writer calls Write(). The pointers it returns can be read from
+// any thread until Close().
+class CViewbackSpillFile
+{
+public:
+	CViewbackSpillFile();
+	~CViewbackSpillFile();
+
+private:
+	CViewbackSpillFile(const CViewbackSpillFile&);
+	CViewbackSpillFile& operator=(const CViewbackSpillFile&);
+
+public:
+	// Makes a new file in sDirectory.
+	bool Open(const std::string& sDirectory);
+	void Close();
+
+	bool IsOpen() const { return m_bOpen; }
+
+	// Returns where the copy can be read, or NULL if it couldn't be written,
+	// say if the disk is full. Blocks can't be bigger than a segment.
+	const void* Write(const void* pData, size_t iSize);
+
+	unsigned long long GetSize() const { return m_iSize; }
+
+	// Lets go of the pages that have been read in. What's in them is still
+	// in the file, the next read just pages it back in. Readers don't have
+	// to stop while this happens.
+	void ReleasePages();
+
+private:
+	bool AddSegment();
+
+private:
+	bool m_bOpen;
+
+#ifdef _WIN32
+	void* m_hFile;
+	std::vector<void*> m_ahMappings;
+#else
+	int m_iFile;
+#endif
+
+	std::vector<const char*> m_apSegments;
+	size_t                   m_iSegmentUsed; // Bytes written into the last segment.
+	unsigned long long       m_iSize;        // Bytes written in all.
+};
+
+}
@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "viewback_stats.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace vb;
+using namespace std;
+
+#define VB_PI 3.14159265358979323846
+
+// The t-digest scale function is k(q) = compression / 2pi * asin(2q - 1),
+// and a centroid can cover one unit of it, which is a lot of samples in the
+// middle and very few at the ends. This is how far one unit past q goes,
+// with sin(asin(2q - 1) + 2pi / compression) worked out by angle addition
+// so there's no trig per centroid.
+static double NextQuantile(double q, double flCos, double flSin)
+{
+	double s = 2 * q - 1;
+	if (s >= flCos)
+		return 1;
+
+	return (s * flCos + sqrt(1 - s * s) * flSin + 1) / 2;
+}
+
+static void MergeCentroids(const vector<CViewbackCentroid>& aCentroids, double flTotal, double flCompression, vector<CViewbackCentroid>& aMerged)
+{
+	double flCos = cos(2 * VB_PI / flCompression);
+	double flSin = sin(2 * VB_PI / flCompression);
+
+	aMerged.clear();
+
+	double flBefore = 0; // Weight of everything before the centroid being built.
+	double flLimit = NextQuantile(0, flCos, flSin) * flTotal;
+
+	// The mean is only worked out once a centroid is done.
+	double flWeight = aCentroids[0].m_flWeight;
+	double flSum = aCentroids[0].m_flMean * aCentroids[0].m_flWeight;
+
+	for (size_t i = 1; i < aCentroids.size(); i++)
+	{
+		const CViewbackCentroid& oNext = aCentroids[i];
+
+		if (flBefore + flWeight + oNext.m_flWeight <= flLimit)
+		{
+			flWeight += oNext.m_flWeight;
+			flSum += oNext.m_flMean * oNext.m_flWeight;
+			continue;
+		}
+
+		aMerged.push_back(CViewbackCentroid(flSum / flWeight, flWeight));
+
+		flBefore += flWeight;
+		flLimit = NextQuantile(flBefore / flTotal, flCos, flSin) * flTotal;
+
+		flWeight = oNext.m_flWeight;
+		flSum = oNext.m_flMean * oNext.m_flWeight;
+	}
+
+	aMerged.push_back(CViewbackCentroid(flSum / flWeight, flWeight));
+}
+
+void vb::CompressCentroids(vector<CViewbackCentroid>& aCentroids, size_t iMaxCentroids)
+{
+	if (aCentroids.size() <= 1)
+		return;
+
+	sort(aCentroids.begin(), aCentroids.end(), [](const CViewbackCentroid& l, const CViewbackCentroid& r) {
+		return l.m_flMean < r.m_flMean;
+	});
+
+	if (aCentroids.size() <= iMaxCentroids)
+		return;
+
+	double flTotal = 0;
+	for (size_t i = 0; i < aCentroids.size(); i++)
+		flTotal += aCentroids[i].m_flWeight;
+
+	// Comes out at about half the compression, a little more or less
+	// depending on the weights. Each try starts over so that nothing's
+	// merged more than it has to be.
+	vector<CViewbackCentroid> aMerged;
+	aMerged.reserve(iMaxCentroids * 2);
+
+	double flCompression = (double)iMaxCentroids * 2;
+	while (true)
+	{
+		MergeCentroids(aCentroids, flTotal, flCompression, aMerged);
+
+		if (aMerged.size() <= iMaxCentroids)
+			break;
+
+		flCompression *= 0.95;
+	}
+
+	aCentroids.swap(aMerged);
+}
+
+CViewbackStats::CViewbackStats()
+{
+	m_iCount = 0;
+	m_flMean = 0;
+	m_flM2 = 0;
+	m_flLowest = 0;
+	m_flHighest = 0;
+
+	m_flFirstTime = 0;
+	m_flFirst = 0;
+	m_flLastTime = 0;
+	m_flLast = 0;
+}
+
+double CViewbackStats::GetVariance() const
+{
+	if (!m_iCount)
+		return 0;
+
+	return m_flM2 / m_iCount;
+}
+
+double CViewbackStats::GetStdDev() const
+{
+	return sqrt(GetVariance());
+}
+
+double CViewbackStats::GetRate() const
+{
+	if (m_flLastTime <= m_flFirstTime)
+		return 0;
+
+	return (m_flLast - m_flFirst) / (m_flLastTime - m_flFirstTime);
+}
+
+double CViewbackStats::GetQuantile(double q) const
+{
+	if (!m_aCentroids.size())
+		return 0;
+
+	if (q <= 0)
+		return m_flLowest;
+
+	if (q >= 1)
+		return m_flHighest;
+
+	double flTotal = 0;
+	for (size_t i = 0; i < m_aCentroids.size(); i++)
+		flTotal += m_aCentroids[i].m_flWeight;
+
+	double flRank = q * flTotal;
+
+	// Each centroid's mean is taken to sit at the middle of the samples it
+	// stands for. In between, and out to the lowest and highest, it's linear.
+	double flBefore = 0;
+	double flPreviousRank = 0;
+	double flPreviousValue = m_flLowest;
+
+	for (size_t i = 0; i < m_aCentroids.size(); i++)
+	{
+		const CViewbackCentroid& oCentroid = m_aCentroids[i];
+		double flCenter = flBefore + oCentroid.m_flWeight / 2;
+
+		if (flRank < flCenter)
+		{
+			// A centroid of one sample is exact, don't blur it into the next.
+			if (oCentroid.m_flWeight == 1 && flRank >= flBefore)
+				return oCentroid.m_flMean;
+
+			return flPreviousValue + (oCentroid.m_flMean - flPreviousValue) * (flRank - flPreviousRank) / (flCenter - flPreviousRank);
+		}
+
+		flBefore += oCentroid.m_flWeight;
+		flPreviousRank = flCenter;
+		flPreviousValue = oCentroid.m_flMean;
+	}
+
+	if (flTotal <= flPreviousRank)
+		return m_flHighest;
+
+	return flPreviousValue + (m_flHighest - flPreviousValue) * (flRank - flPreviousRank) / (flTotal - flPreviousRank);
+}
+
+void CViewbackStats::Merge(size_t iCount, double flMean, double flM2, double flLowest, double flHighest)
+{
+	if (!iCount)
+		return;
+
+	if (!m_iCount)
+	{
+		m_iCount = iCount;
+		m_flMean = flMean;
+		m_flM2 = flM2;
+		m_flLowest = flLowest;
+		m_flHighest = flHighest;
+		return;
+	}
+
+	// Chan et al's way of combining two sets' means and variances.
+	double flTotal = (double)(m_iCount + iCount);
+	double flDelta = flMean - m_flMean;
+
+	m_flMean += flDelta * iCount / flTotal;
+	m_flM2 += flM2 + flDelta * flDelta * m_iCount * iCount / flTotal;
+	m_iCount += iCount;
+
+	if (flLowest < m_flLowest)
+		m_flLowest = flLowest;
+
+	if (flHighest > m_flHighest)
+		m_flHighest = flHighest;
+}
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+namespace vb
+{
+
+class CViewbackCentroid
+{
+public:
+	CViewbackCentroid()
+	{
+		m_flMean = 0;
+		m_flWeight = 0;
+	}
+
+	CViewbackCentroid(double flMean, double flWeight)
+	{
+		m_flMean = flMean;
+		m_flWeight = flWeight;
+	}
+
+public:
+	double m_flMean;
+	double m_flWeight; // How many samples it stands for.
+};
+
+// Sorts the centroids and merges neighbors the way a t-digest does until
+// there are at most iMaxCentroids, keeping the ones near the ends small so
+// the tails come out well.
+void CompressCentroids(std::vector<CViewbackCentroid>& aCentroids, size_t iMaxCentroids);
+
+// Summary statistics for a stretch of a channel, see CViewbackClient::GetStats().
+class CViewbackStats
+{
+public:
+	CViewbackStats();
+
+public:
+	double GetVariance() const; // Of the samples, not an estimate for the population.
+	double GetStdDev() const;
+	double GetRate() const; // Average change per second from the first sample to the last.
+
+	// Estimated, q is from 0 to 1. Good to a fraction of a percent in the middle and better near the ends.
+	double GetQuantile(double q) const;
+
+	// Adds the samples something else summed up.
+	void Merge(size_t iCount, double flMean, double flM2, double flLowest, double flHighest);
+
+public:
+	size_t m_iCount;
+	double m_flMean;
+	double m_flM2; // Sum of squared differences from the mean.
+	double m_flLowest;
+	double m_flHighest;
+
+	double m_flFirstTime;
+	double m_flFirst;
+	double m_flLastTime;
+	double m_flLast;
+
+	std::vector<CViewbackCentroid> m_aCentroids; // Compressed, for GetQuantile().
+};
+
+}
@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+#include "viewback_trigger.h"
+
+#include <math.h>
+
+using namespace std;
+using namespace vb;
+
+CViewbackRule::CViewbackRule(const CViewbackTrigger& oTrigger)
+{
+	m_eAggregate = oTrigger.m_eAggregate;
+	m_flQuantile = oTrigger.m_flQuantile;
+	m_flWindow = oTrigger.m_flWindow;
+	m_eCompare = oTrigger.m_eCompare;
+	m_flThreshold = oTrigger.m_flThreshold;
+	m_flDuration = oTrigger.m_flDuration;
+
+	if (m_flQuantile < 0)
+		m_flQuantile = 0;
+	else if (m_flQuantile > 1)
+		m_flQuantile = 1;
+
+	if (m_flWindow < 0)
+		m_flWindow = 0;
+
+	if (m_flDuration < 0)
+		m_flDuration = 0;
+
+	m_bStarted = false;
+	m_flFirstTime = 0;
+	m_flLatest = 0;
+
+	m_flSum = 0;
+	m_iMatching = 0;
+
+	m_bHolding = false;
+	m_bFired = false;
+	m_flDeadline = 0;
+}
+
+bool CViewbackRule::Add(double flTime, double flValue)
+{
+	if (!IsTrue(flTime, flValue))
+	{
+		// The last value held until now, which may have been long enough.
+		bool bFire = IsPending() && flTime >= m_flDeadline;
+
+		m_bHolding = false;
+		m_bFired = false;
+
+		if (bFire)
+			return true;
+
+		m_flLatest = flValue;
+		return false;
+	}
+
+	m_flLatest = flValue;
+
+	if (!m_bHolding)
+	{
+		m_bHolding = true;
+		m_flDeadline = flTime + m_flDuration;
+	}
+
+	if (m_bFired || flTime < m_flDeadline)
+		return false;
+
+	m_bFired = true;
+	return true;
+}
+
+bool CViewbackRule::IsTrue(double flTime, double flValue)
+{
+	if (m_eAggregate == VB_AGGREGATE_VALUE)
+		return Compare(flValue);
+
+	if (!m_bStarted)
+	{
+		m_bStarted = true;
+		m_flFirstTime = flTime;
+	}
+
+	m_aWindow.push_back(make_pair(flTime, flValue));
+	m_flSum += flValue;
+	if (Compare(flValue))
+		m_iMatching++;
+
+	while (m_aWindow.size() > 1 && m_aWindow.front().first < flTime - m_flWindow)
+	{
+		double flOld = m_aWindow.front().second;
+		m_flSum -= flOld;
+		if (Compare(flOld))
+			m_iMatching--;
+
+		m_aWindow.pop_front();
+	}
+
+	// Running sums drift, start over whenever there's only one to sum.
+	if (m_aWindow.size() == 1)
+		m_flSum = flValue;
+
+	if (flTime - m_flFirstTime < m_flWindow)
+		return false;
+
+	size_t iCount = m_aWindow.size();
+
+	if (m_eAggregate == VB_AGGREGATE_MEAN)
+		return Compare(m_flSum / iCount);
+
+	// The quantile is the sample of this rank, counting from 1 at the lowest.
+	// It's below the threshold exactly when at least that many samples are,
+	// and above it when the ones that aren't below leave it out. A little is
+	// taken off so 0.95 of 100 comes out 95 and not 96.
+	size_t iRank = (size_t)ceil(m_flQuantile * iCount - 1e-9);
+	if (iRank < 1)
+		iRank = 1;
+	else if (iRank > iCount)
+		iRank = iCount;
+
+	if (m_eCompare == VB_COMPARE_LESS || m_eCompare == VB_COMPARE_LESS_EQUAL)
+		return m_iMatching >= iRank;
+	else
+		return m_iMatching >= iCount - iRank + 1;
+}
+
+bool CViewbackRule::Compare(double flValue) const
+{
+	switch (m_eCompare)
+	{
+	case VB_COMPARE_LESS:
+	default:
+		return flValue < m_flThreshold;
+
+	case VB_COMPARE_LESS_EQUAL:
+		return flValue <= m_flThreshold;
+
+	case VB_COMPARE_GREATER:
+		return flValue > m_flThreshold;
+
+	case VB_COMPARE_GREATER_EQUAL:
+		return flValue >= m_flThreshold;
+	}
+}
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2014, Jorge Rodriguez, bs.vino@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <deque>
+
+namespace vb
+{
+
+typedef enum
+{
+	VB_AGGREGATE_VALUE,    // Each sample on its own.
+	VB_AGGREGATE_MEAN,     // Of the samples in the window.
+	VB_AGGREGATE_QUANTILE, // Of the samples in the window, m_flQuantile says which.
+} vb_aggregate_t;
+
+typedef enum
+{
+	VB_COMPARE_LESS,
+	VB_COMPARE_LESS_EQUAL,
+	VB_COMPARE_GREATER,
+	VB_COMPARE_GREATER_EQUAL,
+} vb_compare_t;
+
+// A condition on an int or float channel that's watched as its samples come
+// in, see CViewbackClient::AddTrigger(). "Health < 0 for 2s" is
+//
+//   m_sChannel = "Health", m_eCompare = VB_COMPARE_LESS, m_flThreshold = 0,
+//   m_flDuration = 2
+//
+// and "FPS < 30 at p95 over 10s" is
+//
+//   m_sChannel = "FPS", m_eAggregate = VB_AGGREGATE_QUANTILE,
+//   m_flQuantile = 0.95, m_flWindow = 10, m_eCompare = VB_COMPARE_LESS,
+//   m_flThreshold = 30
+//
+// Anything more involved can be watched through a derived channel.
+class CViewbackTrigger
+{
+public:
+	CViewbackTrigger()
+	{
+		m_eAggregate = VB_AGGREGATE_VALUE;
+		m_flQuantile = 0.5;
+		m_flWindow = 0;
+		m_eCompare = VB_COMPARE_LESS;
+		m_flThreshold = 0;
+		m_flDuration = 0;
+	}
+
+public:
+	std::string    m_sName;
+	std::string    m_sChannel;   // A server or derived channel, by name.
+	vb_aggregate_t m_eAggregate;
+	double         m_flQuantile; // 0 is the lowest sample in the window and 1 the highest.
+	double         m_flWindow;   // Seconds. The mean and quantile aren't checked until there's this much data.
+	vb_compare_t   m_eCompare;
+	double         m_flThreshold;
+	double         m_flDuration; // Seconds it has to stay true before it fires. It fires once each time it goes true.
+};
+
+// A trigger going off, as the history records it.
+class CViewbackTriggerHit
+{
+public:
+	size_t m_iTrigger; // Index in CViewbackHistory::GetTriggers().
+	float  m_flValue;  // The channel's latest sample.
+};
+
+// A trigger being watched on one channel. Each sample costs the same no
+// matter how big the window is, counting the ones that leave it: the mean
+// is a running sum, and a quantile held up against a threshold only needs
+// to know how many samples in the window are on which side of it.
+class CViewbackRule
+{
+public:
+	CViewbackRule(const CViewbackTrigger& oTrigger);
+
+public:
+	// Writer. True if it's gone off, at GetDeadline().
+	bool Add(double flTime, double flValue);
+
+	// Writer. True while it's held true for less than the duration. Then
+	// it goes off at GetDeadline() unless a sample says otherwise first.
+	bool   IsPending() const { return m_bHolding && !m_bFired; }
+	double GetDeadline() const { return m_flDeadline; }
+	void   SetFired() { m_bFired = true; }
+
+	double GetLatest() const { return m_flLatest; } // The value it went off with.
+
+private:
+	bool IsTrue(double flTime, double flValue);
+	bool Compare(double flValue) const;
+
+private:
+	vb_aggregate_t m_eAggregate;
+	double         m_flQuantile;
+	double         m_flWindow;
+	vb_compare_t   m_eCompare;
+	double         m_flThreshold;
+	double         m_flDuration;
+
+	bool   m_bStarted;
+	double m_flFirstTime;
+	double m_flLatest;
+
+	// The samples in the window, oldest first.
+	std::deque<std::pair<double, double> > m_aWindow;
+	double                                 m_flSum;
+	size_t                                 m_iMatching; // Samples in the window that pass the comparison.
+
+	bool   m_bHolding; // It's been true since the last sample that said otherwise.
+	bool   m_bFired;   // It's gone off since then.
+	double m_flDeadline;
+};
+
+}
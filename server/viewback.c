@@ -13,6 +13,11 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OU
 THE SOFTWARE.
 */
 
+#ifndef _WIN32
+/* Captures can run for a long time, make sure they can grow past 2GB on 32 bit systems. */
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "viewback.h"
 
 #include <time.h>
@@ -30,11 +35,22 @@ THE SOFTWARE.
 static vb__t* VB;
 static void* vb__automatic_memory = NULL;
 
+#ifndef VB_NO_CAPTURE
+static vb__capture_t vb__capture;
+#endif
+
 #include "viewback_config.h"
 
 extern size_t vb__config_get_channel_mask_length(vb_config_t* config);
+extern size_t vb__config_get_capture_buffer_size(vb_config_t* config);
 extern void vb__send_registrations(vb__socket_t* socket);
 
+#ifndef VB_NO_CAPTURE
+extern void vb__capture_write(const char* message, size_t message_length, vb_bool keep);
+extern void vb__capture_pause();
+extern void vb__capture_resume();
+#endif
+
 vb__t* vb__alloc(vb_config_t* config, size_t size)
 {
 	vb__t* r;
@@ -68,8 +84,14 @@ void vb__memory_layout(vb__t* memory, size_t memory_size)
 	memory->controls = (vb__data_control_t*)((char*)memory->labels + sizeof(vb__data_label_t)*config->num_data_labels);
 	memory->connections = (vb__connection_t*)((char*)memory->controls + sizeof(vb__data_control_t)*config->num_data_controls);
 	char* active_channels = (char*)memory->connections + sizeof(vb__connection_t)*config->max_connections;
+	char* capture_buffers = active_channels + vb__config_get_channel_mask_length(config)*config->max_connections;
 
-	VBAssert(active_channels + vb__config_get_channel_mask_length(config)*config->max_connections == (char*)memory + memory_size);
+	VBAssert(capture_buffers + 3 * vb__config_get_capture_buffer_size(config) == (char*)memory + memory_size);
+
+	if (vb__config_get_capture_buffer_size(config))
+		memory->capture_buffers = capture_buffers;
+	else
+		memory->capture_buffers = NULL;
 
 	for (size_t i = 0; i < config->max_connections; i++)
 	{
@@ -93,6 +115,7 @@ void vb__memory_copy(vb__t* dest, size_t dest_size, vb__t* src)
 	dest->multicast_addr = src->multicast_addr;
 	dest->last_multicast = src->last_multicast;
 	dest->tcp_socket = src->tcp_socket;
+	dest->unix_socket = src->unix_socket;
 	dest->current_time = src->current_time;
 	dest->server_active = src->server_active;
 
@@ -119,8 +142,19 @@ void vb__memory_copy(vb__t* dest, size_t dest_size, vb__t* src)
 	for (size_t k = 0; k < src->config.max_connections; k++)
 	{
 		dest->connections[k].socket = src->connections[k].socket;
+		dest->connections[k].udp_addr = src->connections[k].udp_addr;
+		dest->connections[k].udp_sequence = src->connections[k].udp_sequence;
+		dest->connections[k].udp_active = src->connections[k].udp_active;
+		dest->connections[k].command_length = src->connections[k].command_length;
+		memcpy(dest->connections[k].command_buffer, src->connections[k].command_buffer, src->connections[k].command_length);
 		memcpy(dest->connections[k].active_channels, src->connections[k].active_channels, vb__config_get_channel_mask_length(&dest->config));
 	}
+
+	// The capture thread is paused while this happens, so the only buffer
+	// with anything in it is the one the game is filling.
+	VBAssert(vb__config_get_capture_buffer_size(&dest->config) == vb__config_get_capture_buffer_size(&src->config));
+	if (src->capture_buffers)
+		memcpy(dest->capture_buffers, src->capture_buffers, 3 * vb__config_get_capture_buffer_size(&dest->config));
 }
 
 void vb__memory_reallocate(vb_config_t* new_config)
@@ -132,12 +166,20 @@ void vb__memory_reallocate(vb_config_t* new_config)
 	vb__t* new_memory = vb__alloc(new_config, new_memory_size);
 	new_memory->config = *new_config;
 
+#ifndef VB_NO_CAPTURE
+	vb__capture_pause();
+#endif
+
 	vb__memory_copy(new_memory, new_memory_size, VB);
 
 	vb__t* old_memory = VB;
 
 	vb__automatic_memory = VB = new_memory;
 
+#ifndef VB_NO_CAPTURE
+	vb__capture_resume();
+#endif
+
 	vb__free(&old_memory->config, old_memory);
 }
 
@@ -184,6 +226,24 @@ size_t vb__config_get_channel_mask_length(vb_config_t* config)
 		return channels / 32 + 1;
 }
 
+size_t vb__config_get_capture_buffer_size(vb_config_t* config)
+{
+#ifdef VB_NO_CAPTURE
+	return 0;
+#else
+	if (!config)
+		return 0;
+
+	if (!config->capture_file || !config->capture_file[0])
+		return 0;
+
+	if (!config->capture_buffer_size)
+		return VB_DEFAULT_CAPTURE_BUFFER_SIZE;
+
+	return config->capture_buffer_size;
+#endif
+}
+
 size_t vb_config_get_memory_required(vb_config_t* config)
 {
 	if (!config)
@@ -200,7 +260,8 @@ size_t vb_config_get_memory_required(vb_config_t* config)
 		config->num_data_labels * sizeof(vb__data_label_t)+
 		config->num_data_controls * sizeof(vb__data_control_t)+
 		config->max_connections * sizeof(vb__connection_t)+
-		config->max_connections * vb__config_get_channel_mask_length(config);
+		config->max_connections * vb__config_get_channel_mask_length(config)+
+		3 * vb__config_get_capture_buffer_size(config);
 }
 
 vb_bool vb_config_install(vb_config_t* config, void* memory, size_t memory_size)
@@ -506,6 +567,22 @@ vb_bool vb_data_set_range(vb_channel_handle_t handle, float range_min, float ran
 }
 #endif
 
+vb_bool vb_data_set_unreliable(vb_channel_handle_t handle)
+{
+	if (!VB)
+		return 0;
+
+	if (handle < 0 || handle >= VB->next_channel)
+		return 0;
+
+	if (VB->server_active)
+		return 0;
+
+	VB->channels[handle].flags |= CHANNEL_FLAG_UNRELIABLE;
+
+	return 1;
+}
+
 vb__data_control_t* vb__data_add_control(const char* name, vb_control_t type)
 {
 	if (!VB)
@@ -764,6 +841,10 @@ vb_bool vb__data_update_control(size_t i, vb_control_t control_type, void* value
 	if (!message_actual_length)
 		return 0;
 
+#ifndef VB_NO_CAPTURE
+	vb__capture_write((const char*)message, message_actual_length, 1);
+#endif
+
 	for (size_t i = 0; i < VB->config.max_connections; i++)
 	{
 		if (VB->connections[i].socket == VB_INVALID_SOCKET)
@@ -847,6 +928,285 @@ vb_bool vb_data_set_control_slider_int_value(const char* name, int value)
 	return vb__data_set_control_slider_int_value_h(vb__data_find_control_by_name(name, strlen(name)), value);
 }
 
+vb_bool vb__server_create_unix_socket()
+{
+#ifdef _WIN32
+	VBPrintf("Unix domain sockets are not supported on this platform.\n");
+	return 0;
+#else
+	struct sockaddr_un unix_addr;
+
+	if (strlen(VB->config.unix_socket_path) >= sizeof(unix_addr.sun_path))
+	{
+		VBPrintf("Unix socket path is too long: '%s'\n", VB->config.unix_socket_path);
+		return 0;
+	}
+
+	VB->unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (!vb__socket_valid(VB->unix_socket))
+		return 0;
+
+	if (vb__socket_set_blocking(VB->unix_socket, 0) != 0)
+		return 0;
+
+	memset(&unix_addr, 0, sizeof(unix_addr));
+	unix_addr.sun_family = AF_UNIX;
+	strcpy(unix_addr.sun_path, VB->config.unix_socket_path);
+
+	/* A socket file left over from a server that didn't shut down cleanly will make bind() fail. */
+	unlink(unix_addr.sun_path);
+
+	if (bind(VB->unix_socket, (struct sockaddr*) &unix_addr, sizeof(unix_addr)) != 0)
+	{
+		VBPrintf("Couldn't bind Unix socket '%s'. Error: %d\n", unix_addr.sun_path, vb__socket_error());
+		return 0;
+	}
+
+	if (listen(VB->unix_socket, SOMAXCONN) != 0)
+		return 0;
+
+	VBPrintf("Viewback server listening on Unix socket '%s'.\n", unix_addr.sun_path);
+
+	return 1;
+#endif
+}
+
+#ifndef VB_NO_CAPTURE
+static vb__thread_result_t VB_THREAD_CALL vb__capture_thread(void* arg)
+{
+	(void)arg;
+
+	vb__mutex_lock(&vb__capture.mutex);
+
+	while (1)
+	{
+		while (!vb__capture.write_pending && !vb__capture.quit)
+			vb__cond_wait(&vb__capture.write_ready, &vb__capture.mutex);
+
+		// Only quit once there's nothing left to write.
+		if (!vb__capture.write_pending)
+			break;
+
+		int buffer = !vb__capture.fill_buffer;
+		const char* data = vb__capture.buffers[buffer];
+		size_t length = vb__capture.buffer_length[buffer];
+		size_t overflow_length = vb__capture.overflow_length[buffer];
+
+		// The game thread won't touch this buffer or the overflow it's
+		// using until write_pending is cleared.
+		vb__mutex_unlock(&vb__capture.mutex);
+
+		size_t written = fwrite(data, 1, length, vb__capture.file);
+
+		if (overflow_length)
+			written += fwrite(vb__capture.overflow, 1, overflow_length, vb__capture.file);
+
+		fflush(vb__capture.file);
+
+		vb__mutex_lock(&vb__capture.mutex);
+
+		vb__capture.bytes_written += written;
+		if (written != length + overflow_length)
+			vb__capture.write_failed = 1;
+
+		vb__capture.buffer_length[buffer] = 0;
+		vb__capture.overflow_length[buffer] = 0;
+		vb__capture.write_pending = 0;
+		vb__cond_signal(&vb__capture.write_finished);
+	}
+
+	vb__mutex_unlock(&vb__capture.mutex);
+
+	return 0;
+}
+
+// Call with the capture mutex held and no write pending. Gives the capture
+// thread the buffer the game has been filling.
+void vb__capture_handoff()
+{
+	VBAssert(!vb__capture.write_pending);
+
+	int fill = vb__capture.fill_buffer;
+	if (!vb__capture.buffer_length[fill] && !vb__capture.overflow_length[fill])
+		return;
+
+	vb__capture.write_pending = 1;
+	vb__capture.fill_buffer = !fill;
+	vb__cond_signal(&vb__capture.write_ready);
+}
+
+// Never waits for the capture thread and never allocates. If it's still
+// writing the last buffer when this one fills up, what comes in goes into
+// the overflow until it's done. Data only gets half of the overflow so that
+// registrations and control changes, which the capture can't do without,
+// still have room. Anything that doesn't fit is dropped and counted, so a
+// slow disk costs data and not frames.
+void vb__capture_write(const char* message, size_t message_length, vb_bool keep)
+{
+	if (!vb__capture.file)
+		return;
+
+	// Only the game thread changes fill_buffer and the lengths of the buffer
+	// it's filling, so the common case doesn't need the lock.
+	int fill = vb__capture.fill_buffer;
+	if (!vb__capture.overflow_length[fill] && vb__capture.buffer_length[fill] + message_length <= vb__capture.buffer_size)
+	{
+		memcpy(vb__capture.buffers[fill] + vb__capture.buffer_length[fill], message, message_length);
+		vb__capture.buffer_length[fill] += message_length;
+		return;
+	}
+
+	vb__mutex_lock(&vb__capture.mutex);
+
+	if (!vb__capture.write_pending)
+		vb__capture_handoff();
+
+	fill = vb__capture.fill_buffer;
+
+	size_t overflow_size = keep ? vb__capture.buffer_size : vb__capture.buffer_size / 2;
+
+	if (!vb__capture.overflow_length[fill] && vb__capture.buffer_length[fill] + message_length <= vb__capture.buffer_size)
+	{
+		memcpy(vb__capture.buffers[fill] + vb__capture.buffer_length[fill], message, message_length);
+		vb__capture.buffer_length[fill] += message_length;
+	}
+	else if (!vb__capture.overflow_length[!fill] && vb__capture.overflow_length[fill] + message_length <= overflow_size)
+	{
+		memcpy(vb__capture.overflow + vb__capture.overflow_length[fill], message, message_length);
+		vb__capture.overflow_length[fill] += message_length;
+	}
+	else
+	{
+		if (keep && !vb__capture.dropped_kept++)
+			VBPrintf("A registration or control change didn't fit in the capture buffers and was dropped. Try a bigger capture_buffer_size.\n");
+
+		vb__capture.dropped_messages++;
+		vb__capture.dropped_bytes += message_length;
+	}
+
+	vb__mutex_unlock(&vb__capture.mutex);
+}
+
+// Hands off whatever has been captured so far, unless the capture thread is
+// still busy with the last buffer. Never blocks.
+void vb__capture_flush()
+{
+	if (!vb__capture.file)
+		return;
+
+	vb__mutex_lock(&vb__capture.mutex);
+
+	if (!vb__capture.write_pending)
+		vb__capture_handoff();
+
+	vb__mutex_unlock(&vb__capture.mutex);
+}
+
+// The capture buffers are about to move. Waits for the capture thread to go
+// idle and keeps it that way until vb__capture_resume().
+void vb__capture_pause()
+{
+	if (!vb__capture.file)
+		return;
+
+	vb__mutex_lock(&vb__capture.mutex);
+
+	while (vb__capture.write_pending)
+		vb__cond_wait(&vb__capture.write_finished, &vb__capture.mutex);
+}
+
+void vb__capture_resume()
+{
+	if (!vb__capture.file)
+		return;
+
+	vb__capture.buffers[0] = VB->capture_buffers;
+	vb__capture.buffers[1] = VB->capture_buffers + vb__capture.buffer_size;
+	vb__capture.overflow = VB->capture_buffers + 2 * vb__capture.buffer_size;
+
+	vb__mutex_unlock(&vb__capture.mutex);
+}
+
+vb_bool vb__capture_open()
+{
+	memset(&vb__capture, 0, sizeof(vb__capture));
+
+	// Append so that restarting the server doesn't clobber an old capture.
+	vb__capture.file = fopen(VB->config.capture_file, "ab");
+	if (!vb__capture.file)
+	{
+		VBPrintf("Couldn't open capture file %s\n", VB->config.capture_file);
+		return 0;
+	}
+
+	vb__capture.buffer_size = vb__config_get_capture_buffer_size(&VB->config);
+	vb__capture.buffers[0] = VB->capture_buffers;
+	vb__capture.buffers[1] = VB->capture_buffers + vb__capture.buffer_size;
+	vb__capture.overflow = VB->capture_buffers + 2 * vb__capture.buffer_size;
+
+	vb__mutex_init(&vb__capture.mutex);
+	vb__cond_init(&vb__capture.write_ready);
+	vb__cond_init(&vb__capture.write_finished);
+
+	if (!vb__thread_create(&vb__capture.thread, &vb__capture_thread, NULL))
+	{
+		VBPrintf("Couldn't start the capture thread.\n");
+		vb__cond_destroy(&vb__capture.write_finished);
+		vb__cond_destroy(&vb__capture.write_ready);
+		vb__mutex_destroy(&vb__capture.mutex);
+		fclose(vb__capture.file);
+		vb__capture.file = NULL;
+		return 0;
+	}
+
+	VBPrintf("Capturing to %s.\n", VB->config.capture_file);
+
+	// A capture has to start with the registrations, just like a connection.
+	// There are no connections yet so this only goes to the capture.
+	vb__send_registrations(NULL);
+
+	return 1;
+}
+
+void vb__capture_close()
+{
+	if (!vb__capture.file)
+		return;
+
+	vb__mutex_lock(&vb__capture.mutex);
+
+	// It's shutting down, so this is the one place the game waits for the disk.
+	while (vb__capture.write_pending)
+		vb__cond_wait(&vb__capture.write_finished, &vb__capture.mutex);
+
+	vb__capture_handoff();
+
+	vb__capture.quit = 1;
+	vb__cond_signal(&vb__capture.write_ready);
+
+	vb__mutex_unlock(&vb__capture.mutex);
+
+	// The capture thread writes anything still pending before it quits.
+	vb__thread_join(vb__capture.thread);
+
+	vb__cond_destroy(&vb__capture.write_finished);
+	vb__cond_destroy(&vb__capture.write_ready);
+	vb__mutex_destroy(&vb__capture.mutex);
+
+	if (vb__capture.write_failed)
+		VBPrintf("Some captured data couldn't be written to %s.\n", VB->config.capture_file);
+
+	if (vb__capture.dropped_messages)
+		VBPrintf("The disk couldn't keep up, %llu captured messages (%llu bytes) were dropped.\n", vb__capture.dropped_messages, vb__capture.dropped_bytes);
+
+	VBPrintf("Capture finished, %llu bytes written.\n", vb__capture.bytes_written);
+
+	fclose(vb__capture.file);
+	vb__capture.file = NULL;
+}
+#endif
+
 vb_bool vb_server_create()
 {
 	if (!VB)
@@ -855,6 +1215,9 @@ vb_bool vb_server_create()
 	if (VB->server_active)
 		return 0;
 
+	VB->tcp_socket = VB_INVALID_SOCKET;
+	VB->unix_socket = VB_INVALID_SOCKET;
+
 	VB->multicast_socket = socket(AF_INET, SOCK_DGRAM, 0);
 
 	if (!vb__socket_valid(VB->multicast_socket))
@@ -921,13 +1284,30 @@ vb_bool vb_server_create()
 	VBPrintf("Viewback server created on %s:%d (%u).\n", inet_ntoa(tcp_addr.sin_addr), ntohs(tcp_addr.sin_port), tcp_addr.sin_addr.s_addr);
 	VBPrintf("Multicasting to %s:%d.\n", inet_ntoa(VB->multicast_addr.sin_addr), ntohs(VB->multicast_addr.sin_port));
 
+	if (VB->config.unix_socket_path && VB->config.unix_socket_path[0])
+	{
+		if (!vb__server_create_unix_socket())
+			goto error;
+	}
+
 	vb__configfile_load();
 
+#ifndef VB_NO_CAPTURE
+	if (VB->capture_buffers)
+	{
+		if (!vb__capture_open())
+			goto error;
+	}
+#endif
+
 	VB->server_active = 1;
 
 	return 1;
 
 error:
+	if (vb__socket_valid(VB->unix_socket))
+		vb__socket_close(VB->unix_socket);
+	VB->unix_socket = VB_INVALID_SOCKET;
 	vb__socket_close(VB->tcp_socket);
 	vb__socket_close(VB->multicast_socket);
 	return 0;
@@ -944,9 +1324,22 @@ void vb_server_shutdown()
 	vb__socket_close(VB->tcp_socket);
 	vb__socket_close(VB->multicast_socket);
 
+	if (vb__socket_valid(VB->unix_socket))
+	{
+		vb__socket_close(VB->unix_socket);
+#ifndef _WIN32
+		unlink(VB->config.unix_socket_path);
+#endif
+	}
+	VB->unix_socket = VB_INVALID_SOCKET;
+
 	for (size_t i = 0; i < VB->config.max_connections; i++)
 		vb__socket_close(VB->connections[i].socket);
 
+#ifndef VB_NO_CAPTURE
+	vb__capture_close();
+#endif
+
 	VB->server_active = 0;
 }
 
@@ -1007,6 +1400,186 @@ void vb__connection_setup(vb__connection_t* connection)
 {
 	// Clear the channel masks so all channels are inactive by default.
 	memset(connection->active_channels, 0, vb__config_get_channel_mask_length(&VB->config));
+
+	// Everything goes over TCP until the client asks for UDP.
+	memset(&connection->udp_addr, 0, sizeof(connection->udp_addr));
+	connection->udp_sequence = 0;
+	connection->udp_active = 0;
+
+	connection->command_length = 0;
+}
+
+void vb__connection_command(size_t connection, char* mesg)
+{
+	if (vb__strncmp(mesg, "registrations", 13, 13) == 0)
+	{
+		vb__send_registrations(&VB->connections[connection].socket);
+	}
+	else if (vb__strncmp(mesg, "console: ", 9, 9) == 0)
+	{
+		if (VB->config.command_callback)
+			(*VB->config.command_callback)(&mesg[9]);
+	}
+	else if (vb__strncmp(mesg, "activate: ", 10, 10) == 0)
+	{
+		int channel = atoi(mesg + 10);
+		vb__data_channel_activate((vb_channel_handle_t)channel, connection);
+	}
+	else if (vb__strncmp(mesg, "deactivate: ", 12, 12) == 0)
+	{
+		int channel = atoi(mesg + 12);
+		vb__data_channel_deactivate((vb_channel_handle_t)channel, connection);
+	}
+	else if (vb__strncmp(mesg, "udp: ", 5, 5) == 0)
+	{
+		int port = atoi(mesg + 5);
+
+		struct sockaddr_in peer_addr;
+		vb__socklen_t peer_addr_len = sizeof(peer_addr);
+
+		if (port <= 0 || port > 65535)
+			return;
+
+		/* Datagrams go to the same host as the TCP connection, Unix socket clients can't have them. */
+		if (getpeername(VB->connections[connection].socket, (struct sockaddr*)&peer_addr, &peer_addr_len) != 0 || peer_addr.sin_family != AF_INET)
+			return;
+
+		peer_addr.sin_port = htons((unsigned short)port);
+
+		VB->connections[connection].udp_addr = peer_addr;
+		VB->connections[connection].udp_active = 1;
+
+		VBPrintf("Sending unreliable channels to %s:%d.\n", inet_ntoa(peer_addr.sin_addr), port);
+	}
+	else if (vb__strncmp(mesg, "group: ", 7, 7) == 0)
+	{
+		int group = atoi(mesg + 7);
+
+		for (size_t j = 0; j < VB->next_channel; j++)
+			vb__data_channel_deactivate((vb_channel_handle_t)j, connection);
+
+		for (size_t j = 0; j < VB->next_group_member; j++)
+		{
+			if (VB->group_members[j].group != group)
+				continue;
+
+			vb__data_channel_activate(VB->group_members[j].channel, connection);
+
+#ifndef VB_NO_COMPRESSION
+			vb__data_channel_t* channel = &VB->channels[VB->group_members[j].channel];
+
+			if (channel->flags & CHANNEL_FLAG_INITIALIZED)
+			{
+				if (channel->type == VB_DATATYPE_INT)
+					vb_data_send_int(VB->group_members[j].channel, channel->last_int);
+				else if (channel->type == VB_DATATYPE_FLOAT)
+					vb_data_send_float(VB->group_members[j].channel, channel->last_float);
+				else if (channel->type == VB_DATATYPE_VECTOR)
+					vb_data_send_vector(VB->group_members[j].channel, channel->last_float_x, channel->last_float_y, channel->last_float_z);
+				else
+					VBAssert(!"Unknown channel type");
+			}
+#endif
+		}
+	}
+	else if (vb__strncmp(mesg, "control: ", 9, 9) == 0)
+	{
+		size_t message_length = strlen(mesg);
+
+		// Find out what's after the control index.
+		size_t after_control_index = 9;
+		while (after_control_index < message_length && mesg[after_control_index] != ' ')
+			after_control_index++;
+
+		int control = atoi(mesg + 9);
+
+		if (control < 0 || control >= (int)VB->next_control)
+			return;
+
+		switch (VB->controls[control].type)
+		{
+		case VB_CONTROL_BUTTON:
+			if (VB->controls[control].button_callback)
+				VB->controls[control].button_callback();
+			else if (VB->controls[control].command)
+				VB->config.command_callback(VB->controls[control].command);
+			break;
+
+		case VB_CONTROL_SLIDER_FLOAT:
+			VBAssert(after_control_index < message_length);
+			if (after_control_index < message_length)
+			{
+				float new_value = (float)atof(&mesg[after_control_index]);
+				VB->controls[control].slider_float.value = new_value;
+				vb__data_update_control(control, VB_CONTROL_SLIDER_FLOAT, &new_value, connection);
+
+				if (VB->controls[control].slider_float_callback)
+					VB->controls[control].slider_float_callback(new_value);
+				else if (VB->controls[control].command)
+				{
+					if (strstr(VB->controls[control].command, "%f"))
+						vb__sprintf(VB->controls[control].command, (float)new_value);
+					else
+						vb__sprintf("%s %f", VB->controls[control].command, (float)new_value);
+
+					VB->config.command_callback(vb__sprintf_buffer);
+				}
+				else if (VB->controls[control].slider_float.address)
+					*VB->controls[control].slider_float.address = new_value;
+				else
+					VBUnimplemented();
+
+				vb__configfile_write();
+			}
+			break;
+
+		case VB_CONTROL_SLIDER_INT:
+			VBAssert(after_control_index < message_length);
+			if (after_control_index < message_length)
+			{
+				int new_value = atoi(&mesg[after_control_index]);
+				VB->controls[control].slider_int.value = new_value;
+				vb__data_update_control(control, VB_CONTROL_SLIDER_INT, &new_value, connection);
+
+				if (VB->controls[control].slider_int_callback)
+					VB->controls[control].slider_int_callback(new_value);
+				else if (VB->controls[control].command)
+				{
+					if (strstr(VB->controls[control].command, "%f"))
+						vb__sprintf(VB->controls[control].command, (float)new_value);
+					else
+						vb__sprintf("%s %f", VB->controls[control].command, (float)new_value);
+
+					VB->config.command_callback(vb__sprintf_buffer);
+				}
+				else if (VB->controls[control].slider_int.address)
+					*VB->controls[control].slider_int.address = new_value;
+				else
+					VBUnimplemented();
+
+				vb__configfile_write();
+			}
+			break;
+		}
+	}
+
+}
+
+void vb__connection_send_datagram(vb__connection_t* connection, const char* message, size_t message_length)
+{
+	/* Datagrams don't need the length prefix, it's replaced with a sequence
+	number so that the client can throw out datagrams that arrive late. */
+	size_t packet_length = message_length - sizeof(size_t);
+
+	vb__stack_allocate(char, datagram, packet_length + sizeof(unsigned int));
+
+	unsigned int sequence = htonl(++connection->udp_sequence);
+	memcpy(datagram, &sequence, sizeof(sequence));
+	memcpy(datagram + sizeof(sequence), message + sizeof(size_t), packet_length);
+
+	/* The multicast socket is a plain UDP socket, it can send unicast too. */
+	if (sendto(VB->multicast_socket, (const char*)datagram, packet_length + sizeof(sequence), 0, (struct sockaddr *)&connection->udp_addr, sizeof(connection->udp_addr)) < 0)
+		VBPrintf("Datagram sendto failed, error %d\n", vb__socket_error());
 }
 
 // socket == NULL means to send registration to all connections.
@@ -1059,6 +1632,10 @@ void vb__send_registrations(vb__socket_t* socket)
 			vb__socket_send(socket, (const char*)message, message_actual_length);
 		else
 		{
+#ifndef VB_NO_CAPTURE
+			vb__capture_write((const char*)message, message_actual_length, 1);
+#endif
+
 			for (size_t i = 0; i < VB->config.max_connections; i++)
 			{
 				if (VB->connections[i].socket == VB_INVALID_SOCKET)
@@ -1070,6 +1647,59 @@ void vb__send_registrations(vb__socket_t* socket)
 	}
 }
 
+void vb__server_accept(vb__socket_t listen_socket)
+{
+	/* We have an incoming connection. */
+
+	VBPrintf("Incoming connection... ");
+
+	char VB_ALIGN(8) client_addr[64];
+	vb__socklen_t client_addr_len = sizeof(client_addr);
+	vb__socket_t incoming_socket = accept(listen_socket, (struct sockaddr*) &client_addr[0], &client_addr_len);
+
+	if (vb__socket_valid(incoming_socket))
+	{
+		vb_bool socket_success = 0;
+
+		int open_socket = -1;
+		for (size_t i = 0; i < VB->config.max_connections; i++)
+		{
+			if (VB->connections[i].socket == VB_INVALID_SOCKET)
+			{
+				open_socket = i;
+				break;
+			}
+		}
+
+		VBAssert(open_socket >= 0);
+
+		if (open_socket >= 0)
+		{
+			VB->connections[open_socket].socket = incoming_socket;
+
+			if (vb__socket_set_blocking(incoming_socket, 0) == 0)
+			{
+				vb__connection_setup(&VB->connections[open_socket]);
+
+				socket_success = 1;
+			}
+		}
+
+		if (socket_success)
+		{
+			VBPrintf("Successful. Socket: %d\n", incoming_socket);
+			vb__send_registrations(&VB->connections[open_socket].socket);
+		}
+		else
+		{
+			VBPrintf("Not enough connections, increase max_connections\n");
+			vb__socket_close(incoming_socket);
+		}
+	}
+	else
+		VBPrintf("Dropped.\n");
+}
+
 #ifdef VIEWBACK_TIME_DOUBLE
 void vb_server_update(double current_game_time)
 #else
@@ -1125,6 +1755,11 @@ void vb_server_update(vb_uint64 current_game_time)
 			VBPrintf("Multicast sendto failed, error %d\n", vb__socket_error());
 
 		VB->last_multicast = current_time;
+
+#ifndef VB_NO_CAPTURE
+		// Don't let captured data sit in the buffer forever if the game is quiet.
+		vb__capture_flush();
+#endif
 	}
 
 	fd_set read_fds;
@@ -1144,6 +1779,14 @@ void vb_server_update(vb_uint64 current_game_time)
 	{
 		FD_SET(VB->tcp_socket, &read_fds);
 		max_socket = VB->tcp_socket;
+
+		if (vb__socket_valid(VB->unix_socket))
+		{
+			FD_SET(VB->unix_socket, &read_fds);
+
+			if (VB->unix_socket > max_socket)
+				max_socket = VB->unix_socket;
+		}
 	}
 
 	for (size_t i = 0; i < VB->config.max_connections; ++i)
@@ -1165,57 +1808,10 @@ void vb_server_update(vb_uint64 current_game_time)
 	select((int) (max_socket + 1), &read_fds, NULL, NULL, &timeout);
 
 	if (FD_ISSET(VB->tcp_socket, &read_fds))
-	{
-		/* We have an incoming connection. */
-
-		VBPrintf("Incoming connection... ");
-
-		char VB_ALIGN(8) client_addr[64];
-		vb__socklen_t client_addr_len = sizeof(client_addr);
-		vb__socket_t incoming_socket = accept(VB->tcp_socket, (struct sockaddr*) &client_addr[0], &client_addr_len);
-
-		if (vb__socket_valid(incoming_socket))
-		{
-			vb_bool socket_success = 0;
-
-			int open_socket = -1;
-			for (size_t i = 0; i < VB->config.max_connections; i++)
-			{
-				if (VB->connections[i].socket == VB_INVALID_SOCKET)
-				{
-					open_socket = i;
-					break;
-				}
-			}
-
-			VBAssert(open_socket >= 0);
-
-			if (open_socket >= 0)
-			{
-				VB->connections[open_socket].socket = incoming_socket;
-
-				if (vb__socket_set_blocking(incoming_socket, 0) == 0)
-				{
-					vb__connection_setup(&VB->connections[open_socket]);
-
-					socket_success = 1;
-				}
-			}
+		vb__server_accept(VB->tcp_socket);
 
-			if (socket_success)
-			{
-				VBPrintf("Successful. Socket: %d\n", incoming_socket);
-				vb__send_registrations(&VB->connections[open_socket].socket);
-			}
-			else
-			{
-				VBPrintf("Not enough connections, increase max_connections\n");
-				vb__socket_close(incoming_socket);
-			}
-		}
-		else
-			VBPrintf("Dropped.\n");
-	}
+	if (vb__socket_valid(VB->unix_socket) && FD_ISSET(VB->unix_socket, &read_fds))
+		vb__server_accept(VB->unix_socket);
 
 	for (size_t i = 0; i < VB->config.max_connections; i++)
 	{
@@ -1224,152 +1820,50 @@ void vb_server_update(vb_uint64 current_game_time)
 
 		if (FD_ISSET(VB->connections[i].socket, &read_fds))
 		{
-			char mesg[1024];
+			vb__connection_t* connection = &VB->connections[i];
 
-			int n = recv(VB->connections[i].socket, mesg, sizeof(mesg), 0);
+			int n = recv(connection->socket, connection->command_buffer + connection->command_length, (int)(sizeof(connection->command_buffer) - connection->command_length), 0);
 
 			if (n == 0)
 			{
-				vb__socket_close(VB->connections[i].socket);
-				VB->connections[i].socket = VB_INVALID_SOCKET;
+				vb__socket_close(connection->socket);
+				connection->socket = VB_INVALID_SOCKET;
 				continue;
 			}
-			else if (n == sizeof(mesg))
-			{
-				/* We read the whole damn thing? Shouldn't ever happen, but ignore. */
-				VBAssert(0);
+			else if (n < 0)
 				continue;
-			}
 
-			if (vb__strncmp(mesg, "registrations", 13, 13) == 0)
-			{
-				vb__send_registrations(&VB->connections[i].socket);
-			}
-			else if (vb__strncmp(mesg, "console: ", 9, 9) == 0)
-			{
-				if (VB->config.command_callback)
-					(*VB->config.command_callback)(&mesg[9]);
-			}
-			else if (vb__strncmp(mesg, "activate: ", 10, 10) == 0)
-			{
-				int channel = atoi(mesg + 10);
-				vb__data_channel_activate((vb_channel_handle_t)channel, i);
-			}
-			else if (vb__strncmp(mesg, "deactivate: ", 12, 12) == 0)
-			{
-				int channel = atoi(mesg + 12);
-				vb__data_channel_deactivate((vb_channel_handle_t)channel, i);
-			}
-			else if (vb__strncmp(mesg, "group: ", 7, 7) == 0)
-			{
-				int group = atoi(mesg + 7);
+			connection->command_length += n;
 
-				for (size_t j = 0; j < VB->next_channel; j++)
-					vb__data_channel_deactivate((vb_channel_handle_t)j, i);
+			/* A client can send several commands in one go. Handle every complete
+			one and keep whatever's after the last null for next time. */
+			size_t command_start = 0;
+			for (size_t k = 0; k < VB->connections[i].command_length; k++)
+			{
+				if (VB->connections[i].command_buffer[k] != '\0')
+					continue;
 
-				for (size_t j = 0; j < VB->next_group_member; j++)
-				{
-					if (VB->group_members[j].group != group)
-						continue;
+				/* The command might add channels, which moves VB->connections, so work on a copy. */
+				char mesg[VB_COMMAND_BUFFER_SIZE];
+				memcpy(mesg, &VB->connections[i].command_buffer[command_start], k + 1 - command_start);
 
-					vb__data_channel_activate(VB->group_members[j].channel, i);
+				vb__connection_command(i, mesg);
 
-#ifndef VB_NO_COMPRESSION
-					vb__data_channel_t* channel = &VB->channels[VB->group_members[j].channel];
-
-					if (channel->flags & CHANNEL_FLAG_INITIALIZED)
-					{
-						if (channel->type == VB_DATATYPE_INT)
-							vb_data_send_int(VB->group_members[j].channel, channel->last_int);
-						else if (channel->type == VB_DATATYPE_FLOAT)
-							vb_data_send_float(VB->group_members[j].channel, channel->last_float);
-						else if (channel->type == VB_DATATYPE_VECTOR)
-							vb_data_send_vector(VB->group_members[j].channel, channel->last_float_x, channel->last_float_y, channel->last_float_z);
-						else
-							VBAssert(!"Unknown channel type");
-					}
-#endif
-				}
+				command_start = k + 1;
 			}
-			else if (vb__strncmp(mesg, "control: ", 9, 9) == 0)
-			{
-				size_t message_length = strlen(mesg);
 
-				// Find out what's after the control index.
-				size_t after_control_index = 9;
-				while (after_control_index < message_length && mesg[after_control_index] != ' ')
-					after_control_index++;
+			connection = &VB->connections[i];
 
-				int control = atoi(mesg + 9);
-
-				if (control < 0 || control >= (int)VB->next_control)
-					continue;
-
-				switch (VB->controls[control].type)
-				{
-				case VB_CONTROL_BUTTON:
-					if (VB->controls[control].button_callback)
-						VB->controls[control].button_callback();
-					else if (VB->controls[control].command)
-						VB->config.command_callback(VB->controls[control].command);
-					break;
-
-				case VB_CONTROL_SLIDER_FLOAT:
-					VBAssert(after_control_index < message_length);
-					if (after_control_index < message_length)
-					{
-						float new_value = (float)atof(&mesg[after_control_index]);
-						VB->controls[control].slider_float.value = new_value;
-						vb__data_update_control(control, VB_CONTROL_SLIDER_FLOAT, &new_value, i);
-
-						if (VB->controls[control].slider_float_callback)
-							VB->controls[control].slider_float_callback(new_value);
-						else if (VB->controls[control].command)
-						{
-							if (strstr(VB->controls[control].command, "%f"))
-								vb__sprintf(VB->controls[control].command, (float)new_value);
-							else
-								vb__sprintf("%s %f", VB->controls[control].command, (float)new_value);
-
-							VB->config.command_callback(vb__sprintf_buffer);
-						}
-						else if (VB->controls[control].slider_float.address)
-							*VB->controls[control].slider_float.address = new_value;
-						else
-							VBUnimplemented();
-
-						vb__configfile_write();
-					}
-					break;
-
-				case VB_CONTROL_SLIDER_INT:
-					VBAssert(after_control_index < message_length);
-					if (after_control_index < message_length)
-					{
-						int new_value = atoi(&mesg[after_control_index]);
-						VB->controls[control].slider_int.value = new_value;
-						vb__data_update_control(control, VB_CONTROL_SLIDER_INT, &new_value, i);
-
-						if (VB->controls[control].slider_int_callback)
-							VB->controls[control].slider_int_callback(new_value);
-						else if (VB->controls[control].command)
-						{
-							if (strstr(VB->controls[control].command, "%f"))
-								vb__sprintf(VB->controls[control].command, (float)new_value);
-							else
-								vb__sprintf("%s %f", VB->controls[control].command, (float)new_value);
-
-							VB->config.command_callback(vb__sprintf_buffer);
-						}
-						else if (VB->controls[control].slider_int.address)
-							*VB->controls[control].slider_int.address = new_value;
-						else
-							VBUnimplemented();
-
-						vb__configfile_write();
-					}
-					break;
-				}
+			if (command_start)
+			{
+				memmove(connection->command_buffer, connection->command_buffer + command_start, connection->command_length - command_start);
+				connection->command_length -= command_start;
+			}
+			else if (connection->command_length == sizeof(connection->command_buffer))
+			{
+				/* A command that doesn't fit in the buffer. Shouldn't ever happen, but throw it out. */
+				VBAssert(0);
+				connection->command_length = 0;
 			}
 		}
 	}
@@ -1402,6 +1896,13 @@ void vb_server_update(vb_uint64 current_game_time)
 
 void vb__send_to_all(vb_channel_handle_t channel, void* message, size_t message_length)
 {
+	vb_bool unreliable = (channel != VB_CHANNEL_NONE) && (VB->channels[channel].flags & CHANNEL_FLAG_UNRELIABLE);
+
+#ifndef VB_NO_CAPTURE
+	// Captures get everything, as if a monitor had every channel turned on.
+	vb__capture_write((const char*)message, message_length, 0);
+#endif
+
 	for (size_t i = 0; i < VB->config.max_connections; i++)
 	{
 		if (VB->connections[i].socket == VB_INVALID_SOCKET)
@@ -1410,6 +1911,12 @@ void vb__send_to_all(vb_channel_handle_t channel, void* message, size_t message_
 		if (!vb__data_is_channel_active(channel, i))
 			continue;
 
+		if (unreliable && VB->connections[i].udp_active)
+		{
+			vb__connection_send_datagram(&VB->connections[i], (const char*)message, message_length);
+			continue;
+		}
+
 		vb__socket_send(&VB->connections[i].socket, (const char*)message, message_length);
 	}
 }
@@ -50,6 +50,7 @@ typedef unsigned char vb_bool;
 	viewback.h is included, it's best to put them in your project files.
 	VR_NO_RANGE - Remove the ability to specify a channel's range, saves 8 bytes per channel.
 	VR_NO_COMPRESSION - Remove delta compression, saves 20 bytes per channel.
+	VB_NO_CAPTURE - Remove capture to disk. Viewback will never start a thread.
 
 	On Windows you must call WSAStartup before using Viewback.
 
@@ -177,6 +178,42 @@ typedef struct {
 	*/
 	unsigned short tcp_port;
 
+	/*
+		If this is set, Viewback will also listen for connections on a Unix
+		domain socket at this path, in addition to the TCP port. Monitors
+		running on the same machine can connect here to skip the TCP stack.
+		Any stale socket file at this path is removed. Leave it NULL to only
+		use TCP. Not available on Windows.
+		NOTE: Viewback doesn't make a copy so don't use memory that will be freed.
+	*/
+	const char* unix_socket_path;
+
+#ifndef VB_NO_CAPTURE
+	/*
+		If this is set, Viewback appends everything it would send to a monitor
+		with every channel turned on to this file, byte for byte, starting
+		with the registrations. The file can be replayed later as if the game
+		were running. Writes are buffered and done on a separate thread so
+		they don't stall the game, and the last of it is written out by
+		vb_server_shutdown(). Leave it NULL to not capture.
+		NOTE: Viewback doesn't make a copy so don't use memory that will be freed.
+	*/
+	const char* capture_file;
+
+	/*
+		Captured data is collected into two buffers of this size. The game
+		fills one while the other is written to disk, and a third holds
+		what doesn't fit while the disk is busy. If that fills up too, data
+		is dropped instead of making the game wait. Half of the third is
+		kept for registrations and control changes, which can't be dropped
+		without spoiling the capture, so this should be at least twice the
+		size of the registrations. 0 means use a default of 64KB. Only used
+		if capture_file is set. All three are part of the memory returned
+		by vb_config_get_memory_required().
+	*/
+	size_t capture_buffer_size;
+#endif
+
 #ifndef VIEWBACK_NO_CONFIG
 	/*
 		Viewback reads and writes configuration options and persistent data to
@@ -303,6 +340,17 @@ vb_bool vb_data_get_label(vb_channel_handle_t handle, int value, /*out*/ const c
 vb_bool vb_data_set_range(vb_channel_handle_t handle, float range_min, float range_max);
 #endif
 
+/*
+	Mark a channel as unreliable. Monitors that support it will receive this
+	channel's data over UDP instead of TCP, so a lost packet never holds up
+	the data behind it. Datagrams can be lost or arrive out of order and the
+	monitor throws out stale ones, so only use this for high frequency data
+	where the latest value is all that matters, eg mouse position or camera
+	velocity. Monitors connected through a Unix socket always use TCP.
+	Returns 1 on success, 0 on failure.
+*/
+vb_bool vb_data_set_unreliable(vb_channel_handle_t handle);
+
 /*
 	Register a control, a more convenient way to send commands to the game.
 
@@ -405,7 +453,8 @@ void vb_server_update(vb_uint64 current_time_milliseconds);
 #endif
 
 /*
-	Closes all sockets. After shutdown you can add more channels or reset the
+	Closes all sockets. If capturing, blocks until everything captured has
+	been written to disk. After shutdown you can add more channels or reset the
 	config (which removes all channels) if you like. After calling this
 	Viewback no longer uses the memory you passed it, so you can free it if
 	you won't be using Viewback anymore.
@@ -36,6 +36,7 @@ void vb__sprintf(const char* format, ...)
 }
 
 #define CHANNEL_FLAG_INITIALIZED (1<<0)
+#define CHANNEL_FLAG_UNRELIABLE  (1<<1)
 // If you add more than 8, bump the size of vb_data_channel_t::flags
 
 // This isn't really always 1 byte long. It's a bit mask large enough to hold
@@ -132,12 +133,26 @@ typedef struct
 	};
 } vb__data_control_t;
 
+// Longest command a client can send.
+#define VB_COMMAND_BUFFER_SIZE 1024
+
 typedef struct
 {
 	// If you add something to this struct, update it in vb__memory_layout and vb__memory_copy
 	vb__socket_t socket;
 
 	vb__data_channel_mask_t* active_channels;
+
+	// If the client asked for it with the "udp:" command, data for unreliable
+	// channels is sent to this address instead of down the TCP socket.
+	struct sockaddr_in udp_addr;
+	unsigned int       udp_sequence;
+	char               udp_active;
+
+	// Commands are null terminated. One recv() can hold several of them, or
+	// stop partway through one, which waits here for the rest.
+	char               command_buffer[VB_COMMAND_BUFFER_SIZE];
+	size_t             command_length;
 } vb__connection_t;
 
 typedef struct
@@ -150,6 +165,7 @@ typedef struct
 	struct sockaddr_in  multicast_addr;
 	time_t              last_multicast;
 	vb__socket_t        tcp_socket;
+	vb__socket_t        unix_socket;
 	vb__time_t          current_time;
 
 	vb__data_channel_t* channels;
@@ -169,9 +185,52 @@ typedef struct
 
 	vb__connection_t* connections;
 
+	// Three areas of vb__config_get_capture_buffer_size() bytes each, or
+	// NULL. Two buffers and the overflow, see vb__capture_write().
+	char*             capture_buffers;
+
 	char              server_active;
 } vb__t;
 
+#ifndef VB_NO_CAPTURE
+#include <stdio.h>
+
+#define VB_DEFAULT_CAPTURE_BUFFER_SIZE (64*1024)
+
+typedef struct
+{
+	FILE*        file;
+	vb__thread_t thread;
+	vb__mutex_t  mutex;
+	vb__cond_t   write_ready;    // The game thread handed off a buffer, or it's time to quit.
+	vb__cond_t   write_finished; // The capture thread is done with the buffer it was handed.
+
+	// These point into vb__t::capture_buffers.
+	char*        buffers[2];
+	size_t       buffer_length[2];
+	size_t       buffer_size;
+
+	// Only the game thread changes fill_buffer, and only while holding the
+	// mutex with no write pending. While write_pending is set the capture
+	// thread owns the other buffer.
+	int          fill_buffer;
+	char         write_pending;
+	char         quit;
+	char         write_failed;
+
+	// Holds what didn't fit in a buffer while the capture thread was busy,
+	// and is written after it. Only one buffer can be using it at a time.
+	// The fill buffer's length is only touched by the game thread.
+	char*        overflow;
+	size_t       overflow_length[2];
+
+	unsigned long long bytes_written;
+	unsigned long long dropped_messages;
+	unsigned long long dropped_bytes;
+	unsigned long long dropped_kept; // Registrations and control changes.
+} vb__capture_t;
+#endif
+
 
 
 
@@ -1,50 +1,142 @@
 #pragma once
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sched.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 typedef int vb__socket_t;
 typedef socklen_t vb__socklen_t;
 
+typedef pthread_t       vb__thread_t;
+typedef pthread_mutex_t vb__mutex_t;
+typedef pthread_cond_t  vb__cond_t;
+typedef void*           vb__thread_result_t;
+#define VB_THREAD_CALL
+
+typedef struct pollfd vb__pollfd_t;
+typedef int           vb__wakeup_t;
+
 #define VB_ALIGN(x) __attribute__((aligned(x)))
 #define VB_INVALID_SOCKET (-1)
+#define VB_INVALID_WAKEUP (-1)
 
-static int vb__socket_error(void)
+static inline int vb__socket_error(void)
 {
 	return errno;
 }
 
-static int vb__socket_valid(vb__socket_t socket)
+static inline int vb__socket_valid(vb__socket_t socket)
 {
 	return socket > 0;
 }
 
-static void vb__socket_close(vb__socket_t socket)
+static inline void vb__socket_close(vb__socket_t socket)
 {
 	close(socket);
 }
 
-static int vb__socket_is_blocking_error(int error)
+static inline int vb__socket_is_blocking_error(int error)
 {
 	return EAGAIN == error;
 }
 
-static int vb__socket_set_blocking(vb__socket_t socket, int blocking)
+static inline int vb__socket_set_blocking(vb__socket_t socket, int blocking)
 {
 	return fcntl(socket, F_SETFL, O_NONBLOCK, !blocking);
 }
 
-static void vb__strcat(char* dest, size_t size, const char* src)
+static inline void vb__strcat(char* dest, size_t size, const char* src)
 {
 	strcat(dest, src);
 }
 
-static void vb__thread_yield()
+static inline void vb__thread_yield()
 {
 	sched_yield();
 }
+
+static inline int vb__thread_create(vb__thread_t* thread, vb__thread_result_t (VB_THREAD_CALL *proc)(void*), void* arg)
+{
+	return pthread_create(thread, NULL, proc, arg) == 0;
+}
+
+static inline void vb__thread_join(vb__thread_t thread)
+{
+	pthread_join(thread, NULL);
+}
+
+static inline void vb__mutex_init(vb__mutex_t* mutex)
+{
+	pthread_mutex_init(mutex, NULL);
+}
+
+static inline void vb__mutex_destroy(vb__mutex_t* mutex)
+{
+	pthread_mutex_destroy(mutex);
+}
+
+static inline void vb__mutex_lock(vb__mutex_t* mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+static inline void vb__mutex_unlock(vb__mutex_t* mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+static inline void vb__cond_init(vb__cond_t* cond)
+{
+	pthread_cond_init(cond, NULL);
+}
+
+static inline void vb__cond_destroy(vb__cond_t* cond)
+{
+	pthread_cond_destroy(cond);
+}
+
+static inline void vb__cond_wait(vb__cond_t* cond, vb__mutex_t* mutex)
+{
+	pthread_cond_wait(cond, mutex);
+}
+
+static inline void vb__cond_signal(vb__cond_t* cond)
+{
+	pthread_cond_signal(cond);
+}
+
+static inline int vb__poll(vb__pollfd_t* fds, size_t count, int timeout_ms)
+{
+	return poll(fds, (nfds_t)count, timeout_ms);
+}
+
+// A wakeup can be polled alongside sockets, other threads signal it to get a poll to return.
+static inline int vb__wakeup_create(vb__wakeup_t* wakeup)
+{
+	*wakeup = eventfd(0, EFD_NONBLOCK);
+	return *wakeup >= 0;
+}
+
+static inline void vb__wakeup_destroy(vb__wakeup_t wakeup)
+{
+	close(wakeup);
+}
+
+static inline void vb__wakeup_signal(vb__wakeup_t wakeup)
+{
+	eventfd_write(wakeup, 1);
+}
+
+static inline void vb__wakeup_clear(vb__wakeup_t wakeup)
+{
+	eventfd_t value;
+	eventfd_read(wakeup, &value);
+}
@@ -40,6 +40,7 @@ public:
 		range_min = 0;
 		range_max = 0;
 #endif
+		unreliable = false;
 	}
 
 public:
@@ -51,6 +52,8 @@ public:
 	float range_max;
 #endif
 
+	bool unreliable;
+
 	vector<CLabel> labels;
 };
 
@@ -121,6 +124,8 @@ public:
 	vb_debug_output_callback output;
 	vb_command_callback command;
 	unsigned short tcp_port;
+	const char* unix_socket_path;
+	const char* capture_file;
 	const char* config_file;
 } g_util_config;
 
@@ -269,6 +274,29 @@ vb_bool vb_util_set_range_s(const char* channel, float range_min, float range_ma
 }
 #endif
 
+void vb_util_set_unreliable(vb_channel_handle_t handle)
+{
+	if (!g_initialized)
+		vb_util_initialize();
+
+	g_channels[handle].unreliable = true;
+}
+
+vb_bool vb_util_set_unreliable_s(const char* channel)
+{
+	if (!g_initialized)
+		vb_util_initialize();
+
+	vb_channel_handle_t handle = vb_util_find_channel(channel);
+
+	if (handle == VB_CHANNEL_NONE)
+		return 0;
+
+	vb_util_set_unreliable(handle);
+
+	return 1;
+}
+
 void vb_util_add_control_button(const char* name, vb_control_button_callback callback)
 {
 	if (!g_initialized)
@@ -461,6 +489,24 @@ void vb_util_set_tcp_port(unsigned short tcp_port)
 	g_util_config.tcp_port = tcp_port;
 }
 
+void vb_util_set_unix_socket_path(const char* unix_socket_path)
+{
+	if (!g_initialized)
+		vb_util_initialize();
+
+	g_util_config.unix_socket_path = unix_socket_path;
+}
+
+#ifndef VB_NO_CAPTURE
+void vb_util_set_capture_file(const char* capture_file)
+{
+	if (!g_initialized)
+		vb_util_initialize();
+
+	g_util_config.capture_file = capture_file;
+}
+#endif
+
 // RAII class to free a vector's memory
 template<typename T>
 class CVectorEmancipator
@@ -509,6 +555,10 @@ vb_bool vb_util_server_create(const char* server_name)
 		config.max_connections = g_util_config.max_connections;
 
 	config.tcp_port = g_util_config.tcp_port;
+	config.unix_socket_path = g_util_config.unix_socket_path;
+#ifndef VB_NO_CAPTURE
+	config.capture_file = g_util_config.capture_file;
+#endif
 	config.debug_output_callback = g_util_config.output;
 	config.command_callback = g_util_config.command;
 
@@ -541,6 +591,12 @@ vb_bool vb_util_server_create(const char* server_name)
 		}
 #endif
 
+		if (channel.unreliable)
+		{
+			if (!vb_data_set_unreliable((vb_channel_handle_t)i))
+				return 0;
+		}
+
 		for (size_t j = 0; j < channel.labels.size(); j++)
 		{
 			auto& label = channel.labels[j];
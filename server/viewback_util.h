@@ -110,6 +110,17 @@ void vb_util_set_range(vb_channel_handle_t handle, float range_min, float range_
 vb_bool vb_util_set_range_s(const char* channel, float range_min, float range_max);
 #endif
 
+/*
+	Mark a channel as unreliable, its data will be sent over UDP to monitors
+	that support it. For more info see the notes in viewback.h for
+	vb_data_set_unreliable().
+
+	The string version performs a linear search for the specified channel and
+	returns 0 if it couldn't be found, 1 otherwise.
+*/
+void vb_util_set_unreliable(vb_channel_handle_t handle);
+vb_bool vb_util_set_unreliable_s(const char* channel);
+
 /*
 	Register a control, a more convenient way to send commands to the game.
 	For more info see the notes in viewback.h for vb_data_add_control_button().
@@ -145,6 +156,10 @@ void vb_util_set_max_connections(unsigned char max_connections);
 void vb_util_set_output_callback(vb_debug_output_callback output);
 void vb_util_set_command_callback(vb_command_callback command);
 void vb_util_set_tcp_port(unsigned short tcp_port);
+void vb_util_set_unix_socket_path(const char* unix_socket_path);
+#ifndef VB_NO_CAPTURE
+void vb_util_set_capture_file(const char* capture_file);
+#endif
 
 /*
 	Viewback reads and writes configuration options and persistent data to
@@ -25,49 +25,171 @@ THE SOFTWARE.
 typedef SOCKET vb__socket_t;
 typedef int vb__socklen_t;
 
+typedef HANDLE             vb__thread_t;
+typedef CRITICAL_SECTION   vb__mutex_t;
+typedef CONDITION_VARIABLE vb__cond_t;
+typedef DWORD              vb__thread_result_t;
+#define VB_THREAD_CALL WINAPI
+
+typedef WSAPOLLFD vb__pollfd_t;
+typedef SOCKET    vb__wakeup_t;
+
 #if defined(__GNUC__)
 #define VB_ALIGN(x) __attribute__((aligned(x)))
 #else
 #define VB_ALIGN(x) __declspec(align(x))
 #endif
 
+// Before 2015 MSVC only knows inline in C++, C has to say __inline.
+#if defined(__GNUC__) || defined(__cplusplus)
+#define VB_INLINE inline
+#else
+#define VB_INLINE __inline
+#endif
+
 #define VB_INVALID_SOCKET INVALID_SOCKET
+#define VB_INVALID_WAKEUP INVALID_SOCKET
 #define snprintf _snprintf
 
 #pragma warning(disable:4505) // unreferenced local function has been removed
 
-static int vb__socket_error(void)
+static VB_INLINE int vb__socket_error(void)
 {
 	return WSAGetLastError();
 }
 
-static int vb__socket_set_blocking(vb__socket_t socket, int blocking)
+static VB_INLINE int vb__socket_set_blocking(vb__socket_t socket, int blocking)
 {
 	u_long val = !blocking;
 	return ioctlsocket(socket, FIONBIO, &val);
 }
 
-static int vb__socket_valid(vb__socket_t socket)
+static VB_INLINE int vb__socket_valid(vb__socket_t socket)
 {
 	return INVALID_SOCKET != socket;
 }
 
-static void vb__socket_close(vb__socket_t socket)
+static VB_INLINE void vb__socket_close(vb__socket_t socket)
 {
 	closesocket(socket);
 }
 
-static int vb__socket_is_blocking_error(int error)
+static VB_INLINE int vb__socket_is_blocking_error(int error)
 {
 	return WSAEWOULDBLOCK == error;
 }
 
-static void vb__strcat(char* dest, size_t size, const char* src)
+static VB_INLINE void vb__strcat(char* dest, size_t size, const char* src)
 {
 	strcat_s(dest, size, src);
 }
 
-static void vb__thread_yield()
+static VB_INLINE void vb__thread_yield()
 {
 	Sleep(0);
 }
+
+static VB_INLINE int vb__thread_create(vb__thread_t* thread, vb__thread_result_t (VB_THREAD_CALL *proc)(void*), void* arg)
+{
+	*thread = CreateThread(NULL, 0, proc, arg, 0, NULL);
+	return *thread != NULL;
+}
+
+static VB_INLINE void vb__thread_join(vb__thread_t thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static VB_INLINE void vb__mutex_init(vb__mutex_t* mutex)
+{
+	InitializeCriticalSection(mutex);
+}
+
+static VB_INLINE void vb__mutex_destroy(vb__mutex_t* mutex)
+{
+	DeleteCriticalSection(mutex);
+}
+
+static VB_INLINE void vb__mutex_lock(vb__mutex_t* mutex)
+{
+	EnterCriticalSection(mutex);
+}
+
+static VB_INLINE void vb__mutex_unlock(vb__mutex_t* mutex)
+{
+	LeaveCriticalSection(mutex);
+}
+
+static VB_INLINE void vb__cond_init(vb__cond_t* cond)
+{
+	InitializeConditionVariable(cond);
+}
+
+static VB_INLINE void vb__cond_destroy(vb__cond_t* cond)
+{
+	// Windows condition variables don't need to be destroyed.
+	(void)cond;
+}
+
+static VB_INLINE void vb__cond_wait(vb__cond_t* cond, vb__mutex_t* mutex)
+{
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+static VB_INLINE void vb__cond_signal(vb__cond_t* cond)
+{
+	WakeConditionVariable(cond);
+}
+
+static VB_INLINE int vb__poll(vb__pollfd_t* fds, size_t count, int timeout_ms)
+{
+	return WSAPoll(fds, (ULONG)count, timeout_ms);
+}
+
+// A wakeup can be polled alongside sockets, other threads signal it to get a poll to return.
+// WSAPoll only takes sockets, so this is a loopback datagram socket that sends to itself.
+static VB_INLINE int vb__wakeup_create(vb__wakeup_t* wakeup)
+{
+	struct sockaddr_in addr;
+	int addrlen = sizeof(addr);
+
+	*wakeup = socket(AF_INET, SOCK_DGRAM, 0);
+	if (*wakeup == INVALID_SOCKET)
+		return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if (bind(*wakeup, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+		getsockname(*wakeup, (struct sockaddr*)&addr, &addrlen) != 0 ||
+		connect(*wakeup, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+		vb__socket_set_blocking(*wakeup, 0) != 0)
+	{
+		closesocket(*wakeup);
+		*wakeup = INVALID_SOCKET;
+		return 0;
+	}
+
+	return 1;
+}
+
+static VB_INLINE void vb__wakeup_destroy(vb__wakeup_t wakeup)
+{
+	closesocket(wakeup);
+}
+
+static VB_INLINE void vb__wakeup_signal(vb__wakeup_t wakeup)
+{
+	char c = 0;
+	send(wakeup, &c, 1, 0);
+}
+
+static VB_INLINE void vb__wakeup_clear(vb__wakeup_t wakeup)
+{
+	char buf[64];
+	while (recv(wakeup, buf, sizeof(buf), 0) > 0)
+		;
+}
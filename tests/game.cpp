@@ -111,6 +111,8 @@ int main(int argc, const char** args)
 	//vb_util_initialize(); // This is optional.
 
 	unsigned short port = 0;
+	const char* unix_socket_path = NULL;
+	const char* capture_file = NULL;
 
 	for (int i = 1; i < argc; i++)
 	{
@@ -119,6 +121,16 @@ int main(int argc, const char** args)
 			i++;
 			port = (unsigned short)atoi(args[i]);
 		}
+		else if (strcmp(args[i], "--unix") == 0 && i < argc - 1)
+		{
+			i++;
+			unix_socket_path = args[i];
+		}
+		else if (strcmp(args[i], "--capture") == 0 && i < argc - 1)
+		{
+			i++;
+			capture_file = args[i];
+		}
 	}
 
 	vb_channel_handle_t vb_keydown, vb_player, vb_health, vb_mousepos;
@@ -192,6 +204,13 @@ int main(int argc, const char** args)
 	}
 #endif
 
+	// Only the latest mouse position matters, it's fine to lose some.
+	if (!vb_util_set_unreliable_s("Mouse"))
+	{
+		printf("Couldn't set unreliable\n");
+		return 1;
+	}
+
 	vb_util_add_control_button("Pause", &pause_callback);
 	vb_util_add_control_slider_float("Difficulty", 0, 10, 21, &difficulty_callback);
 	vb_util_add_control_slider_float("Brightness", 0, 1, 0, &brightness_callback);
@@ -201,6 +220,12 @@ int main(int argc, const char** args)
 	vb_util_set_output_callback(&debug_printf);
 	vb_util_set_command_callback(&command_callback);
 
+	if (unix_socket_path)
+		vb_util_set_unix_socket_path(unix_socket_path);
+
+	if (capture_file)
+		vb_util_set_capture_file(capture_file);
+
 	if (!vb_util_server_create("Viewback Test Server"))
 	{
 		printf("Couldn't install config\n");